@@ -88,6 +88,13 @@ int bdr_max_databases;
 static bool bdr_skip_ddl_replication;
 bool bdr_skip_ddl_locking;
 bool bdr_do_not_replicate;
+int bdr_stats_snapshot_interval;
+int bdr_backpressure_max_lag_bytes;
+int bdr_backpressure_max_lag_time;
+#ifdef BUILDING_BDR
+int bdr_sequence_lookahead;
+int bdr_heartbeat_interval;
+#endif
 
 PG_MODULE_MAGIC;
 
@@ -587,6 +594,10 @@ bdr_establish_connection_and_slot(const char *dsn,
 						out_replication_identifier, out_snapshot);
 	}
 
+	/* remember the identity behind the identifier for later lookups */
+	bdr_nodecache_insert(*out_replication_identifier, *out_sysid,
+						 *out_timeline, *out_dboid, MyDatabaseId);
+
 	pfree(remote_ident);
 	remote_ident = NULL;
 
@@ -752,6 +763,53 @@ _PG_init(void)
 							GUC_UNIT_MS,
 							NULL, NULL, NULL);
 
+	DefineCustomIntVariable("bdr.backpressure_max_lag_bytes",
+							"Delay local commits while a peer is this far behind",
+							"Commits of transactions writing to a BDR database are delayed more the further the slowest connected peer's replay exceeds this many bytes of WAL. Zero disables the limit.",
+							&bdr_backpressure_max_lag_bytes,
+							0, 0, MAX_KILOBYTES,
+							PGC_SIGHUP,
+							GUC_UNIT_KB,
+							NULL, NULL, NULL);
+
+	DefineCustomIntVariable("bdr.backpressure_max_lag_time",
+							"Delay local commits while a peer is this far behind",
+							"Commits of transactions writing to a BDR database are delayed more the further the slowest connected peer's replay exceeds this many seconds. Zero disables the limit.",
+							&bdr_backpressure_max_lag_time,
+							0, 0, 3600,
+							PGC_SIGHUP,
+							GUC_UNIT_S,
+							NULL, NULL, NULL);
+
+	DefineCustomIntVariable("bdr.stats_snapshot_interval",
+							"Seconds between snapshots of the replication statistics",
+							"Snapshots are kept in shared memory to compute rates over recent time windows. Zero disables them.",
+							&bdr_stats_snapshot_interval,
+							10, 0, 3600,
+							PGC_SIGHUP,
+							GUC_UNIT_S,
+							NULL, NULL, NULL);
+
+#ifdef BUILDING_BDR
+	DefineCustomIntVariable("bdr.sequence_lookahead",
+							"Seconds of global sequence consumption to allocate chunks ahead for",
+							"The sequencer requests more and bigger chunks for sequences that would otherwise run out within this time at their current rate of use.",
+							&bdr_sequence_lookahead,
+							30, 0, 3600,
+							PGC_SIGHUP,
+							GUC_UNIT_S,
+							NULL, NULL, NULL);
+
+	DefineCustomIntVariable("bdr.heartbeat_interval",
+							"Seconds between heartbeat messages sent to peer nodes",
+							"Heartbeats keep the replication lag peers report current while there are no transactions to replay. Zero, the default, disables them.",
+							&bdr_heartbeat_interval,
+							0, 0, 3600,
+							PGC_SIGHUP,
+							GUC_UNIT_S,
+							NULL, NULL, NULL);
+#endif
+
 	/*
 	 * We can't use the temp_tablespace safely for our dumps, because Pg's
 	 * crash recovery is very careful to delete only particularly formatted
@@ -765,6 +823,33 @@ _PG_init(void)
 							   0,
 							   NULL, NULL, NULL);
 
+	DefineCustomIntVariable("bdr.init_replica_jobs",
+							"Number of parallel jobs copying data when joining a node",
+							"Each job uses one connection to the node data is copied from and one to the local database.",
+							&bdr_init_replica_jobs,
+							4, 1, 64,
+							PGC_SIGHUP,
+							0,
+							NULL, NULL, NULL);
+
+	DefineCustomIntVariable("bdr.init_replica_index_jobs",
+							"Number of parallel jobs building indexes and constraints when joining a node",
+							"Each job uses one connection to the local database.",
+							&bdr_init_replica_index_jobs,
+							4, 1, 64,
+							PGC_SIGHUP,
+							0,
+							NULL, NULL, NULL);
+
+	DefineCustomBoolVariable("bdr.init_parallel_catchup",
+							 "Catch up from every node in parallel when joining a node",
+							 "Otherwise all changes made since the data was copied are replayed through the node it was copied from.",
+							 &bdr_init_parallel_catchup,
+							 false,
+							 PGC_SIGHUP,
+							 0,
+							 NULL, NULL, NULL);
+
 	DefineCustomBoolVariable("bdr.do_not_replicate",
 							 "Internal. Set during local initialization from basebackup only",
 							 NULL,
@@ -780,6 +865,10 @@ _PG_init(void)
 
 	bdr_label_init();
 
+#ifdef BUILDING_BDR
+	bdr_sequence_reloptions_init();
+#endif
+
 	if (!IsBinaryUpgrade)
 	{
 
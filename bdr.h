@@ -42,7 +42,6 @@
 #define BDR_LOCALID_FORMAT_ARGS \
 	GetSystemIdentifier(), ThisTimeLineID, MyDatabaseId, EMPTY_REPLICATION_NAME
 
-#define BDR_INIT_REPLICA_CMD "bdr_initial_load"
 #define BDR_LIBRARY_NAME "bdr"
 #define BDR_RESTORE_CMD "pg_restore"
 #ifdef BUILDING_UDR
@@ -127,6 +126,12 @@ typedef struct BDRRelation
 
 	Relation	rel;
 
+	/*
+	 * Most columns the origin has sent tuples with, kept across
+	 * invalidations; see read_tuple_parts().
+	 */
+	int			remote_natts;
+
 	BDRConflictHandler *conflict_handlers;
 	size_t		conflict_handlers_len;
 
@@ -268,14 +273,24 @@ extern int	bdr_default_apply_delay;
 extern int bdr_max_workers;
 extern int bdr_max_databases;
 extern char *bdr_temp_dump_directory;
+extern int bdr_init_replica_jobs;
+extern int bdr_init_replica_index_jobs;
+extern bool bdr_init_parallel_catchup;
 extern bool bdr_log_conflicts_to_table;
 extern bool bdr_conflict_logging_include_tuples;
 extern bool bdr_permit_ddl_locking;
 extern bool bdr_permit_unsafe_commands;
 extern bool bdr_skip_ddl_locking;
+extern int bdr_stats_snapshot_interval;
+extern int bdr_backpressure_max_lag_bytes;
+extern int bdr_backpressure_max_lag_time;
 #ifdef BUILDING_UDR
 extern bool bdr_conflict_default_apply;
 #endif
+#ifdef BUILDING_BDR
+extern int bdr_sequence_lookahead;
+extern int bdr_heartbeat_interval;
+#endif
 
 /*
  * Header for the shared memory segment ref'd by the BdrWorkerCtl ptr,
@@ -345,6 +360,20 @@ extern void bdr_fetch_sysid_via_node_id(RepNodeId node_id, uint64 *sysid,
 										TimeLineID *tli, Oid *remote_dboid);
 extern RepNodeId bdr_fetch_node_id_via_sysid(uint64 sysid, TimeLineID tli, Oid dboid);
 
+/* shared memory cache of node identities, see bdr_nodecache.c */
+extern void bdr_nodecache_shmem_init(int nentries);
+extern bool bdr_nodecache_lookup(RepNodeId node_id, uint64 *sysid,
+								 TimeLineID *tli, Oid *dboid);
+extern bool bdr_nodecache_lookup_node_id(uint64 sysid, TimeLineID tli,
+										 Oid dboid, Oid local_dboid,
+										 RepNodeId *node_id);
+extern void bdr_nodecache_insert(RepNodeId node_id, uint64 sysid,
+								 TimeLineID tli, Oid dboid, Oid local_dboid);
+extern void bdr_nodecache_forget_node(uint64 sysid, TimeLineID tli, Oid dboid,
+									  Oid local_dboid);
+extern void bdr_nodecache_forget_node_id(RepNodeId node_id);
+extern void bdr_nodecache_populate(void);
+
 /* Index maintenance, heap access, etc */
 extern struct EState * bdr_create_rel_estate(Relation rel);
 extern void UserTableUpdateIndexes(struct EState *estate,
@@ -415,19 +444,32 @@ extern void tuple_to_stringinfo(StringInfo s, TupleDesc tupdesc, HeapTuple tuple
 #ifdef BUILDING_BDR
 /* sequence support */
 extern void bdr_sequencer_shmem_init(int sequencers);
+extern void bdr_sequence_reloptions_init(void);
 extern void bdr_sequencer_init(int seq_slot, Size nnodes);
 extern void bdr_sequencer_lock(void);
 extern bool bdr_sequencer_vote(void);
 extern void bdr_sequencer_tally(void);
 extern bool bdr_sequencer_start_elections(void);
 extern void bdr_sequencer_fill_sequences(void);
+extern bool bdr_sequencer_round(void);
+extern void bdr_sequencer_request_full_round(void);
+
+/* work that can be requested from the sequencer */
+#define BDR_SEQ_WORK_ELECT		0x01	/* start elections for new chunks */
+#define BDR_SEQ_WORK_VOTE		0x02	/* vote on remote elections */
+#define BDR_SEQ_WORK_TALLY		0x04	/* tally votes on our elections */
+#define BDR_SEQ_WORK_FILL		0x08	/* replace used up chunks */
+#define BDR_SEQ_WORK_ALL		0x0F
 
 extern void bdr_sequencer_wakeup(void);
 extern void bdr_schedule_eoxact_sequencer_wakeup(void);
+extern void bdr_schedule_eoxact_sequencer_work(uint32 work, Oid seqoid);
 
 PGDLLEXPORT extern Datum bdr_sequence_alloc(PG_FUNCTION_ARGS);
 PGDLLEXPORT extern Datum bdr_sequence_setval(PG_FUNCTION_ARGS);
 PGDLLEXPORT extern Datum bdr_sequence_options(PG_FUNCTION_ARGS);
+PGDLLEXPORT extern Datum bdr_sequence_chunk_demand(PG_FUNCTION_ARGS);
+PGDLLEXPORT extern Datum bdr_get_sequence_stats(PG_FUNCTION_ARGS);
 #endif
 
 extern int bdr_sequencer_get_next_free_slot(void); //XXX PERDB temp
@@ -436,15 +478,27 @@ extern int bdr_sequencer_get_next_free_slot(void); //XXX PERDB temp
 /* statistic functions */
 extern void bdr_count_shmem_init(Size nnodes);
 extern void bdr_count_set_current_node(RepNodeId node_id);
+extern void bdr_count_begin(void);
 extern void bdr_count_commit(void);
 extern void bdr_count_rollback(void);
+extern void bdr_count_change_begin(Size nbytes);
+extern void bdr_count_set_relation(Oid relid);
+extern void bdr_count_change_end(void);
 extern void bdr_count_insert(void);
-extern void bdr_count_insert_conflict(void);
+extern void bdr_count_insert_conflict(BdrConflictType conflict_type);
 extern void bdr_count_update(void);
-extern void bdr_count_update_conflict(void);
+extern void bdr_count_update_conflict(BdrConflictType conflict_type);
 extern void bdr_count_delete(void);
-extern void bdr_count_delete_conflict(void);
+extern void bdr_count_delete_conflict(BdrConflictType conflict_type);
 extern void bdr_count_disconnect(void);
+extern void bdr_count_bytes_in(Size nbytes);
+extern void bdr_count_sent(Size nbytes, bool commit);
+extern void bdr_count_lag(TimestampTz remote_time, bool commit);
+extern long bdr_count_maintain(void);
+
+/* throttling of local writers */
+extern void bdr_backpressure_shmem_init(void);
+extern void bdr_backpressure_note_write(void);
 
 /* compat check functions */
 extern bool bdr_get_float4byval(void);
@@ -480,7 +534,7 @@ extern void bdr_queue_ddl_command(char *command_tag, char *command);
 extern void bdr_execute_ddl_command(char *cmdstr, char *perpetrator, bool tx_just_started);
 
 extern void bdr_locks_shmem_init(void);
-extern void bdr_locks_check_dml(void);
+extern void bdr_locks_check_dml(List *relids);
 
 /* background workers and supporting functions for them */
 PGDLLEXPORT extern void bdr_apply_main(Datum main_arg);
@@ -511,6 +565,7 @@ extern BDRNodeInfo * bdr_nodes_get_local_info(uint64 sysid, TimeLineID tli,
 										  Oid dboid);
 extern void bdr_bdr_node_free(BDRNodeInfo *node);
 extern void bdr_nodes_set_local_status(char status);
+extern void bdr_nodes_set_local_seq_id(void);
 
 extern Oid GetSysCacheOidError(int cacheId, Datum key1, Datum key2, Datum key3,
 							   Datum key4);
@@ -529,9 +584,74 @@ stringify_node_identity(char *sysid_str, Size sysid_str_size,
 						char *dboid_str, Size dboid_str_size,
 						uint64 sysid, TimeLineID timeline, Oid dboid);
 
+/* rows relayed per bdr_copytable_pump call in async mode */
+#define BDR_COPY_ROWS_PER_PUMP 1000
+/* rows are sent to the destination in messages of up to this size */
+#define BDR_COPY_BUFFER_SIZE 65536
+
+typedef enum BdrCopyStatus
+{
+	BDR_COPY_RUNNING,
+	BDR_COPY_WAIT_READ,
+	BDR_COPY_WAIT_WRITE,
+	/* the destination has yet to confirm the COPY */
+	BDR_COPY_WAIT_RESULT,
+	BDR_COPY_DONE
+} BdrCopyStatus;
+
+/* A COPY relayed between two connections, see bdr_copytable_begin */
+typedef struct BdrCopyState
+{
+	struct pg_conn *from;
+	struct pg_conn *to;
+	/* all rows read from the source */
+	bool		from_eof;
+	/* the source's and the destination's COPY completed successfully */
+	bool		from_confirmed;
+	bool		to_confirmed;
+	/* all rows read from the source, and COPY end queued */
+	bool		from_done;
+	/* rows not sent yet */
+	char	   *buf;
+	int			len;
+	int64		rows;
+	int64		bytes;
+} BdrCopyState;
+
 extern void
 bdr_copytable(PGconn *copyfrom_conn, PGconn *copyto_conn,
 		const char * copyfrom_query, const char *copyto_query);
+extern void
+bdr_copytable_begin(BdrCopyState *copy,
+		PGconn *copyfrom_conn, PGconn *copyto_conn,
+		const char * copyfrom_query, const char *copyto_query);
+extern BdrCopyStatus bdr_copytable_pump(BdrCopyState *copy, bool async);
+extern bool bdr_copy_binary_compatible(PGconn *conn);
+
+/* bdr_init_sync.c */
+typedef enum BdrInitPhase
+{
+	BDR_INIT_PHASE_DUMP_SCHEMA,
+	BDR_INIT_PHASE_RESTORE_SCHEMA,
+	BDR_INIT_PHASE_COPY_DATA,
+	BDR_INIT_PHASE_POST_DATA
+} BdrInitPhase;
+
+extern void bdr_init_sync_shmem_init(int ndatabases);
+extern void bdr_init_progress_start(void);
+extern void bdr_init_progress_phase(BdrInitPhase phase);
+extern void bdr_init_progress_end(void);
+extern void bdr_init_sync_data(const char *source_dsn, const char *target_dsn,
+							   const char *snapshot, int njobs);
+extern void bdr_init_sync_order_post_data(const char *source_dsn,
+										  const char *target_dsn,
+										  const char *listfile);
+extern void bdr_init_sync_file_md5(const char *path, char *md5);
+extern char *bdr_init_checkpoint_get(const char *step, char **schema_md5);
+extern void bdr_init_checkpoint_schema(const char *snapshot,
+									   const char *schema_md5);
+extern void bdr_init_checkpoint_forget(const char *step);
+extern bool bdr_init_local_schema_empty(void);
 
 
 /* helpers shared by multiple worker types */
@@ -27,6 +27,7 @@
 #endif
 #include "access/htup_details.h"
 #include "access/relscan.h"
+#include "access/transam.h"
 #include "access/xact.h"
 
 #include "catalog/catversion.h"
@@ -104,6 +105,30 @@ static BdrApplyWorker *bdr_apply_worker = NULL;
 
 static BdrConnectionConfig *bdr_apply_config = NULL;
 
+#ifdef BUILDING_BDR
+/*
+ * Small direct-mapped cache of the commit timestamp and origin of the xmins
+ * of recently seen local tuples, so repeated conflicts against rows written
+ * by the same local transactions don't have to hit the commit timestamp SLRU
+ * every time. Only committed transactions are cached, their commit data
+ * can't change anymore.
+ */
+#define BDR_LOCAL_ORIGIN_CACHE_SIZE 64
+
+typedef struct BdrLocalOriginCacheEntry
+{
+	TransactionId	xmin;
+	TimestampTz		commit_ts;
+	RepNodeId		node_id;
+} BdrLocalOriginCacheEntry;
+
+static BdrLocalOriginCacheEntry local_origin_cache[BDR_LOCAL_ORIGIN_CACHE_SIZE];
+
+/* next xid at the time the cache was last reset, see check_local_origin_cache */
+static TransactionId local_origin_cache_xid_horizon = InvalidTransactionId;
+static bool local_origin_cache_used = false;
+#endif
+
 dlist_head bdr_lsn_association = DLIST_STATIC_INIT(bdr_lsn_association);
 
 static BDRRelation *read_rel(StringInfo s, LOCKMODE mode);
@@ -135,6 +160,9 @@ static void process_remote_message(StringInfo s);
 static void get_local_tuple_origin(HeapTuple tuple,
 								   TimestampTz *commit_ts,
 								   RepNodeId *node_id);
+#ifdef BUILDING_BDR
+static void check_local_origin_cache(void);
+#endif
 static void abs_timestamp_difference(TimestampTz start_time,
 									 TimestampTz stop_time,
 									 long *secs, int *microsecs);
@@ -156,6 +184,8 @@ process_remote_begin(StringInfo s)
 
 	Assert(bdr_apply_worker != NULL);
 
+	bdr_count_begin();
+
 	started_transaction = false;
 	remote_origin_id = InvalidRepNodeId;
 
@@ -190,6 +220,17 @@ process_remote_begin(StringInfo s)
 	/* store remote xid for logging and debugging */
 	replication_origin_xid = remote_xid;
 
+#ifdef BUILDING_BDR
+	check_local_origin_cache();
+
+	/*
+	 * If the origin holds a global write lock, its changes from here on may
+	 * depend on other nodes' changes from before the lock having been
+	 * replayed; wait for that.
+	 */
+	bdr_locks_wait_for_peer_replay();
+#endif
+
 	snprintf(statbuf, sizeof(statbuf),
 			"bdr_apply: BEGIN origin(source, orig_lsn, timestamp): %X/%X, %s",
 			(uint32) (origlsn >> 32), (uint32) origlsn,
@@ -208,9 +249,6 @@ process_remote_begin(StringInfo s)
 	 */
 	if (flags & BDR_OUTPUT_TRANSACTION_HAS_ORIGIN)
 	{
-		char remote_ident[256];
-		NameData replication_name;
-
 		if (remote_origin_sysid == GetSystemIdentifier()
 			&& remote_origin_timeline_id == ThisTimeLineID
 			&& remote_origin_dboid == MyDatabaseId)
@@ -225,22 +263,24 @@ process_remote_begin(StringInfo s)
 					 errdetail("Received a transaction from the remote node that originated on this node")));
 		}
 
-		/* replication_name is currently unused in bdr */
-		NameStr(replication_name)[0] = '\0';
-
 		/*
 		 * To determine whether the commit was forwarded by the upstream from
 		 * another node, we need to get the local RepNodeId for that node based
-		 * on the (sysid, timelineid, dboid) supplied in catchup mode.
+		 * on the (sysid, timelineid, dboid) supplied in catchup mode. That's
+		 * almost always in the node identity cache, only start a transaction
+		 * for the catalog lookup if it isn't.
 		 */
-		snprintf(remote_ident, sizeof(remote_ident),
-				BDR_NODE_ID_FORMAT,
-				remote_origin_sysid, remote_origin_timeline_id, remote_origin_dboid, MyDatabaseId,
-				NameStr(replication_name));
-
-		StartTransactionCommand();
-		remote_origin_id = GetReplicationIdentifier(remote_ident, false);
-		CommitTransactionCommand();
+		if (!bdr_nodecache_lookup_node_id(remote_origin_sysid,
+										  remote_origin_timeline_id,
+										  remote_origin_dboid, MyDatabaseId,
+										  &remote_origin_id))
+		{
+			StartTransactionCommand();
+			remote_origin_id = bdr_fetch_node_id_via_sysid(remote_origin_sysid,
+														   remote_origin_timeline_id,
+														   remote_origin_dboid);
+			CommitTransactionCommand();
+		}
 	}
 
 	/* don't want the overhead otherwise */
@@ -366,6 +406,7 @@ process_remote_commit(StringInfo s)
 	CurrentResourceOwner = bdr_saved_resowner;
 
 	bdr_count_commit();
+	bdr_count_lag(committime, true);
 
 	replication_origin_xid = InvalidTransactionId;
 	replication_origin_lsn = InvalidXLogRecPtr;
@@ -421,6 +462,7 @@ process_remote_insert(StringInfo s)
 	Assert(bdr_apply_worker != NULL);
 
 	rel = read_rel(s, RowExclusiveLock);
+	bdr_count_set_relation(RelationGetRelid(rel->rel));
 
 	action = pq_getmsgbyte(s);
 	if (action != 'N')
@@ -544,7 +586,7 @@ process_remote_insert(StringInfo s)
 
 			bdr_conflict_log_serverlog(apply_conflict);
 
-			bdr_count_insert_conflict();
+			bdr_count_insert_conflict(BdrConflictType_InsertInsert);
 		}
 
 		/*
@@ -670,6 +712,7 @@ process_remote_update(StringInfo s)
 	bdr_performing_work();
 
 	rel = read_rel(s, RowExclusiveLock);
+	bdr_count_set_relation(RelationGetRelid(rel->rel));
 
 	action = pq_getmsgbyte(s);
 
@@ -784,7 +827,7 @@ process_remote_update(StringInfo s)
 
 			bdr_conflict_log_serverlog(apply_conflict);
 
-			bdr_count_update_conflict();
+			bdr_count_update_conflict(BdrConflictType_UpdateUpdate);
 		}
 
 		if (apply_update)
@@ -836,7 +879,7 @@ process_remote_update(StringInfo s)
 												   BdrConflictType_UpdateDelete,
 												   0, &skip);
 
-		bdr_count_update_conflict();
+		bdr_count_update_conflict(BdrConflictType_UpdateDelete);
 
 		if (skip)
 			resolution = BdrConflictResolution_ConflictTriggerSkipChange;
@@ -903,6 +946,7 @@ process_remote_delete(StringInfo s)
 	bdr_performing_work();
 
 	rel = read_rel(s, RowExclusiveLock);
+	bdr_count_set_relation(RelationGetRelid(rel->rel));
 
 	action = pq_getmsgbyte(s);
 
@@ -983,7 +1027,7 @@ process_remote_delete(StringInfo s)
 					user_tuple = NULL;
 		BdrApplyConflict *apply_conflict;
 
-		bdr_count_delete_conflict();
+		bdr_count_delete_conflict(BdrConflictType_DeleteDelete);
 
 		/* Since the local tuple is missing, fill slot from the received data. */
 		remote_tuple = heap_form_tuple(RelationGetDescr(rel->rel),
@@ -1030,6 +1074,33 @@ process_remote_delete(StringInfo s)
 	CommandCounterIncrement();
 }
 
+#ifdef BUILDING_BDR
+/*
+ * Throw away the local origin cache once xids could have wrapped around far
+ * enough for a cached xid to be reused by another transaction.
+ *
+ * Called at the start of each remote transaction, that's more than often
+ * enough.
+ */
+static void
+check_local_origin_cache(void)
+{
+	TransactionId	next_xid;
+
+	if (!local_origin_cache_used)
+		return;
+
+	next_xid = ReadNewTransactionId();
+
+	if ((uint32) (next_xid - local_origin_cache_xid_horizon) > (1U << 30))
+	{
+		memset(local_origin_cache, 0, sizeof(local_origin_cache));
+		local_origin_cache_xid_horizon = next_xid;
+		local_origin_cache_used = false;
+	}
+}
+#endif
+
 /*
  * Get commit timestamp and origin of the tuple
  */
@@ -1039,12 +1110,44 @@ get_local_tuple_origin(HeapTuple tuple, TimestampTz *commit_ts, RepNodeId *node_
 #ifdef BUILDING_BDR
 	TransactionId	xmin;
 	CommitExtraData	node_id_raw;
+	BdrLocalOriginCacheEntry *entry;
 
 	/* refetch tuple, check for old commit ts & origin */
 	xmin = HeapTupleHeaderGetXmin(tuple->t_data);
 
+	/* frozen tuples and our own changes aren't worth caching */
+	if (!TransactionIdIsNormal(xmin) ||
+		TransactionIdIsCurrentTransactionId(xmin))
+	{
+		TransactionIdGetCommitTsData(xmin, commit_ts, &node_id_raw);
+		*node_id = node_id_raw;
+		return;
+	}
+
+	entry = &local_origin_cache[xmin % BDR_LOCAL_ORIGIN_CACHE_SIZE];
+	if (entry->xmin == xmin)
+	{
+		*commit_ts = entry->commit_ts;
+		*node_id = entry->node_id;
+		return;
+	}
+
 	TransactionIdGetCommitTsData(xmin, commit_ts, &node_id_raw);
 	*node_id = node_id_raw;
+
+	/* transactions without a commit timestamp aren't committed yet */
+	if (*commit_ts != 0)
+	{
+		if (!local_origin_cache_used)
+		{
+			local_origin_cache_xid_horizon = ReadNewTransactionId();
+			local_origin_cache_used = true;
+		}
+
+		entry->xmin = xmin;
+		entry->commit_ts = *commit_ts;
+		entry->node_id = *node_id;
+	}
 #else
 	TIMESTAMP_NOBEGIN(*commit_ts);
 	*node_id = InvalidRepNodeId;
@@ -1333,14 +1436,17 @@ process_remote_message(StringInfo s)
 	}
 	else if (msg_type == BDR_MESSAGE_ACQUIRE_LOCK)
 	{
-		int			lock_type;
+		BDRLockType	lock_type;
+		int			nrelations;
+		BDRLockRelation *relations;
+		XLogRecPtr	request_lsn;
+
+		bdr_locks_parse_acquire(&message, &lock_type, &nrelations, &relations,
+								&request_lsn);
 
-		if (message.cursor == message.len) 		/* Old proto */
-			lock_type = BDR_LOCK_WRITE;
-		else
-			lock_type = pq_getmsgint(&message, 4);
 		bdr_process_acquire_ddl_lock(origin_sysid, origin_tlid, origin_datid,
-									 lock_type);
+									 lock_type, nrelations, relations,
+									 request_lsn);
 	}
 	else if (msg_type == BDR_MESSAGE_RELEASE_LOCK)
 	{
@@ -1361,6 +1467,7 @@ process_remote_message(StringInfo s)
 		TimeLineID	lock_tlid;
 		Oid			lock_datid;
 		int			lock_type;
+		XLogRecPtr	request_lsn = InvalidXLogRecPtr;
 
 		lock_sysid = pq_getmsgint64(&message);
 		lock_tlid = pq_getmsgint(&message, 4);
@@ -1371,9 +1478,12 @@ process_remote_message(StringInfo s)
 		else
 			lock_type = pq_getmsgint(&message, 4);
 
+		if (message.cursor < message.len)
+			request_lsn = pq_getmsgint64(&message);
+
 		bdr_process_confirm_ddl_lock(origin_sysid, origin_tlid, origin_datid,
 									 lock_sysid, lock_tlid, lock_datid,
-									 lock_type);
+									 lock_type, request_lsn);
 	}
 	else if (msg_type == BDR_MESSAGE_DECLINE_LOCK)
 	{
@@ -1381,6 +1491,7 @@ process_remote_message(StringInfo s)
 		TimeLineID	lock_tlid;
 		Oid			lock_datid;
 		int			lock_type;
+		XLogRecPtr	request_lsn = InvalidXLogRecPtr;
 
 		lock_sysid = pq_getmsgint64(&message);
 		lock_tlid = pq_getmsgint(&message, 4);
@@ -1391,9 +1502,12 @@ process_remote_message(StringInfo s)
 		else
 			lock_type = pq_getmsgint(&message, 4);
 
+		if (message.cursor < message.len)
+			request_lsn = pq_getmsgint64(&message);
+
 		bdr_process_decline_ddl_lock(origin_sysid, origin_tlid, origin_datid,
 									 lock_sysid, lock_tlid, lock_datid,
-									 lock_type);
+									 lock_type, request_lsn);
 	}
 	else if (msg_type == BDR_MESSAGE_REQUEST_REPLAY_CONFIRM)
 	{
@@ -1411,6 +1525,25 @@ process_remote_message(StringInfo s)
 		bdr_process_replay_confirm(origin_sysid, origin_tlid, origin_datid,
 								   confirm_lsn);
 	}
+	else if (msg_type == BDR_MESSAGE_LOCK_ACQUIRED)
+	{
+		XLogRecPtr request_lsn;
+		request_lsn = pq_getmsgint64(&message);
+
+		bdr_process_lock_acquired(origin_sysid, origin_tlid, origin_datid,
+								  request_lsn);
+	}
+	else if (msg_type == BDR_MESSAGE_HEARTBEAT)
+	{
+		TimestampTz sent_time;
+		sent_time = pq_getmsgint64(&message);
+
+		/* only our upstream's heartbeats say how far behind we are */
+		if (origin_sysid == bdr_apply_worker->remote_sysid &&
+			origin_tlid == bdr_apply_worker->remote_timeline &&
+			origin_datid == bdr_apply_worker->remote_dboid)
+			bdr_count_lag(sent_time, false);
+	}
 	else
 		elog(LOG, "unknown message type %d", msg_type);
 
@@ -1871,10 +2004,14 @@ check_bdr_wakeups(BDRRelation *rel)
 		bdr_connections_changed(NULL);
 
 #ifdef BUILDING_BDR
+	/* remote elections, or chunks they're about, may need our vote */
 	if (reloid == BdrSequenceValuesRelid ||
-		reloid == BdrSequenceElectionsRelid ||
-		reloid == BdrVotesRelid)
-		bdr_schedule_eoxact_sequencer_wakeup();
+		reloid == BdrSequenceElectionsRelid)
+		bdr_schedule_eoxact_sequencer_work(BDR_SEQ_WORK_VOTE, InvalidOid);
+
+	/* votes on our elections came in */
+	if (reloid == BdrVotesRelid)
+		bdr_schedule_eoxact_sequencer_work(BDR_SEQ_WORK_TALLY, InvalidOid);
 #endif
 }
 
@@ -1896,18 +2033,52 @@ read_tuple_parts(StringInfo s, BDRRelation *rel, BDRTupleData *tup)
 
 	rnatts = pq_getmsgint(s, 4);
 
-	if (desc->natts != rnatts)
+	if (rnatts < 0 || rnatts > MaxTupleAttributeNumber)
 		elog(ERROR, "tuple natts mismatch, %u vs %u", desc->natts, rnatts);
 
+	/*
+	 * Nullable columns without a default are added under a DDL lock only, so
+	 * nodes may send tuples before or after they replayed adding one. Missing
+	 * trailing columns are NULL for inserts and unchanged for updates, as
+	 * long as they could have been added that way, and the origin hasn't
+	 * already sent us tuples including them; then it knows about them and
+	 * the tuple is broken. Extra trailing columns have to be empty; if they
+	 * aren't, we error out and retry until we replayed adding them ourselves.
+	 */
+	for (i = rnatts; i < desc->natts; i++)
+	{
+		Form_pg_attribute att = desc->attrs[i];
+
+		if (!att->attisdropped &&
+			(att->attnotnull || att->atthasdef ||
+			 get_typtype(att->atttypid) == TYPTYPE_DOMAIN ||
+			 i < rel->remote_natts))
+			elog(ERROR, "tuple natts mismatch, %u vs %u", desc->natts, rnatts);
+
+		tup->changed[i] = false;
+	}
+
+	rel->remote_natts = Max(rel->remote_natts, rnatts);
+
 	/* FIXME: unaligned data accesses */
 
-	for (i = 0; i < desc->natts; i++)
+	for (i = 0; i < rnatts; i++)
 	{
-		Form_pg_attribute att = desc->attrs[i];
+		Form_pg_attribute att;
 		char		kind = pq_getmsgbyte(s);
 		const char *data;
 		int			len;
 
+		if (i >= desc->natts)
+		{
+			if (kind != 'n' && kind != 'u')
+				elog(ERROR, "data for column %d, which doesn't exist locally (yet)",
+					 i + 1);
+			continue;
+		}
+
+		att = desc->attrs[i];
+
 		switch (kind)
 		{
 			case 'n': /* null */
@@ -2037,15 +2208,21 @@ bdr_process_remote_action(StringInfo s)
 			break;
 			/* INSERT */
 		case 'I':
+			bdr_count_change_begin(s->len);
 			process_remote_insert(s);
+			bdr_count_change_end();
 			break;
 			/* UPDATE */
 		case 'U':
+			bdr_count_change_begin(s->len);
 			process_remote_update(s);
+			bdr_count_change_end();
 			break;
 			/* DELETE */
 		case 'D':
+			bdr_count_change_begin(s->len);
 			process_remote_delete(s);
+			bdr_count_change_end();
 			break;
 #ifdef BUILDING_BDR
 		case 'M':
@@ -2362,6 +2539,8 @@ bdr_apply_work(PGconn* streamConn)
 
 				c = pq_getmsgbyte(&s);
 
+				bdr_count_bytes_in(r);
+
 				if (c == 'w')
 				{
 					XLogRecPtr	start_lsn;
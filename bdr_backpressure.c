@@ -0,0 +1,335 @@
+/* -------------------------------------------------------------------------
+ *
+ * bdr_backpressure.c
+ *		Throttle local writers when a peer falls too far behind
+ *
+ * Copyright (C) 2012-2015, PostgreSQL Global Development Group
+ *
+ * IDENTIFICATION
+ *		bdr_backpressure.c
+ *
+ * Transactions that wrote to a BDR-enabled database are delayed at commit
+ * while the slowest connected peer's replay is further behind than
+ * bdr.backpressure_max_lag_bytes or bdr.backpressure_max_lag_time. The delay
+ * grows with how far the lag exceeds the budget, up to
+ * BDR_BACKPRESSURE_MAX_DELAY_MS per commit at twice the budget. That slows
+ * writers down to the rate peers can replay at, instead of retaining ever
+ * more WAL for them.
+ *
+ * A peer's position is the flush position its apply worker last reported to
+ * the walsender streaming changes to it. Peers without a connected walsender
+ * aren't considered, throttling writers can't make them catch up.
+ *
+ * WAL positions don't say anything about time, so committing backends
+ * record the WAL insert position about once a second in a ring in shared
+ * memory. A peer's lag in time is the age of the oldest sample it hasn't
+ * flushed yet.
+ * -------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "bdr.h"
+
+#include "miscadmin.h"
+
+#include "access/xact.h"
+#include "access/xlog.h"
+
+#include "replication/walsender_private.h"
+
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/proc.h"
+#include "storage/shmem.h"
+#include "storage/spin.h"
+
+#include "utils/timestamp.h"
+
+/* WAL position samples kept, one per BDR_BACKPRESSURE_SAMPLE_INTERVAL_MS */
+#define BDR_BACKPRESSURE_SAMPLES 600
+#define BDR_BACKPRESSURE_SAMPLE_INTERVAL_MS 1000
+
+/* longest delay of a commit, at twice the lag budget */
+#define BDR_BACKPRESSURE_MAX_DELAY_MS 1000
+
+/* how long a backend reuses the delay it computed */
+#define BDR_BACKPRESSURE_RECHECK_MS 100
+
+typedef struct BdrBackpressureSample
+{
+	XLogRecPtr	lsn;
+	TimestampTz time;
+} BdrBackpressureSample;
+
+typedef struct BdrBackpressureControl
+{
+	/* protects the samples */
+	LWLockId	lock;
+	/* index of the next sample to take, and number of valid ones */
+	int			next;
+	int			count;
+	BdrBackpressureSample samples[BDR_BACKPRESSURE_SAMPLES];
+} BdrBackpressureControl;
+
+static BdrBackpressureControl *BdrBackpressureCtl = NULL;
+
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+/* did the current transaction write to a BDR-enabled database */
+static bool this_xact_wrote = false;
+
+/* delay computed at last_check, reused for BDR_BACKPRESSURE_RECHECK_MS */
+static TimestampTz last_check = 0;
+static long last_delay_ms = 0;
+
+static void bdr_backpressure_shmem_startup(void);
+
+void
+bdr_backpressure_shmem_init(void)
+{
+	Assert(process_shared_preload_libraries_in_progress);
+
+	RequestAddinShmemSpace(sizeof(BdrBackpressureControl));
+	RequestAddinLWLocks(1);
+
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = bdr_backpressure_shmem_startup;
+}
+
+static void
+bdr_backpressure_shmem_startup(void)
+{
+	bool		found;
+
+	if (prev_shmem_startup_hook != NULL)
+		prev_shmem_startup_hook();
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+	BdrBackpressureCtl = ShmemInitStruct("bdr_backpressure",
+										 sizeof(BdrBackpressureControl),
+										 &found);
+	if (!found)
+	{
+		memset(BdrBackpressureCtl, 0, sizeof(BdrBackpressureControl));
+		BdrBackpressureCtl->lock = LWLockAssign();
+	}
+	LWLockRelease(AddinShmemInitLock);
+}
+
+/*
+ * Record the current WAL insert position if the last sample is older than
+ * BDR_BACKPRESSURE_SAMPLE_INTERVAL_MS.
+ */
+static void
+bdr_backpressure_sample(TimestampTz now)
+{
+	BdrBackpressureControl *ctl = BdrBackpressureCtl;
+	BdrBackpressureSample *sample;
+	int			i;
+
+	LWLockAcquire(ctl->lock, LW_EXCLUSIVE);
+
+	if (ctl->count > 0)
+	{
+		i = (ctl->next - 1 + BDR_BACKPRESSURE_SAMPLES) % BDR_BACKPRESSURE_SAMPLES;
+		if (!TimestampDifferenceExceeds(ctl->samples[i].time, now,
+										BDR_BACKPRESSURE_SAMPLE_INTERVAL_MS))
+		{
+			LWLockRelease(ctl->lock);
+			return;
+		}
+	}
+
+	sample = &ctl->samples[ctl->next];
+	sample->lsn = GetXLogInsertRecPtr();
+	sample->time = now;
+
+	ctl->next = (ctl->next + 1) % BDR_BACKPRESSURE_SAMPLES;
+	if (ctl->count < BDR_BACKPRESSURE_SAMPLES)
+		ctl->count++;
+
+	LWLockRelease(ctl->lock);
+}
+
+/*
+ * Return how many milliseconds a peer that has flushed up to flush is
+ * behind, judging by the oldest sample it hasn't flushed yet. Lag beyond the
+ * samples kept is underestimated.
+ */
+static int64
+bdr_backpressure_time_lag(XLogRecPtr flush, TimestampTz now)
+{
+	BdrBackpressureControl *ctl = BdrBackpressureCtl;
+	int64		lag_ms = 0;
+	int			i;
+
+	LWLockAcquire(ctl->lock, LW_SHARED);
+	for (i = 0; i < ctl->count; i++)
+	{
+		BdrBackpressureSample *sample;
+
+		/* from the oldest to the newest sample */
+		sample = &ctl->samples[(ctl->next - ctl->count + i +
+								BDR_BACKPRESSURE_SAMPLES) %
+							   BDR_BACKPRESSURE_SAMPLES];
+		if (sample->lsn > flush)
+		{
+			lag_ms = Max(now - sample->time, 0) / 1000;
+			break;
+		}
+	}
+	LWLockRelease(ctl->lock);
+
+	return lag_ms;
+}
+
+/*
+ * Return the oldest flush position reported by the peers currently streaming
+ * changes from this database, or InvalidXLogRecPtr if there are none.
+ */
+static XLogRecPtr
+bdr_backpressure_slowest_peer(void)
+{
+	XLogRecPtr	slowest = InvalidXLogRecPtr;
+	int			i;
+
+	LWLockAcquire(BdrWorkerCtl->lock, LW_SHARED);
+	for (i = 0; i < bdr_max_workers; i++)
+	{
+		BdrWorker  *w = &BdrWorkerCtl->slots[i];
+		volatile WalSnd *walsnd;
+		XLogRecPtr	flush;
+
+		if (w->worker_type != BDR_WORKER_WALSENDER ||
+			w->worker_proc == NULL ||
+			w->worker_proc->databaseId != MyDatabaseId ||
+			w->data.walsnd.walsender == NULL)
+			continue;
+
+		walsnd = w->data.walsnd.walsender;
+		SpinLockAcquire(&walsnd->mutex);
+		flush = walsnd->flush;
+		SpinLockRelease(&walsnd->mutex);
+
+		/* no feedback yet */
+		if (flush == InvalidXLogRecPtr)
+			continue;
+
+		if (slowest == InvalidXLogRecPtr || flush < slowest)
+			slowest = flush;
+	}
+	LWLockRelease(BdrWorkerCtl->lock);
+
+	return slowest;
+}
+
+/*
+ * Compute how long to delay a commit, given the slowest peer's lag.
+ */
+static long
+bdr_backpressure_delay(TimestampTz now)
+{
+	XLogRecPtr	slowest;
+	double		excess = 0;
+
+	if (bdr_backpressure_max_lag_time > 0)
+		bdr_backpressure_sample(now);
+
+	slowest = bdr_backpressure_slowest_peer();
+	if (slowest == InvalidXLogRecPtr)
+		return 0;
+
+	if (bdr_backpressure_max_lag_bytes > 0)
+	{
+		double		budget = bdr_backpressure_max_lag_bytes * 1024.0;
+		XLogRecPtr	insert = GetXLogInsertRecPtr();
+
+		if (insert > slowest)
+			excess = Max(excess, ((insert - slowest) - budget) / budget);
+	}
+
+	if (bdr_backpressure_max_lag_time > 0)
+	{
+		double		budget = bdr_backpressure_max_lag_time * 1000.0;
+		int64		lag_ms = bdr_backpressure_time_lag(slowest, now);
+
+		excess = Max(excess, (lag_ms - budget) / budget);
+	}
+
+	if (excess <= 0)
+		return 0;
+
+	return (long) (BDR_BACKPRESSURE_MAX_DELAY_MS * Min(excess, 1.0));
+}
+
+static void
+bdr_backpressure_xact_callback(XactEvent event, void *arg)
+{
+	TimestampTz now;
+
+	if (!this_xact_wrote)
+		return;
+
+	if (event != XACT_EVENT_PRE_COMMIT)
+	{
+		this_xact_wrote = false;
+		return;
+	}
+
+	/* nothing to replicate */
+	if (GetTopTransactionIdIfAny() == InvalidTransactionId)
+		return;
+
+	now = GetCurrentTimestamp();
+	if (TimestampDifferenceExceeds(last_check, now,
+								   BDR_BACKPRESSURE_RECHECK_MS))
+	{
+		last_delay_ms = bdr_backpressure_delay(now);
+		last_check = now;
+	}
+
+	if (last_delay_ms > 0)
+	{
+		int			rc;
+
+		elog(DEBUG2, "delaying commit by %ld ms, a peer is too far behind",
+			 last_delay_ms);
+
+		ResetLatch(&MyProc->procLatch);
+		rc = WaitLatch(&MyProc->procLatch,
+					   WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
+					   last_delay_ms);
+
+		/* emergency bailout if postmaster has died */
+		if (rc & WL_POSTMASTER_DEATH)
+			proc_exit(1);
+
+		CHECK_FOR_INTERRUPTS();
+	}
+}
+
+/*
+ * Note that the current transaction writes to the BDR-enabled database
+ * we're in, so its commit is delayed while a peer is too far behind.
+ *
+ * Called from the ExecutorStart_hook, and from the ProcessUtility_hook for
+ * COPY FROM, which doesn't use the executor hooks. BDR's own workers never
+ * get here.
+ */
+void
+bdr_backpressure_note_write(void)
+{
+	static bool registered = false;
+
+	if (bdr_backpressure_max_lag_bytes <= 0 &&
+		bdr_backpressure_max_lag_time <= 0)
+		return;
+
+	if (!registered)
+	{
+		RegisterXactCallback(bdr_backpressure_xact_callback, NULL);
+		registered = true;
+	}
+
+	this_xact_wrote = true;
+}
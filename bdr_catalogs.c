@@ -278,6 +278,68 @@ bdr_nodes_set_local_status(char status)
 		CommitTransactionCommand();
 }
 
+/*
+ * Assign the local node (as identified by current sysid,tlid,dboid) a
+ * bdr.bdr_nodes.node_seq_id, used to generate timeshard sequence values, if
+ * it doesn't have one yet. The node record must already exist.
+ *
+ * Numbers are never reused, so this has to be done while the local
+ * bdr.bdr_nodes is up to date; bdr_sync_nodes() does the same for joining
+ * nodes.
+ */
+void
+bdr_nodes_set_local_seq_id(void)
+{
+	int			spi_ret;
+	Oid			argtypes[] = { TEXTOID, OIDOID, OIDOID };
+	Datum		values[3];
+	char		sysid_str[33];
+	bool		tx_started = false;
+	bool		spi_pushed;
+
+	/* Cannot have replication apply state set in this tx */
+	Assert(replication_origin_id == InvalidRepNodeId);
+
+	if (!IsTransactionState())
+	{
+		tx_started = true;
+		StartTransactionCommand();
+	}
+	spi_pushed = SPI_push_conditional();
+	SPI_connect();
+
+	snprintf(sysid_str, sizeof(sysid_str), UINT64_FORMAT,
+			 GetSystemIdentifier());
+	sysid_str[sizeof(sysid_str)-1] = '\0';
+
+	values[0] = CStringGetTextDatum(sysid_str);
+	values[1] = ObjectIdGetDatum(ThisTimeLineID);
+	values[2] = ObjectIdGetDatum(MyDatabaseId);
+
+	spi_ret = SPI_execute_with_args(
+							   "UPDATE bdr.bdr_nodes"
+							   "   SET node_seq_id = ("
+							   "       SELECT COALESCE(max(node_seq_id), 0) + 1"
+							   "       FROM bdr.bdr_nodes)"
+							   " WHERE node_sysid = $1"
+							   "   AND node_timeline = $2"
+							   "   AND node_dboid = $3"
+							   "   AND node_seq_id IS NULL;",
+							   3, argtypes, values, NULL, false, 0);
+
+	if (spi_ret != SPI_OK_UPDATE)
+		elog(ERROR, "Unable to set node_seq_id of row (node_sysid="
+					UINT64_FORMAT ", node_timeline=%u, node_dboid=%u) "
+					"in bdr.bdr_nodes: SPI error %d",
+					GetSystemIdentifier(), ThisTimeLineID,
+					MyDatabaseId, spi_ret);
+
+	SPI_finish();
+	SPI_pop_conditional(spi_pushed);
+	if (tx_started)
+		CommitTransactionCommand();
+}
+
 /*
  * Given a node's local RepNodeId, get its globally unique identifier
  * (sysid, timeline id, database oid)
@@ -293,6 +355,10 @@ bdr_fetch_sysid_via_node_id(RepNodeId node_id, uint64 *sysid, TimeLineID *tli,
 		*tli = ThisTimeLineID;
 		*dboid = MyDatabaseId;
 	}
+	else if (bdr_nodecache_lookup(node_id, sysid, tli, dboid))
+	{
+		/* Already known, no need to look at the catalogs */
+	}
 	else
 	{
 		char *riname;
@@ -311,6 +377,9 @@ bdr_fetch_sysid_via_node_id(RepNodeId node_id, uint64 *sysid, TimeLineID *tli,
 			elog(ERROR, "could not parse sysid: %s", riname);
 		pfree(riname);
 
+		bdr_nodecache_insert(node_id, remote_sysid, remote_tli, remote_dboid,
+							 local_dboid);
+
 		*sysid = remote_sysid;
 		*tli = remote_tli;
 		*dboid = remote_dboid;
@@ -329,16 +398,32 @@ bdr_parse_slot_name(const char *sname, uint64 *remote_sysid, TimeLineID *remote_
 		elog(ERROR, "could not parse slot name: %s", sname);
 }
 
+/*
+ * Given a node's globally unique identifier (sysid, timeline id, database
+ * oid), get the RepNodeId the local database uses for it.
+ *
+ * Must be called inside a transaction unless the node is known to be in the
+ * node identity cache.
+ */
 RepNodeId
 bdr_fetch_node_id_via_sysid(uint64 sysid, TimeLineID tli, Oid dboid)
 {
 	char		ident[256];
+	RepNodeId	node_id;
+
+	if (bdr_nodecache_lookup_node_id(sysid, tli, dboid, MyDatabaseId,
+									 &node_id))
+		return node_id;
 
 	snprintf(ident, sizeof(ident),
 			 BDR_NODE_ID_FORMAT,
 			 sysid, tli, dboid, MyDatabaseId,
 			 "");
-	return GetReplicationIdentifier(ident, false);
+	node_id = GetReplicationIdentifier(ident, false);
+
+	bdr_nodecache_insert(node_id, sysid, tli, dboid, MyDatabaseId);
+
+	return node_id;
 }
 
 /*
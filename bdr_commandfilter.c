@@ -24,7 +24,10 @@
 #include "access/seqam.h"
 #endif
 
+#include "catalog/index.h"
 #include "catalog/namespace.h"
+#include "catalog/pg_inherits_fn.h"
+#include "catalog/pg_type.h"
 
 #include "commands/dbcommands.h"
 #include "commands/event_trigger.h"
@@ -35,6 +38,8 @@
 /* For the client auth filter */
 #include "libpq/auth.h"
 
+#include "parser/parse_clause.h"
+#include "parser/parse_type.h"
 #include "parser/parse_utilcmd.h"
 
 #include "storage/standby.h"
@@ -42,6 +47,7 @@
 #include "tcop/utility.h"
 
 #include "utils/guc.h"
+#include "utils/lsyscache.h"
 #include "utils/rel.h"
 #include "utils/syscache.h"
 
@@ -167,7 +173,86 @@ filter_CreateStmt(Node *parsetree,
 	}
 }
 
-static void
+/*
+ * Does adding this column change what rows other nodes may send us? A
+ * nullable column without a default doesn't; the apply process treats it as
+ * NULL, or unchanged, in rows from nodes that haven't added it yet.
+ */
+static bool
+column_needs_write_lock(ColumnDef *def)
+{
+	ListCell   *cell;
+	Type		typtup;
+	bool		isdomain;
+
+	if (def->raw_default != NULL || def->cooked_default != NULL ||
+		def->is_not_null)
+		return true;
+
+	foreach(cell, def->constraints)
+	{
+		Constraint *con = (Constraint *) lfirst(cell);
+
+		if (con->contype != CONSTR_NULL)
+			return true;
+	}
+
+	/* domains can bring their own defaults and constraints */
+	typtup = LookupTypeName(NULL, def->typeName, NULL, true);
+	if (typtup == NULL)
+		return true;
+	isdomain = ((Form_pg_type) GETSTRUCT(typtup))->typtype == TYPTYPE_DOMAIN;
+	ReleaseSysCache(typtup);
+
+	return isdomain;
+}
+
+/*
+ * Lock class of an ALTER TABLE subcommand. Subcommands not affecting the
+ * rows other nodes may concurrently send, or how they're applied, only need
+ * to be serialized against other DDL.
+ */
+static BDRLockType
+alter_table_cmd_lock_type(AlterTableCmd *cmd)
+{
+	switch (cmd->subtype)
+	{
+		case AT_AddColumn:
+			if (!IsA(cmd->def, ColumnDef) ||
+				column_needs_write_lock((ColumnDef *) cmd->def))
+				return BDR_LOCK_WRITE;
+			return BDR_LOCK_DDL;
+
+		case AT_DropNotNull:
+		case AT_ColumnDefault:
+		case AT_ClusterOn:
+		case AT_DropCluster:
+		case AT_SetRelOptions:
+		case AT_ResetRelOptions:
+		case AT_ReplaceRelOptions:
+		case AT_ChangeOwner:
+		case AT_SetStorage:
+		case AT_SetStatistics:
+		case AT_EnableTrig:
+		case AT_EnableAlwaysTrig:
+		case AT_EnableReplicaTrig:
+		case AT_DisableTrig:
+		case AT_EnableTrigAll:
+		case AT_DisableTrigAll:
+		case AT_EnableTrigUser:
+		case AT_DisableTrigUser:
+			return BDR_LOCK_DDL;
+
+		default:
+			return BDR_LOCK_WRITE;
+	}
+}
+
+/*
+ * Check whether the ALTER TABLE is supported, and return the global lock it
+ * needs.
+ */
+static BDRLockType
 filter_AlterTableStmt(Node *parsetree,
 					  char *completionTag,
 					  const char *queryString)
@@ -179,6 +264,7 @@ filter_AlterTableStmt(Node *parsetree,
 	List	   *stmts;
 	Oid			relid;
 	LOCKMODE	lockmode;
+	BDRLockType	lock_type = BDR_LOCK_DDL;
 
 	astmt = (AlterTableStmt *) parsetree;
 	hasInvalid = false;
@@ -201,10 +287,14 @@ filter_AlterTableStmt(Node *parsetree,
 		/*
 		 * we ignore all nodes which are not AlterTableCmd statements since
 		 * the standard utility hook will recurse and thus call our handler
-		 * again
+		 * again. They're executed as part of this statement though, so don't
+		 * know what lock they'd need.
 		 */
 		if (!IsA(node, AlterTableStmt))
+		{
+			lock_type = BDR_LOCK_WRITE;
 			continue;
+		}
 
 		at_stmt = (AlterTableStmt *) node;
 
@@ -212,6 +302,8 @@ filter_AlterTableStmt(Node *parsetree,
 		{
 			AlterTableCmd *stmt = (AlterTableCmd *) lfirst(cell1);
 
+			lock_type = Max(lock_type, alter_table_cmd_lock_type(stmt));
+
 			switch (stmt->subtype)
 			{
 					/*
@@ -398,6 +490,8 @@ filter_AlterTableStmt(Node *parsetree,
 							   "This variant of ALTER TABLE",
 				               lockmode,
 							   astmt->missing_ok);
+
+	return lock_type;
 }
 
 static void
@@ -576,6 +670,200 @@ statement_affects_only_nonpermanent(Node *parsetree)
 	return false;
 }
 
+/*
+ * Add the relation a RangeVar refers to to *relids. Returns false if the
+ * relation can't be resolved, in which case the caller has to fall back to
+ * locking the whole database.
+ */
+static bool
+add_lock_relation(List **relids, RangeVar *rv)
+{
+	Oid			relid;
+
+	if (rv == NULL)
+		return false;
+
+	relid = RangeVarGetRelid(rv, NoLock, true);
+	if (!OidIsValid(relid))
+		return false;
+
+	*relids = list_append_unique_oid(*relids, relid);
+	return true;
+}
+
+/*
+ * Like add_lock_relation(), but for statements that also affect the
+ * relation's inheritance children unless ONLY was specified.
+ */
+static bool
+add_lock_relation_recurse(List **relids, RangeVar *rv)
+{
+	Oid			relid;
+
+	if (rv == NULL)
+		return false;
+
+	relid = RangeVarGetRelid(rv, NoLock, true);
+	if (!OidIsValid(relid))
+		return false;
+
+	if (interpretInhOption(rv->inhOpt))
+		*relids = list_concat_unique_oid(*relids,
+										 find_all_inheritors(relid, NoLock, NULL));
+	else
+		*relids = list_append_unique_oid(*relids, relid);
+	return true;
+}
+
+static bool
+add_lock_constraint_relations(List **relids, List *constraints)
+{
+	ListCell   *lc;
+
+	foreach(lc, constraints)
+	{
+		Node	   *con = (Node *) lfirst(lc);
+
+		if (IsA(con, Constraint) &&
+			((Constraint *) con)->contype == CONSTR_FOREIGN &&
+			!add_lock_relation(relids, ((Constraint *) con)->pktable))
+			return false;
+	}
+	return true;
+}
+
+/*
+ * Determine the relations a statement requiring a write lock needs to stop
+ * concurrent writes to, so the global write lock can be restricted to them.
+ *
+ * Returns NIL if the statement isn't known to be limited to a fixed set of
+ * relations, or if one of them can't be looked up; the lock then covers the
+ * whole database as before.
+ */
+static List *
+statement_lock_relations(Node *parsetree)
+{
+	List	   *relids = NIL;
+	ListCell   *lc;
+
+	switch (nodeTag(parsetree))
+	{
+		case T_IndexStmt:
+			if (!add_lock_relation(&relids, ((IndexStmt *) parsetree)->relation))
+				return NIL;
+			break;
+
+		case T_AlterTableStmt:
+			{
+				AlterTableStmt *stmt = (AlterTableStmt *) parsetree;
+
+				if (!add_lock_relation_recurse(&relids, stmt->relation))
+					return NIL;
+
+				/* relations referenced by the subcommands */
+				foreach(lc, stmt->cmds)
+				{
+					AlterTableCmd *cmd = (AlterTableCmd *) lfirst(lc);
+
+					switch (cmd->subtype)
+					{
+						case AT_AddConstraint:
+							if (!add_lock_constraint_relations(&relids,
+															   list_make1(cmd->def)))
+								return NIL;
+							break;
+						case AT_AddColumn:
+							if (IsA(cmd->def, ColumnDef) &&
+								!add_lock_constraint_relations(&relids,
+									((ColumnDef *) cmd->def)->constraints))
+								return NIL;
+							break;
+						case AT_AddInherit:
+						case AT_DropInherit:
+							if (!add_lock_relation(&relids, (RangeVar *) cmd->def))
+								return NIL;
+							break;
+						default:
+							break;
+					}
+				}
+				break;
+			}
+
+		case T_CreateTrigStmt:
+			{
+				CreateTrigStmt *stmt = (CreateTrigStmt *) parsetree;
+
+				if (!add_lock_relation(&relids, stmt->relation))
+					return NIL;
+				if (stmt->constrrel != NULL &&
+					!add_lock_relation(&relids, stmt->constrrel))
+					return NIL;
+				break;
+			}
+
+		case T_RuleStmt:
+			if (!add_lock_relation(&relids, ((RuleStmt *) parsetree)->relation))
+				return NIL;
+			break;
+
+		case T_RenameStmt:
+			{
+				RenameStmt *stmt = (RenameStmt *) parsetree;
+
+				if (!add_lock_relation_recurse(&relids, stmt->relation))
+					return NIL;
+				break;
+			}
+
+		case T_DropStmt:
+			{
+				DropStmt   *stmt = (DropStmt *) parsetree;
+
+				if (stmt->removeType != OBJECT_TABLE &&
+					stmt->removeType != OBJECT_INDEX)
+					return NIL;
+
+				/* could drop inheritance children, or anything else */
+				if (stmt->behavior == DROP_CASCADE)
+					return NIL;
+
+				foreach(lc, stmt->objects)
+				{
+					RangeVar   *rv = makeRangeVarFromNameList((List *) lfirst(lc));
+					Oid			relid;
+
+					relid = RangeVarGetRelid(rv, NoLock, true);
+					if (!OidIsValid(relid))
+						return NIL;
+
+					/*
+					 * Dropping an index affects writes to its table. If the
+					 * name isn't an index, DROP INDEX will complain.
+					 */
+					if (stmt->removeType == OBJECT_INDEX)
+					{
+						if (get_rel_relkind(relid) != RELKIND_INDEX)
+							return NIL;
+						relid = IndexGetRelation(relid, false);
+					}
+
+					relids = list_append_unique_oid(relids, relid);
+				}
+				break;
+			}
+
+		default:
+			return NIL;
+	}
+
+	/* too many to transport, lock everything */
+	if (list_length(relids) > BDR_LOCKS_MAX_RELATIONS)
+		return NIL;
+
+	return relids;
+}
+
 static void
 bdr_commandfilter_dbname(const char *dbname)
 {
@@ -597,9 +885,28 @@ bdr_commandfilter(Node *parsetree,
 				  DestReceiver *dest,
 				  char *completionTag)
 {
-	/* take strongest lock by default. */
+	/*
+	 * Statements fall into one of three lock classes: those not replicated
+	 * at all, like COMMENT and GRANT, are skipped below and take no global
+	 * lock. Those that can't affect the rows other nodes concurrently send
+	 * us, or how we apply them, like CREATE FUNCTION, CREATE VIEW, CREATE
+	 * INDEX CONCURRENTLY or adding a nullable column without default, only
+	 * take a BDR_LOCK_DDL to serialize them against other DDL. Everything
+	 * else stops writes, so take the strongest lock by default.
+	 */
 	BDRLockType	lock_type = BDR_LOCK_WRITE;
 
+	/*
+	 * COPY FROM writes rows without going through BdrExecutorStart(), so
+	 * note the write for backpressure here. Do that before the checks below,
+	 * it isn't filtering.
+	 */
+	if (IsA(parsetree, CopyStmt) && ((CopyStmt *) parsetree)->is_from &&
+		IsUnderPostmaster &&
+		replication_origin_id == InvalidRepNodeId &&
+		bdr_is_bdr_activated_db(MyDatabaseId))
+		bdr_backpressure_note_write();
+
 	/* don't filter in single user mode */
 	if (!IsUnderPostmaster)
 		goto done;
@@ -777,7 +1084,8 @@ bdr_commandfilter(Node *parsetree,
 			break;
 
 		case T_AlterTableStmt:
-			filter_AlterTableStmt(parsetree, completionTag, queryString);
+			lock_type = filter_AlterTableStmt(parsetree, completionTag,
+											  queryString);
 			break;
 
 		case T_AlterDomainStmt:
@@ -859,8 +1167,11 @@ bdr_commandfilter(Node *parsetree,
 			lock_type = BDR_LOCK_DDL;
 			break;
 
-		case T_AlterEnumStmt:
 		case T_AlterFunctionStmt:	/* ALTER FUNCTION */
+			lock_type = BDR_LOCK_DDL;
+			break;
+
+		case T_AlterEnumStmt:
 		case T_RuleStmt:	/* CREATE RULE */
 			break;
 
@@ -909,7 +1220,20 @@ bdr_commandfilter(Node *parsetree,
 			break;
 
 		case T_DropStmt:
-			break;
+			{
+				DropStmt   *stmt = (DropStmt *) parsetree;
+
+				/*
+				 * Replay never writes to views, and a function can only be
+				 * dropped without CASCADE if no trigger, constraint or
+				 * default uses it.
+				 */
+				if ((stmt->removeType == OBJECT_VIEW ||
+					 stmt->removeType == OBJECT_FUNCTION) &&
+					stmt->behavior == DROP_RESTRICT)
+					lock_type = BDR_LOCK_DDL;
+				break;
+			}
 
 		case T_RenameStmt:
 			{
@@ -966,7 +1290,14 @@ bdr_commandfilter(Node *parsetree,
 
 	/* now lock other nodes in the bdr flock against ddl */
 	if (!bdr_skip_ddl_locking && !statement_affects_only_nonpermanent(parsetree))
-		bdr_acquire_ddl_lock(lock_type);
+	{
+		List	   *relids = NIL;
+
+		if (lock_type == BDR_LOCK_WRITE)
+			relids = statement_lock_relations(parsetree);
+
+		bdr_acquire_ddl_lock(lock_type, relids);
+	}
 
 done:
 	if (next_ProcessUtility_hook)
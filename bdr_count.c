@@ -12,6 +12,7 @@
  */
 #include "postgres.h"
 
+#include <signal.h>
 #include <unistd.h>
 #include <sys/stat.h>
 
@@ -21,26 +22,40 @@
 #include "funcapi.h"
 #include "miscadmin.h"
 
+#include "catalog/pg_type.h"
+
 #include "nodes/execnodes.h"
 
+#include "portability/instr_time.h"
+
+#include "replication/walsender.h"
+
+#include "storage/barrier.h"
 #include "storage/fd.h"
 #include "storage/ipc.h"
 #include "storage/lwlock.h"
 #include "storage/spin.h"
 
+#include "utils/array.h"
 #include "utils/builtins.h"
+#include "utils/hsearch.h"
 #include "utils/syscache.h"
+#include "utils/timestamp.h"
+
+/* one for each BdrConflictType */
+#define BDR_COUNT_CONFLICT_TYPES (BdrConflictType_UnhandledTxAbort + 1)
 
 /*
- * Statistics about logical replication
+ * Counters kept both per peer node and per relation.
  *
- * whenever this struct is changed, bdr_count_version needs to be increased so
- * on-disk values aren't reused
+ * The apply worker for a peer is the only process writing to its slot's
+ * counters, and to its relations' counters; bdr_count_set_current_node()
+ * makes sure of that, see BdrCountWriter. Each write is bracketed by
+ * increments of the containing struct's changecount, so readers can take a
+ * consistent copy without locking, like with PgBackendStatus.
  */
-typedef struct BdrCountSlot
+typedef struct BdrCountCounters
 {
-	RepNodeId	node_id;
-
 	/* we use int64 to make sure we can export to sql, there is uint64 there */
 	int64		nr_commit;
 	int64		nr_rollback;
@@ -52,18 +67,141 @@ typedef struct BdrCountSlot
 	int64		nr_delete;
 	int64		nr_delete_conflict;
 
+	/* conflicts by BdrConflictType */
+	int64		nr_conflict[BDR_COUNT_CONFLICT_TYPES];
+
+	/* replication protocol bytes received */
+	int64		nr_bytes_in;
+	/* time spent applying, in microseconds */
+	int64		apply_time_us;
+}	BdrCountCounters;
+
+/* replication lag histogram buckets, upper bounds in ms; the last is open */
+#define BDR_COUNT_LAG_BUCKETS 7
+static const int bdr_count_lag_bucket_ms[BDR_COUNT_LAG_BUCKETS - 1] = {
+	10, 100, 1000, 10000, 60000, 600000
+};
+
+/*
+ * How far, in time, replay from a peer is behind. Lag is the difference
+ * between the remote commit time of a transaction, or the remote time of a
+ * heartbeat message, and the local time it was replayed at.
+ */
+typedef struct BdrCountLag
+{
+	/* remote time of the last commit or heartbeat replayed, and when */
+	TimestampTz last_remote_time;
+	TimestampTz last_apply_time;
+	int64		current_us;
+
+	/* only from commits: moving average, maximum and distribution */
+	int64		avg_us;
+	int64		max_us;
+	int64		nr_commits;
+	int64		buckets[BDR_COUNT_LAG_BUCKETS];
+}	BdrCountLag;
+
+/*
+ * Statistics about logical replication
+ *
+ * whenever this struct is changed, bdr_count_version needs to be increased so
+ * on-disk values aren't reused
+ */
+typedef struct BdrCountSlot
+{
+	RepNodeId	node_id;
+
+	/* written by the apply worker replaying changes from node_id */
+	uint32		changecount;
+	BdrCountCounters in;
 	int64		nr_disconnect;
+	BdrCountLag lag;
+
+	/* written by the walsender streaming changes to node_id */
+	uint32		out_changecount;
+	int64		nr_xact_out;
+	int64		nr_bytes_out;
 }	BdrCountSlot;
 
+typedef struct BdrCountRelationKey
+{
+	RepNodeId	node_id;
+	Oid			dboid;
+	Oid			relid;
+} BdrCountRelationKey;
+
+/*
+ * Changes replayed to a relation from a peer node, kept in a shared hash.
+ */
+typedef struct BdrCountRelation
+{
+	/* hash key, needs to be first */
+	BdrCountRelationKey key;
+
+	uint32		changecount;
+	BdrCountCounters counters;
+} BdrCountRelation;
+
+/*
+ * Processes writing a live slot's counters. Concurrent writers would corrupt
+ * the changecount protocol, possibly leaving it odd for good, so
+ * bdr_count_set_current_node() refuses to hand out a slot to a second one.
+ * Kept outside of BdrCountSlot as it's neither serialized nor snapshotted.
+ */
+typedef struct BdrCountWriter
+{
+	/* the apply worker, writing changecount and its relations' entries */
+	int			apply_pid;
+	/* the walsender, writing out_changecount */
+	int			walsender_pid;
+}	BdrCountWriter;
+
+/* an apply worker's reference to a relation's shared entry */
+typedef struct BdrCountRelationRef
+{
+	Oid			relid;
+	BdrCountRelation *entry;
+} BdrCountRelationRef;
+
+/* periodic snapshots of the counters we keep, see bdr_count_snapshot() */
+#define BDR_COUNT_SNAPSHOTS 360
+
+/* how often the stats file is written out while running */
+#define BDR_COUNT_FLUSH_INTERVAL_MS 60000
+
+/*
+ * Ring of periodic snapshots of all slots, allowing to compute rates over a
+ * window. The snapshotted slots themselves follow the live ones, see
+ * BdrCountSnapshotSlots().
+ */
+typedef struct BdrCountRing
+{
+	/* index of the next snapshot to take, and number of valid ones */
+	int			next;
+	int			count;
+	TimestampTz time[BDR_COUNT_SNAPSHOTS];
+}	BdrCountRing;
+
 /*
  * Shared memory header for the stats module.
  */
 typedef struct BdrCountControl
 {
+	/* protects slot assignment, the ring and BdrCountRelationHash */
 	LWLockId	lock;
+	BdrCountRing ring;
+
+	/*
+	 * bdr_count_nnodes live slots, followed by BDR_COUNT_SNAPSHOTS times as
+	 * many snapshotted ones.
+	 */
 	BdrCountSlot slots[FLEXIBLE_ARRAY_MEMBER];
 }	BdrCountControl;
 
+/* the bdr_count_nnodes slots of snapshot snap */
+#define BdrCountSnapshotSlots(snap) \
+	(&BdrCountCtl->slots[bdr_count_nnodes * (1 + (snap))])
+
 /*
  * Header of a stats disk serialization, used to detect old files, changed
  * parameters and such.
@@ -79,43 +217,144 @@ typedef struct BdrCountSerialize
 static const uint32 bdr_count_magic = 0x5e51A7;
 
 /* everytime the stored data format changes, increase */
-static const uint32 bdr_count_version = 2;
+static const uint32 bdr_count_version = 5;
+
+/* relations we keep statistics for, per node */
+#define BDR_COUNT_RELATIONS_PER_NODE 1000
 
 /* shortcut for the finding BdrCountControl in memory */
 static BdrCountControl *BdrCountCtl = NULL;
 
+static HTAB *BdrCountRelationHash = NULL;
+
+/* bdr_count_nnodes writers, one for each live slot */
+static BdrCountWriter *BdrCountWriters = NULL;
+
 /* how many nodes have we built shmem for */
 static size_t bdr_count_nnodes = 0;
 
 /* offset in the BdrCountControl->slots "our" backend is in */
 static int	MyCountOffsetIdx = -1;
 
+/*
+ * The apply worker's relation entries, by relid, and the relation the
+ * change currently being applied is for.
+ */
+static HTAB *MyCountRelations = NULL;
+static BdrCountRelation *MyCountRelation = NULL;
+static instr_time MyCountChangeStart;
+static Size MyCountChangeBytes;
+static instr_time MyCountXactStart;
+
 static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
 
 static void bdr_count_shmem_startup(void);
 static void bdr_count_shmem_shutdown(int code, Datum arg);
 static Size bdr_count_shmem_size(void);
+static Size bdr_count_relations_size(void);
 
+static void bdr_count_release_slot(int code, Datum arg);
 static void bdr_count_serialize(void);
 static void bdr_count_unserialize(void);
 
 #define BDR_COUNT_STAT_COLS 12
+#define BDR_COUNT_APPLY_STAT_COLS 21
+#define BDR_COUNT_RELATION_STAT_COLS 16
+#define BDR_COUNT_RATE_COLS 14
+#define BDR_COUNT_LAG_COLS 9
 
 PGDLLEXPORT Datum pg_stat_get_bdr(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum bdr_get_apply_stats(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum bdr_get_relation_stats(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum bdr_get_apply_rates(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum bdr_get_replication_lag(PG_FUNCTION_ARGS);
 
 PG_FUNCTION_INFO_V1(pg_stat_get_bdr);
+PG_FUNCTION_INFO_V1(bdr_get_apply_stats);
+PG_FUNCTION_INFO_V1(bdr_get_relation_stats);
+PG_FUNCTION_INFO_V1(bdr_get_apply_rates);
+PG_FUNCTION_INFO_V1(bdr_get_replication_lag);
+
+/*
+ * Bracket modifications of counters protected by changecount.
+ */
+#define BDR_COUNT_BEGIN_WRITE(changecount) \
+	do { \
+		(changecount)++; \
+		pg_write_barrier(); \
+	} while (0)
+
+#define BDR_COUNT_END_WRITE(changecount) \
+	do { \
+		pg_write_barrier(); \
+		(changecount)++; \
+	} while (0)
+
+/*
+ * How often bdr_count_read() retries before settling for a possibly torn
+ * copy; after the first BDR_COUNT_READ_SPINS it sleeps 1ms between tries.
+ */
+#define BDR_COUNT_READ_SPINS 100
+#define BDR_COUNT_READ_RETRIES 1000
+
+/*
+ * Copy size bytes of counters at src, protected by *changecount, to dst.
+ * Retries while the writer is concurrently modifying them.
+ *
+ * A write only takes a few instructions, so if the counters stay in flux
+ * for about a second something's broken; we'd rather return inconsistent
+ * statistics than hang whoever is looking at them, possibly while holding
+ * BdrCountCtl->lock.
+ */
+static void
+bdr_count_read(volatile uint32 *changecount, volatile void *src, void *dst,
+			   Size size)
+{
+	int			retries = 0;
+
+	for (;;)
+	{
+		uint32		before = *changecount;
+
+		pg_read_barrier();
+		memcpy(dst, (void *) src, size);
+		pg_read_barrier();
+
+		if (before == *changecount && (before & 1) == 0)
+			break;
+
+		if (++retries >= BDR_COUNT_READ_RETRIES)
+		{
+			elog(WARNING, "bdr statistics are being modified for too long, returning possibly inconsistent values");
+			break;
+		}
+
+		CHECK_FOR_INTERRUPTS();
+		if (retries > BDR_COUNT_READ_SPINS)
+			pg_usleep(1000L);
+	}
+}
 
 static Size
 bdr_count_shmem_size(void)
 {
 	Size		size = 0;
 
-	size = add_size(size, sizeof(BdrCountControl));
-	size = add_size(size, mul_size(bdr_count_nnodes, sizeof(BdrCountSlot)));
+	size = add_size(size, offsetof(BdrCountControl, slots));
+	size = add_size(size, mul_size(mul_size(bdr_count_nnodes,
+											1 + BDR_COUNT_SNAPSHOTS),
+								   sizeof(BdrCountSlot)));
+	size = add_size(size, mul_size(bdr_count_nnodes, sizeof(BdrCountWriter)));
 
 	return size;
 }
 
+static Size
+bdr_count_relations_size(void)
+{
+	return bdr_count_nnodes * BDR_COUNT_RELATIONS_PER_NODE;
+}
+
 void
 bdr_count_shmem_init(size_t nnodes)
 {
@@ -124,6 +363,8 @@ bdr_count_shmem_init(size_t nnodes)
 	bdr_count_nnodes = nnodes;
 
 	RequestAddinShmemSpace(bdr_count_shmem_size());
+	RequestAddinShmemSpace(hash_estimate_size(bdr_count_relations_size(),
+											  sizeof(BdrCountRelation)));
 	/* lock for slot acquiration */
 	RequestAddinLWLocks(1);
 
@@ -135,6 +376,7 @@ static void
 bdr_count_shmem_startup(void)
 {
 	bool		found;
+	HASHCTL		ctl;
 
 	if (prev_shmem_startup_hook != NULL)
 		prev_shmem_startup_hook();
@@ -150,6 +392,19 @@ bdr_count_shmem_startup(void)
 		BdrCountCtl->lock = LWLockAssign();
 		bdr_count_unserialize();
 	}
+	BdrCountWriters = (BdrCountWriter *)
+		BdrCountSnapshotSlots(BDR_COUNT_SNAPSHOTS);
+
+	MemSet(&ctl, 0, sizeof(ctl));
+	ctl.keysize = sizeof(BdrCountRelationKey);
+	ctl.entrysize = sizeof(BdrCountRelation);
+	ctl.hash = tag_hash;
+
+	BdrCountRelationHash = ShmemInitHash("bdr relation statistics",
+										 bdr_count_relations_size(),
+										 bdr_count_relations_size(),
+										 &ctl,
+										 HASH_ELEM | HASH_FUNCTION);
 	LWLockRelease(AddinShmemInitLock);
 
 	/*
@@ -174,17 +429,106 @@ bdr_count_shmem_shutdown(int code, Datum arg)
 	bdr_count_serialize();
 }
 
+/*
+ * The pid of the process writing slot idx's counters of the kind we write,
+ * the apply worker's or the walsender's.
+ */
+static int *
+bdr_count_writer(int idx)
+{
+	if (am_walsender)
+		return &BdrCountWriters[idx].walsender_pid;
+	return &BdrCountWriters[idx].apply_pid;
+}
+
+/*
+ * Stop writing to our slot, if we have one. Also used as a shmem exit
+ * callback, so the next process can take over.
+ *
+ * No lock needed, nobody else changes the writer while we're alive, and we
+ * might be exiting with it held.
+ */
+static void
+bdr_count_release_slot(int code, Datum arg)
+{
+	volatile int *writer;
+
+	if (MyCountOffsetIdx == -1)
+		return;
+
+	writer = bdr_count_writer(MyCountOffsetIdx);
+	if (*writer == MyProcPid)
+		*writer = 0;
+
+	MyCountOffsetIdx = -1;
+}
+
+/*
+ * Register ourselves as the writer of slot idx's counters. Errors out if
+ * another process still is, as we'd corrupt each other's changecounts.
+ * Needs BdrCountCtl->lock held exclusively.
+ */
+static void
+bdr_count_claim_slot(int idx)
+{
+	static bool registered = false;
+	int		   *writer = bdr_count_writer(idx);
+
+	if (*writer != 0 && *writer != MyProcPid &&
+		(kill(*writer, 0) == 0 || errno != ESRCH))
+	{
+		int			pid = *writer;
+		RepNodeId	node_id = BdrCountCtl->slots[idx].node_id;
+
+		LWLockRelease(BdrCountCtl->lock);
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_IN_USE),
+				 errmsg("bdr statistics for node %u are already being written by process %d",
+						node_id, pid)));
+	}
+
+	*writer = MyProcPid;
+	MyCountOffsetIdx = idx;
+
+	if (!registered)
+	{
+		on_shmem_exit(bdr_count_release_slot, (Datum) 0);
+		registered = true;
+	}
+}
+
+/*
+ * Our slot, which we must be the registered apply worker of.
+ */
+static volatile BdrCountSlot *
+bdr_count_apply_slot(void)
+{
+	Assert(MyCountOffsetIdx != -1);
+	Assert(!am_walsender);
+	Assert(BdrCountWriters[MyCountOffsetIdx].apply_pid == MyProcPid);
+
+	return &BdrCountCtl->slots[MyCountOffsetIdx];
+}
+
 /*
  * Find a statistics slot for a given RepNodeId and setup a local variable
  * pointing to it so we can quickly find it for the actual statistics
- * manipulation.
+ * manipulation. We become the only process of our kind writing to it.
  */
 void
 bdr_count_set_current_node(RepNodeId node_id)
 {
 	size_t		i;
+	int			idx = -1;
 
-	MyCountOffsetIdx = -1;
+	bdr_count_release_slot(0, (Datum) 0);
+	MyCountRelation = NULL;
+
+	if (MyCountRelations != NULL)
+	{
+		hash_destroy(MyCountRelations);
+		MyCountRelations = NULL;
+	}
 
 	LWLockAcquire(BdrCountCtl->lock, LW_EXCLUSIVE);
 
@@ -193,114 +537,535 @@ bdr_count_set_current_node(RepNodeId node_id)
 	{
 		if (BdrCountCtl->slots[i].node_id == node_id)
 		{
-			MyCountOffsetIdx = i;
+			idx = i;
 			break;
 		}
 	}
 
-	if (MyCountOffsetIdx != -1)
-		goto out;
-
-	/* ok, get a new slot */
-	for (i = 0; i < bdr_count_nnodes; i++)
+	/* if not, get a new slot */
+	for (i = 0; idx == -1 && i < bdr_count_nnodes; i++)
 	{
 		if (BdrCountCtl->slots[i].node_id == InvalidRepNodeId)
 		{
-			MyCountOffsetIdx = i;
+			idx = i;
 			BdrCountCtl->slots[i].node_id = node_id;
-			break;
 		}
 	}
 
-	if (MyCountOffsetIdx == -1)
+	if (idx == -1)
 		elog(PANIC, "could not find a bdr count slot for %u", node_id);
-out:
+
+	bdr_count_claim_slot(idx);
+
+	LWLockRelease(BdrCountCtl->lock);
+}
+
+/*
+ * Remove our node's entries for relations that don't exist anymore, so
+ * dropped tables don't use up BdrCountRelationHash for good. We're the only
+ * process writing, and thus creating or removing, our node's entries.
+ * Needs to be called in a transaction. Returns whether anything was removed.
+ */
+static bool
+bdr_count_prune_relations(void)
+{
+	HASH_SEQ_STATUS status;
+	BdrCountRelation *entry;
+	BdrCountRelationRef *ref;
+	RepNodeId	node_id = BdrCountCtl->slots[MyCountOffsetIdx].node_id;
+	List	   *candidates = NIL;
+	List	   *dropped = NIL;
+	ListCell   *lc;
+
+	/* collect our entries first, no catalog access while holding the lock */
+	LWLockAcquire(BdrCountCtl->lock, LW_SHARED);
+	hash_seq_init(&status, BdrCountRelationHash);
+	while ((entry = hash_seq_search(&status)) != NULL)
+	{
+		if (entry->key.node_id == node_id &&
+			entry->key.dboid == MyDatabaseId)
+			candidates = lappend_oid(candidates, entry->key.relid);
+	}
+	LWLockRelease(BdrCountCtl->lock);
+
+	foreach(lc, candidates)
+	{
+		Oid			relid = lfirst_oid(lc);
+
+		if (!SearchSysCacheExists1(RELOID, ObjectIdGetDatum(relid)))
+			dropped = lappend_oid(dropped, relid);
+	}
+	list_free(candidates);
+
+	if (dropped == NIL)
+		return false;
+
+	LWLockAcquire(BdrCountCtl->lock, LW_EXCLUSIVE);
+	foreach(lc, dropped)
+	{
+		BdrCountRelationKey key;
+
+		memset(&key, 0, sizeof(key));
+		key.node_id = node_id;
+		key.dboid = MyDatabaseId;
+		key.relid = lfirst_oid(lc);
+
+		hash_search(BdrCountRelationHash, &key, HASH_REMOVE, NULL);
+	}
+	LWLockRelease(BdrCountCtl->lock);
+
+	elog(DEBUG1, "removed statistics of %d dropped relations",
+		 list_length(dropped));
+
+	/*
+	 * Forget our references to the removed entries, and to entries we
+	 * couldn't create for lack of space so they're retried.
+	 */
+	foreach(lc, dropped)
+	{
+		Oid			relid = lfirst_oid(lc);
+
+		hash_search(MyCountRelations, &relid, HASH_REMOVE, NULL);
+	}
+	list_free(dropped);
+
+	hash_seq_init(&status, MyCountRelations);
+	while ((ref = hash_seq_search(&status)) != NULL)
+	{
+		if (ref->entry == NULL)
+			hash_search(MyCountRelations, &ref->relid, HASH_REMOVE, NULL);
+	}
+
+	return true;
+}
+
+/*
+ * Create the shared entry for key, returning NULL if there's no space.
+ */
+static BdrCountRelation *
+bdr_count_create_relation(BdrCountRelationKey *key)
+{
+	BdrCountRelation *entry;
+	bool		found;
+
+	/*
+	 * We're the only one creating entries for our node, so there's no need
+	 * to look with a shared lock first. Readers only block us here.
+	 */
+	LWLockAcquire(BdrCountCtl->lock, LW_EXCLUSIVE);
+	entry = hash_search(BdrCountRelationHash, key, HASH_ENTER_NULL, &found);
+	if (entry != NULL && !found)
+	{
+		entry->changecount = 0;
+		memset(&entry->counters, 0, sizeof(BdrCountCounters));
+	}
 	LWLockRelease(BdrCountCtl->lock);
+
+	return entry;
+}
+
+/*
+ * Find, or create, the shared entry counting changes to relid replayed from
+ * our node. If there's no space for another entry, entries of dropped
+ * relations are removed; returns NULL if that doesn't help.
+ */
+static BdrCountRelation *
+bdr_count_lookup_relation(Oid relid)
+{
+	BdrCountRelationRef *ref;
+	BdrCountRelationKey key;
+	BdrCountRelation *entry;
+
+	if (MyCountRelations == NULL)
+	{
+		HASHCTL		ctl;
+
+		MemSet(&ctl, 0, sizeof(ctl));
+		ctl.keysize = sizeof(Oid);
+		ctl.entrysize = sizeof(BdrCountRelationRef);
+		ctl.hash = oid_hash;
+		ctl.hcxt = TopMemoryContext;
+
+		MyCountRelations = hash_create("bdr relation statistics refs", 128,
+									   &ctl,
+									   HASH_ELEM | HASH_FUNCTION | HASH_CONTEXT);
+	}
+
+	ref = hash_search(MyCountRelations, &relid, HASH_FIND, NULL);
+	if (ref != NULL)
+		return ref->entry;
+
+	memset(&key, 0, sizeof(key));
+	key.node_id = BdrCountCtl->slots[MyCountOffsetIdx].node_id;
+	key.dboid = MyDatabaseId;
+	key.relid = relid;
+
+	entry = bdr_count_create_relation(&key);
+	if (entry == NULL && bdr_count_prune_relations())
+		entry = bdr_count_create_relation(&key);
+
+	/* remember failures too, pruning makes us retry them */
+	ref = hash_search(MyCountRelations, &relid, HASH_ENTER, NULL);
+	ref->entry = entry;
+
+	return entry;
 }
 
 /*
  * Statistic manipulation functions.
  *
- * We assume we don't have to do any locking for *our* slot since only one
- * backend will do writing there.
+ * We don't have to do any locking for *our* slot since only one backend will
+ * do writing there, see BdrCountCounters and BdrCountWriter.
+ */
+
+/*
+ * Start counting a change that's sent as a message of nbytes, which the
+ * apply worker is about to replay.
  */
 void
-bdr_count_commit(void)
+bdr_count_change_begin(Size nbytes)
 {
 	Assert(MyCountOffsetIdx != -1);
-	BdrCountCtl->slots[MyCountOffsetIdx].nr_commit++;
+
+	MyCountRelation = NULL;
+	MyCountChangeBytes = nbytes;
+	INSTR_TIME_SET_CURRENT(MyCountChangeStart);
 }
 
+/*
+ * The change being replayed is for relid.
+ */
 void
-bdr_count_rollback(void)
+bdr_count_set_relation(Oid relid)
 {
 	Assert(MyCountOffsetIdx != -1);
-	BdrCountCtl->slots[MyCountOffsetIdx].nr_rollback++;
+
+	MyCountRelation = bdr_count_lookup_relation(relid);
 }
 
+/*
+ * Done replaying a change, account its size and duration to its relation.
+ */
 void
-bdr_count_insert(void)
+bdr_count_change_end(void)
 {
-	Assert(MyCountOffsetIdx != -1);
-	BdrCountCtl->slots[MyCountOffsetIdx].nr_insert++;
+	volatile BdrCountRelation *rel = MyCountRelation;
+	instr_time	duration;
+
+	if (rel == NULL)
+		return;
+
+	INSTR_TIME_SET_CURRENT(duration);
+	INSTR_TIME_SUBTRACT(duration, MyCountChangeStart);
+
+	BDR_COUNT_BEGIN_WRITE(rel->changecount);
+	rel->counters.nr_bytes_in += MyCountChangeBytes;
+	rel->counters.apply_time_us += INSTR_TIME_GET_MICROSEC(duration);
+	BDR_COUNT_END_WRITE(rel->changecount);
+
+	MyCountRelation = NULL;
 }
 
 void
-bdr_count_insert_conflict(void)
+bdr_count_begin(void)
 {
 	Assert(MyCountOffsetIdx != -1);
-	BdrCountCtl->slots[MyCountOffsetIdx].nr_insert_conflict++;
+	INSTR_TIME_SET_CURRENT(MyCountXactStart);
+}
+
+/* Account the time since bdr_count_begin() */
+static void
+bdr_count_xact_end(volatile BdrCountSlot *slot)
+{
+	instr_time	duration;
+
+	if (INSTR_TIME_IS_ZERO(MyCountXactStart))
+		return;
+
+	INSTR_TIME_SET_CURRENT(duration);
+	INSTR_TIME_SUBTRACT(duration, MyCountXactStart);
+	slot->in.apply_time_us += INSTR_TIME_GET_MICROSEC(duration);
+	INSTR_TIME_SET_ZERO(MyCountXactStart);
+}
+
+void
+bdr_count_commit(void)
+{
+	volatile BdrCountSlot *slot = bdr_count_apply_slot();
+
+	BDR_COUNT_BEGIN_WRITE(slot->changecount);
+	slot->in.nr_commit++;
+	bdr_count_xact_end(slot);
+	BDR_COUNT_END_WRITE(slot->changecount);
+}
+
+void
+bdr_count_rollback(void)
+{
+	volatile BdrCountSlot *slot = bdr_count_apply_slot();
+
+	BDR_COUNT_BEGIN_WRITE(slot->changecount);
+	slot->in.nr_rollback++;
+	bdr_count_xact_end(slot);
+	BDR_COUNT_END_WRITE(slot->changecount);
+}
+
+/*
+ * Count a row change, and a conflict of conflict_type if not -1, for our
+ * node and the current relation, if known.
+ */
+#define BDR_COUNT_ROW(field, conflict_type) \
+	do { \
+		volatile BdrCountSlot *slot = bdr_count_apply_slot(); \
+		volatile BdrCountRelation *rel = MyCountRelation; \
+		int			ctype = (conflict_type); \
+		\
+		BDR_COUNT_BEGIN_WRITE(slot->changecount); \
+		slot->in.field++; \
+		if (ctype >= 0) \
+			slot->in.nr_conflict[ctype]++; \
+		BDR_COUNT_END_WRITE(slot->changecount); \
+		\
+		if (rel != NULL) \
+		{ \
+			BDR_COUNT_BEGIN_WRITE(rel->changecount); \
+			rel->counters.field++; \
+			if (ctype >= 0) \
+				rel->counters.nr_conflict[ctype]++; \
+			BDR_COUNT_END_WRITE(rel->changecount); \
+		} \
+	} while (0)
+
+void
+bdr_count_insert(void)
+{
+	BDR_COUNT_ROW(nr_insert, -1);
+}
+
+void
+bdr_count_insert_conflict(BdrConflictType conflict_type)
+{
+	BDR_COUNT_ROW(nr_insert_conflict, conflict_type);
 }
 
 void
 bdr_count_update(void)
 {
-	Assert(MyCountOffsetIdx != -1);
-	BdrCountCtl->slots[MyCountOffsetIdx].nr_update++;
+	BDR_COUNT_ROW(nr_update, -1);
 }
 
 void
-bdr_count_update_conflict(void)
+bdr_count_update_conflict(BdrConflictType conflict_type)
 {
-	Assert(MyCountOffsetIdx != -1);
-	BdrCountCtl->slots[MyCountOffsetIdx].nr_update_conflict++;
+	BDR_COUNT_ROW(nr_update_conflict, conflict_type);
 }
 
 void
 bdr_count_delete(void)
 {
-	Assert(MyCountOffsetIdx != -1);
-	BdrCountCtl->slots[MyCountOffsetIdx].nr_delete++;
+	BDR_COUNT_ROW(nr_delete, -1);
 }
 
 void
-bdr_count_delete_conflict(void)
+bdr_count_delete_conflict(BdrConflictType conflict_type)
 {
-	Assert(MyCountOffsetIdx != -1);
-	BdrCountCtl->slots[MyCountOffsetIdx].nr_delete_conflict++;
+	BDR_COUNT_ROW(nr_delete_conflict, conflict_type);
 }
 
 void
 bdr_count_disconnect(void)
 {
-	Assert(MyCountOffsetIdx != -1);
-	BdrCountCtl->slots[MyCountOffsetIdx].nr_disconnect++;
+	volatile BdrCountSlot *slot = bdr_count_apply_slot();
+
+	BDR_COUNT_BEGIN_WRITE(slot->changecount);
+	slot->nr_disconnect++;
+	BDR_COUNT_END_WRITE(slot->changecount);
 }
 
-Datum
-pg_stat_get_bdr(PG_FUNCTION_ARGS)
+/*
+ * Count bytes of replication protocol data received by the apply worker.
+ */
+void
+bdr_count_bytes_in(Size nbytes)
+{
+	volatile BdrCountSlot *slot = bdr_count_apply_slot();
+
+	BDR_COUNT_BEGIN_WRITE(slot->changecount);
+	slot->in.nr_bytes_in += nbytes;
+	BDR_COUNT_END_WRITE(slot->changecount);
+}
+
+/*
+ * Count data sent by a walsender, which only has a slot if we also replay
+ * changes from its peer.
+ */
+void
+bdr_count_sent(Size nbytes, bool commit)
+{
+	volatile BdrCountSlot *slot;
+
+	if (MyCountOffsetIdx == -1)
+		return;
+	Assert(am_walsender);
+	Assert(BdrCountWriters[MyCountOffsetIdx].walsender_pid == MyProcPid);
+	slot = &BdrCountCtl->slots[MyCountOffsetIdx];
+
+	BDR_COUNT_BEGIN_WRITE(slot->out_changecount);
+	slot->nr_bytes_out += nbytes;
+	if (commit)
+		slot->nr_xact_out++;
+	BDR_COUNT_END_WRITE(slot->out_changecount);
+}
+
+/*
+ * Account the lag of replaying something the peer did at remote_time, a
+ * transaction commit or, if !commit, a heartbeat.
+ */
+void
+bdr_count_lag(TimestampTz remote_time, bool commit)
+{
+	volatile BdrCountSlot *slot = bdr_count_apply_slot();
+	TimestampTz now = GetCurrentTimestamp();
+	int64		lag_us;
+	int			bucket;
+
+	/* clocks may be skewed */
+	lag_us = Max(now - remote_time, 0);
+
+	for (bucket = 0; bucket < BDR_COUNT_LAG_BUCKETS - 1; bucket++)
+	{
+		if (lag_us < (int64) bdr_count_lag_bucket_ms[bucket] * 1000)
+			break;
+	}
+
+	BDR_COUNT_BEGIN_WRITE(slot->changecount);
+	slot->lag.last_remote_time = remote_time;
+	slot->lag.last_apply_time = now;
+	slot->lag.current_us = lag_us;
+	if (commit)
+	{
+		/* exponential moving average, weighting the new sample 1/8 */
+		if (slot->lag.nr_commits == 0)
+			slot->lag.avg_us = lag_us;
+		else
+			slot->lag.avg_us += (lag_us - slot->lag.avg_us) / 8;
+		if (lag_us > slot->lag.max_us)
+			slot->lag.max_us = lag_us;
+		slot->lag.nr_commits++;
+		slot->lag.buckets[bucket]++;
+	}
+	BDR_COUNT_END_WRITE(slot->changecount);
+}
+
+/*
+ * Copy a slot's counters without blocking its writers.
+ */
+static void
+bdr_count_read_slot(volatile BdrCountSlot *slot, BdrCountSlot *copy)
+{
+	copy->node_id = slot->node_id;
+	bdr_count_read(&slot->changecount, &slot->in, &copy->in,
+				   sizeof(BdrCountCounters));
+	bdr_count_read(&slot->changecount, &slot->nr_disconnect,
+				   &copy->nr_disconnect, sizeof(int64));
+	bdr_count_read(&slot->changecount, &slot->lag, &copy->lag,
+				   sizeof(BdrCountLag));
+	bdr_count_read(&slot->out_changecount, &slot->nr_xact_out,
+				   &copy->nr_xact_out, sizeof(int64));
+	bdr_count_read(&slot->out_changecount, &slot->nr_bytes_out,
+				   &copy->nr_bytes_out, sizeof(int64));
+}
+
+/*
+ * Add a snapshot of all slots, taken at now, to the ring, replacing the
+ * oldest one once it's full.
+ */
+static void
+bdr_count_snapshot(TimestampTz now)
+{
+	BdrCountRing *ring = &BdrCountCtl->ring;
+	BdrCountSlot *snapshot;
+	size_t		i;
+
+	LWLockAcquire(BdrCountCtl->lock, LW_EXCLUSIVE);
+
+	snapshot = BdrCountSnapshotSlots(ring->next);
+	for (i = 0; i < bdr_count_nnodes; i++)
+		bdr_count_read_slot(&BdrCountCtl->slots[i], &snapshot[i]);
+	ring->time[ring->next] = now;
+
+	ring->next = (ring->next + 1) % BDR_COUNT_SNAPSHOTS;
+	if (ring->count < BDR_COUNT_SNAPSHOTS)
+		ring->count++;
+
+	LWLockRelease(BdrCountCtl->lock);
+}
+
+/*
+ * Snapshot the counters every bdr.stats_snapshot_interval and write them to
+ * disk every BDR_COUNT_FLUSH_INTERVAL_MS, so a crash only loses little
+ * history. Called regularly by the supervisor; returns the number of
+ * milliseconds until there's work to do again.
+ */
+long
+bdr_count_maintain(void)
+{
+	static TimestampTz last_snapshot = 0;
+	static TimestampTz last_flush = 0;
+	TimestampTz now = GetCurrentTimestamp();
+	TimestampTz next_flush;
+	TimestampTz wakeup;
+	long		secs;
+	int			usecs;
+
+	if (last_flush == 0)
+		last_flush = now;
+
+	next_flush = TimestampTzPlusMilliseconds(last_flush,
+											 BDR_COUNT_FLUSH_INTERVAL_MS);
+	if (now >= next_flush)
+	{
+		bdr_count_serialize();
+		last_flush = now;
+		next_flush = TimestampTzPlusMilliseconds(now,
+												 BDR_COUNT_FLUSH_INTERVAL_MS);
+	}
+	wakeup = next_flush;
+
+	if (bdr_stats_snapshot_interval > 0)
+	{
+		TimestampTz next_snapshot;
+
+		next_snapshot = TimestampTzPlusMilliseconds(last_snapshot,
+							bdr_stats_snapshot_interval * 1000L);
+		if (now >= next_snapshot)
+		{
+			bdr_count_snapshot(now);
+			last_snapshot = now;
+			next_snapshot = TimestampTzPlusMilliseconds(now,
+								bdr_stats_snapshot_interval * 1000L);
+		}
+
+		if (next_snapshot < wakeup)
+			wakeup = next_snapshot;
+	}
+
+	TimestampDifference(now, wakeup, &secs, &usecs);
+
+	return secs * 1000L + usecs / 1000 + 1;
+}
+
+/*
+ * Check that we're being called in a way that allows to return a
+ * materialized set of natts columns, and set that up.
+ */
+static Tuplestorestate *
+bdr_count_begin_srf(FunctionCallInfo fcinfo, int natts, TupleDesc *tupdesc)
 {
 	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
-	TupleDesc	tupdesc;
 	Tuplestorestate *tupstore;
 	MemoryContext per_query_ctx;
 	MemoryContext oldcontext;
-	size_t		current_offset;
-
-	if (!superuser())
-		ereport(ERROR,
-				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
-				 errmsg("Access to pg_stat_get_bdr() denied as non-superuser")));
 
 	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
 		ereport(ERROR,
@@ -310,10 +1075,10 @@ pg_stat_get_bdr(PG_FUNCTION_ARGS)
 		ereport(ERROR,
 				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
 				 errmsg("materialize mode required, but it is not allowed in this context")));
-	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+	if (get_call_result_type(fcinfo, NULL, tupdesc) != TYPEFUNC_COMPOSITE)
 		elog(ERROR, "return type must be a row type");
 
-	if (tupdesc->natts != BDR_COUNT_STAT_COLS)
+	if ((*tupdesc)->natts != natts)
 		elog(ERROR, "wrong function definition");
 
 	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
@@ -322,49 +1087,379 @@ pg_stat_get_bdr(PG_FUNCTION_ARGS)
 	tupstore = tuplestore_begin_heap(true, false, work_mem);
 	rsinfo->returnMode = SFRM_Materialize;
 	rsinfo->setResult = tupstore;
-	rsinfo->setDesc = tupdesc;
+	rsinfo->setDesc = *tupdesc;
 
 	MemoryContextSwitchTo(oldcontext);
 
-	/* don't let a node get created/vanish below us */
-	LWLockAcquire(BdrCountCtl->lock, LW_SHARED);
+	return tupstore;
+}
+
+Datum
+pg_stat_get_bdr(PG_FUNCTION_ARGS)
+{
+	TupleDesc	tupdesc;
+	Tuplestorestate *tupstore;
+	size_t		current_offset;
+
+	if (!superuser())
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+				 errmsg("Access to pg_stat_get_bdr() denied as non-superuser")));
+
+	tupstore = bdr_count_begin_srf(fcinfo, BDR_COUNT_STAT_COLS, &tupdesc);
 
 	for (current_offset = 0; current_offset < bdr_count_nnodes;
 		 current_offset++)
 	{
-		BdrCountSlot *slot;
+		BdrCountSlot slot;
 		char	   *riname;
 		Datum		values[BDR_COUNT_STAT_COLS];
 		bool		nulls[BDR_COUNT_STAT_COLS];
 
-		slot = &BdrCountCtl->slots[current_offset];
+		bdr_count_read_slot(&BdrCountCtl->slots[current_offset], &slot);
 
 		/* no stats here */
-		if (slot->node_id == InvalidRepNodeId)
+		if (slot.node_id == InvalidRepNodeId)
 			continue;
 
 		memset(values, 0, sizeof(values));
 		memset(nulls, 0, sizeof(nulls));
 
-		GetReplicationInfoByIdentifier(slot->node_id, false, &riname);
+		GetReplicationInfoByIdentifier(slot.node_id, false, &riname);
 
-		values[ 0] = ObjectIdGetDatum(slot->node_id);
-		values[ 1] = ObjectIdGetDatum(slot->node_id);
+		values[ 0] = ObjectIdGetDatum(slot.node_id);
+		values[ 1] = ObjectIdGetDatum(slot.node_id);
 		values[ 2] = CStringGetTextDatum(riname);
-		values[ 3] = Int64GetDatumFast(slot->nr_commit);
-		values[ 4] = Int64GetDatumFast(slot->nr_rollback);
-		values[ 5] = Int64GetDatumFast(slot->nr_insert);
-		values[ 6] = Int64GetDatumFast(slot->nr_insert_conflict);
-		values[ 7] = Int64GetDatumFast(slot->nr_update);
-		values[ 8] = Int64GetDatumFast(slot->nr_update_conflict);
-		values[ 9] = Int64GetDatumFast(slot->nr_delete);
-		values[10] = Int64GetDatumFast(slot->nr_delete_conflict);
-		values[11] = Int64GetDatumFast(slot->nr_disconnect);
+		values[ 3] = Int64GetDatumFast(slot.in.nr_commit);
+		values[ 4] = Int64GetDatumFast(slot.in.nr_rollback);
+		values[ 5] = Int64GetDatumFast(slot.in.nr_insert);
+		values[ 6] = Int64GetDatumFast(slot.in.nr_insert_conflict);
+		values[ 7] = Int64GetDatumFast(slot.in.nr_update);
+		values[ 8] = Int64GetDatumFast(slot.in.nr_update_conflict);
+		values[ 9] = Int64GetDatumFast(slot.in.nr_delete);
+		values[10] = Int64GetDatumFast(slot.in.nr_delete_conflict);
+		values[11] = Int64GetDatumFast(slot.nr_disconnect);
+
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+
+	tuplestore_donestoring(tupstore);
+
+	return (Datum) 0;
+}
+
+/*
+ * Fill values with the counters shared between nodes and relations, in the
+ * column order of bdr_get_apply_stats() and bdr_get_relation_stats().
+ */
+static int
+bdr_count_counters_values(BdrCountCounters *counters, Datum *values)
+{
+	int			i = 0;
+	int			type;
+
+	values[i++] = Int64GetDatum(counters->nr_insert);
+	values[i++] = Int64GetDatum(counters->nr_update);
+	values[i++] = Int64GetDatum(counters->nr_delete);
+	values[i++] = Int64GetDatum(counters->nr_insert_conflict);
+	values[i++] = Int64GetDatum(counters->nr_update_conflict);
+	values[i++] = Int64GetDatum(counters->nr_delete_conflict);
+	for (type = 0; type < BDR_COUNT_CONFLICT_TYPES; type++)
+		values[i++] = Int64GetDatum(counters->nr_conflict[type]);
+	values[i++] = Int64GetDatum(counters->nr_bytes_in);
+	values[i++] = Float8GetDatum(counters->apply_time_us / 1000.0);
+
+	return i;
+}
+
+/*
+ * Return replication statistics for each peer node, without blocking the
+ * processes maintaining them.
+ */
+Datum
+bdr_get_apply_stats(PG_FUNCTION_ARGS)
+{
+	TupleDesc	tupdesc;
+	Tuplestorestate *tupstore;
+	size_t		off;
+
+	tupstore = bdr_count_begin_srf(fcinfo, BDR_COUNT_APPLY_STAT_COLS,
+								   &tupdesc);
+
+	for (off = 0; off < bdr_count_nnodes; off++)
+	{
+		BdrCountSlot slot;
+		char	   *riname;
+		Datum		values[BDR_COUNT_APPLY_STAT_COLS];
+		bool		nulls[BDR_COUNT_APPLY_STAT_COLS];
+		int			i = 0;
+
+		bdr_count_read_slot(&BdrCountCtl->slots[off], &slot);
+
+		/* no stats here */
+		if (slot.node_id == InvalidRepNodeId)
+			continue;
+
+		memset(nulls, 0, sizeof(nulls));
+
+		GetReplicationInfoByIdentifier(slot.node_id, false, &riname);
+
+		values[i++] = ObjectIdGetDatum(slot.node_id);
+		values[i++] = CStringGetTextDatum(riname);
+		values[i++] = Int64GetDatum(slot.in.nr_commit);
+		values[i++] = Int64GetDatum(slot.in.nr_rollback);
+		i += bdr_count_counters_values(&slot.in, &values[i]);
+		values[i++] = Int64GetDatum(slot.nr_disconnect);
+		values[i++] = Int64GetDatum(slot.nr_xact_out);
+		values[i++] = Int64GetDatum(slot.nr_bytes_out);
+		Assert(i == BDR_COUNT_APPLY_STAT_COLS);
 
 		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
 	}
+
+	tuplestore_donestoring(tupstore);
+
+	return (Datum) 0;
+}
+
+/*
+ * Return statistics of changes replayed to relations of the current
+ * database, by relation and peer node. Only creating new entries is
+ * blocked while this runs, not counting.
+ */
+Datum
+bdr_get_relation_stats(PG_FUNCTION_ARGS)
+{
+	TupleDesc	tupdesc;
+	Tuplestorestate *tupstore;
+	HASH_SEQ_STATUS status;
+	BdrCountRelation *entry;
+
+	tupstore = bdr_count_begin_srf(fcinfo, BDR_COUNT_RELATION_STAT_COLS,
+								   &tupdesc);
+
+	LWLockAcquire(BdrCountCtl->lock, LW_SHARED);
+
+	hash_seq_init(&status, BdrCountRelationHash);
+	while ((entry = hash_seq_search(&status)) != NULL)
+	{
+		BdrCountCounters counters;
+		Datum		values[BDR_COUNT_RELATION_STAT_COLS];
+		bool		nulls[BDR_COUNT_RELATION_STAT_COLS];
+		int			i = 0;
+
+		if (entry->key.dboid != MyDatabaseId)
+			continue;
+
+		bdr_count_read(&entry->changecount, &entry->counters, &counters,
+					   sizeof(BdrCountCounters));
+
+		memset(nulls, 0, sizeof(nulls));
+
+		values[i++] = ObjectIdGetDatum(entry->key.node_id);
+		values[i++] = ObjectIdGetDatum(entry->key.relid);
+		i += bdr_count_counters_values(&counters, &values[i]);
+		Assert(i == BDR_COUNT_RELATION_STAT_COLS);
+
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+
+	LWLockRelease(BdrCountCtl->lock);
+
+	tuplestore_donestoring(tupstore);
+
+	return (Datum) 0;
+}
+
+/*
+ * Return, for each peer node, the rates at which changes were replayed from
+ * and sent to it in the window ending now. The window starts at the newest
+ * snapshot taken at least window ago, or at the oldest one if there's no
+ * such snapshot yet. Returns nothing before the first snapshot.
+ */
+Datum
+bdr_get_apply_rates(PG_FUNCTION_ARGS)
+{
+	Interval   *window = PG_GETARG_INTERVAL_P(0);
+	TupleDesc	tupdesc;
+	Tuplestorestate *tupstore;
+	BdrCountRing *ring = &BdrCountCtl->ring;
+	BdrCountSlot *base;
+	TimestampTz now;
+	TimestampTz start;
+	TimestampTz window_start = 0;
+	long		secs;
+	int			usecs;
+	double		elapsed;
+	size_t		off;
+	int			k;
+
+	if (window->time < 0 || window->day < 0 || window->month < 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("window must not be negative")));
+
+	tupstore = bdr_count_begin_srf(fcinfo, BDR_COUNT_RATE_COLS, &tupdesc);
+
+	now = GetCurrentTimestamp();
+	start = DatumGetTimestampTz(DirectFunctionCall2(timestamptz_mi_interval,
+													TimestampTzGetDatum(now),
+													IntervalPGetDatum(window)));
+
+	base = palloc0(sizeof(BdrCountSlot) * bdr_count_nnodes);
+
+	LWLockAcquire(BdrCountCtl->lock, LW_SHARED);
+	for (k = 0; k < ring->count; k++)
+	{
+		int			snap;
+
+		snap = (ring->next - 1 - k + BDR_COUNT_SNAPSHOTS) % BDR_COUNT_SNAPSHOTS;
+
+		if (ring->time[snap] <= start || k == ring->count - 1)
+		{
+			window_start = ring->time[snap];
+			memcpy(base, BdrCountSnapshotSlots(snap),
+				   sizeof(BdrCountSlot) * bdr_count_nnodes);
+			break;
+		}
+	}
 	LWLockRelease(BdrCountCtl->lock);
 
+	if (window_start == 0)
+		goto out;
+
+	TimestampDifference(window_start, now, &secs, &usecs);
+	elapsed = secs + usecs / 1000000.0;
+	if (elapsed <= 0)
+		goto out;
+
+	for (off = 0; off < bdr_count_nnodes; off++)
+	{
+		BdrCountSlot slot;
+		BdrCountSlot *prev = &base[off];
+		char	   *riname;
+		Datum		values[BDR_COUNT_RATE_COLS];
+		bool		nulls[BDR_COUNT_RATE_COLS];
+		int64		conflicts = 0;
+		int			type;
+		int			i = 0;
+
+		bdr_count_read_slot(&BdrCountCtl->slots[off], &slot);
+
+		/* no stats here */
+		if (slot.node_id == InvalidRepNodeId)
+			continue;
+
+		/* the slot was assigned after the snapshot, everything is new */
+		if (prev->node_id != slot.node_id)
+			memset(prev, 0, sizeof(BdrCountSlot));
+
+		for (type = 0; type < BDR_COUNT_CONFLICT_TYPES; type++)
+			conflicts += slot.in.nr_conflict[type] - prev->in.nr_conflict[type];
+
+		memset(nulls, 0, sizeof(nulls));
+
+		GetReplicationInfoByIdentifier(slot.node_id, false, &riname);
+
+#define BDR_COUNT_RATE(delta) Float8GetDatum(Max(delta, 0) / elapsed)
+		values[i++] = ObjectIdGetDatum(slot.node_id);
+		values[i++] = CStringGetTextDatum(riname);
+		values[i++] = TimestampTzGetDatum(window_start);
+		values[i++] = TimestampTzGetDatum(now);
+		values[i++] = BDR_COUNT_RATE(slot.in.nr_commit - prev->in.nr_commit);
+		values[i++] = BDR_COUNT_RATE(slot.in.nr_rollback - prev->in.nr_rollback);
+		values[i++] = BDR_COUNT_RATE(slot.in.nr_insert - prev->in.nr_insert);
+		values[i++] = BDR_COUNT_RATE(slot.in.nr_update - prev->in.nr_update);
+		values[i++] = BDR_COUNT_RATE(slot.in.nr_delete - prev->in.nr_delete);
+		values[i++] = BDR_COUNT_RATE(conflicts);
+		values[i++] = BDR_COUNT_RATE(slot.in.nr_bytes_in - prev->in.nr_bytes_in);
+		values[i++] = BDR_COUNT_RATE(slot.nr_xact_out - prev->nr_xact_out);
+		values[i++] = BDR_COUNT_RATE(slot.nr_bytes_out - prev->nr_bytes_out);
+		/* microseconds spent applying per second, as a fraction */
+		values[i++] = Float8GetDatum(Max(slot.in.apply_time_us -
+										 prev->in.apply_time_us, 0)
+									 / (elapsed * 1000000.0));
+#undef BDR_COUNT_RATE
+		Assert(i == BDR_COUNT_RATE_COLS);
+
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+
+out:
+	pfree(base);
+	tuplestore_donestoring(tupstore);
+
+	return (Datum) 0;
+}
+
+/*
+ * Return, for each peer node, how far replay from it is behind in time.
+ */
+Datum
+bdr_get_replication_lag(PG_FUNCTION_ARGS)
+{
+	TupleDesc	tupdesc;
+	Tuplestorestate *tupstore;
+	size_t		off;
+
+	tupstore = bdr_count_begin_srf(fcinfo, BDR_COUNT_LAG_COLS, &tupdesc);
+
+	for (off = 0; off < bdr_count_nnodes; off++)
+	{
+		BdrCountSlot slot;
+		char	   *riname;
+		Datum		values[BDR_COUNT_LAG_COLS];
+		bool		nulls[BDR_COUNT_LAG_COLS];
+		Datum		buckets[BDR_COUNT_LAG_BUCKETS];
+		int			i;
+
+		bdr_count_read_slot(&BdrCountCtl->slots[off], &slot);
+
+		/* no stats here */
+		if (slot.node_id == InvalidRepNodeId)
+			continue;
+
+		memset(nulls, 0, sizeof(nulls));
+
+		GetReplicationInfoByIdentifier(slot.node_id, false, &riname);
+
+		for (i = 0; i < BDR_COUNT_LAG_BUCKETS; i++)
+			buckets[i] = Int64GetDatum(slot.lag.buckets[i]);
+
+		values[0] = ObjectIdGetDatum(slot.node_id);
+		values[1] = CStringGetTextDatum(riname);
+
+		/* nothing replayed yet */
+		if (slot.lag.last_apply_time == 0)
+		{
+			nulls[2] = nulls[3] = nulls[4] = true;
+		}
+		else
+		{
+			values[2] = TimestampTzGetDatum(slot.lag.last_remote_time);
+			values[3] = TimestampTzGetDatum(slot.lag.last_apply_time);
+			values[4] = Float8GetDatum(slot.lag.current_us / 1000.0);
+		}
+
+		/* heartbeats only set the current lag */
+		if (slot.lag.nr_commits == 0)
+		{
+			nulls[5] = nulls[6] = true;
+		}
+		else
+		{
+			values[5] = Float8GetDatum(slot.lag.avg_us / 1000.0);
+			values[6] = Float8GetDatum(slot.lag.max_us / 1000.0);
+		}
+		values[7] = Int64GetDatum(slot.lag.nr_commits);
+		values[8] = PointerGetDatum(construct_array(buckets,
+													BDR_COUNT_LAG_BUCKETS,
+													INT8OID, 8,
+													FLOAT8PASSBYVAL, 'd'));
+
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+
 	tuplestore_donestoring(tupstore);
 
 	return (Datum) 0;
@@ -372,6 +1467,9 @@ pg_stat_get_bdr(PG_FUNCTION_ARGS)
 
 /*
  * Write the BDR stats from shared memory to a file
+ *
+ * The live slots are copied without blocking their writers. Only the
+ * supervisor and, once it's gone at shutdown, the postmaster write the file.
  */
 static void
 bdr_count_serialize(void)
@@ -380,9 +1478,21 @@ bdr_count_serialize(void)
 	const char *tpath = "global/bdr.stat.tmp";
 	const char *path = "global/bdr.stat";
 	BdrCountSerialize serial;
+	BdrCountRing ring;
+	BdrCountSlot *slots;
+	Size		nslots = bdr_count_nnodes * (1 + BDR_COUNT_SNAPSHOTS);
 	Size		write_size;
+	size_t		i;
 
-	LWLockAcquire(BdrCountCtl->lock, LW_EXCLUSIVE);
+	slots = palloc0(sizeof(BdrCountSlot) * nslots);
+	for (i = 0; i < bdr_count_nnodes; i++)
+		bdr_count_read_slot(&BdrCountCtl->slots[i], &slots[i]);
+
+	LWLockAcquire(BdrCountCtl->lock, LW_SHARED);
+	memcpy(&ring, &BdrCountCtl->ring, sizeof(BdrCountRing));
+	memcpy(&slots[bdr_count_nnodes], BdrCountSnapshotSlots(0),
+		   sizeof(BdrCountSlot) * bdr_count_nnodes * BDR_COUNT_SNAPSHOTS);
+	LWLockRelease(BdrCountCtl->lock);
 
 	if (unlink(tpath) < 0 && errno != ENOENT)
 		ereport(ERROR,
@@ -415,9 +1525,22 @@ bdr_count_serialize(void)
 						tpath)));
 	}
 
-	/* write data */
-	write_size = sizeof(BdrCountSlot) * bdr_count_nnodes;
-	if ((write(fd, &BdrCountCtl->slots, write_size)) != write_size)
+	/* write the ring, then the live and snapshotted slots */
+	write_size = sizeof(ring);
+	if ((write(fd, &ring, write_size)) != write_size)
+	{
+		int		save_errno = errno;
+
+		CloseTransientFile(fd);
+		errno = save_errno;
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not write bdr stat file data \"%s\": %m",
+						tpath)));
+	}
+
+	write_size = sizeof(BdrCountSlot) * nslots;
+	if ((write(fd, slots, write_size)) != write_size)
 	{
 		int		save_errno = errno;
 
@@ -437,7 +1560,8 @@ bdr_count_serialize(void)
 				(errcode_for_file_access(),
 				 errmsg("could not rename bdr stat file \"%s\" to \"%s\": %m",
 						tpath, path)));
-	LWLockRelease(BdrCountCtl->lock);
+
+	pfree(slots);
 }
 
 /*
@@ -450,6 +1574,7 @@ bdr_count_unserialize(void)
 	const char *path = "global/bdr.stat";
 	BdrCountSerialize serial;
 	ssize_t		read_size;
+	int			snap;
 
 	if (BdrCountCtl == NULL)
 		elog(ERROR, "cannot use bdr statistics function without loading bdr");
@@ -504,11 +1629,32 @@ bdr_count_unserialize(void)
 	}
 
 	/* read actual data, directly into shmem */
+	read_size = sizeof(BdrCountRing);
+	if (read(fd, &BdrCountCtl->ring, read_size) != read_size)
+		goto read_error;
+
 	read_size = sizeof(BdrCountSlot) * serial.nr_slots;
 	if (read(fd, &BdrCountCtl->slots, read_size) != read_size)
+		goto read_error;
+
+	/* snapshots are stored nr_slots at a time, and we may have more */
+	for (snap = 0; snap < BDR_COUNT_SNAPSHOTS; snap++)
+	{
+		if (read(fd, BdrCountSnapshotSlots(snap), read_size) != read_size)
+			goto read_error;
+	}
+
+out:
+	if (fd >= 0)
+		CloseTransientFile(fd);
+	LWLockRelease(BdrCountCtl->lock);
+	return;
+
+read_error:
 	{
 		int saved_errno = errno;
 		CloseTransientFile(fd);
+		LWLockRelease(BdrCountCtl->lock);
 		errno = saved_errno;
 		ereport(ERROR,
 				(errcode_for_file_access(),
@@ -516,12 +1662,6 @@ bdr_count_unserialize(void)
 						path)));
 	}
 
-out:
-	if (fd >= 0)
-		CloseTransientFile(fd);
-	LWLockRelease(BdrCountCtl->lock);
-	return;
-
 zero_file:
 	CloseTransientFile(fd);
 	LWLockRelease(BdrCountCtl->lock);
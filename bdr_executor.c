@@ -775,6 +775,7 @@ BdrExecutorStart(QueryDesc *queryDesc, int eflags)
 	bool		performs_writes = false;
 	ListCell   *l;
 	List	   *rangeTable = queryDesc->plannedstmt->rtable;
+	List	   *written_relids = NIL;
 
 	if (bdr_always_allow_writes)
 		goto done;
@@ -792,8 +793,17 @@ BdrExecutorStart(QueryDesc *queryDesc, int eflags)
 	if (!bdr_is_bdr_activated_db(MyDatabaseId))
 		goto done;
 
-	/* check for concurrent global DDL locks */
-	bdr_locks_check_dml();
+	/* check for concurrent global DDL locks on the relations we write to */
+	foreach(l, queryDesc->plannedstmt->resultRelations)
+	{
+		RangeTblEntry  *rte = rt_fetch(lfirst_int(l), rangeTable);
+
+		written_relids = lappend_oid(written_relids, rte->relid);
+	}
+	bdr_locks_check_dml(written_relids);
+
+	/* delay the commit if a peer is too far behind */
+	bdr_backpressure_note_write();
 
 	/* plain INSERTs are always ok beyond this point */
 	if (queryDesc->operation == CMD_INSERT &&
@@ -23,6 +23,7 @@
 #include "miscadmin.h"
 
 #include "access/timeline.h"
+#include "access/xlog_internal.h"
 
 #include <dirent.h>
 #include <fcntl.h>
@@ -31,6 +32,7 @@
 #include <time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 #include "bdr_config.h"
@@ -71,11 +73,17 @@ static char		   *data_dir = NULL;
 static char			pid_file[MAXPGPATH];
 static time_t		start_time;
 static VerbosityLevelEnum	verbosity = VERBOSITY_NORMAL;
+static bool			incremental = false;
 
 /* defined as static so that die() can close them */
 static PGconn		*local_conn = NULL;
 static PGconn		*remote_conn = NULL;
 
+/* likewise for the backup and WAL streaming of an incremental copy */
+static PGconn		*backup_conn = NULL;
+static bool			backup_started = false;
+static pid_t		receivexlog_pid = 0;
+
 static void signal_handler(int sig);
 static void usage(void);
 static void die(const char *fmt,...)
@@ -85,6 +93,8 @@ __attribute__((format(PG_PRINTF_ATTRIBUTE, 2, 3)));
 
 static int run_pg_ctl(const char *arg);
 static void run_basebackup(const char *remote_connstr, const char *data_dir);
+static void run_incremental_copy(const char *remote_connstr, const char *data_dir,
+								 TimeLineID tli);
 static void wait_postmaster_connection(const char *connstr);
 static void wait_postmaster_shutdown(void);
 
@@ -100,7 +110,7 @@ static void bdr_node_start(PGconn *conn, char *node_name, char *remote_connstr,
 
 static RemoteInfo *get_remote_info(char* connstr);
 
-static void initialize_data_dir(char *data_dir, char *connstr,
+static void initialize_data_dir(char *data_dir, char *connstr, TimeLineID tli,
 					char *postgresql_conf, char *pg_hba_conf);
 
 static uint64 GenerateSystemIdentifier(void);
@@ -192,6 +202,7 @@ main(int argc, char **argv)
 		{"postgresql-conf", required_argument, NULL, 6},
 		{"hba-conf", required_argument, NULL, 7},
 		{"recovery-conf", required_argument, NULL, 8},
+		{"incremental", no_argument, NULL, 9},
 		{"stop", no_argument, NULL, 's'},
 		{NULL, 0, NULL, 0}
 	};
@@ -273,6 +284,9 @@ main(int argc, char **argv)
 						die(_("The specified recovery.conf file does not exist."));
 					break;
 				}
+			case 9:
+				incremental = true;
+				break;
 			case 's':
 				stop = true;
 				break;
@@ -374,7 +388,8 @@ main(int argc, char **argv)
 	/*
 	 * Create basebackup or use existing one
 	 */
-	initialize_data_dir(data_dir, remote_connstr, postgresql_conf, pg_hba_conf);
+	initialize_data_dir(data_dir, remote_connstr, remote_info->tlid,
+						postgresql_conf, pg_hba_conf);
 	snprintf(pid_file, MAXPGPATH, "%s/postmaster.pid", data_dir);
 
 	/*
@@ -505,6 +520,9 @@ usage(void)
 	printf(_("                         can be either empty/non-existing directory,\n"));
 	printf(_("                         or directory populated using pg_basebackup -X stream\n"));
 	printf(_("                         command\n"));
+	printf(_("  --incremental          bring an existing, outdated copy of the remote\n"));
+	printf(_("                         node in the data directory up to date, copying\n"));
+	printf(_("                         only what differs\n"));
 	printf(_("  -s, --stop             stop the server once the initialization is done\n"));
 	printf(_("  --postgresql-conf      path to the new postgresql.conf\n"));
 	printf(_("  --hba-conf             path to the new pg_hba.conf\n"));
@@ -539,6 +557,15 @@ die(const char *fmt,...)
 	if (remote_conn)
 		PQfinish(remote_conn);
 
+	if (receivexlog_pid > 0)
+		kill(receivexlog_pid, SIGINT);
+	if (backup_conn)
+	{
+		if (backup_started)
+			PQclear(PQexec(backup_conn, "SELECT pg_catalog.pg_stop_backup()"));
+		PQfinish(backup_conn);
+	}
+
 	if (get_pgpid())
 		run_pg_ctl("stop -s");
 
@@ -612,6 +639,891 @@ run_basebackup(const char *remote_connstr, const char *data_dir)
 		die(_("pg_basebackup failed, cannot continue.\n"));
 }
 
+/*
+ * Incremental copy of the remote node into an existing data directory.
+ *
+ * This is what pg_basebackup -X stream does, but files the local data
+ * directory already has are compared with the remote ones chunk by chunk and
+ * only the chunks that differ are fetched. A node that was copied before and
+ * has fallen behind, or was detached and is rejoined, only transfers what
+ * changed since.
+ *
+ * The chunks are compared by md5, computed on the remote node by reading the
+ * file with pg_read_binary_file() and locally by md5_hex(). Page LSNs can't
+ * tell what changed, the local node's WAL isn't the remote node's.
+ *
+ * Files keep changing while they're copied, as with any base backup: the
+ * remote node is in backup mode for the duration, and the WAL written
+ * meanwhile is streamed into pg_xlog by pg_receivexlog so that recovery can
+ * make the copy consistent again.
+ */
+
+/* unit in which file contents are compared and copied */
+#define INCR_CHUNK_SIZE		(8 * BLCKSZ)
+/* most data fetched from the remote node with one query */
+#define INCR_FETCH_SIZE		(128 * INCR_CHUNK_SIZE)
+
+typedef struct IncrFile
+{
+	char	   *path;		/* relative to the data directory */
+	int64		size;
+	bool		isdir;
+} IncrFile;
+
+typedef struct IncrFileList
+{
+	IncrFile   *files;
+	int			nfiles;
+	int			maxfiles;
+} IncrFileList;
+
+/*
+ * Directories whose contents aren't copied, but emptied. pg_xlog gets the
+ * WAL streamed by pg_receivexlog instead.
+ */
+static const char *const incr_excluded_dirs[] = {
+	"pg_xlog", "pg_replslot", "pg_stat_tmp", NULL
+};
+
+/* files that aren't copied at all */
+static const char *const incr_excluded_files[] = {
+	"postmaster.pid", "postmaster.opts", NULL
+};
+
+static int64 incr_bytes_compared = 0;
+static int64 incr_bytes_copied = 0;
+
+/*
+ * Minimal MD5 (RFC 1321), so that file chunks can be hashed locally the same
+ * way the remote node's md5() function does.
+ */
+#define MD5_ROTL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+static const uint32 md5_k[64] = {
+	0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a,
+	0xa8304613, 0xfd469501, 0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+	0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821, 0xf61e2562, 0xc040b340,
+	0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+	0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8,
+	0x676f02d9, 0x8d2a4c8a, 0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+	0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70, 0x289b7ec6, 0xeaa127fa,
+	0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+	0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92,
+	0xffeff47d, 0x85845dd1, 0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+	0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+};
+
+static const int md5_r[64] = {
+	7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+	5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20,
+	4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+	6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21
+};
+
+static void
+md5_block(uint32 *state, const unsigned char *p)
+{
+	uint32		w[16];
+	uint32		a = state[0],
+				b = state[1],
+				c = state[2],
+				d = state[3];
+	int			i;
+
+	for (i = 0; i < 16; i++)
+		w[i] = (uint32) p[i * 4] | ((uint32) p[i * 4 + 1] << 8) |
+			((uint32) p[i * 4 + 2] << 16) | ((uint32) p[i * 4 + 3] << 24);
+
+	for (i = 0; i < 64; i++)
+	{
+		uint32		f;
+		int			g;
+		uint32		tmp;
+
+		if (i < 16)
+		{
+			f = (b & c) | (~b & d);
+			g = i;
+		}
+		else if (i < 32)
+		{
+			f = (d & b) | (~d & c);
+			g = (5 * i + 1) % 16;
+		}
+		else if (i < 48)
+		{
+			f = b ^ c ^ d;
+			g = (3 * i + 5) % 16;
+		}
+		else
+		{
+			f = c ^ (b | ~d);
+			g = (7 * i) % 16;
+		}
+
+		tmp = d;
+		d = c;
+		c = b;
+		b = b + MD5_ROTL(a + f + md5_k[i] + w[g], md5_r[i]);
+		a = tmp;
+	}
+
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+}
+
+/*
+ * Compute the md5 of len bytes at data as 32 hex digits into hex, which
+ * must have room for 33 bytes.
+ */
+static void
+md5_hex(const unsigned char *data, size_t len, char *hex)
+{
+	uint32		state[4] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476};
+	uint64		bits = (uint64) len * 8;
+	unsigned char tail[128];
+	size_t		ntail;
+	size_t		i;
+
+	for (i = 0; i + 64 <= len; i += 64)
+		md5_block(state, data + i);
+
+	/* pad the rest with 0x80, zeroes and the length in bits */
+	ntail = len - i;
+	memset(tail, 0, sizeof(tail));
+	memcpy(tail, data + i, ntail);
+	tail[ntail] = 0x80;
+	ntail = (ntail < 56) ? 64 : 128;
+	for (i = 0; i < 8; i++)
+		tail[ntail - 8 + i] = (unsigned char) (bits >> (i * 8));
+
+	md5_block(state, tail);
+	if (ntail == 128)
+		md5_block(state, tail + 64);
+
+	for (i = 0; i < 16; i++)
+		sprintf(hex + i * 2, "%02x",
+				(unsigned int) ((state[i / 4] >> ((i % 4) * 8)) & 0xff));
+}
+
+/*
+ * Is the path, relative to the data directory, left out of the copy?
+ */
+static bool
+incr_path_excluded(const char *path)
+{
+	int			i;
+
+	for (i = 0; incr_excluded_dirs[i] != NULL; i++)
+	{
+		size_t		len = strlen(incr_excluded_dirs[i]);
+
+		if (strncmp(path, incr_excluded_dirs[i], len) == 0 && path[len] == '/')
+			return true;
+	}
+
+	for (i = 0; incr_excluded_files[i] != NULL; i++)
+	{
+		if (strcmp(path, incr_excluded_files[i]) == 0)
+			return true;
+	}
+
+	return false;
+}
+
+static void
+incr_list_append(IncrFileList *list, const char *path, int64 size, bool isdir)
+{
+	IncrFile   *file;
+
+	if (list->nfiles == list->maxfiles)
+	{
+		list->maxfiles = Max(list->maxfiles * 2, 1024);
+		list->files = pg_realloc(list->files, list->maxfiles * sizeof(IncrFile));
+	}
+
+	file = &list->files[list->nfiles++];
+	file->path = pg_strdup(path);
+	file->size = size;
+	file->isdir = isdir;
+}
+
+static int
+incr_file_cmp(const void *a, const void *b)
+{
+	return strcmp(((const IncrFile *) a)->path, ((const IncrFile *) b)->path);
+}
+
+/*
+ * Remove a file, symlink or directory tree, relative to the data directory.
+ * Tablespace symlinks are removed, not what they point to. Paths below a
+ * directory that was removed already are fine.
+ */
+static void
+incr_remove(const char *path)
+{
+	char		fullpath[MAXPGPATH];
+	struct stat statbuf;
+
+	snprintf(fullpath, MAXPGPATH, "%s/%s", data_dir, path);
+
+	if (lstat(fullpath, &statbuf) != 0)
+	{
+		if (errno == ENOENT)
+			return;
+		die(_("Could not stat file \"%s\": %s\n"), fullpath, strerror(errno));
+	}
+
+	if (S_ISDIR(statbuf.st_mode))
+	{
+		if (!rmtree(fullpath, true))
+			die(_("Could not remove directory \"%s\".\n"), fullpath);
+	}
+	else if (unlink(fullpath) != 0 && errno != ENOENT)
+		die(_("Could not remove file \"%s\": %s\n"), fullpath, strerror(errno));
+}
+
+/*
+ * Remove everything in a directory relative to the data directory, creating
+ * it if it doesn't exist.
+ */
+static void
+incr_empty_dir(const char *path)
+{
+	char		fullpath[MAXPGPATH];
+	DIR		   *dir;
+	struct dirent *de;
+
+	snprintf(fullpath, MAXPGPATH, "%s/%s", data_dir, path);
+
+	dir = opendir(fullpath);
+	if (dir == NULL)
+	{
+		if (errno != ENOENT)
+			die(_("Could not open directory \"%s\": %s\n"),
+				fullpath, strerror(errno));
+		if (mkdir(fullpath, S_IRWXU) != 0)
+			die(_("Could not create directory \"%s\": %s\n"),
+				fullpath, strerror(errno));
+		return;
+	}
+
+	while (errno = 0, (de = readdir(dir)) != NULL)
+	{
+		char		entry[MAXPGPATH];
+
+		if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+			continue;
+
+		snprintf(entry, MAXPGPATH, "%s/%s", path, de->d_name);
+		incr_remove(entry);
+	}
+
+	if (errno)
+		die(_("Could not read directory \"%s\": %s\n"),
+			fullpath, strerror(errno));
+
+	closedir(dir);
+}
+
+/*
+ * Add the files below the directory path, relative to the data directory, to
+ * the list. NULL is the data directory itself.
+ */
+static void
+incr_list_local(const char *path, IncrFileList *list)
+{
+	char		fullpath[MAXPGPATH];
+	DIR		   *dir;
+	struct dirent *de;
+
+	if (path)
+		snprintf(fullpath, MAXPGPATH, "%s/%s", data_dir, path);
+	else
+		strlcpy(fullpath, data_dir, MAXPGPATH);
+
+	dir = opendir(fullpath);
+	if (dir == NULL)
+		die(_("Could not open directory \"%s\": %s\n"),
+			fullpath, strerror(errno));
+
+	while (errno = 0, (de = readdir(dir)) != NULL)
+	{
+		char		entry[MAXPGPATH];
+		char		fullentry[MAXPGPATH];
+		struct stat statbuf;
+
+		if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+			continue;
+
+		if (path)
+			snprintf(entry, MAXPGPATH, "%s/%s", path, de->d_name);
+		else
+			strlcpy(entry, de->d_name, MAXPGPATH);
+
+		if (incr_path_excluded(entry))
+			continue;
+
+		/* follows tablespace symlinks, like pg_stat_file() does remotely */
+		snprintf(fullentry, MAXPGPATH, "%s/%s", data_dir, entry);
+		if (stat(fullentry, &statbuf) != 0)
+			die(_("Could not stat file \"%s\": %s\n"),
+				fullentry, strerror(errno));
+
+		incr_list_append(list, entry, statbuf.st_size,
+						 S_ISDIR(statbuf.st_mode));
+
+		if (S_ISDIR(statbuf.st_mode))
+			incr_list_local(entry, list);
+	}
+
+	if (errno)
+		die(_("Could not read directory \"%s\": %s\n"),
+			fullpath, strerror(errno));
+
+	closedir(dir);
+}
+
+/*
+ * List the files in the remote node's data directory, sorted by path.
+ *
+ * Files being removed while the directory is walked make the query fail, so
+ * retry a few times.
+ */
+static void
+incr_list_remote(PGconn *conn, IncrFileList *list)
+{
+	PGresult   *res = NULL;
+	int			attempt;
+	int			i;
+
+	for (attempt = 1;; attempt++)
+	{
+		res = PQexec(conn,
+					 "WITH RECURSIVE files (path, size, isdir) AS (\n"
+					 "    SELECT fn, this.size, this.isdir\n"
+					 "    FROM pg_catalog.pg_ls_dir('.') AS fn,\n"
+					 "         pg_catalog.pg_stat_file(fn) AS this\n"
+					 "  UNION ALL\n"
+					 "    SELECT parent.path || '/' || fn, this.size, this.isdir\n"
+					 "    FROM files AS parent,\n"
+					 "         pg_catalog.pg_ls_dir(parent.path) AS fn,\n"
+					 "         pg_catalog.pg_stat_file(parent.path || '/' || fn) AS this\n"
+					 "    WHERE parent.isdir\n"
+					 "      AND parent.path NOT IN ('pg_xlog', 'pg_replslot', 'pg_stat_tmp')\n"
+					 ")\n"
+					 "SELECT path, size, isdir FROM files ORDER BY path COLLATE \"C\"");
+
+		if (PQresultStatus(res) == PGRES_TUPLES_OK)
+			break;
+
+		if (attempt == 5)
+			die(_("Could not list files on remote node: %s\n"),
+				PQerrorMessage(conn));
+
+		print_msg(VERBOSITY_VERBOSE,
+				  _("Listing files on remote node failed, retrying: %s"),
+				  PQerrorMessage(conn));
+		PQclear(res);
+		pg_usleep(1000000);		/* 1 sec */
+	}
+
+	for (i = 0; i < PQntuples(res); i++)
+	{
+		char	   *path = PQgetvalue(res, i, 0);
+
+		if (incr_path_excluded(path))
+			continue;
+
+		incr_list_append(list, path,
+						 strtoll(PQgetvalue(res, i, 1), NULL, 10),
+						 strcmp(PQgetvalue(res, i, 2), "t") == 0);
+	}
+
+	PQclear(res);
+}
+
+/*
+ * Did the query fail because the remote file it read doesn't exist anymore?
+ * That's fine, the relation was dropped or truncated and WAL replay will
+ * take care of the local copy.
+ */
+static bool
+incr_file_vanished(PGresult *res)
+{
+	char	   *sqlstate = PQresultErrorField(res, PG_DIAG_SQLSTATE);
+
+	return sqlstate != NULL && strcmp(sqlstate, "58P01") == 0;
+}
+
+/*
+ * Copy len bytes at off of the remote file to the local one open as fd.
+ *
+ * Returns false if the remote file vanished.
+ */
+static bool
+incr_fetch_range(PGconn *conn, const char *path, int fd, int64 off, int64 len)
+{
+	while (len > 0)
+	{
+		int64		n = Min(len, INCR_FETCH_SIZE);
+		char		offstr[32];
+		char		lenstr[32];
+		const char *values[3];
+		PGresult   *res;
+		int			got;
+
+		snprintf(offstr, sizeof(offstr), INT64_FORMAT, off);
+		snprintf(lenstr, sizeof(lenstr), INT64_FORMAT, n);
+		values[0] = path;
+		values[1] = offstr;
+		values[2] = lenstr;
+
+		res = PQexecParams(conn,
+						   "SELECT pg_catalog.pg_read_binary_file($1, $2::pg_catalog.int8, $3::pg_catalog.int8)",
+						   3, NULL, values, NULL, NULL, 1);
+		if (PQresultStatus(res) != PGRES_TUPLES_OK)
+		{
+			if (incr_file_vanished(res))
+			{
+				PQclear(res);
+				return false;
+			}
+			die(_("Could not read file \"%s\" on remote node: %s\n"),
+				path, PQerrorMessage(conn));
+		}
+
+		got = PQgetlength(res, 0, 0);
+		if (lseek(fd, (off_t) off, SEEK_SET) < 0 ||
+			write(fd, PQgetvalue(res, 0, 0), got) != got)
+		{
+			/* if write didn't set errno, assume problem is no disk space */
+			if (errno == 0)
+				errno = ENOSPC;
+			die(_("Could not write to file \"%s\": %s\n"),
+				path, strerror(errno));
+		}
+		incr_bytes_copied += got;
+		PQclear(res);
+
+		/* the remote file shrank meanwhile, replay takes care of the rest */
+		if (got < n)
+			break;
+
+		off += n;
+		len -= n;
+	}
+
+	return true;
+}
+
+/*
+ * Compare the first len bytes of the remote file with the local one open as
+ * fd chunk by chunk, and fetch the chunks that differ.
+ *
+ * Returns false if the remote file vanished.
+ */
+static bool
+incr_sync_chunks(PGconn *conn, const char *path, int fd, int64 len)
+{
+	int64		nchunks = (len + INCR_CHUNK_SIZE - 1) / INCR_CHUNK_SIZE;
+	PQExpBuffer query = createPQExpBuffer();
+	const char *values[1];
+	PGresult   *res;
+	unsigned char *buf;
+	int64		run_start = -1;
+	int64		run_end = -1;
+	int64		i;
+
+	appendPQExpBuffer(query,
+					  "SELECT pg_catalog.md5(pg_catalog.pg_read_binary_file($1, i * %d, pg_catalog.least(%d, " INT64_FORMAT " - i * %d)))\n"
+					  "FROM pg_catalog.generate_series(0, " INT64_FORMAT "::pg_catalog.int8) i ORDER BY i",
+					  INCR_CHUNK_SIZE, INCR_CHUNK_SIZE, len, INCR_CHUNK_SIZE,
+					  nchunks - 1);
+	values[0] = path;
+
+	res = PQexecParams(conn, query->data, 1, NULL, values, NULL, NULL, 0);
+	destroyPQExpBuffer(query);
+
+	if (PQresultStatus(res) != PGRES_TUPLES_OK)
+	{
+		if (incr_file_vanished(res))
+		{
+			PQclear(res);
+			return false;
+		}
+		die(_("Could not checksum file \"%s\" on remote node: %s\n"),
+			path, PQerrorMessage(conn));
+	}
+
+	if (PQntuples(res) != nchunks)
+		die(_("Unexpected number of checksums for file \"%s\" from remote node.\n"),
+			path);
+
+	buf = pg_malloc(INCR_CHUNK_SIZE);
+
+	if (lseek(fd, 0, SEEK_SET) < 0)
+		die(_("Could not seek in file \"%s\": %s\n"), path, strerror(errno));
+
+	for (i = 0; i < nchunks; i++)
+	{
+		int64		off = i * INCR_CHUNK_SIZE;
+		int			n = (int) Min(INCR_CHUNK_SIZE, len - off);
+		char		hex[33];
+
+		if (read(fd, buf, n) != n)
+			die(_("Could not read file \"%s\": %s\n"), path, strerror(errno));
+		incr_bytes_compared += n;
+
+		md5_hex(buf, n, hex);
+		if (strcmp(hex, PQgetvalue(res, i, 0)) == 0)
+			continue;
+
+		/* copy runs of differing chunks at once */
+		if (run_end == off)
+		{
+			run_end = off + n;
+			continue;
+		}
+
+		if (run_start >= 0 &&
+			!incr_fetch_range(conn, path, fd, run_start, run_end - run_start))
+		{
+			PQclear(res);
+			pg_free(buf);
+			return false;
+		}
+
+		/* incr_fetch_range() moved the file position */
+		if (lseek(fd, (off_t) (off + n), SEEK_SET) < 0)
+			die(_("Could not seek in file \"%s\": %s\n"), path, strerror(errno));
+
+		run_start = off;
+		run_end = off + n;
+	}
+
+	PQclear(res);
+	pg_free(buf);
+
+	if (run_start >= 0)
+		return incr_fetch_range(conn, path, fd, run_start, run_end - run_start);
+
+	return true;
+}
+
+/*
+ * Make the local copy of the remote file identical to it. local_size is -1
+ * if there is no local copy yet.
+ */
+static void
+incr_sync_file(PGconn *conn, IncrFile *remote, int64 local_size)
+{
+	char		fullpath[MAXPGPATH];
+	int64		common = Min(remote->size, Max(local_size, 0));
+	int			fd;
+
+	snprintf(fullpath, MAXPGPATH, "%s/%s", data_dir, remote->path);
+
+	fd = open(fullpath, O_RDWR | O_CREAT | PG_BINARY, S_IRUSR | S_IWUSR);
+	if (fd < 0)
+		die(_("Could not open file \"%s\": %s\n"), fullpath, strerror(errno));
+
+	print_msg(VERBOSITY_DEBUG, _("Updating file \"%s\".\n"), remote->path);
+
+	if (common > 0 && !incr_sync_chunks(conn, remote->path, fd, common))
+	{
+		print_msg(VERBOSITY_VERBOSE,
+				  _("File \"%s\" was removed on remote node, skipped.\n"),
+				  remote->path);
+		close(fd);
+		return;
+	}
+
+	if (remote->size > common)
+		incr_fetch_range(conn, remote->path, fd, common, remote->size - common);
+	else if (local_size > remote->size &&
+			 ftruncate(fd, (off_t) remote->size) != 0)
+		die(_("Could not truncate file \"%s\": %s\n"),
+			fullpath, strerror(errno));
+
+	if (close(fd))
+		die(_("Could not close file \"%s\": %s\n"), fullpath, strerror(errno));
+}
+
+/*
+ * Start pg_receivexlog streaming the remote node's WAL into the local
+ * pg_xlog, and wait until it receives data, so that no WAL written after
+ * the backup starts can be missed.
+ */
+static void
+start_receivexlog(const char *remote_connstr)
+{
+	char	   *exec_path = find_other_exec_or_die(argv0, "pg_receivexlog", "pg_receivexlog (PostgreSQL) " PG_VERSION "\n");
+	char		xlogdir[MAXPGPATH];
+
+	snprintf(xlogdir, MAXPGPATH, "%s/pg_xlog", data_dir);
+
+	print_msg(VERBOSITY_DEBUG, _("Running pg_receivexlog: %s -D \"%s\".\n"),
+			  exec_path, xlogdir);
+
+	fflush(stdout);
+	fflush(stderr);
+
+	receivexlog_pid = fork();
+	if (receivexlog_pid < 0)
+		die(_("Could not start pg_receivexlog: %s\n"), strerror(errno));
+
+	if (receivexlog_pid == 0)
+	{
+		if (verbosity >= VERBOSITY_VERBOSE)
+			execl(exec_path, "pg_receivexlog", "-D", xlogdir,
+				  "-d", remote_connstr, "-n", "-v", (char *) NULL);
+		else
+			execl(exec_path, "pg_receivexlog", "-D", xlogdir,
+				  "-d", remote_connstr, "-n", (char *) NULL);
+
+		fprintf(stderr, _("Could not execute \"%s\": %s\n"),
+				exec_path, strerror(errno));
+		_exit(1);
+	}
+
+	for (;;)
+	{
+		DIR		   *dir;
+		struct dirent *de;
+		bool		receiving = false;
+		int			status;
+
+		if (waitpid(receivexlog_pid, &status, WNOHANG) == receivexlog_pid)
+		{
+			receivexlog_pid = 0;
+			die(_("pg_receivexlog failed, cannot continue.\n"));
+		}
+
+		dir = opendir(xlogdir);
+		if (dir == NULL)
+			die(_("Could not open directory \"%s\": %s\n"),
+				xlogdir, strerror(errno));
+		while ((de = readdir(dir)) != NULL)
+		{
+			size_t		len = strlen(de->d_name);
+
+			if (len > 8 && strcmp(de->d_name + len - 8, ".partial") == 0)
+				receiving = true;
+		}
+		closedir(dir);
+
+		if (receiving)
+			break;
+
+		pg_usleep(100000);		/* 100 ms */
+	}
+}
+
+/*
+ * Wait until pg_receivexlog has received the complete segment containing
+ * stop_lsn, then stop it.
+ */
+static void
+stop_receivexlog(const char *stop_lsn, TimeLineID tli)
+{
+	uint32		hi,
+				lo;
+	XLogRecPtr	stoppoint;
+	XLogSegNo	segno;
+	char		segname[MAXFNAMELEN];
+	char		path[MAXPGPATH];
+	char		xlogdir[MAXPGPATH];
+	DIR		   *dir;
+	struct dirent *de;
+	int			status;
+
+	if (sscanf(stop_lsn, "%X/%X", &hi, &lo) != 2)
+		die(_("Could not parse backup end position \"%s\".\n"), stop_lsn);
+	stoppoint = ((uint64) hi) << 32 | lo;
+
+	/* pg_stop_backup() switches to a new segment after the end record */
+	XLByteToPrevSeg(stoppoint, segno);
+	XLogFileName(segname, tli, segno);
+
+	snprintf(xlogdir, MAXPGPATH, "%s/pg_xlog", data_dir);
+	snprintf(path, MAXPGPATH, "%s/%s", xlogdir, segname);
+
+	print_msg(VERBOSITY_VERBOSE,
+			  _("Waiting for WAL segment %s to be received ...\n"), segname);
+
+	while (!file_exists(path))
+	{
+		if (waitpid(receivexlog_pid, &status, WNOHANG) == receivexlog_pid)
+		{
+			receivexlog_pid = 0;
+			die(_("pg_receivexlog failed, cannot continue.\n"));
+		}
+		pg_usleep(100000);		/* 100 ms */
+	}
+
+	kill(receivexlog_pid, SIGINT);
+	waitpid(receivexlog_pid, &status, 0);
+	receivexlog_pid = 0;
+
+	/* recovery streams anything past the backup end again */
+	dir = opendir(xlogdir);
+	if (dir == NULL)
+		die(_("Could not open directory \"%s\": %s\n"),
+			xlogdir, strerror(errno));
+	while ((de = readdir(dir)) != NULL)
+	{
+		size_t		len = strlen(de->d_name);
+
+		if (len > 8 && strcmp(de->d_name + len - 8, ".partial") == 0)
+		{
+			snprintf(path, MAXPGPATH, "%s/%s", xlogdir, de->d_name);
+			if (unlink(path) != 0)
+				die(_("Could not remove file \"%s\": %s\n"),
+					path, strerror(errno));
+		}
+	}
+	closedir(dir);
+}
+
+/*
+ * Bring an existing, stale copy of the remote node's data directory up to
+ * date, copying only what differs.
+ */
+static void
+run_incremental_copy(const char *remote_connstr, const char *data_dir,
+					 TimeLineID tli)
+{
+	char		path[MAXPGPATH];
+	FILE	   *pidf;
+	long		pid;
+	PGresult   *res;
+	char	   *stop_lsn;
+	IncrFileList remote = {NULL, 0, 0};
+	IncrFileList local = {NULL, 0, 0};
+	int			r,
+				l;
+
+	/* the copy must not be in use */
+	snprintf(path, MAXPGPATH, "%s/postmaster.pid", data_dir);
+	pidf = fopen(path, "r");
+	if (pidf != NULL)
+	{
+		if (fscanf(pidf, "%ld", &pid) == 1 && postmaster_is_alive((pid_t) pid))
+			die(_("PostgreSQL is running in directory \"%s\", stop it first.\n"),
+				data_dir);
+		fclose(pidf);
+		incr_remove("postmaster.pid");
+	}
+	incr_remove("postmaster.opts");
+
+	/* nothing of the old WAL, slots and temporary stats can be reused */
+	incr_empty_dir("pg_xlog");
+	snprintf(path, MAXPGPATH, "%s/pg_xlog/archive_status", data_dir);
+	if (mkdir(path, S_IRWXU) != 0)
+		die(_("Could not create directory \"%s\": %s\n"), path, strerror(errno));
+	incr_empty_dir("pg_replslot");
+	incr_empty_dir("pg_stat_tmp");
+
+	start_receivexlog(remote_connstr);
+
+	backup_conn = PQconnectdb(remote_connstr);
+	if (PQstatus(backup_conn) != CONNECTION_OK)
+		die(_("Connection to remote node failed: %s"), PQerrorMessage(backup_conn));
+
+	res = PQexec(backup_conn,
+				 "SELECT pg_catalog.pg_start_backup('bdr_init_copy', true)");
+	if (PQresultStatus(res) != PGRES_TUPLES_OK)
+		die(_("Could not start backup on remote node: %s\n"),
+			PQerrorMessage(backup_conn));
+	PQclear(res);
+	backup_started = true;
+
+	incr_list_remote(backup_conn, &remote);
+	incr_list_local(NULL, &local);
+	qsort(local.files, local.nfiles, sizeof(IncrFile), incr_file_cmp);
+
+	print_msg(VERBOSITY_VERBOSE,
+			  _("Comparing %d remote files with %d local files ...\n"),
+			  remote.nfiles, local.nfiles);
+
+	/* both lists are sorted the same way, so walk them in step */
+	r = l = 0;
+	while (r < remote.nfiles || l < local.nfiles)
+	{
+		IncrFile   *rf = (r < remote.nfiles) ? &remote.files[r] : NULL;
+		IncrFile   *lf = (l < local.nfiles) ? &local.files[l] : NULL;
+		int			cmp;
+
+		if (rf == NULL)
+			cmp = 1;
+		else if (lf == NULL)
+			cmp = -1;
+		else
+			cmp = strcmp(rf->path, lf->path);
+
+		if (cmp > 0)
+		{
+			/* only exists locally */
+			print_msg(VERBOSITY_DEBUG, _("Removing \"%s\".\n"), lf->path);
+			incr_remove(lf->path);
+			l++;
+			continue;
+		}
+
+		snprintf(path, MAXPGPATH, "%s/%s", data_dir, rf->path);
+
+		if (rf->isdir)
+		{
+			if (cmp != 0 || !lf->isdir)
+			{
+				/* it'd end up inside the data directory */
+				if (strncmp(rf->path, "pg_tblspc/", 10) == 0 &&
+					strchr(rf->path + 10, '/') == NULL)
+					die(_("Tablespace \"%s\" is missing in the local data directory.\n"),
+						rf->path);
+
+				if (cmp == 0)
+					incr_remove(lf->path);
+				if (mkdir(path, S_IRWXU) != 0)
+					die(_("Could not create directory \"%s\": %s\n"),
+						path, strerror(errno));
+			}
+		}
+		else if (cmp == 0 && !lf->isdir)
+			incr_sync_file(backup_conn, rf, lf->size);
+		else
+		{
+			if (cmp == 0)
+				incr_remove(lf->path);
+			incr_sync_file(backup_conn, rf, -1);
+		}
+
+		r++;
+		if (cmp == 0)
+			l++;
+	}
+
+	res = PQexec(backup_conn, "SELECT pg_catalog.pg_stop_backup()");
+	if (PQresultStatus(res) != PGRES_TUPLES_OK)
+		die(_("Could not stop backup on remote node: %s\n"),
+			PQerrorMessage(backup_conn));
+	backup_started = false;
+	stop_lsn = pg_strdup(PQgetvalue(res, 0, 0));
+	PQclear(res);
+
+	PQfinish(backup_conn);
+	backup_conn = NULL;
+
+	stop_receivexlog(stop_lsn, tli);
+
+	print_msg(VERBOSITY_NORMAL,
+			  _("Compared " INT64_FORMAT " kB of existing files, copied " INT64_FORMAT " kB from the remote node.\n"),
+			  incr_bytes_compared / 1024, incr_bytes_copied / 1024);
+}
+
 /*
  * Set system identifier to system id we used for registering the slots.
  */
@@ -695,13 +1607,14 @@ remove_unwanted_files(void)
  * Init the datadir
  *
  * This function can either ensure provided datadir is a postgres datadir,
- * or create it using pg_basebackup.
+ * or create it using pg_basebackup. With --incremental an existing datadir
+ * is brought up to date with the remote node.
  *
  * In any case, new postresql.conf and pg_hba.conf will be copied to the
  * datadir if they are provided.
  */
 static void
-initialize_data_dir(char *data_dir, char *connstr,
+initialize_data_dir(char *data_dir, char *connstr, TimeLineID tli,
 					char *postgresql_conf, char *pg_hba_conf)
 {
 	/* Run basebackup as needed. */
@@ -728,6 +1641,13 @@ initialize_data_dir(char *data_dir, char *connstr,
 				if (!is_pg_dir(data_dir))
 					die(_("Directory \"%s\" exists but is not valid postgres data directory.\n"),
 						data_dir);
+
+				if (incremental)
+				{
+					print_msg(VERBOSITY_NORMAL,
+							  _("Updating existing data directory from the remote node...\n"));
+					run_incremental_copy(connstr, data_dir, tli);
+				}
 				break;
 			}
 		case -1:	/* Access problem */
@@ -979,6 +1899,9 @@ validate_remote_node(PGconn *conn)
 
 /*
  * Insert node entry for local node to the remote's bdr_nodes.
+ *
+ * The node_seq_id is picked while holding the global DDL lock, so nodes
+ * joining via other upstreams at the same time can't pick the same one.
  */
 void
 initialize_node_entry(PGconn *conn, NodeInfo *ni, char* node_name, Oid dboid,
@@ -987,10 +1910,17 @@ initialize_node_entry(PGconn *conn, NodeInfo *ni, char* node_name, Oid dboid,
 	PQExpBuffer		query = createPQExpBuffer();
 	PGresult	   *res;
 
-	printfPQExpBuffer(query, "INSERT INTO bdr.bdr_nodes"
+	printfPQExpBuffer(query, "BEGIN;"
+							 " SET LOCAL bdr.permit_ddl_locking = on;"
+							 " SELECT bdr.bdr_acquire_global_ddl_lock();"
+							 " INSERT INTO bdr.bdr_nodes"
 							 " (node_status, node_sysid, node_timeline,"
-							 "	node_dboid, node_name, node_init_from_dsn)"
-							 " VALUES ('c', '"UINT64_FORMAT"', %u, %u, %s, %s);",
+							 "	node_dboid, node_name, node_init_from_dsn,"
+							 "	node_seq_id)"
+							 " VALUES ('c', '"UINT64_FORMAT"', %u, %u, %s, %s,"
+							 "	(SELECT COALESCE(max(node_seq_id), 0) + 1"
+							 "	 FROM bdr.bdr_nodes));"
+							 " COMMIT;",
 					  ni->local_sysid, ni->local_tlid, dboid,
 					  PQescapeLiteral(conn, node_name, strlen(node_name)),
 					  PQescapeLiteral(conn, remote_connstr, strlen(remote_connstr)));
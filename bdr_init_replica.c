@@ -57,11 +57,54 @@
 
 
 char *bdr_temp_dump_directory = NULL;
+int bdr_init_replica_jobs = 4;
+int bdr_init_replica_index_jobs = 4;
+bool bdr_init_parallel_catchup = false;
+
+/* whether the dump is kept if this attempt at the join fails */
+static bool bdr_init_keep_dump = false;
 
 static void bdr_init_exec_dump_restore(BDRNodeInfo *node,
 									   char *snapshot);
 
-static void bdr_catchup_to_lsn(remote_node_info *ri, XLogRecPtr target_lsn);
+/*
+ * A node other than the one a join copies its data from, that the join
+ * catches up from directly; see bdr_init_prepare_peers.
+ */
+typedef struct BdrInitPeer
+{
+	uint64		sysid;
+	TimeLineID	timeline;
+	Oid			dboid;
+	char	   *dsn;
+	RepNodeId	riident;
+	/* position the join source has to replay the peer's changes up to */
+	XLogRecPtr	wait_lsn;
+	/* position the peer's changes are replayed from */
+	XLogRecPtr	lsn;
+} BdrInitPeer;
+
+/* A node to catch up from, see bdr_catchup_to_lsn */
+typedef struct BdrCatchupWorker
+{
+	uint64		sysid;
+	TimeLineID	timeline;
+	Oid			dboid;
+	XLogRecPtr	target_lsn;
+	bool		forward_changesets;
+	/* the worker's shmem slot and bgworker, while we have them */
+	BdrWorker  *worker;
+	BackgroundWorkerHandle *handle;
+	pid_t		pid;
+} BdrCatchupWorker;
+
+typedef struct BdrCatchup
+{
+	BdrCatchupWorker *workers;
+	int			nworkers;
+} BdrCatchup;
+
+static void bdr_catchup_to_lsn(BdrCatchupWorker *workers, int nworkers);
 
 /*
  * Make sure remote node has BDR activated (insert the security label).
@@ -177,55 +220,152 @@ bdr_ensure_ext_installed(PGconn *pgconn)
 	pfree(installed_version);
 }
 
+/*
+ * Directory the remote schema is dumped to. It's named after the local node,
+ * so an attempt at the join that's interrupted after copying all data can be
+ * resumed with its dump.
+ */
+static char *
+bdr_init_replica_tmpdir(void)
+{
+	return psprintf("%s/postgres-bdr-"UINT64_FORMAT"-%u-%u",
+					bdr_temp_dump_directory, GetSystemIdentifier(),
+					ThisTimeLineID, MyDatabaseId);
+}
+
 static void
 bdr_init_replica_cleanup_tmpdir(int errcode, Datum tmpdir)
 {
 	struct stat st;
 	const char* dir = DatumGetCString(tmpdir);
 
-	if (stat(dir, &st) == 0)
+	/* the next attempt needs the dump to build indexes and constraints */
+	if (!bdr_init_keep_dump && stat(dir, &st) == 0)
 		if (!rmtree(dir, true))
 			elog(WARNING, "Failed to clean up bdr dump temporary directory %s on exit/error", dir);
+
+	/* this attempt at copying the remote node is over either way */
+	bdr_init_progress_end();
 }
 
+#ifndef WIN32
 /*
- * Use a script to copy the contents of a remote node using pg_dump and apply
- * it to the local node. Runs during node join creation to bring up a new
- * logical replica from an existing node. The remote dump is taken from the
- * start position of a slot on the remote end to ensure that we never replay
- * changes included in the dump and never miss changes.
+ * Run a program to completion, raising FATAL if it fails, so the join is
+ * retried from scratch.
+ */
+static void
+bdr_init_exec_program(char *const argv[])
+{
+	pid_t pid;
+	StringInfoData cmd;
+	int i;
+
+	initStringInfo(&cmd);
+	for (i = 0; argv[i] != NULL; i++)
+		appendStringInfo(&cmd, i == 0 ? "%s" : " \"%s\"", argv[i]);
+
+	ereport(LOG,
+			(errmsg("bdr init_replica: running %s", cmd.data)));
+
+	pid = fork();
+	if (pid < 0)
+		elog(FATAL, "can't fork to create initial replica");
+	else if (pid == 0)
+	{
+		int n = 0;
+
+		n = execv(argv[0], argv);
+		if (n < 0)
+			_exit(n);
+	}
+	else
+	{
+		pid_t res;
+		int exitstatus = 0;
+
+		elog(DEBUG3, "Waiting for %s pid %d", argv[0], pid);
+
+		do
+		{
+			res = waitpid(pid, &exitstatus, WNOHANG);
+			if (res < 0)
+			{
+				if (errno == EINTR || errno == EAGAIN)
+					continue;
+				elog(FATAL, "bdr_exec_init_replica: error calling waitpid");
+			}
+			else if (res == pid)
+				break;
+
+			pg_usleep(10 * 1000);
+			CHECK_FOR_INTERRUPTS();
+		}
+		while (1);
+
+		elog(DEBUG3, "%s exited with waitpid return status %d",
+			 argv[0], exitstatus);
+
+		if (exitstatus != 0)
+		{
+			if (WIFEXITED(exitstatus))
+				elog(FATAL, "bdr: %s exited with exit code %d",
+					 argv[0], WEXITSTATUS(exitstatus));
+			if (WIFSIGNALED(exitstatus))
+				elog(FATAL, "bdr: %s exited due to signal %d",
+					 argv[0], WTERMSIG(exitstatus));
+			elog(FATAL, "bdr: %s exited for an unknown reason with waitpid return %d",
+				 argv[0], exitstatus);
+		}
+	}
+
+	pfree(cmd.data);
+}
+#endif
+
+/*
+ * Copy the contents of a remote node and apply it to the local node. Runs
+ * during node join creation to bring up a new logical replica from an
+ * existing node. The remote state is read in the snapshot exported when
+ * the slot on the remote end was created, to ensure that we never replay
+ * changes included in the copy and never miss changes.
+ *
+ * The schema, and everything else pg_dump puts in the data section except
+ * table data, like sequence values, is dumped to a file with pg_dump. That's
+ * small. Everything but indexes, constraints and triggers is restored, then
+ * bdr_init_sync_data streams the table data straight into the local tables
+ * over bdr.init_replica_jobs connections. Indexes and constraints are built
+ * last by bdr.init_replica_index_jobs parallel pg_restore jobs, those on the
+ * largest tables first.
+ *
+ * When resuming an interrupted join, see bdr_init_resume, the schema is
+ * restored only if the earlier attempt didn't get that far, and it must not
+ * have changed since. It's restored in a single transaction, so an attempt
+ * that fails while restoring it leaves nothing behind. Without a snapshot
+ * all data was copied already and only the indexes and constraints missing
+ * are built, from the earlier attempt's dump.
  */
 static void
 bdr_init_exec_dump_restore(BDRNodeInfo *node,
 						   char *snapshot)
 {
 #ifndef WIN32
-	pid_t pid;
-	char *bindir;
 	char *tmpdir;
-	char  bdr_init_replica_script_path[MAXPGPATH];
+	char *dumpfile;
+	char *schemafile;
+	char *listfile;
 	char  bdr_dump_path[MAXPGPATH];
 	char  bdr_restore_path[MAXPGPATH];
-	StringInfoData path;
+	char  index_jobs[12];
 	StringInfoData origin_dsn;
 	StringInfoData local_dsn;
+	StringInfoData local_copy_dsn;
 	int   saved_errno;
+	const char *local_options =
+		" options='-c bdr.do_not_replicate=on -c bdr.permit_unsafe_ddl_commands=on -c bdr.skip_ddl_replication=on -c bdr.skip_ddl_locking=on'";
 
-	initStringInfo(&path);
 	initStringInfo(&origin_dsn);
 	initStringInfo(&local_dsn);
-
-	bindir = pstrdup(my_exec_path);
-	get_parent_directory(bindir);
-
-	if (find_other_exec(my_exec_path, BDR_INIT_REPLICA_CMD,
-						BDR_INIT_REPLICA_CMD " (PostgreSQL " PG_VERSION ", BDR " BDR_VERSION ")\n",
-						&bdr_init_replica_script_path[0]) < 0)
-	{
-		elog(ERROR, "bdr: failed to find " BDR_INIT_REPLICA_CMD
-			 " relative to binary %s or wrong version. Expected (PostgreSQL %s, BDR %s)",
-			 my_exec_path, PG_VERSION, BDR_VERSION);
-	}
+	initStringInfo(&local_copy_dsn);
 
 	if (find_other_exec(my_exec_path, BDR_DUMP_CMD,
 						"pg_dump (PostgreSQL) " PG_VERSION "\n",
@@ -245,6 +385,7 @@ bdr_init_exec_dump_restore(BDRNodeInfo *node,
 			 my_exec_path, PG_VERSION);
 	}
 
+	snprintf(index_jobs, sizeof(index_jobs), "%d", bdr_init_replica_index_jobs);
 
 	appendStringInfo(&origin_dsn,
 					 "%s fallback_application_name='"BDR_LOCALID_FORMAT": init_replica dump'",
@@ -255,117 +396,154 @@ bdr_init_exec_dump_restore(BDRNodeInfo *node,
 					 node->local_dsn, BDR_LOCALID_FORMAT_ARGS);
 
 	/*
-	 * Suppress replication of changes applied via pg_restore back to
-	 * the local node.
+	 * Suppress replication of changes applied via pg_restore and the copy
+	 * back to the local node.
 	 *
 	 * TODO: This should PQconninfoParse, modify the options keyword or add
 	 * it, and reconstruct the string using the functions from pg_dumpall
 	 * (also to be used for init_copy). Simply appending the options
 	 * instead is a bit dodgy.
 	 */
-	appendStringInfoString(&local_dsn,
-						   " options='-c bdr.do_not_replicate=on -c bdr.permit_unsafe_ddl_commands=on -c bdr.skip_ddl_replication=on -c bdr.skip_ddl_locking=on'");
+	appendStringInfoString(&local_dsn, local_options);
+	appendStringInfo(&local_copy_dsn, "%s%s", node->local_dsn, local_options);
 
-	tmpdir = palloc(strlen(bdr_temp_dump_directory)+32);
-	sprintf(tmpdir, "%s/postgres-bdr-%s.%d", bdr_temp_dump_directory,
-			snapshot, getpid());
+	tmpdir = bdr_init_replica_tmpdir();
+	dumpfile = psprintf("%s/schema.dump", tmpdir);
+	schemafile = psprintf("%s/schema.sql", tmpdir);
+	listfile = psprintf("%s/schema.list", tmpdir);
 
-	if (mkdir(tmpdir, 0700))
+	/* a dump left behind by an earlier attempt isn't of this snapshot */
+	if (snapshot != NULL)
 	{
-		saved_errno = errno;
-		if (saved_errno == EEXIST)
-		{
-			/*
-			 * Target is an existing dir that somehow wasn't cleaned up or
-			 * something more sinister. We'll just die here, and let the
-			 * postmaster relaunch us and retry the whole operation.
-			 */
-			elog(ERROR, "bdr init_replica: Temporary dump directory %s exists: %s",
-				 tmpdir, strerror(saved_errno));
-		}
-		else
+		struct stat st;
+
+		if (stat(tmpdir, &st) == 0 && !rmtree(tmpdir, true))
+			elog(ERROR, "bdr init_replica: Failed to remove old temporary dump directory %s",
+				 tmpdir);
+
+		if (mkdir(tmpdir, 0700))
 		{
+			saved_errno = errno;
 			elog(ERROR, "bdr init_replica: Failed to create temp directory: %s",
 				 strerror(saved_errno));
 		}
 	}
 
-	pid = fork();
-	if (pid < 0)
-		elog(FATAL, "can't fork to create initial replica");
-	else if (pid == 0)
-	{
-		int n = 0;
+	bdr_init_keep_dump = (snapshot == NULL);
+	bdr_init_progress_start();
 
-		char *const argv[] = {
-			bdr_init_replica_script_path,
+	PG_ENSURE_ERROR_CLEANUP(bdr_init_replica_cleanup_tmpdir,
+							CStringGetDatum(tmpdir));
+	{
+		char *const dump_argv[] = {
+			bdr_dump_path,
+			"-T", "bdr.bdr_nodes",
+			"-T", "bdr.bdr_connections",
 			"--snapshot", snapshot,
-			"--source", origin_dsn.data,
-			"--target", local_dsn.data,
-			"--tmp-directory", tmpdir,
-			"--pg-dump-path", bdr_dump_path,
-			"--pg-restore-path", bdr_restore_path,
+			"--exclude-table-data", "*.*",
+			"-F", "c",
+			"-f", dumpfile,
+			origin_dsn.data,
+			NULL
+		};
+		char *const schema_argv[] = {
+			bdr_restore_path,
+			"--section", "pre-data",
+			"-f", schemafile,
+			dumpfile,
+			NULL
+		};
+		/*
+		 * All or nothing, so a failed attempt doesn't leave a partial schema
+		 * behind that the next one can't restore over.
+		 */
+		char *const restore_argv[] = {
+			bdr_restore_path,
+			"--exit-on-error",
+			"--single-transaction",
+			"--section", "pre-data",
+			"-d", local_dsn.data,
+			dumpfile,
+			NULL
+		};
+		char *const data_restore_argv[] = {
+			bdr_restore_path,
+			"--exit-on-error",
+			"--section", "data",
+			"-d", local_dsn.data,
+			dumpfile,
+			NULL
+		};
+		char *const list_argv[] = {
+			bdr_restore_path,
+			"-l",
+			"-f", listfile,
+			dumpfile,
+			NULL
+		};
+		char *const post_restore_argv[] = {
+			bdr_restore_path,
+			"--exit-on-error",
+			"--section", "post-data",
+			"-L", listfile,
+			"-j", index_jobs,
+			"-d", local_dsn.data,
+			dumpfile,
 			NULL
 		};
 
-		ereport(LOG,
-				(errmsg("Creating replica with: %s --snapshot %s --source \"%s\" --target \"%s\" --tmp-directory \"%s\", --pg-dump-path \"%s\", --pg-restore-path \"%s\"",
-						bdr_init_replica_script_path, snapshot,
-						node->init_from_dsn, node->local_dsn, tmpdir,
-						bdr_dump_path, bdr_restore_path)));
-
-		n = execv(bdr_init_replica_script_path, argv);
-		if (n < 0)
-			_exit(n);
-	}
-	else
-	{
-		pid_t res;
-		int exitstatus = 0;
+		if (snapshot != NULL)
+		{
+			char		schema_md5[33];
+			char	   *restored_md5 = NULL;
 
-		elog(DEBUG3, "Waiting for %s pid %d",
-			 bdr_init_replica_script_path, pid);
+			bdr_init_progress_phase(BDR_INIT_PHASE_DUMP_SCHEMA);
+			bdr_init_exec_program(dump_argv);
+			bdr_init_exec_program(schema_argv);
+			bdr_init_sync_file_md5(schemafile, schema_md5);
 
-		PG_ENSURE_ERROR_CLEANUP(bdr_init_replica_cleanup_tmpdir,
-								CStringGetDatum(tmpdir));
-		{
-			do
+			bdr_init_progress_phase(BDR_INIT_PHASE_RESTORE_SCHEMA);
+			if (bdr_init_checkpoint_get("schema", &restored_md5) == NULL)
 			{
-				res = waitpid(pid, &exitstatus, WNOHANG);
-				if (res < 0)
-				{
-					if (errno == EINTR || errno == EAGAIN)
-						continue;
-					elog(FATAL, "bdr_exec_init_replica: error calling waitpid");
-				}
-				else if (res == pid)
-					break;
-
-				pg_usleep(10 * 1000);
-				CHECK_FOR_INTERRUPTS();
+				bdr_init_exec_program(restore_argv);
+				bdr_init_checkpoint_schema(snapshot, schema_md5);
 			}
-			while (1);
+			else if (restored_md5 == NULL ||
+					 strcmp(restored_md5, schema_md5) != 0)
+				ereport(ERROR,
+						(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+						 errmsg("previous init failed, manual cleanup is required"),
+						 errdetail("The schema of the remote node changed since an earlier attempt at the join restored it."),
+						 errhint("Remove all replication identifiers and slots corresponding to this node from the init target node then drop and recreate this database and try again")));
+			else
+				elog(LOG, "bdr init_replica: keeping the schema restored by an earlier attempt");
 
-			elog(DEBUG3, "%s exited with waitpid return status %d",
-				 bdr_init_replica_script_path, exitstatus);
+			/* sequence values and large objects, restoring them again is fine */
+			bdr_init_exec_program(data_restore_argv);
 
-			if (exitstatus != 0)
-			{
-				if (WIFEXITED(exitstatus))
-					elog(FATAL, "bdr: %s exited with exit code %d",
-						 bdr_init_replica_script_path, WEXITSTATUS(exitstatus));
-				if (WIFSIGNALED(exitstatus))
-					elog(FATAL, "bdr: %s exited due to signal %d",
-						 bdr_init_replica_script_path, WTERMSIG(exitstatus));
-				elog(FATAL, "bdr: %s exited for an unknown reason with waitpid return %d",
-					 bdr_init_replica_script_path, exitstatus);
-			}
+			bdr_init_progress_phase(BDR_INIT_PHASE_COPY_DATA);
+			bdr_init_sync_data(node->init_from_dsn, local_copy_dsn.data,
+							   snapshot, bdr_init_replica_jobs);
+			bdr_init_keep_dump = true;
 		}
-		PG_END_ENSURE_ERROR_CLEANUP(bdr_init_replica_cleanup_tmpdir,
-									PointerGetDatum(tmpdir));
-		bdr_init_replica_cleanup_tmpdir(0, CStringGetDatum(tmpdir));
+		else
+			elog(LOG, "bdr init_replica: all data was copied by an earlier attempt, building indexes and constraints");
+
+		/* biggest indexes and constraint checks first */
+		bdr_init_progress_phase(BDR_INIT_PHASE_POST_DATA);
+		bdr_init_exec_program(list_argv);
+		bdr_init_sync_order_post_data(node->init_from_dsn, local_copy_dsn.data,
+									  listfile);
+		bdr_init_exec_program(post_restore_argv);
 	}
-
+	PG_END_ENSURE_ERROR_CLEANUP(bdr_init_replica_cleanup_tmpdir,
+								PointerGetDatum(tmpdir));
+	bdr_init_keep_dump = false;
+	bdr_init_replica_cleanup_tmpdir(0, CStringGetDatum(tmpdir));
+
+	pfree(listfile);
+	pfree(schemafile);
+	pfree(dumpfile);
 	pfree(tmpdir);
 #else
 	/*
@@ -402,20 +580,73 @@ bdr_sync_nodes(PGconn *remote_conn, BDRNodeInfo *local_node)
 			"SET LOCAL search_path = bdr, pg_catalog;\n"
 			"SET LOCAL bdr.permit_unsafe_ddl_commands = on;\n"
 			"SET LOCAL bdr.skip_ddl_replication = on;\n"
-			"SET LOCAL bdr.skip_ddl_locking = on;\n"
+			"SET LOCAL bdr.skip_ddl_locking = on;\n";
+		const char *const lock_query =
 			"LOCK TABLE bdr.bdr_nodes IN EXCLUSIVE MODE;\n"
 			"LOCK TABLE bdr.bdr_connections IN EXCLUSIVE MODE;\n";
 
 		/* Setup the environment. */
 		res = PQexec(remote_conn, setup_query);
 		if (PQresultStatus(res) != PGRES_COMMAND_OK)
-			elog(ERROR, "BEGIN or table locking on remote failed: %s",
+			elog(ERROR, "BEGIN on remote failed: %s",
+					PQresultErrorMessage(res));
+		PQclear(res);
+
+		/*
+		 * node_seq_ids have to be unique across the group, and other nodes
+		 * may be joining via other upstreams at the same time. The global
+		 * DDL lock serializes us against them, and once it's granted the
+		 * remote has replayed the ids they took. Take it before locking
+		 * bdr_nodes, the remote's apply workers may have to write to it
+		 * before they can confirm the lock.
+		 */
+		res = PQexec(remote_conn,
+					 "SET LOCAL bdr.permit_ddl_locking = on;\n"
+					 "SELECT bdr.bdr_acquire_global_ddl_lock();\n");
+		if (PQresultStatus(res) != PGRES_TUPLES_OK)
+			elog(ERROR, "acquiring global DDL lock on remote failed: %s",
+					PQresultErrorMessage(res));
+		PQclear(res);
+
+		res = PQexec(remote_conn, lock_query);
+		if (PQresultStatus(res) != PGRES_COMMAND_OK)
+			elog(ERROR, "table locking on remote failed: %s",
 					PQresultErrorMessage(res));
 		PQclear(res);
 
 		res = PQexec(local_conn, setup_query);
 		if (PQresultStatus(res) != PGRES_COMMAND_OK)
-			elog(ERROR, "BEGIN or table locking on local failed: %s",
+			elog(ERROR, "BEGIN on local failed: %s",
+					PQresultErrorMessage(res));
+		PQclear(res);
+
+		res = PQexec(local_conn, lock_query);
+		if (PQresultStatus(res) != PGRES_COMMAND_OK)
+			elog(ERROR, "table locking on local failed: %s",
+					PQresultErrorMessage(res));
+		PQclear(res);
+
+		/*
+		 * Number any nodes that don't have a node_seq_id yet, e.g. because
+		 * their row was created by an older bdr_init_copy. This replicates
+		 * to the rest of the group from the remote.
+		 */
+		res = PQexec(remote_conn,
+					 "UPDATE bdr.bdr_nodes n\n"
+					 "SET node_seq_id = s.node_seq_id\n"
+					 "FROM (\n"
+					 "    SELECT node_sysid, node_timeline, node_dboid,\n"
+					 "        (SELECT COALESCE(max(node_seq_id), 0) FROM bdr.bdr_nodes)\n"
+					 "        + row_number() OVER (ORDER BY node_sysid, node_timeline, node_dboid)\n"
+					 "        AS node_seq_id\n"
+					 "    FROM bdr.bdr_nodes\n"
+					 "    WHERE node_seq_id IS NULL\n"
+					 ") s\n"
+					 "WHERE n.node_sysid = s.node_sysid\n"
+					 "  AND n.node_timeline = s.node_timeline\n"
+					 "  AND n.node_dboid = s.node_dboid");
+		if (PQresultStatus(res) != PGRES_COMMAND_OK)
+			elog(ERROR, "numbering nodes on remote failed: %s",
 					PQresultErrorMessage(res));
 		PQclear(res);
 
@@ -424,11 +655,32 @@ bdr_sync_nodes(PGconn *remote_conn, BDRNodeInfo *local_node)
 					  "COPY (SELECT * FROM bdr.bdr_nodes) TO stdout",
 					  "COPY bdr.bdr_nodes FROM stdin");
 
-		/* Copy the local entry to remote node. */
-		initStringInfo(&query);
 		/* No need to quote as everything is numbers. */
 		snprintf(sysid_str, sizeof(sysid_str), UINT64_FORMAT, local_node->sysid);
 		sysid_str[sizeof(sysid_str)-1] = '\0';
+
+		/*
+		 * Now that we know all nodes, and hold the global DDL lock, we can
+		 * pick the next free node_seq_id for ourselves. The unique index on
+		 * node_seq_id catches it, should anything still go wrong.
+		 */
+		initStringInfo(&query);
+		appendStringInfo(&query,
+						 "UPDATE bdr.bdr_nodes SET node_seq_id = ("
+							"SELECT COALESCE(max(node_seq_id), 0) + 1 "
+							"FROM bdr.bdr_nodes) "
+						 "WHERE node_sysid = '%s' AND node_timeline = '%u' "
+							"AND node_dboid = '%u' AND node_seq_id IS NULL",
+						 sysid_str, local_node->timeline, local_node->dboid);
+
+		res = PQexec(local_conn, query.data);
+		if (PQresultStatus(res) != PGRES_COMMAND_OK)
+			elog(ERROR, "assigning node_seq_id on local failed: %s",
+					PQresultErrorMessage(res));
+		PQclear(res);
+
+		/* Copy the local entry to remote node. */
+		resetStringInfo(&query);
 		appendStringInfo(&query,
 						 "COPY (SELECT * FROM bdr.bdr_nodes WHERE "
 							"node_sysid = '%s' AND node_timeline = '%u' "
@@ -739,6 +991,525 @@ perform_pointless_transaction(PGconn *conn, BDRNodeInfo *node)
 	PQclear(res);
 }
 
+/*
+ * Decide what of an interrupted join can be kept, given a connection to the
+ * node it's copied from; see bdr_init_sync.c.
+ *
+ * Returns true if all data was copied, the join's slot still exists to
+ * stream the changes made since and the dump to build the indexes and
+ * constraints from is still there. Otherwise the slot and the local
+ * replication identifier are dropped, so they're created again with a new
+ * snapshot, and the data copied in the old one is copied again.
+ *
+ * Raises an ERROR if the earlier attempt may have restored part of the
+ * schema, which still has to be cleaned up manually.
+ */
+static bool
+bdr_init_resume(PGconn *conn)
+{
+	remote_node_info ri;
+	NameData	slot_name;
+	char		ident[256];
+	char	   *tmpdir;
+	char	   *dumpfile;
+	char	   *snapshot;
+	char	   *query;
+	PGresult   *res;
+	RepNodeId	riident;
+	bool		slot_exists;
+	bool		keep_data;
+	struct stat st;
+
+	bdr_get_remote_nodeinfo_internal(conn, &ri);
+
+	bdr_slot_name(&slot_name, GetSystemIdentifier(), ThisTimeLineID,
+				  MyDatabaseId, ri.dboid);
+	snprintf(ident, sizeof(ident), BDR_NODE_ID_FORMAT,
+			 ri.sysid, ri.timeline, ri.dboid, MyDatabaseId,
+			 EMPTY_REPLICATION_NAME);
+
+	query = psprintf("SELECT 1 FROM pg_catalog.pg_replication_slots WHERE slot_name = %s",
+					 quote_literal_cstr(NameStr(slot_name)));
+	res = PQexec(conn, query);
+	if (PQresultStatus(res) != PGRES_TUPLES_OK)
+		elog(ERROR, "bdr init_replica: looking up slot %s failed: %s",
+			 NameStr(slot_name), PQerrorMessage(conn));
+	slot_exists = PQntuples(res) > 0;
+	PQclear(res);
+	pfree(query);
+
+	StartTransactionCommand();
+	riident = GetReplicationIdentifier(ident, true);
+	CommitTransactionCommand();
+
+	tmpdir = bdr_init_replica_tmpdir();
+	dumpfile = psprintf("%s/schema.dump", tmpdir);
+
+	snapshot = bdr_init_checkpoint_get("data", NULL);
+	keep_data = snapshot != NULL && slot_exists &&
+		riident != InvalidRepNodeId && stat(dumpfile, &st) == 0;
+
+	if (keep_data)
+		elog(LOG, "bdr init_replica: keeping the data copied in snapshot %s, streaming changes from slot %s",
+			 snapshot, NameStr(slot_name));
+	else
+	{
+		if (bdr_init_checkpoint_get("schema", NULL) == NULL &&
+			!bdr_init_local_schema_empty())
+			ereport(ERROR,
+					(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+					 errmsg("previous init failed, manual cleanup is required"),
+					 errdetail("Found bdr.bdr_nodes entry for "BDR_LOCALID_FORMAT" with state=i and a partially restored schema", BDR_LOCALID_FORMAT_ARGS),
+					 errhint("Remove all replication identifiers and slots corresponding to this node from the init target node then drop and recreate this database and try again")));
+
+		/*
+		 * Data copied in the old snapshot can't be combined with changes
+		 * streamed from a new slot. Forget it's complete before dropping the
+		 * slot, bdr_init_sync_data copies it again.
+		 */
+		bdr_init_checkpoint_forget("data");
+
+		if (slot_exists)
+		{
+			elog(LOG, "bdr init_replica: dropping slot %s of an earlier attempt",
+				 NameStr(slot_name));
+
+			query = psprintf("SELECT pg_catalog.pg_drop_replication_slot(%s)",
+							 quote_literal_cstr(NameStr(slot_name)));
+			res = PQexec(conn, query);
+			if (PQresultStatus(res) != PGRES_TUPLES_OK)
+				elog(ERROR, "bdr init_replica: dropping slot %s failed: %s",
+					 NameStr(slot_name), PQerrorMessage(conn));
+			PQclear(res);
+			pfree(query);
+		}
+
+		if (riident != InvalidRepNodeId)
+		{
+			StartTransactionCommand();
+			DropReplicationIdentifier(riident);
+			CommitTransactionCommand();
+			bdr_nodecache_forget_node(ri.sysid, ri.timeline, ri.dboid,
+									  MyDatabaseId);
+		}
+	}
+
+	if (snapshot != NULL)
+		pfree(snapshot);
+	pfree(dumpfile);
+	pfree(tmpdir);
+	free_remote_node_info(&ri);
+
+	return keep_data;
+}
+
+/*
+ * Return the position up to which the node conn is connected to has replayed
+ * the changes of peer, or InvalidXLogRecPtr if it hasn't replayed any.
+ */
+static XLogRecPtr
+bdr_init_remote_progress(PGconn *conn, Oid remote_dboid, BdrInitPeer *peer)
+{
+	char		ident[256];
+	char	   *query;
+	PGresult   *res;
+	XLogRecPtr	lsn = InvalidXLogRecPtr;
+
+	snprintf(ident, sizeof(ident), BDR_NODE_ID_FORMAT,
+			 peer->sysid, peer->timeline, peer->dboid, remote_dboid,
+			 EMPTY_REPLICATION_NAME);
+
+	query = psprintf("SELECT remote_lsn FROM pg_catalog.pg_replication_identifier_progress WHERE external_id = %s",
+					 quote_literal_cstr(ident));
+	res = PQexec(conn, query);
+	if (PQresultStatus(res) != PGRES_TUPLES_OK)
+		elog(ERROR, "bdr init_replica: looking up replication identifier %s failed: %s",
+			 ident, PQerrorMessage(conn));
+
+	if (PQntuples(res) > 0 && !PQgetisnull(res, 0, 0))
+		lsn = DatumGetLSN(DirectFunctionCall1Coll(pg_lsn_in, InvalidOid,
+						  CStringGetDatum(PQgetvalue(res, 0, 0))));
+
+	PQclear(res);
+	pfree(query);
+
+	return lsn;
+}
+
+/* how long to wait for the join source to replay the peers up to their slots */
+#define BDR_INIT_PEERS_WAIT_TIMEOUT_MS 300000
+
+/*
+ * Get ready to catch up from every node of the group in parallel, instead of
+ * replaying all changes through the node the join copies its data from.
+ * Called before the join's snapshot is taken on that node, conn is
+ * connected to it.
+ *
+ * The changes a peer makes after the snapshot aren't in the data copied, so
+ * they have to be streamed from a slot on the peer that exists already by
+ * then. We create slots on all peers first, and wait until the join source
+ * has replayed each peer's changes up to where the peer's slot starts. Then
+ * we note the position the source has replayed each peer to; once the
+ * snapshot is taken, bdr_init_verify_peers checks that it's still the same.
+ *
+ * Returns the peers, or NIL to catch up through the source if it doesn't
+ * replay them up to their slots within BDR_INIT_PEERS_WAIT_TIMEOUT_MS.
+ */
+static List *
+bdr_init_prepare_peers(PGconn *conn)
+{
+	remote_node_info ri;
+	PGresult   *res;
+	List	   *peers = NIL;
+	ListCell   *lc;
+	TimestampTz deadline;
+	int			nwaiting;
+	int			i;
+
+	bdr_get_remote_nodeinfo_internal(conn, &ri);
+
+	res = PQexec(conn,
+				 "SELECT c.conn_sysid, c.conn_timeline, c.conn_dboid, c.conn_dsn \n"
+				 "FROM bdr.bdr_connections c \n"
+				 "JOIN bdr.bdr_nodes n ON (n.node_sysid = c.conn_sysid \n"
+				 "                         AND n.node_timeline = c.conn_timeline \n"
+				 "                         AND n.node_dboid = c.conn_dboid) \n"
+				 "WHERE c.conn_origin_sysid = '0' \n"
+				 "  AND c.conn_origin_timeline = 0 \n"
+				 "  AND c.conn_origin_dboid = 0 \n"
+				 "  AND n.node_status <> 'k'");
+	if (PQresultStatus(res) != PGRES_TUPLES_OK)
+		elog(ERROR, "bdr init_replica: listing the nodes of the group failed: %s",
+			 PQerrorMessage(conn));
+
+	for (i = 0; i < PQntuples(res); i++)
+	{
+		BdrInitPeer *peer = palloc0(sizeof(BdrInitPeer));
+
+		if (sscanf(PQgetvalue(res, i, 0), UINT64_FORMAT, &peer->sysid) != 1 ||
+			sscanf(PQgetvalue(res, i, 1), "%u", &peer->timeline) != 1 ||
+			sscanf(PQgetvalue(res, i, 2), "%u", &peer->dboid) != 1)
+			elog(ERROR, "bdr init_replica: could not parse node identity ("
+				 "%s,%s,%s)", PQgetvalue(res, i, 0), PQgetvalue(res, i, 1),
+				 PQgetvalue(res, i, 2));
+
+		/* the source's changes are streamed from the join's own slot */
+		if ((peer->sysid == ri.sysid &&
+			 peer->timeline == ri.timeline &&
+			 peer->dboid == ri.dboid) ||
+			(peer->sysid == GetSystemIdentifier() &&
+			 peer->timeline == ThisTimeLineID &&
+			 peer->dboid == MyDatabaseId))
+		{
+			pfree(peer);
+			continue;
+		}
+
+		peer->dsn = pstrdup(PQgetvalue(res, i, 3));
+		peers = lappend(peers, peer);
+	}
+	PQclear(res);
+
+	foreach(lc, peers)
+	{
+		BdrInitPeer *peer = lfirst(lc);
+		PGconn	   *peer_conn;
+		NameData	slot_name;
+		uint64		sysid;
+		TimeLineID	timeline;
+		Oid			dboid;
+		char	   *snapshot;
+
+		/*
+		 * If the slot already exists from a prior attempt we'll leave it
+		 * alone, it starts earlier than a new one would.
+		 */
+		peer_conn = bdr_establish_connection_and_slot(peer->dsn, "mkslot",
+				&slot_name, &sysid, &timeline, &dboid, &peer->riident,
+				&snapshot);
+
+		/* Ensure the slot points to the node the conn info says it should */
+		if (peer->sysid != sysid ||
+			peer->timeline != timeline ||
+			peer->dboid != dboid)
+			ereport(ERROR,
+					(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+					 errmsg("System identification mismatch between connection and slot"),
+					 errdetail("Connection for "BDR_LOCALID_FORMAT" resulted in slot on node "BDR_LOCALID_FORMAT" instead of expected node",
+							   peer->sysid, peer->timeline, peer->dboid, EMPTY_REPLICATION_NAME,
+							   sysid, timeline, dboid, EMPTY_REPLICATION_NAME)));
+
+		/* We don't require the snapshot IDs here */
+		if (snapshot != NULL)
+			pfree(snapshot);
+		PQfinish(peer_conn);
+
+		/*
+		 * The slot starts before the peer's current position. Make sure the
+		 * peer commits something after it, so the source has something to
+		 * replay up to there even if the peer is idle.
+		 */
+		peer_conn = bdr_connect_nonrepl(peer->dsn, "init");
+		peer->wait_lsn = bdr_get_remote_lsn(peer_conn);
+		perform_pointless_transaction(peer_conn, NULL);
+		PQfinish(peer_conn);
+
+		elog(DEBUG2, "Ensured existence of slot %s on "BDR_LOCALID_FORMAT,
+			 NameStr(slot_name), peer->sysid, peer->timeline, peer->dboid,
+			 EMPTY_REPLICATION_NAME);
+	}
+
+	/* Wait for the source to replay every peer's changes up to its slot */
+	deadline = TimestampTzPlusMilliseconds(GetCurrentTimestamp(),
+										   BDR_INIT_PEERS_WAIT_TIMEOUT_MS);
+	for (;;)
+	{
+		int			rc;
+
+		nwaiting = 0;
+		foreach(lc, peers)
+		{
+			BdrInitPeer *peer = lfirst(lc);
+
+			if (peer->lsn != InvalidXLogRecPtr && peer->lsn >= peer->wait_lsn)
+				continue;
+
+			peer->lsn = bdr_init_remote_progress(conn, ri.dboid, peer);
+			if (peer->lsn == InvalidXLogRecPtr || peer->lsn < peer->wait_lsn)
+				nwaiting++;
+		}
+
+		if (nwaiting == 0)
+			break;
+
+		if (GetCurrentTimestamp() >= deadline)
+		{
+			ereport(WARNING,
+					(errmsg("bdr init_replica: the source didn't replay the changes of %d nodes up to their slots in time, catching up through the source",
+							nwaiting),
+					 errhint("Check that the source is connected to all nodes of the group.")));
+			list_free_deep(peers);
+			peers = NIL;
+			break;
+		}
+
+		elog(DEBUG1, "bdr init_replica: waiting for the source to replay the changes of %d nodes",
+			 nwaiting);
+
+		rc = WaitLatch(&MyProc->procLatch,
+					   WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
+					   1000L);
+
+		ResetLatch(&MyProc->procLatch);
+
+		/* emergency bailout if postmaster has died */
+		if (rc & WL_POSTMASTER_DEATH)
+			proc_exit(1);
+
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	free_remote_node_info(&ri);
+
+	return peers;
+}
+
+/*
+ * Check that the join's snapshot contains each peer's changes exactly up to
+ * the position bdr_init_prepare_peers noted, and if so advance the local
+ * replication identifier of each peer to it. Called once the snapshot was
+ * taken on the source conn is connected to.
+ *
+ * The source advances its progress of a peer when committing a transaction
+ * replayed from it, right after writing the commit record. If the progress
+ * didn't move between reading it before the snapshot was taken and now,
+ * every transaction up to it is in the snapshot and none after it. If it did
+ * move, the snapshot may or may not contain the transactions in between, and
+ * replaying them again from the peer would not be safe: a replayed INSERT
+ * can resurrect a row another node's change in the snapshot deleted since.
+ *
+ * Returns the peers, or NIL to catch up through the source instead, which
+ * is exact.
+ */
+static List *
+bdr_init_verify_peers(PGconn *conn, List *peers)
+{
+	remote_node_info ri;
+	ListCell   *lc;
+
+	bdr_get_remote_nodeinfo_internal(conn, &ri);
+
+	foreach(lc, peers)
+	{
+		BdrInitPeer *peer = lfirst(lc);
+		XLogRecPtr	lsn = bdr_init_remote_progress(conn, ri.dboid, peer);
+
+		if (lsn != peer->lsn)
+		{
+			elog(LOG, "bdr init_replica: the source replayed changes of "BDR_LOCALID_FORMAT" while the snapshot was taken, catching up through the source",
+				 peer->sysid, peer->timeline, peer->dboid,
+				 EMPTY_REPLICATION_NAME);
+			free_remote_node_info(&ri);
+			list_free_deep(peers);
+			return NIL;
+		}
+	}
+	free_remote_node_info(&ri);
+
+	StartTransactionCommand();
+	foreach(lc, peers)
+	{
+		BdrInitPeer *peer = lfirst(lc);
+
+		elog(DEBUG1, "bdr init_replica: catching up from "BDR_LOCALID_FORMAT" at %X/%X",
+			 peer->sysid, peer->timeline, peer->dboid, EMPTY_REPLICATION_NAME,
+			 (uint32) (peer->lsn >> 32), (uint32) peer->lsn);
+
+		AdvanceReplicationIdentifier(peer->riident, peer->lsn,
+									 InvalidXLogRecPtr);
+	}
+	CommitTransactionCommand();
+
+	return peers;
+}
+
+/*
+ * Record the peers prepared by bdr_init_prepare_peers, as the ones the join
+ * in snapshot catches up from directly.
+ */
+static void
+bdr_init_record_peers(List *peers, const char *snapshot)
+{
+	ListCell   *lc;
+
+	StartTransactionCommand();
+	SPI_connect();
+
+	foreach(lc, peers)
+	{
+		BdrInitPeer *peer = lfirst(lc);
+		Oid			argtypes[] = { TEXTOID, TEXTOID, OIDOID, OIDOID, LSNOID };
+		Datum		values[5];
+		char		sysid_str[33];
+		int			spi_ret;
+
+		snprintf(sysid_str, sizeof(sysid_str), UINT64_FORMAT, peer->sysid);
+		sysid_str[sizeof(sysid_str)-1] = '\0';
+
+		values[0] = CStringGetTextDatum(snapshot);
+		values[1] = CStringGetTextDatum(sysid_str);
+		values[2] = ObjectIdGetDatum(peer->timeline);
+		values[3] = ObjectIdGetDatum(peer->dboid);
+		values[4] = LSNGetDatum(peer->lsn);
+
+		spi_ret = SPI_execute_with_args(
+			"INSERT INTO bdr.bdr_init_checkpoints \n"
+			"    (step, snapshot, peer_sysid, peer_timeline, peer_dboid, peer_lsn) \n"
+			"VALUES ('peer', $1, $2, $3, $4, $5)",
+			5, argtypes, values, NULL, false, 0);
+
+		if (spi_ret != SPI_OK_INSERT)
+			elog(ERROR, "Unable to insert into bdr.bdr_init_checkpoints, SPI error %d",
+				 spi_ret);
+	}
+
+	SPI_finish();
+	CommitTransactionCommand();
+}
+
+/*
+ * Return the nodes other than ri to catch up from directly, as recorded by
+ * bdr_init_record_peers, or NIL to replay all changes through ri.
+ *
+ * That's also the case if a node we didn't prepare joined the group in the
+ * meantime: the changes it made before it has a slot for us are only
+ * available through ri.
+ */
+static List *
+bdr_init_catchup_peers(remote_node_info *ri)
+{
+	MemoryContext caller_ctx = CurrentMemoryContext;
+	Oid			argtypes[] = { TEXTOID, OIDOID, OIDOID, TEXTOID, OIDOID, OIDOID };
+	Datum		values[6];
+	char		local_sysid_str[33];
+	List	   *peers = NIL;
+	bool		complete = true;
+	int			spi_ret;
+	int			i;
+
+	snprintf(local_sysid_str, sizeof(local_sysid_str), UINT64_FORMAT,
+			 GetSystemIdentifier());
+	local_sysid_str[sizeof(local_sysid_str)-1] = '\0';
+
+	StartTransactionCommand();
+	SPI_connect();
+
+	values[0] = CStringGetTextDatum(local_sysid_str);
+	values[1] = ObjectIdGetDatum(ThisTimeLineID);
+	values[2] = ObjectIdGetDatum(MyDatabaseId);
+	values[3] = CStringGetTextDatum(ri->sysid_str);
+	values[4] = ObjectIdGetDatum(ri->timeline);
+	values[5] = ObjectIdGetDatum(ri->dboid);
+
+	spi_ret = SPI_execute_with_args(
+		"SELECT DISTINCT c.conn_sysid, c.conn_timeline, c.conn_dboid, \n"
+		"    p.peer_sysid IS NOT NULL AS prepared \n"
+		"FROM bdr.bdr_connections c \n"
+		"JOIN bdr.bdr_nodes n ON (n.node_sysid = c.conn_sysid \n"
+		"                         AND n.node_timeline = c.conn_timeline \n"
+		"                         AND n.node_dboid = c.conn_dboid) \n"
+		"LEFT JOIN bdr.bdr_init_checkpoints p ON (p.step = 'peer' \n"
+		"                                         AND p.peer_sysid = c.conn_sysid \n"
+		"                                         AND p.peer_timeline = c.conn_timeline \n"
+		"                                         AND p.peer_dboid = c.conn_dboid) \n"
+		"WHERE n.node_status <> 'k' \n"
+		"  AND NOT (c.conn_sysid = $1 AND c.conn_timeline = $2 AND c.conn_dboid = $3) \n"
+		"  AND NOT (c.conn_sysid = $4 AND c.conn_timeline = $5 AND c.conn_dboid = $6)",
+		6, argtypes, values, NULL, false, 0);
+
+	if (spi_ret != SPI_OK_SELECT)
+		elog(ERROR, "Unable to query bdr.bdr_init_checkpoints, SPI error %d",
+			 spi_ret);
+
+	for (i = 0; i < SPI_processed; i++)
+	{
+		HeapTuple	tuple = SPI_tuptable->vals[i];
+		TupleDesc	tupdesc = SPI_tuptable->tupdesc;
+		MemoryContext spi_ctx;
+		BdrInitPeer *peer;
+		char	   *sysid_str;
+		bool		isnull;
+
+		if (!DatumGetBool(SPI_getbinval(tuple, tupdesc, 4, &isnull)))
+		{
+			complete = false;
+			continue;
+		}
+
+		spi_ctx = MemoryContextSwitchTo(caller_ctx);
+		peer = palloc0(sizeof(BdrInitPeer));
+		sysid_str = SPI_getvalue(tuple, tupdesc, 1);
+		if (sscanf(sysid_str, UINT64_FORMAT, &peer->sysid) != 1)
+			elog(ERROR, "Parsing sysid uint64 from %s failed", sysid_str);
+		peer->timeline = DatumGetObjectId(SPI_getbinval(tuple, tupdesc, 2, &isnull));
+		peer->dboid = DatumGetObjectId(SPI_getbinval(tuple, tupdesc, 3, &isnull));
+		peers = lappend(peers, peer);
+		MemoryContextSwitchTo(spi_ctx);
+	}
+
+	SPI_finish();
+	CommitTransactionCommand();
+
+	if (!complete && peers != NIL)
+	{
+		elog(LOG, "bdr init_replica: a node joined the group during the join, catching up through the node the data was copied from only");
+		list_free_deep(peers);
+		peers = NIL;
+	}
+
+	return peers;
+}
+
 /*
  * Initialize the database, from a remote node if necessary.
  */
@@ -793,6 +1564,7 @@ bdr_init_replica(BDRNodeInfo *local_node)
 		 * XXX: is this actually a good idea?
 		 */
 		elog(DEBUG2, "init_replica: Marking as root/standalone node");
+		bdr_nodes_set_local_seq_id();
 		bdr_nodes_set_local_status('r');
 
 		return;
@@ -847,22 +1619,17 @@ bdr_init_replica(BDRNodeInfo *local_node)
 
 			case 'i':
 				/*
-				 * A previous init attempt seems to have failed.
-				 * Clean up, then fall through to start setup
-				 * again.
+				 * A previous init attempt failed or was interrupted. Resume
+				 * it from the checkpoints it left, see bdr_init_resume.
 				 *
-				 * We can't just re-use the slot and replication
-				 * identifier that were created last time (if
-				 * they were), because we have no way of getting
-				 * the slot's exported snapshot after
+				 * We can't re-use the slot that was created last time
+				 * unless all data was copied, because we have no way of
+				 * getting the slot's exported snapshot after
 				 * CREATE_REPLICATION_SLOT.
 				 *
-				 * We could drop and re-create the slot, but...
-				 *
-				 * We also have no way to undo a failed
-				 * pg_restore, so if that phase fails it's
-				 * necessary to do manual cleanup, dropping and
-				 * re-creating the db.
+				 * We also have no way to undo a failed pg_restore of the
+				 * schema, so if that phase fails it's still necessary to
+				 * do manual cleanup, dropping and re-creating the db.
 				 *
 				 * To avoid that We need to be able to run
 				 * pg_restore --clean, and that needs a way to
@@ -870,11 +1637,7 @@ bdr_init_replica(BDRNodeInfo *local_node)
 				 * and their dependencies like plpgsql and
 				 * btree_gist. (TODO patch pg_restore for that)
 				 */
-				ereport(ERROR,
-						(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
-						 errmsg("previous init failed, manual cleanup is required"),
-						 errdetail("Found bdr.bdr_nodes entry for "BDR_LOCALID_FORMAT" with state=i in remote bdr.bdr_nodes", BDR_LOCALID_FORMAT_ARGS),
-						 errhint("Remove all replication identifiers and slots corresponding to this node from the init target node then drop and recreate this database and try again")));
+				elog(DEBUG2, "resuming interrupted init");
 				break;
 
 			default:
@@ -882,7 +1645,7 @@ bdr_init_replica(BDRNodeInfo *local_node)
 				break;
 		}
 
-		if (status == 'b')
+		if (status == 'b' || status == 'i')
 		{
 			char	   *init_snapshot = NULL;
 			PGconn	   *init_repl_conn = NULL;
@@ -891,15 +1654,23 @@ bdr_init_replica(BDRNodeInfo *local_node)
 			TimeLineID  remote_timeline;
 			Oid			remote_dboid;
 			RepNodeId	repnodeid;
+			bool		keep_data = false;
+			List	   *peers = NIL;
 
-			elog(INFO, "initializing node");
+			if (status == 'b')
+			{
+				elog(INFO, "initializing node");
 
-			/*
-			 * We're starting from scratch or have cleaned up a previous failed
-			 * attempt.
-			 */
-			status = 'i';
-			bdr_nodes_set_local_status(status);
+				/* We're starting from scratch. */
+				status = 'i';
+				bdr_nodes_set_local_status(status);
+				bdr_init_checkpoint_forget(NULL);
+			}
+			else
+			{
+				elog(INFO, "resuming node initialization");
+				keep_data = bdr_init_resume(nonrepl_init_conn);
+			}
 
 			/*
 			 * This is unidirectional subscribe, let the other node know that
@@ -909,9 +1680,23 @@ bdr_init_replica(BDRNodeInfo *local_node)
 			if (local_conn_config == NULL)
 				bdr_remote_activate(nonrepl_init_conn);
 
+			/*
+			 * To catch up from every node in parallel we need slots on them
+			 * before the snapshot is taken. If we keep the data of an earlier
+			 * attempt we catch up the way it was going to.
+			 */
+			if (!keep_data)
+			{
+				bdr_init_checkpoint_forget("peer");
+				if (bdr_init_parallel_catchup && local_conn_config != NULL)
+					peers = bdr_init_prepare_peers(nonrepl_init_conn);
+			}
+
 			/*
 			 * Now establish our slot on the target node, so we can replay
-			 * changes from that node. It'll be used in catchup mode.
+			 * changes from that node. It'll be used in catchup mode. If we
+			 * keep the data of an earlier attempt we keep its slot too, and
+			 * don't get a snapshot.
 			 */
 			init_repl_conn = bdr_establish_connection_and_slot(
 								local_node->init_from_dsn,
@@ -919,10 +1704,24 @@ bdr_init_replica(BDRNodeInfo *local_node)
 								&remote_sysid, &remote_timeline, &remote_dboid,
 								&repnodeid, &init_snapshot);
 
+			if (!keep_data && init_snapshot == NULL)
+				elog(ERROR, "bdr init_replica: slot %s exists already",
+					 NameStr(slot_name));
+
+			if (peers != NIL)
+				peers = bdr_init_verify_peers(nonrepl_init_conn, peers);
+
+			if (peers != NIL)
+			{
+				bdr_init_record_peers(peers, init_snapshot);
+				list_free_deep(peers);
+			}
+
 			elog(INFO, "connected to target node "BDR_LOCALID_FORMAT
 				 " with snapshot %s",
 				 remote_sysid, remote_timeline, remote_dboid,
-				 EMPTY_REPLICATION_NAME, init_snapshot);
+				 EMPTY_REPLICATION_NAME,
+				 init_snapshot != NULL ? init_snapshot : "(none)");
 
 			/*
 			 * Take the remote dump and apply it. This will give us a local
@@ -953,7 +1752,8 @@ bdr_init_replica(BDRNodeInfo *local_node)
 			 */
 
 			PQfinish(init_repl_conn);
-			pfree(init_snapshot);
+			if (init_snapshot != NULL)
+				pfree(init_snapshot);
 
 			/*
 			 * This is group join, copy the state (bdr_nodes and
@@ -974,8 +1774,11 @@ bdr_init_replica(BDRNodeInfo *local_node)
 
 		if (status == 'c')
 		{
-			XLogRecPtr min_remote_lsn;
 			remote_node_info ri;
+			List	   *peers;
+			ListCell   *lc;
+			BdrCatchupWorker *workers;
+			int			nworkers = 0;
 
 			/*
 			 * Launch outbound connections to all other nodes. It doesn't
@@ -984,9 +1787,19 @@ bdr_init_replica(BDRNodeInfo *local_node)
 			 * if we switched to replaying from these slots now.  We'll be
 			 * advancing them in catchup mode until they overtake their current
 			 * position before switching to replaying from them directly.
+			 *
+			 * Unless the join catches up from every node in parallel; then
+			 * the slots were made before the dump, see
+			 * bdr_init_prepare_peers, and are left alone here.
 			 */
 			bdr_init_make_other_slots();
 
+			bdr_get_remote_nodeinfo_internal(nonrepl_init_conn, &ri);
+			peers = bdr_init_catchup_peers(&ri);
+
+			workers = palloc0(sizeof(BdrCatchupWorker) *
+							  (list_length(peers) + 1));
+
 			/*
 			 * Enter catchup mode and wait until we've replayed up to the LSN
 			 * the remote was at when we started catchup.
@@ -995,10 +1808,17 @@ bdr_init_replica(BDRNodeInfo *local_node)
 			 * were committed on a 3rd party node before we made our slot on it
 			 * but not replicated to the init target node until after we exit
 			 * catchup mode. If we acquire the DDL lock during join we can know
-			 * that can't happen, so we should do that.
+			 * that can't happen, so we should do that. Catching up from every
+			 * node in parallel doesn't have that problem.
 			 */
 			elog(DEBUG3, "getting LSN to replay to in catchup mode");
-			min_remote_lsn = bdr_get_remote_lsn(nonrepl_init_conn);
+			workers[0].sysid = ri.sysid;
+			workers[0].timeline = ri.timeline;
+			workers[0].dboid = ri.dboid;
+			workers[0].target_lsn = bdr_get_remote_lsn(nonrepl_init_conn);
+			/* replay the other nodes' changes too, unless they have workers */
+			workers[0].forward_changesets = (peers == NIL);
+			nworkers++;
 
 			/*
 			 * Catchup cannot complete if there isn't at least one remote transaction
@@ -1015,21 +1835,48 @@ bdr_init_replica(BDRNodeInfo *local_node)
 			elog(DEBUG3, "forcing a new transaction on the target node");
 			perform_pointless_transaction(nonrepl_init_conn, local_node);
 
-			bdr_get_remote_nodeinfo_internal(nonrepl_init_conn, &ri);
+			/* Likewise on every other node we catch up from */
+			foreach(lc, peers)
+			{
+				BdrInitPeer *peer = lfirst(lc);
+				BdrCatchupWorker *cw = &workers[nworkers++];
+				BdrConnectionConfig *cfg;
+				PGconn	   *peer_conn;
 
-			/* Launch the catchup worker and wait for it to finish */
-			elog(DEBUG1, "launching catchup mode apply worker");
-			bdr_catchup_to_lsn(&ri, min_remote_lsn);
+				cfg = bdr_get_connection_config(peer->sysid, peer->timeline,
+												peer->dboid, false);
+				peer_conn = bdr_connect_nonrepl(cfg->dsn, "init");
 
+				cw->sysid = peer->sysid;
+				cw->timeline = peer->timeline;
+				cw->dboid = peer->dboid;
+				cw->target_lsn = bdr_get_remote_lsn(peer_conn);
+				cw->forward_changesets = false;
+
+				perform_pointless_transaction(peer_conn, local_node);
+
+				PQfinish(peer_conn);
+				bdr_free_connection_config(cfg);
+			}
+
+			/* Launch the catchup workers and wait for them to finish */
+			elog(DEBUG1, "launching %d catchup mode apply workers", nworkers);
+			bdr_catchup_to_lsn(workers, nworkers);
+
+			pfree(workers);
+			list_free_deep(peers);
 			free_remote_node_info(&ri);
 
+			/* The join's checkpoints aren't needed anymore */
+			bdr_init_checkpoint_forget(NULL);
+
 			/*
 			 * We're done with catchup. The next phase is inserting our
 			 * conninfo, so set status=o
 			 */
 			status = 'o';
 			bdr_nodes_set_local_status(status);
-			elog(DEBUG1, "catchup worker finished, requesting slot creation");
+			elog(DEBUG1, "catchup workers finished, requesting slot creation");
 		}
 
 		/* To reach here we must be waiting for slot creation */
@@ -1098,105 +1945,138 @@ bdr_init_replica(BDRNodeInfo *local_node)
 
 /*
  * Cleanup function after catchup; makes sure we free the bgworker
- * slot for the catchup worker.
+ * slots for the catchup workers, stopping any still running if we're
+ * bailing out.
  */
 static void
-bdr_catchup_to_lsn_cleanup(int code, Datum offset)
+bdr_catchup_to_lsn_cleanup(int code, Datum arg)
 {
-	uint32 worker_shmem_idx = DatumGetInt32(offset);
+	BdrCatchup *catchup = (BdrCatchup *) DatumGetPointer(arg);
+	int			i;
 
-	/*
-	 * Clear the worker's shared memory struct now we're done with it.
-	 *
-	 * There's no need to unregister the worker as it was registered with
-	 * BGW_NEVER_RESTART.
-	 */
-	bdr_worker_shmem_free(&BdrWorkerCtl->slots[worker_shmem_idx], NULL);
+	for (i = 0; i < catchup->nworkers; i++)
+	{
+		BdrCatchupWorker *cw = &catchup->workers[i];
+
+		if (cw->handle != NULL)
+		{
+			TerminateBackgroundWorker(cw->handle);
+			pfree(cw->handle);
+			cw->handle = NULL;
+		}
+
+		/*
+		 * Clear the worker's shared memory struct now we're done with it.
+		 *
+		 * There's no need to unregister the worker as it was registered with
+		 * BGW_NEVER_RESTART.
+		 */
+		if (cw->worker != NULL)
+		{
+			bdr_worker_shmem_free(cw->worker, NULL);
+			cw->worker = NULL;
+		}
+	}
 }
 
 /*
- * Launch a temporary apply worker in catchup mode (forward_changesets=t),
- * set to replay until the passed LSN.
+ * Launch a temporary apply worker in catchup mode for each of the passed
+ * nodes, set to replay until the node's target LSN, and wait for all of
+ * them to get there.
  *
- * This worker will receive and apply all changes the remote server has
- * received since the snapshot we got our dump from was taken, including
- * those from other servers, and will advance the replication identifiers
- * associated with each remote node appropriately.
+ * A worker with forward_changesets set will receive and apply all changes the
+ * remote server has received since the snapshot we got our dump from was
+ * taken, including those from other servers, and will advance the
+ * replication identifiers associated with each remote node appropriately.
+ * Without, it only applies the changes made on the remote server itself,
+ * the other nodes' are replayed by workers of their own.
  *
- * When we finish applying and the worker exits, we'll be caught up with the
- * remote and in a consistent state where all our local replication identifiers
- * are consistent with the actual state of the local DB.
+ * When we finish applying and the workers exit, we'll be caught up with the
+ * remotes and in a consistent state where all our local replication
+ * identifiers are consistent with the actual state of the local DB.
  */
 static void
-bdr_catchup_to_lsn(remote_node_info *ri, XLogRecPtr target_lsn)
+bdr_catchup_to_lsn(BdrCatchupWorker *workers, int nworkers)
 {
-	uint32 worker_shmem_idx;
-	BdrWorker *worker;
-	BdrApplyWorker *catchup_worker;
-
-	elog(DEBUG1, "Registering bdr apply catchup worker for "BDR_LOCALID_FORMAT" to lsn %X/%X",
-		 ri->sysid, ri->timeline, ri->dboid, EMPTY_REPLICATION_NAME,
-		 (uint32)(target_lsn>>32), (uint32)target_lsn);
+	BdrCatchup	catchup;
+	int			i;
 
 	Assert(bdr_worker_type == BDR_WORKER_PERDB);
-	/* Create the shmem entry for the catchup worker */
-	LWLockAcquire(BdrWorkerCtl->lock, LW_EXCLUSIVE);
-	worker = bdr_worker_shmem_alloc(BDR_WORKER_APPLY, &worker_shmem_idx);
-	catchup_worker = &worker->data.apply;
-	catchup_worker->dboid = MyDatabaseId;
-	catchup_worker->remote_sysid = ri->sysid;
-	catchup_worker->remote_timeline = ri->timeline;
-	catchup_worker->remote_dboid = ri->dboid;
-	catchup_worker->perdb = bdr_worker_slot;
-	LWLockRelease(BdrWorkerCtl->lock);
+
+	catchup.workers = workers;
+	catchup.nworkers = nworkers;
 
 	/*
-	 * Launch the catchup worker, ensuring that we free the shmem slot for the
-	 * catchup worker even if we hit an error.
-	 *
-	 * There's a small race between claiming the worker and entering the ensure
-	 * cleanup block. The real consequences are pretty much nil, since this is
-	 * really just startup code and all we leak is one shmem slot.
+	 * Launch the catchup workers, ensuring that we free their shmem slots
+	 * even if we hit an error.
 	 */
 	PG_ENSURE_ERROR_CLEANUP(bdr_catchup_to_lsn_cleanup,
-							Int32GetDatum(worker_shmem_idx));
+							PointerGetDatum(&catchup));
 	{
-		BgwHandleStatus bgw_status;
-		BackgroundWorker bgw;
-		BackgroundWorkerHandle *bgw_handle;
-		pid_t bgw_pid;
-		pid_t prev_bgw_pid = 0;
-		uint32 worker_arg;
-
-		/* Special parameters for a catchup worker only */
-		catchup_worker->replay_stop_lsn = target_lsn;
-		catchup_worker->forward_changesets = true;
-
-		/* and the BackgroundWorker, which is a regular apply worker */
-		bgw.bgw_flags = BGWORKER_SHMEM_ACCESS |
-			BGWORKER_BACKEND_DATABASE_CONNECTION;
-		bgw.bgw_start_time = BgWorkerStart_RecoveryFinished;
-		bgw.bgw_main = NULL;
-		strncpy(bgw.bgw_library_name, BDR_LIBRARY_NAME, BGW_MAXLEN);
-		strncpy(bgw.bgw_function_name, "bdr_apply_main", BGW_MAXLEN);
-
-		bgw.bgw_restart_time = BGW_NEVER_RESTART;
-		Assert(MyProc->pid != 0);
-		bgw.bgw_notify_pid = MyProc->pid;
-
-		Assert(worker_shmem_idx <= UINT16_MAX);
-		worker_arg = (((uint32)BdrWorkerCtl->worker_generation) << 16) | (uint32)worker_shmem_idx;
-		bgw.bgw_main_arg = Int32GetDatum(worker_arg);
-
-		snprintf(bgw.bgw_name, BGW_MAXLEN,
-				 "bdr: catchup apply to %X/%X",
-				 (uint32)(target_lsn >> 32), (uint32)target_lsn);
-		bgw.bgw_name[BGW_MAXLEN-1] = '\0';
-
-		/* Launch the catchup worker and wait for it to start */
-		RegisterDynamicBackgroundWorker(&bgw, &bgw_handle);
-		bgw_status = WaitForBackgroundWorkerStartup(bgw_handle, &bgw_pid);
-		prev_bgw_pid = bgw_pid;
+		int			nrunning = 0;
+
+		for (i = 0; i < nworkers; i++)
+		{
+			BdrCatchupWorker *cw = &workers[i];
+			BdrApplyWorker *catchup_worker;
+			BackgroundWorker bgw;
+			BgwHandleStatus bgw_status;
+			uint32		worker_shmem_idx;
+			uint32		worker_arg;
+
+			elog(DEBUG1, "Registering bdr apply catchup worker for "BDR_LOCALID_FORMAT" to lsn %X/%X",
+				 cw->sysid, cw->timeline, cw->dboid, EMPTY_REPLICATION_NAME,
+				 (uint32)(cw->target_lsn>>32), (uint32)cw->target_lsn);
+
+			/* Create the shmem entry for the catchup worker */
+			LWLockAcquire(BdrWorkerCtl->lock, LW_EXCLUSIVE);
+			cw->worker = bdr_worker_shmem_alloc(BDR_WORKER_APPLY, &worker_shmem_idx);
+			catchup_worker = &cw->worker->data.apply;
+			catchup_worker->dboid = MyDatabaseId;
+			catchup_worker->remote_sysid = cw->sysid;
+			catchup_worker->remote_timeline = cw->timeline;
+			catchup_worker->remote_dboid = cw->dboid;
+			catchup_worker->perdb = bdr_worker_slot;
+
+			/* Special parameters for a catchup worker only */
+			catchup_worker->replay_stop_lsn = cw->target_lsn;
+			catchup_worker->forward_changesets = cw->forward_changesets;
+			LWLockRelease(BdrWorkerCtl->lock);
+
+			/* and the BackgroundWorker, which is a regular apply worker */
+			bgw.bgw_flags = BGWORKER_SHMEM_ACCESS |
+				BGWORKER_BACKEND_DATABASE_CONNECTION;
+			bgw.bgw_start_time = BgWorkerStart_RecoveryFinished;
+			bgw.bgw_main = NULL;
+			strncpy(bgw.bgw_library_name, BDR_LIBRARY_NAME, BGW_MAXLEN);
+			strncpy(bgw.bgw_function_name, "bdr_apply_main", BGW_MAXLEN);
+
+			bgw.bgw_restart_time = BGW_NEVER_RESTART;
+			Assert(MyProc->pid != 0);
+			bgw.bgw_notify_pid = MyProc->pid;
+
+			Assert(worker_shmem_idx <= UINT16_MAX);
+			worker_arg = (((uint32)BdrWorkerCtl->worker_generation) << 16) | (uint32)worker_shmem_idx;
+			bgw.bgw_main_arg = Int32GetDatum(worker_arg);
+
+			snprintf(bgw.bgw_name, BGW_MAXLEN,
+					 "bdr: catchup apply to %X/%X",
+					 (uint32)(cw->target_lsn >> 32), (uint32)cw->target_lsn);
+			bgw.bgw_name[BGW_MAXLEN-1] = '\0';
+
+			/* Launch the catchup worker and wait for it to start */
+			if (!RegisterDynamicBackgroundWorker(&bgw, &cw->handle))
+				ereport(ERROR,
+						(errcode(ERRCODE_CONFIGURATION_LIMIT_EXCEEDED),
+						 errmsg("could not register background process for catchup from "BDR_LOCALID_FORMAT,
+								cw->sysid, cw->timeline, cw->dboid, EMPTY_REPLICATION_NAME),
+						 errhint("You may need to increase max_worker_processes.")));
+
+			bgw_status = WaitForBackgroundWorkerStartup(cw->handle, &cw->pid);
+			if (bgw_status == BGWH_POSTMASTER_DIED)
+				proc_exit(1);
+			nrunning++;
+		}
 
 		/*
 		 * Sleep on our latch until we're woken by SIGUSR1 on bgworker state
@@ -1204,9 +2084,67 @@ bdr_catchup_to_lsn(remote_node_info *ri, XLogRecPtr target_lsn)
 		 * between bgworker start and our setting the latch; if it starts and
 		 * dies again quickly we'll miss it and sleep forever w/o a timeout).
 		 */
-		while (bgw_status == BGWH_STARTED && bgw_pid == prev_bgw_pid)
+		while (nrunning > 0)
 		{
 			int rc;
+
+			for (i = 0; i < nworkers; i++)
+			{
+				BdrCatchupWorker *cw = &workers[i];
+				BgwHandleStatus bgw_status;
+				pid_t		bgw_pid;
+
+				if (cw->handle == NULL)
+					continue;
+
+				/* Is our worker still replaying? */
+				bgw_status = GetBackgroundWorkerPid(cw->handle, &bgw_pid);
+				if (bgw_status == BGWH_STARTED && bgw_pid == cw->pid)
+					continue;
+
+				switch(bgw_status)
+				{
+					case BGWH_POSTMASTER_DIED:
+						proc_exit(1);
+						break;
+					case BGWH_STOPPED:
+					case BGWH_STARTED:
+						/* stopped, or restarted despite BGW_NEVER_RESTART */
+						TerminateBackgroundWorker(cw->handle);
+						break;
+					case BGWH_NOT_YET_STARTED:
+						/* Should be unreachable */
+						elog(ERROR, "Unreachable case, bgw status %d", bgw_status);
+						break;
+				}
+				pfree(cw->handle);
+				cw->handle = NULL;
+				nrunning--;
+
+				/*
+				 * Stopped doesn't mean *successful*. The worker might've
+				 * errored out. We have no way of getting its exit status, so
+				 * we have to rely on it setting something in shmem on
+				 * successful exit. In this case it will set replay_stop_lsn to
+				 * InvalidXLogRecPtr to indicate that replay is done.
+				 */
+				if (cw->worker->data.apply.replay_stop_lsn != InvalidXLogRecPtr)
+				{
+					/* Worker must've died before it finished */
+					elog(ERROR,
+						 "catchup worker for "BDR_LOCALID_FORMAT" exited before catching up to target LSN %X/%X",
+						 cw->sysid, cw->timeline, cw->dboid, EMPTY_REPLICATION_NAME,
+						 (uint32)(cw->target_lsn>>32), (uint32)cw->target_lsn);
+				}
+
+				elog(DEBUG1, "catchup worker for "BDR_LOCALID_FORMAT" caught up to target LSN, %d still replaying",
+					 cw->sysid, cw->timeline, cw->dboid, EMPTY_REPLICATION_NAME,
+					 nrunning);
+			}
+
+			if (nrunning == 0)
+				break;
+
 			rc = WaitLatch(&MyProc->procLatch,
 						   WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
 						   1000L);
@@ -1217,48 +2155,13 @@ bdr_catchup_to_lsn(remote_node_info *ri, XLogRecPtr target_lsn)
 			if (rc & WL_POSTMASTER_DEATH)
 				proc_exit(1);
 
-			/* Is our worker still replaying? */
-			bgw_status = GetBackgroundWorkerPid(bgw_handle, &bgw_pid);
-		}
-		switch(bgw_status)
-		{
-			case BGWH_POSTMASTER_DIED:
-				proc_exit(1);
-				break;
-			case BGWH_STOPPED:
-				TerminateBackgroundWorker(bgw_handle);
-				break;
-			case BGWH_NOT_YET_STARTED:
-			case BGWH_STARTED:
-				/* Should be unreachable */
-				elog(ERROR, "Unreachable case, bgw status %d", bgw_status);
-				break;
-		}
-		pfree(bgw_handle);
-
-		/*
-		 * Stopped doesn't mean *successful*. The worker might've errored
-		 * out. We have no way of getting its exit status, so we have to rely
-		 * on it setting something in shmem on successful exit. In this case
-		 * it will set replay_stop_lsn to InvalidXLogRecPtr to indicate that
-		 * replay is done.
-		 */
-		if (catchup_worker->replay_stop_lsn != InvalidXLogRecPtr)
-		{
-			/* Worker must've died before it finished */
-			elog(ERROR,
-				 "catchup worker exited before catching up to target LSN %X/%X",
-				 (uint32)(target_lsn>>32), (uint32)target_lsn);
-		}
-		else
-		{
-			elog(DEBUG1, "catchup worker caught up to target LSN");
+			CHECK_FOR_INTERRUPTS();
 		}
 	}
 	PG_END_ENSURE_ERROR_CLEANUP(bdr_catchup_to_lsn_cleanup,
-								Int32GetDatum(worker_shmem_idx));
+								PointerGetDatum(&catchup));
 
-	bdr_catchup_to_lsn_cleanup(0, Int32GetDatum(worker_shmem_idx));
+	bdr_catchup_to_lsn_cleanup(0, PointerGetDatum(&catchup));
 
 	/* We're caught up! */
 }
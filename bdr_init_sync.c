@@ -0,0 +1,2056 @@
+/* -------------------------------------------------------------------------
+ *
+ * bdr_init_sync.c
+ *		Stream table data from an existing node into a joining node
+ *
+ * Copyright (C) 2012-2015, PostgreSQL Global Development Group
+ *
+ * IDENTIFICATION
+ *		bdr_init_sync.c
+ *
+ * During a logical join the schema is restored from a dump without table
+ * data, then the data of every table is copied here: each table's COPY
+ * TO stdout on the remote node is relayed straight into a COPY FROM stdin
+ * on the local database, so nothing is written to temporary files.
+ *
+ * Up to bdr.init_replica_jobs tables are copied at once, each over its own
+ * pair of connections. All remote connections import the snapshot exported
+ * when the join's replication slot was created, so together they see the
+ * same consistent state the slot streams changes from. The copies are
+ * multiplexed with nonblocking libpq in the calling worker, most of the
+ * work is done by the backends on either side anyway. Tables whose column
+ * types can be sent in binary are copied in binary format if the nodes are
+ * compatible.
+ *
+ * So one big table doesn't hold up the whole copy, tables larger than the
+ * share of the data each job should get in a few goes are split into parts
+ * by ranges of their primary key, copied concurrently like separate tables.
+ * That needs a single-column integer primary key; 9.4 can't scan a range of
+ * blocks of a table without reading all of it. Parts are handed out largest
+ * first to whichever job is idle.
+ *
+ * Indexes, constraints and triggers are only created once all data is in.
+ * A table copied in one go is truncated in the transaction copying it, so
+ * COPY FREEZE can write its rows frozen and with hint bits set, sparing the
+ * new node from rewriting all of them again soon. The order the indexes and
+ * constraints are then built in by pg_restore is set by
+ * bdr_init_sync_order_post_data.
+ *
+ * Each part copied is recorded in bdr.bdr_init_checkpoints in the
+ * transaction that copied it, as are the restored schema and the end of the
+ * copy. A part whose copy fails is copied again on new connections, while
+ * the join snapshot can still be imported, keeping the parts already copied.
+ * The snapshot doesn't survive the worker though. After a restart the data
+ * copied can only be kept if all of it was, and the join's slot still
+ * exists to stream the changes made since. Otherwise the join starts over
+ * with a new slot and snapshot: tables copied in the old snapshot are
+ * emptied and copied again, data read in two snapshots can't be combined
+ * without losing or duplicating the changes made in between.
+ *
+ * The progress of each join, and of each table being copied, is kept in
+ * shared memory for bdr.bdr_init_progress and bdr.bdr_init_table_progress.
+ * -------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <sys/select.h>
+#include <sys/time.h>
+
+#include "bdr.h"
+
+#include "fmgr.h"
+#include "funcapi.h"
+#include "libpq-fe.h"
+#include "miscadmin.h"
+
+#include "access/transam.h"
+#include "access/xact.h"
+
+#include "catalog/pg_type.h"
+
+#include "executor/spi.h"
+
+#include "libpq/md5.h"
+
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/pmsignal.h"
+#include "storage/shmem.h"
+
+#include "storage/fd.h"
+
+#include "utils/builtins.h"
+#include "utils/hsearch.h"
+#include "utils/timestamp.h"
+#include "utils/tuplestore.h"
+
+/* as the maximum of bdr.init_replica_jobs */
+#define BDR_INIT_SYNC_MAX_JOBS 64
+
+/* tables are split into parts of about total size / (jobs * this) */
+#define BDR_INIT_SYNC_PARTS_PER_JOB 4
+/* but never smaller than this */
+#define BDR_INIT_SYNC_MIN_PART_SIZE ((int64) 64 * 1024 * 1024)
+
+/* a part failing more often than this fails the join */
+#define BDR_INIT_SYNC_PART_RETRIES 5
+/* delay before copying it again, times the number of failures so far */
+#define BDR_INIT_SYNC_RETRY_DELAY_MS 1000
+
+#define BDR_INIT_PROGRESS_COLS 11
+#define BDR_INIT_TABLE_PROGRESS_COLS 8
+
+typedef struct BdrInitJobProgress
+{
+	/* table being copied, empty if idle */
+	NameData	nspname;
+	NameData	relname;
+	bool		binary;
+	/* size of the table on the remote node */
+	int64		size;
+	int64		rows;
+	int64		bytes;
+	TimestampTz started;
+} BdrInitJobProgress;
+
+/* Progress of the join of one database */
+typedef struct BdrInitProgress
+{
+	/* InvalidOid if the entry is unused */
+	Oid			dboid;
+	int			pid;
+	BdrInitPhase phase;
+	TimestampTz started;
+	TimestampTz copy_started;
+	int			ntables;
+	int			ntables_done;
+	/* remote size of all tables, and of those copied */
+	int64		size;
+	int64		size_done;
+	/* copied from the tables done */
+	int64		rows_done;
+	int64		bytes_done;
+	int			njobs;
+	BdrInitJobProgress jobs[BDR_INIT_SYNC_MAX_JOBS];
+} BdrInitProgress;
+
+typedef struct BdrInitProgressControl
+{
+	/* protects all entries */
+	LWLockId	lock;
+	int			nentries;
+	BdrInitProgress entries[FLEXIBLE_ARRAY_MEMBER];
+} BdrInitProgressControl;
+
+static BdrInitProgressControl *BdrInitProgressCtl = NULL;
+static int	bdr_init_progress_nentries = 0;
+
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+/* this process' entry, while it's joining a database */
+static BdrInitProgress *MyInitProgress = NULL;
+
+static const char *const bdr_init_phase_names[] = {
+	"dumping schema",
+	"restoring schema",
+	"copying data",
+	"building indexes and constraints"
+};
+
+PGDLLEXPORT Datum bdr_get_init_progress(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum bdr_get_init_table_progress(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(bdr_get_init_progress);
+PG_FUNCTION_INFO_V1(bdr_get_init_table_progress);
+
+static void bdr_init_sync_shmem_startup(void);
+
+/*
+ * Tables pg_dump would copy data of: all ordinary tables, but of those
+ * belonging to extensions only configuration tables, with their dump
+ * condition. BDR's own node and connection tables aren't copied, they're
+ * set up by the join itself. Largest first.
+ *
+ * Also whether the table can be copied in binary format. Like the output
+ * plugin, only send builtin types and plain user-defined types that way;
+ * arrays and composites of user-defined types embed type oids which differ
+ * between nodes. And the primary key column to split the table by, if any.
+ */
+#define BDR_INIT_SYNC_TABLES_QUERY \
+	"SELECT pg_relation_size(c.oid), n.nspname, c.relname, \n" \
+	"       (SELECT e.extcondition[i] \n" \
+	"        FROM pg_extension e, generate_subscripts(e.extconfig, 1) i \n" \
+	"        WHERE e.extconfig[i] = c.oid), \n" \
+	"       NOT EXISTS (SELECT 1 FROM pg_attribute a \n" \
+	"                   JOIN pg_type t ON (t.oid = a.atttypid) \n" \
+	"                   WHERE a.attrelid = c.oid AND a.attnum > 0 \n" \
+	"                     AND NOT a.attisdropped \n" \
+	"                     AND a.atttypid >= " CppAsString2(FirstNormalObjectId) " \n" \
+	"                     AND (t.typtype NOT IN ('b', 'e') OR t.typelem <> 0 \n" \
+	"                          OR t.typsend = 0 OR t.typreceive = 0)), \n" \
+	"       (SELECT a.attname FROM pg_index i \n" \
+	"        JOIN pg_attribute a ON (a.attrelid = i.indrelid AND a.attnum = i.indkey[0]) \n" \
+	"        WHERE i.indrelid = c.oid AND i.indisprimary AND i.indnatts = 1 \n" \
+	"          AND a.atttypid IN ('int2'::regtype, 'int4'::regtype, 'int8'::regtype)) \n" \
+	"FROM pg_class c JOIN pg_namespace n ON (n.oid = c.relnamespace) \n" \
+	"WHERE c.relkind = 'r' AND c.relpersistence <> 't' \n" \
+	"  AND n.nspname NOT IN ('pg_catalog', 'information_schema') \n" \
+	"  AND n.nspname !~ '^pg_toast' \n" \
+	"  AND (n.nspname, c.relname) NOT IN (('bdr', 'bdr_nodes'), ('bdr', 'bdr_connections')) \n" \
+	"  AND (NOT EXISTS (SELECT 1 FROM pg_depend d \n" \
+	"                   WHERE d.classid = 'pg_class'::regclass AND d.objid = c.oid \n" \
+	"                     AND d.deptype = 'e') \n" \
+	"       OR EXISTS (SELECT 1 FROM pg_extension e WHERE c.oid = ANY (e.extconfig))) \n" \
+	"ORDER BY 1 DESC"
+
+typedef struct BdrSyncTable
+{
+	char	   *nspname;
+	char	   *relname;
+	char	   *name;
+	bool		binary;
+	int64		size;
+	/* extension configuration table's condition, or NULL */
+	char	   *condition;
+	/* quoted integer primary key column, or NULL */
+	char	   *key;
+	/* with and without FREEZE */
+	char	   *copy_in;
+	char	   *copy_in_freeze;
+	/* parts the table is copied in, and those not copied yet */
+	int			nparts;
+	int			nparts_left;
+} BdrSyncTable;
+
+/* All of a table, or a range of its primary key */
+typedef struct BdrSyncPart
+{
+	BdrSyncTable *table;
+	/* number of the part within the table, from 0 */
+	int			partno;
+	char	   *copy_out;
+	/* estimated */
+	int64		size;
+	/* failed copies */
+	int			attempts;
+} BdrSyncPart;
+
+typedef struct BdrSyncJob
+{
+	PGconn	   *source;
+	PGconn	   *target;
+	/* part being copied, or NULL if idle */
+	BdrSyncPart *part;
+	/* whether the COPY of part has been started */
+	bool		copying;
+	/* if set, the part failed; copy it again on new connections then */
+	TimestampTz retry_at;
+	BdrCopyState copy;
+	BdrCopyStatus status;
+} BdrSyncJob;
+
+typedef struct BdrSync
+{
+	const char *source_dsn;
+	const char *target_dsn;
+	const char *snapshot;
+	int			njobs;
+	BdrSyncJob *jobs;
+} BdrSync;
+
+static Size
+bdr_init_sync_shmem_size(int ndatabases)
+{
+	Size		size = 0;
+
+	size = add_size(size, offsetof(BdrInitProgressControl, entries));
+	size = add_size(size, mul_size(ndatabases, sizeof(BdrInitProgress)));
+
+	return size;
+}
+
+void
+bdr_init_sync_shmem_init(int ndatabases)
+{
+	Assert(process_shared_preload_libraries_in_progress);
+
+	bdr_init_progress_nentries = ndatabases;
+
+	RequestAddinShmemSpace(bdr_init_sync_shmem_size(ndatabases));
+	RequestAddinLWLocks(1);
+
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = bdr_init_sync_shmem_startup;
+}
+
+static void
+bdr_init_sync_shmem_startup(void)
+{
+	bool		found;
+
+	if (prev_shmem_startup_hook != NULL)
+		prev_shmem_startup_hook();
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+	BdrInitProgressCtl = ShmemInitStruct("bdr_init_progress",
+										 bdr_init_sync_shmem_size(bdr_init_progress_nentries),
+										 &found);
+	if (!found)
+	{
+		memset(BdrInitProgressCtl, 0,
+			   bdr_init_sync_shmem_size(bdr_init_progress_nentries));
+		BdrInitProgressCtl->lock = LWLockAssign();
+		BdrInitProgressCtl->nentries = bdr_init_progress_nentries;
+	}
+	LWLockRelease(AddinShmemInitLock);
+}
+
+/*
+ * Start reporting the progress of joining the current database.
+ */
+void
+bdr_init_progress_start(void)
+{
+	BdrInitProgressControl *ctl = BdrInitProgressCtl;
+	BdrInitProgress *free_entry = NULL;
+	int			i;
+
+	LWLockAcquire(ctl->lock, LW_EXCLUSIVE);
+	for (i = 0; i < ctl->nentries; i++)
+	{
+		BdrInitProgress *entry = &ctl->entries[i];
+
+		/* left behind by an earlier attempt */
+		if (entry->dboid == MyDatabaseId)
+		{
+			free_entry = entry;
+			break;
+		}
+		if (entry->dboid == InvalidOid && free_entry == NULL)
+			free_entry = entry;
+	}
+
+	if (free_entry != NULL)
+	{
+		memset(free_entry, 0, sizeof(BdrInitProgress));
+		free_entry->dboid = MyDatabaseId;
+		free_entry->pid = MyProcPid;
+		free_entry->started = GetCurrentTimestamp();
+	}
+	LWLockRelease(ctl->lock);
+
+	/* one entry per perdb worker, so this can't happen */
+	if (free_entry == NULL)
+		elog(WARNING, "no free slot to report join progress in");
+
+	MyInitProgress = free_entry;
+}
+
+void
+bdr_init_progress_phase(BdrInitPhase phase)
+{
+	if (MyInitProgress == NULL)
+		return;
+
+	LWLockAcquire(BdrInitProgressCtl->lock, LW_EXCLUSIVE);
+	MyInitProgress->phase = phase;
+	LWLockRelease(BdrInitProgressCtl->lock);
+}
+
+void
+bdr_init_progress_end(void)
+{
+	if (MyInitProgress == NULL)
+		return;
+
+	LWLockAcquire(BdrInitProgressCtl->lock, LW_EXCLUSIVE);
+	MyInitProgress->dboid = InvalidOid;
+	LWLockRelease(BdrInitProgressCtl->lock);
+
+	MyInitProgress = NULL;
+}
+
+/*
+ * Publish the progress of the running copies.
+ */
+static void
+bdr_init_sync_report(BdrSync *sync)
+{
+	BdrInitProgress *progress = MyInitProgress;
+	int			i;
+
+	if (progress == NULL)
+		return;
+
+	LWLockAcquire(BdrInitProgressCtl->lock, LW_EXCLUSIVE);
+	progress->njobs = sync->njobs;
+	for (i = 0; i < sync->njobs; i++)
+	{
+		BdrSyncJob *job = &sync->jobs[i];
+
+		if (job->part == NULL)
+			continue;
+		progress->jobs[i].rows = job->copy.rows;
+		progress->jobs[i].bytes = job->copy.bytes;
+	}
+	LWLockRelease(BdrInitProgressCtl->lock);
+}
+
+/*
+ * Publish that job started copying its part, or copied it if done is set.
+ */
+static void
+bdr_init_sync_report_part(int jobno, BdrSyncJob *job, bool done)
+{
+	BdrSyncTable *table = job->part->table;
+	BdrInitProgress *progress = MyInitProgress;
+	BdrInitJobProgress *jobprogress;
+
+	if (progress == NULL)
+		return;
+
+	jobprogress = &progress->jobs[jobno];
+
+	LWLockAcquire(BdrInitProgressCtl->lock, LW_EXCLUSIVE);
+	if (done)
+	{
+		if (table->nparts_left == 0)
+			progress->ntables_done++;
+		progress->size_done += job->part->size;
+		progress->rows_done += job->copy.rows;
+		progress->bytes_done += job->copy.bytes;
+		memset(jobprogress, 0, sizeof(BdrInitJobProgress));
+	}
+	else
+	{
+		memset(jobprogress, 0, sizeof(BdrInitJobProgress));
+		strlcpy(NameStr(jobprogress->nspname), table->nspname, NAMEDATALEN);
+		strlcpy(NameStr(jobprogress->relname), table->relname, NAMEDATALEN);
+		jobprogress->binary = table->binary;
+		jobprogress->size = job->part->size;
+		jobprogress->started = GetCurrentTimestamp();
+	}
+	LWLockRelease(BdrInitProgressCtl->lock);
+}
+
+static void
+bdr_init_sync_cleanup(int code, Datum arg)
+{
+	BdrSync	   *sync = (BdrSync *) DatumGetPointer(arg);
+	int			i;
+
+	for (i = 0; i < sync->njobs; i++)
+	{
+		bdr_cleanup_conn_close(code, PointerGetDatum(&sync->jobs[i].source));
+		bdr_cleanup_conn_close(code, PointerGetDatum(&sync->jobs[i].target));
+		sync->jobs[i].source = NULL;
+		sync->jobs[i].target = NULL;
+	}
+}
+
+static void
+bdr_init_sync_exec(PGconn *conn, const char *query)
+{
+	PGresult   *res;
+
+	res = PQexec(conn, query);
+	if (PQresultStatus(res) != PGRES_COMMAND_OK)
+		ereport(ERROR,
+				(errmsg("bdr init_replica: query failed: %s",
+						PQerrorMessage(conn)),
+				 errdetail("Query was: %s", query)));
+	PQclear(res);
+}
+
+/*
+ * Start a transaction that sees the join snapshot on a connection to the
+ * remote node.
+ */
+static void
+bdr_init_sync_import_snapshot(PGconn *conn, const char *snapshot)
+{
+	char	   *query;
+
+	query = psprintf("BEGIN ISOLATION LEVEL REPEATABLE READ READ ONLY;\n"
+					 "SET TRANSACTION SNAPSHOT '%s';",
+					 snapshot);
+	bdr_init_sync_exec(conn, query);
+	pfree(query);
+}
+
+/*
+ * Open a connection to the remote node in a transaction that sees the
+ * join snapshot.
+ */
+static PGconn *
+bdr_init_sync_connect_source(const char *dsn, const char *snapshot)
+{
+	PGconn	   *conn;
+
+	conn = bdr_connect_nonrepl(dsn, "init_replica copy");
+	bdr_init_sync_import_snapshot(conn, snapshot);
+
+	return conn;
+}
+
+/*
+ * The local side of a job. Tables are committed one by one; the caller
+ * makes sure the changes aren't replicated.
+ */
+static PGconn *
+bdr_init_sync_connect_target(const char *dsn)
+{
+	PGconn	   *conn;
+
+	conn = bdr_connect_nonrepl(dsn, "init_replica copy");
+
+	/*
+	 * The join isn't done until the last table is in. Don't fire BDR's
+	 * truncate trigger for the TRUNCATEs enabling COPY FREEZE.
+	 */
+	bdr_init_sync_exec(conn, "SET synchronous_commit = off");
+	bdr_init_sync_exec(conn, "SET session_replication_role = replica");
+
+	if (PQsetnonblocking(conn, 1) != 0)
+		ereport(ERROR,
+				(errmsg("bdr init_replica: could not set connection nonblocking: %s",
+						PQerrorMessage(conn))));
+
+	return conn;
+}
+
+/*
+ * List the tables to copy, as seen by a connection in the join snapshot.
+ * Tables are copied in binary format where possible if binary is set.
+ */
+static BdrSyncTable *
+bdr_init_sync_tables(PGconn *conn, bool binary, int *ntables)
+{
+	PGresult   *res;
+	BdrSyncTable *tables;
+	int			i;
+
+	res = PQexec(conn, BDR_INIT_SYNC_TABLES_QUERY);
+	if (PQresultStatus(res) != PGRES_TUPLES_OK)
+		ereport(ERROR,
+				(errmsg("bdr init_replica: listing tables of the remote node failed: %s",
+						PQerrorMessage(conn))));
+
+	*ntables = PQntuples(res);
+	tables = palloc0(Max(*ntables, 1) * sizeof(BdrSyncTable));
+
+	for (i = 0; i < *ntables; i++)
+	{
+		BdrSyncTable *table = &tables[i];
+
+		table->size = DatumGetInt64(
+			DirectFunctionCall1(int8in, CStringGetDatum(PQgetvalue(res, i, 0))));
+		table->nspname = pstrdup(PQgetvalue(res, i, 1));
+		table->relname = pstrdup(PQgetvalue(res, i, 2));
+		table->name = quote_qualified_identifier(table->nspname,
+												 table->relname);
+		table->binary = binary && strcmp(PQgetvalue(res, i, 4), "t") == 0;
+
+		/* the extension's own condition for what's user data */
+		if (!PQgetisnull(res, i, 3) && PQgetvalue(res, i, 3)[0] != '\0')
+			table->condition = pstrdup(PQgetvalue(res, i, 3));
+
+		if (!PQgetisnull(res, i, 5))
+			table->key = pstrdup(quote_identifier(PQgetvalue(res, i, 5)));
+
+		table->copy_in = psprintf("COPY %s FROM stdin%s", table->name,
+								  table->binary ? " WITH (FORMAT binary)" : "");
+		table->copy_in_freeze = psprintf("COPY %s FROM stdin WITH (FREEZE%s)",
+										 table->name,
+										 table->binary ? ", FORMAT binary" : "");
+	}
+
+	PQclear(res);
+
+	return tables;
+}
+
+/*
+ * The COPY reading table's rows matching where, if not NULL. Like a plain
+ * COPY, the query doesn't include rows of inheritance children, they're
+ * copied as tables of their own.
+ */
+static char *
+bdr_init_sync_copy_out(BdrSyncTable *table, const char *where)
+{
+	const char *options = table->binary ? " WITH (FORMAT binary)" : "";
+
+	if (where != NULL)
+		return psprintf("COPY (SELECT * FROM ONLY %s %s) TO stdout%s",
+						table->name, where, options);
+	else
+		return psprintf("COPY %s TO stdout%s", table->name, options);
+}
+
+static int
+bdr_init_sync_part_cmp(const void *a, const void *b)
+{
+	const BdrSyncPart *pa = (const BdrSyncPart *) a;
+	const BdrSyncPart *pb = (const BdrSyncPart *) b;
+
+	if (pa->size != pb->size)
+		return pa->size > pb->size ? -1 : 1;
+	return 0;
+}
+
+/*
+ * The key value part i of nsplit starts at, when splitting the width key
+ * values after min. Computed in uint64 without overflowing, whatever the
+ * range; nsplit is at most INT_MAX, so the remainder's product fits.
+ */
+static int64
+bdr_init_sync_split_point(int64 min, uint64 width, int64 i, int64 nsplit)
+{
+	uint64		offset;
+
+	offset = (width / nsplit) * i + ((width % nsplit) * i) / nsplit;
+
+	return (int64) ((uint64) min + offset);
+}
+
+/*
+ * Decide how many parts table is copied in, given the size parts should
+ * have, and add them to parts. A table is split into ranges of equal width
+ * between the smallest and largest key values conn sees.
+ */
+static void
+bdr_init_sync_split(PGconn *conn, BdrSyncTable *table, int64 part_size,
+					BdrSyncPart **parts, int *nparts, int *maxparts)
+{
+	int64		nsplit = 1;
+	int64		min = 0;
+	int64		max = 0;
+	uint64		width = 0;
+	int			i;
+
+	if (table->key != NULL && table->condition == NULL &&
+		table->size > part_size)
+	{
+		PGresult   *res;
+		char	   *query;
+
+		query = psprintf("SELECT min(%s), max(%s) FROM ONLY %s",
+						 table->key, table->key, table->name);
+		res = PQexec(conn, query);
+		if (PQresultStatus(res) != PGRES_TUPLES_OK)
+			ereport(ERROR,
+					(errmsg("bdr init_replica: query failed: %s",
+							PQerrorMessage(conn)),
+					 errdetail("Query was: %s", query)));
+		pfree(query);
+
+		/* not empty */
+		if (!PQgetisnull(res, 0, 0))
+		{
+			min = DatumGetInt64(
+				DirectFunctionCall1(int8in, CStringGetDatum(PQgetvalue(res, 0, 0))));
+			max = DatumGetInt64(
+				DirectFunctionCall1(int8in, CStringGetDatum(PQgetvalue(res, 0, 1))));
+
+			/*
+			 * max - min doesn't fit into an int64 for keys spread over the
+			 * whole range, but always into an uint64.
+			 */
+			width = (uint64) max - (uint64) min;
+
+			nsplit = Min(table->size / part_size + 1, INT_MAX);
+			/* at least one key value per part */
+			if (width < (uint64) (nsplit - 1))
+				nsplit = (int64) width + 1;
+		}
+		PQclear(res);
+	}
+
+	if (*nparts + nsplit > *maxparts)
+	{
+		*maxparts = Max(*maxparts * 2, *nparts + (int) nsplit);
+		*parts = repalloc(*parts, *maxparts * sizeof(BdrSyncPart));
+	}
+
+	if (nsplit > 1)
+		elog(DEBUG1, "bdr init_replica: copying table %s in "INT64_FORMAT" parts by %s",
+			 table->name, nsplit, table->key);
+
+	table->nparts = (int) nsplit;
+	table->nparts_left = (int) nsplit;
+
+	for (i = 0; i < nsplit; i++)
+	{
+		BdrSyncPart *part = &(*parts)[(*nparts)++];
+
+		part->table = table;
+		part->partno = i;
+		part->size = table->size / nsplit;
+		part->attempts = 0;
+
+		if (nsplit == 1)
+			part->copy_out = bdr_init_sync_copy_out(table, table->condition);
+		else
+		{
+			/* first and last part are open-ended, just in case */
+			int64		lower = bdr_init_sync_split_point(min, width, i, nsplit);
+			int64		upper = bdr_init_sync_split_point(min, width, i + 1,
+														  nsplit);
+			char	   *where;
+
+			if (i == 0)
+				where = psprintf("WHERE %s < "INT64_FORMAT,
+								 table->key, upper);
+			else if (i == nsplit - 1)
+				where = psprintf("WHERE %s >= "INT64_FORMAT,
+								 table->key, lower);
+			else
+				where = psprintf("WHERE %s >= "INT64_FORMAT" AND %s < "INT64_FORMAT,
+								 table->key, lower, table->key, upper);
+
+			part->copy_out = bdr_init_sync_copy_out(table, where);
+			pfree(where);
+		}
+	}
+}
+
+/*
+ * Split the tables to copy into parts for njobs jobs, largest first.
+ */
+static BdrSyncPart *
+bdr_init_sync_plan(PGconn *conn, BdrSyncTable *tables, int ntables,
+				   int njobs, int *nparts)
+{
+	BdrSyncPart *parts;
+	int			maxparts = Max(ntables, 1);
+	int64		total = 0;
+	int64		part_size;
+	int			i;
+
+	for (i = 0; i < ntables; i++)
+		total += tables[i].size;
+
+	part_size = Max(total / (njobs * BDR_INIT_SYNC_PARTS_PER_JOB),
+					BDR_INIT_SYNC_MIN_PART_SIZE);
+
+	/* splitting up a table doesn't help with a single job */
+	if (njobs == 1)
+		part_size = INT64CONST(0x7FFFFFFFFFFFFFFF);
+
+	parts = palloc(maxparts * sizeof(BdrSyncPart));
+	*nparts = 0;
+
+	for (i = 0; i < ntables; i++)
+		bdr_init_sync_split(conn, &tables[i], part_size, &parts, nparts,
+							&maxparts);
+
+	qsort(parts, *nparts, sizeof(BdrSyncPart), bdr_init_sync_part_cmp);
+
+	return parts;
+}
+
+/*
+ * Start copying the part handed to a job. A table copied in one go is
+ * truncated first, in the same transaction, so it can be copied with FREEZE.
+ * The parts of a split table are each copied in a transaction of their own.
+ *
+ * Returns false if the part turns out to be copied already, because the
+ * connection failed after committing it.
+ */
+static bool
+bdr_init_sync_begin_part(BdrSync *sync, int jobno, BdrSyncJob *job)
+{
+	BdrSyncTable *table = job->part->table;
+
+	if (job->part->attempts > 0)
+	{
+		PGresult   *res;
+		char	   *query;
+		bool		copied;
+
+		query = psprintf("SELECT 1 FROM bdr.bdr_init_checkpoints \n"
+						 "WHERE step = 'table' AND snapshot = %s \n"
+						 "  AND relation = %s AND part = %d",
+						 quote_literal_cstr(sync->snapshot),
+						 quote_literal_cstr(table->name),
+						 job->part->partno + 1);
+		res = PQexec(job->target, query);
+		if (PQresultStatus(res) != PGRES_TUPLES_OK)
+			ereport(ERROR,
+					(errmsg("bdr init_replica: query failed: %s",
+							PQerrorMessage(job->target)),
+					 errdetail("Query was: %s", query)));
+		copied = PQntuples(res) > 0;
+		PQclear(res);
+		pfree(query);
+
+		if (copied)
+			return false;
+	}
+
+	elog(DEBUG1, "bdr init_replica: copying data of table %s",
+		 table->name);
+
+	/*
+	 * The table is still empty, truncating it gives it a new relfilenode in
+	 * this transaction, as COPY FREEZE needs. Not possible with other parts
+	 * copied concurrently.
+	 */
+	if (table->nparts == 1)
+	{
+		char	   *query;
+
+		query = psprintf("BEGIN; TRUNCATE ONLY %s", table->name);
+		bdr_init_sync_exec(job->target, query);
+		pfree(query);
+	}
+	else
+		bdr_init_sync_exec(job->target, "BEGIN");
+
+	bdr_copytable_begin(&job->copy, job->source, job->target,
+						job->part->copy_out,
+						table->nparts == 1 ?
+						table->copy_in_freeze : table->copy_in);
+	job->copying = true;
+	bdr_init_sync_report_part(jobno, job, false);
+
+	return true;
+}
+
+/*
+ * Record that job copied its part, and commit the copy along with that.
+ */
+static void
+bdr_init_sync_finish_part(BdrSync *sync, BdrSyncJob *job)
+{
+	BdrSyncTable *table = job->part->table;
+	char	   *query;
+
+	elog(DEBUG1, "bdr init_replica: copied "INT64_FORMAT" rows, "INT64_FORMAT" bytes of table %s",
+		 job->copy.rows, job->copy.bytes, table->name);
+
+	query = psprintf("INSERT INTO bdr.bdr_init_checkpoints \n"
+					 "    (step, snapshot, relation, part, nparts, rows_copied, bytes_copied) \n"
+					 "VALUES ('table', %s, %s, %d, %d, "INT64_FORMAT", "INT64_FORMAT"); \n"
+					 "COMMIT;",
+					 quote_literal_cstr(sync->snapshot),
+					 quote_literal_cstr(table->name),
+					 job->part->partno + 1, table->nparts,
+					 job->copy.rows, job->copy.bytes);
+	bdr_init_sync_exec(job->target, query);
+	pfree(query);
+
+	job->copying = false;
+}
+
+/*
+ * Called from PG_CATCH when copying job's part, or reconnecting to copy it
+ * again, failed. Unless the part already failed BDR_INIT_SYNC_PART_RETRIES
+ * times, log the error and drop the job's connections. The part is copied
+ * again on new connections after a delay, see bdr_init_sync_retry_connect.
+ * Nothing of the failed copy is left behind, its transaction is rolled back
+ * with the connection.
+ *
+ * Only libpq and COPY errors are expected here; the worker isn't in a
+ * transaction and holds no locks while copying.
+ */
+static void
+bdr_init_sync_retry(BdrSyncJob *job, MemoryContext context)
+{
+	ErrorData  *edata;
+	long		delay_ms;
+
+	if (job->part->attempts >= BDR_INIT_SYNC_PART_RETRIES)
+		PG_RE_THROW();
+
+	MemoryContextSwitchTo(context);
+	edata = CopyErrorData();
+	FlushErrorState();
+
+	job->part->attempts++;
+	delay_ms = (long) job->part->attempts * BDR_INIT_SYNC_RETRY_DELAY_MS;
+
+	ereport(WARNING,
+			(errmsg("bdr init_replica: copying data of table %s failed, retrying in %ld ms",
+					job->part->table->name, delay_ms),
+			 errdetail("%s%s%s", edata->message,
+					   edata->detail != NULL ? ": " : "",
+					   edata->detail != NULL ? edata->detail : "")));
+	FreeErrorData(edata);
+
+	if (job->copy.buf != NULL)
+		pfree(job->copy.buf);
+	memset(&job->copy, 0, sizeof(BdrCopyState));
+	job->copying = false;
+
+	if (job->source != NULL)
+		PQfinish(job->source);
+	if (job->target != NULL)
+		PQfinish(job->target);
+	job->source = NULL;
+	job->target = NULL;
+
+	job->retry_at = TimestampTzPlusMilliseconds(GetCurrentTimestamp(),
+												delay_ms);
+}
+
+/*
+ * Reconnect a job whose part failed, once its delay is over. Failing to
+ * connect counts as another failed attempt at the part, and is retried the
+ * same way. The new source connection imports the join snapshot again; if
+ * that's gone the ERROR ends this attempt at the join. Returns false while
+ * the job has to wait.
+ */
+static bool
+bdr_init_sync_retry_connect(BdrSync *sync, BdrSyncJob *job)
+{
+	MemoryContext oldcontext = CurrentMemoryContext;
+	volatile bool connected = false;
+
+	if (job->retry_at == 0)
+		return true;
+
+	if (GetCurrentTimestamp() < job->retry_at)
+		return false;
+
+	PG_TRY();
+	{
+		job->source = bdr_connect_nonrepl(sync->source_dsn,
+										  "init_replica copy");
+		job->target = bdr_init_sync_connect_target(sync->target_dsn);
+		connected = true;
+	}
+	PG_CATCH();
+	{
+		bdr_init_sync_retry(job, oldcontext);
+	}
+	PG_END_TRY();
+
+	if (!connected)
+		return false;
+
+	bdr_init_sync_import_snapshot(job->source, sync->snapshot);
+	job->retry_at = 0;
+
+	return true;
+}
+
+/*
+ * Empty the tables an earlier attempt at the join copied data into in
+ * another snapshot, and forget about them. Their data can't be combined with
+ * data read in this one.
+ *
+ * If that attempt got as far as creating foreign keys, they're dropped so the
+ * tables can be truncated one by one. They're created again with the other
+ * constraints once all data is in.
+ */
+static void
+bdr_init_sync_forget_stale(PGconn *conn, const char *snapshot)
+{
+	PGresult   *res;
+	char	   *query;
+	int			i;
+
+	query = psprintf("SELECT DISTINCT relation FROM bdr.bdr_init_checkpoints \n"
+					 "WHERE step = 'table' AND snapshot <> %s",
+					 quote_literal_cstr(snapshot));
+	res = PQexec(conn, query);
+	if (PQresultStatus(res) != PGRES_TUPLES_OK)
+		ereport(ERROR,
+				(errmsg("bdr init_replica: query failed: %s",
+						PQerrorMessage(conn)),
+				 errdetail("Query was: %s", query)));
+	pfree(query);
+
+	if (PQntuples(res) == 0)
+	{
+		PQclear(res);
+		return;
+	}
+
+	elog(LOG, "bdr init_replica: copying the data of %d tables copied in an earlier snapshot again",
+		 PQntuples(res));
+
+	bdr_init_sync_exec(conn, "BEGIN");
+
+	bdr_init_sync_exec(conn,
+		"DO $$ \n"
+		"DECLARE \n"
+		"    fk record; \n"
+		"BEGIN \n"
+		"    FOR fk IN \n"
+		"        SELECT co.conrelid::regclass AS rel, co.conname \n"
+		"        FROM pg_catalog.pg_constraint co \n"
+		"        WHERE co.contype = 'f' \n"
+		"          AND NOT EXISTS (SELECT 1 FROM pg_catalog.pg_depend d \n"
+		"                          WHERE d.classid = 'pg_class'::regclass \n"
+		"                            AND d.objid = co.conrelid AND d.deptype = 'e') \n"
+		"    LOOP \n"
+		"        EXECUTE format('ALTER TABLE %s DROP CONSTRAINT %I', fk.rel, fk.conname); \n"
+		"    END LOOP; \n"
+		"END; \n"
+		"$$");
+
+	for (i = 0; i < PQntuples(res); i++)
+	{
+		query = psprintf("TRUNCATE ONLY %s", PQgetvalue(res, i, 0));
+		bdr_init_sync_exec(conn, query);
+		pfree(query);
+	}
+
+	query = psprintf("DELETE FROM bdr.bdr_init_checkpoints \n"
+					 "WHERE step = 'table' AND snapshot <> %s; \n"
+					 "COMMIT;",
+					 quote_literal_cstr(snapshot));
+	bdr_init_sync_exec(conn, query);
+	pfree(query);
+
+	PQclear(res);
+}
+
+/*
+ * Copy the data of all tables from the node at source_dsn into the empty
+ * tables of the local database at target_dsn, with up to njobs tables or
+ * parts of tables copied concurrently. The data is read in the exported
+ * snapshot.
+ *
+ * The target connections must be set up so the copied rows aren't
+ * replicated. Tables left with data read in another snapshot by an earlier
+ * attempt are copied again. Each part copied is checkpointed, and finally
+ * that all data was. A part that fails is copied again a few times before
+ * an ERROR is raised.
+ */
+void
+bdr_init_sync_data(const char *source_dsn, const char *target_dsn,
+				   const char *snapshot, int njobs)
+{
+	BdrSync		sync;
+	BdrSyncTable *tables;
+	BdrSyncPart *parts;
+	int			ntables;
+	int			nparts;
+	int			next = 0;
+	int			ncopied = 0;
+	int64		nbytes = 0;
+	bool		binary;
+	char	   *query;
+	int			i;
+
+	sync.source_dsn = source_dsn;
+	sync.target_dsn = target_dsn;
+	sync.snapshot = snapshot;
+	sync.njobs = 0;
+	sync.jobs = palloc0(njobs * sizeof(BdrSyncJob));
+
+	PG_ENSURE_ERROR_CLEANUP(bdr_init_sync_cleanup, PointerGetDatum(&sync));
+	{
+		sync.jobs[0].source = bdr_init_sync_connect_source(source_dsn, snapshot);
+		sync.njobs = 1;
+
+		binary = bdr_copy_binary_compatible(sync.jobs[0].source);
+		tables = bdr_init_sync_tables(sync.jobs[0].source, binary, &ntables);
+
+		njobs = Min(njobs, BDR_INIT_SYNC_MAX_JOBS);
+		parts = bdr_init_sync_plan(sync.jobs[0].source, tables, ntables,
+								   njobs, &nparts);
+
+		/* no point in more connections than parts */
+		njobs = Max(Min(njobs, nparts), 1);
+
+		elog(LOG, "bdr init_replica: copying data of %d tables in %d parts with %d concurrent jobs%s",
+			 ntables, nparts, njobs, binary ? "" : ", in text format");
+
+		if (MyInitProgress != NULL)
+		{
+			LWLockAcquire(BdrInitProgressCtl->lock, LW_EXCLUSIVE);
+			MyInitProgress->copy_started = GetCurrentTimestamp();
+			MyInitProgress->ntables = ntables;
+			for (i = 0; i < ntables; i++)
+				MyInitProgress->size += tables[i].size;
+			LWLockRelease(BdrInitProgressCtl->lock);
+		}
+
+		for (i = 0; i < njobs; i++)
+		{
+			if (i > 0)
+			{
+				sync.jobs[i].source =
+					bdr_init_sync_connect_source(source_dsn, snapshot);
+				sync.njobs = i + 1;
+			}
+			sync.jobs[i].target = bdr_init_sync_connect_target(target_dsn);
+		}
+
+		bdr_init_sync_forget_stale(sync.jobs[0].target, snapshot);
+
+		while (ncopied < nparts)
+		{
+			fd_set		readfds;
+			fd_set		writefds;
+			int			maxfd = -1;
+			bool		again = false;
+			struct timeval timeout;
+
+			FD_ZERO(&readfds);
+			FD_ZERO(&writefds);
+
+			for (i = 0; i < njobs; i++)
+			{
+				BdrSyncJob *job = &sync.jobs[i];
+				MemoryContext oldcontext = CurrentMemoryContext;
+				bool		failed = false;
+
+				if (job->part == NULL)
+				{
+					if (next >= nparts)
+						continue;
+					job->part = &parts[next++];
+				}
+
+				if (!bdr_init_sync_retry_connect(&sync, job))
+					continue;
+
+				PG_TRY();
+				{
+					if (!job->copying &&
+						!bdr_init_sync_begin_part(&sync, i, job))
+						job->status = BDR_COPY_DONE;
+					else
+					{
+						job->status = bdr_copytable_pump(&job->copy, true);
+
+						if (job->status == BDR_COPY_DONE)
+							bdr_init_sync_finish_part(&sync, job);
+					}
+				}
+				PG_CATCH();
+				{
+					bdr_init_sync_retry(job, oldcontext);
+					failed = true;
+				}
+				PG_END_TRY();
+
+				if (failed)
+					continue;
+
+				switch (job->status)
+				{
+					case BDR_COPY_DONE:
+						nbytes += job->copy.bytes;
+						ncopied++;
+						job->part->table->nparts_left--;
+						bdr_init_sync_report_part(i, job, true);
+						job->part = NULL;
+						/* hand out the next part right away */
+						again = true;
+						break;
+					case BDR_COPY_RUNNING:
+						again = true;
+						break;
+					case BDR_COPY_WAIT_READ:
+						FD_SET(PQsocket(job->source), &readfds);
+						maxfd = Max(maxfd, PQsocket(job->source));
+						break;
+					case BDR_COPY_WAIT_WRITE:
+						FD_SET(PQsocket(job->target), &writefds);
+						maxfd = Max(maxfd, PQsocket(job->target));
+						break;
+					case BDR_COPY_WAIT_RESULT:
+						FD_SET(PQsocket(job->target), &readfds);
+						maxfd = Max(maxfd, PQsocket(job->target));
+						break;
+				}
+			}
+
+			if (ncopied >= nparts)
+				break;
+
+			bdr_init_sync_report(&sync);
+
+			/* wake up regularly to check for interrupts */
+			timeout.tv_sec = again ? 0 : 1;
+			timeout.tv_usec = 0;
+
+			if (select(maxfd + 1, &readfds, &writefds, NULL, &timeout) < 0 &&
+				errno != EINTR)
+				ereport(ERROR,
+						(errcode_for_socket_access(),
+						 errmsg("bdr init_replica: select() failed: %m")));
+
+			/* emergency bailout if postmaster has died */
+			if (!PostmasterIsAlive())
+				proc_exit(1);
+
+			if (got_SIGTERM)
+				ereport(FATAL,
+						(errcode(ERRCODE_ADMIN_SHUTDOWN),
+						 errmsg("bdr init_replica: terminating data copy due to administrator command")));
+
+			CHECK_FOR_INTERRUPTS();
+		}
+
+		for (i = 0; i < njobs; i++)
+			bdr_init_sync_exec(sync.jobs[i].source, "COMMIT");
+
+		query = psprintf("INSERT INTO bdr.bdr_init_checkpoints (step, snapshot) \n"
+						 "VALUES ('data', %s)",
+						 quote_literal_cstr(snapshot));
+		bdr_init_sync_exec(sync.jobs[0].target, query);
+		pfree(query);
+	}
+	PG_END_ENSURE_ERROR_CLEANUP(bdr_init_sync_cleanup, PointerGetDatum(&sync));
+	bdr_init_sync_cleanup(0, PointerGetDatum(&sync));
+
+	elog(LOG, "bdr init_replica: copied "INT64_FORMAT" bytes of data in %d tables",
+		 nbytes, ntables);
+}
+
+typedef struct BdrSyncRelKey
+{
+	NameData	nspname;
+	NameData	relname;
+} BdrSyncRelKey;
+
+typedef struct BdrSyncRelSize
+{
+	BdrSyncRelKey key;
+	int64		size;
+} BdrSyncRelSize;
+
+/* An index, constraint, trigger or rule, see bdr_init_sync_list_parse */
+typedef struct BdrSyncObjKey
+{
+	char		kind;
+	BdrSyncRelKey rel;
+	NameData	name;
+} BdrSyncObjKey;
+
+typedef struct BdrSyncListEntry
+{
+	char	   *line;
+	int			pass;
+	int64		cost;
+	int			pos;
+} BdrSyncListEntry;
+
+static int
+bdr_init_sync_list_cmp(const void *a, const void *b)
+{
+	const BdrSyncListEntry *ea = (const BdrSyncListEntry *) a;
+	const BdrSyncListEntry *eb = (const BdrSyncListEntry *) b;
+
+	if (ea->pass != eb->pass)
+		return ea->pass - eb->pass;
+	if (ea->cost != eb->cost)
+		return ea->cost > eb->cost ? -1 : 1;
+	return ea->pos - eb->pos;
+}
+
+/*
+ * pg_restore -l entry types bdr_init_sync_list_parse knows about, and the
+ * pass of bdr_init_sync_order_post_data they're restored in.
+ */
+static const struct
+{
+	const char *desc;
+	char		kind;
+	int			pass;
+}	bdr_init_sync_list_kinds[] =
+{
+	{"INDEX ", 'i', 0},
+	{"CONSTRAINT ", 'c', 0},
+	{"FK CONSTRAINT ", 'c', 1},
+	{"TRIGGER ", 't', 1},
+	{"RULE ", 'r', 1},
+	{"EVENT TRIGGER - ", 'e', 1}
+};
+
+/*
+ * Copy the next word of p, up to a space, to name and return the rest, or
+ * NULL if there's no word or it's followed by the end of the line.
+ */
+static const char *
+bdr_init_sync_list_word(const char *p, Name name)
+{
+	size_t		len = strcspn(p, " ");
+
+	if (len == 0 || len >= NAMEDATALEN || p[len] != ' ')
+		return NULL;
+	memcpy(NameStr(*name), p, len);
+
+	return p + len + 1;
+}
+
+/*
+ * Parse the pg_restore -l entry in line, which look like
+ *
+ *	 1234; 1259 16390 INDEX public foo_idx owner
+ *	 1235; 2606 16391 CONSTRAINT public foo foo_pkey owner
+ *	 1236; 2606 16392 FK CONSTRAINT public bar bar_foo_fkey owner
+ *	 1237; 2620 16393 TRIGGER public foo foo_trig owner
+ *	 1238; 2618 16394 RULE public foo foo_rule owner
+ *	 1239; 3466 16395 EVENT TRIGGER - evt owner
+ *
+ * The key is set to the schema and the index, or the table and the name of
+ * the constraint, trigger or rule. Its kind is 'i', 'c', 't', 'r' or 'e'
+ * respectively, or '\0' for other entries and for names that can't be told
+ * apart because they contain spaces.
+ *
+ * Returns 0 for indexes and for constraints other than foreign keys, which
+ * only depend on tables, and 1 for everything else, which may depend on
+ * them: foreign keys need the referenced primary key or unique constraint.
+ */
+static int
+bdr_init_sync_list_parse(const char *line, BdrSyncObjKey *key)
+{
+	const char *p;
+	char		kind;
+	int			pass;
+	int			i;
+
+	memset(key, 0, sizeof(BdrSyncObjKey));
+
+	if (line[0] == ';')
+		return 1;
+
+	/* skip "dumpid; tableoid oid " */
+	p = strchr(line, ';');
+	if (p == NULL)
+		return 1;
+	p++;
+	for (i = 0; i < 2; i++)
+	{
+		while (*p == ' ')
+			p++;
+		while (*p != ' ' && *p != '\0')
+			p++;
+	}
+	while (*p == ' ')
+		p++;
+
+	kind = '\0';
+	pass = 1;
+	for (i = 0; i < lengthof(bdr_init_sync_list_kinds); i++)
+	{
+		const char *desc = bdr_init_sync_list_kinds[i].desc;
+
+		if (strncmp(p, desc, strlen(desc)) == 0)
+		{
+			kind = bdr_init_sync_list_kinds[i].kind;
+			pass = bdr_init_sync_list_kinds[i].pass;
+			p += strlen(desc);
+			break;
+		}
+	}
+	if (kind == '\0')
+		return pass;
+
+	/* event triggers aren't in a schema */
+	if (kind != 'e')
+		p = bdr_init_sync_list_word(p, &key->rel.nspname);
+	if (p != NULL)
+		p = bdr_init_sync_list_word(p, &key->rel.relname);
+	if (p != NULL && kind != 'i' && kind != 'e')
+		p = bdr_init_sync_list_word(p, &key->name);
+
+	if (p == NULL)
+		memset(key, 0, sizeof(BdrSyncObjKey));
+	else
+		key->kind = kind;
+
+	return pass;
+}
+
+/*
+ * Estimate the cost of restoring a pg_restore -l entry as the size of the
+ * table an index is built on or a constraint is checked on. Anything else
+ * costs 0.
+ */
+static int64
+bdr_init_sync_list_cost(HTAB *sizes, BdrSyncObjKey *key)
+{
+	BdrSyncRelSize *entry;
+
+	if (key->kind != 'i' && key->kind != 'c')
+		return 0;
+
+	entry = hash_search(sizes, &key->rel, HASH_FIND, NULL);
+
+	return entry != NULL ? entry->size : 0;
+}
+
+/*
+ * Look up the size of each table, and of the table of each index, on the
+ * node at source_dsn.
+ */
+static HTAB *
+bdr_init_sync_list_sizes(const char *source_dsn)
+{
+	PGconn	   *conn;
+	PGresult   *res;
+	HASHCTL		ctl;
+	HTAB	   *sizes;
+	int			i;
+
+	MemSet(&ctl, 0, sizeof(ctl));
+	ctl.keysize = sizeof(BdrSyncRelKey);
+	ctl.entrysize = sizeof(BdrSyncRelSize);
+	ctl.hash = tag_hash;
+	ctl.hcxt = CurrentMemoryContext;
+	sizes = hash_create("bdr init_replica relation sizes", 1024, &ctl,
+						HASH_ELEM | HASH_FUNCTION | HASH_CONTEXT);
+
+	conn = bdr_connect_nonrepl(source_dsn, "init_replica sizes");
+
+	PG_ENSURE_ERROR_CLEANUP(bdr_cleanup_conn_close,
+							PointerGetDatum(&conn));
+	{
+		res = PQexec(conn,
+					 "SELECT n.nspname, c.relname, "
+					 "       pg_relation_size(coalesce(i.indrelid, c.oid)) "
+					 "FROM pg_class c "
+					 "JOIN pg_namespace n ON (n.oid = c.relnamespace) "
+					 "LEFT JOIN pg_index i ON (i.indexrelid = c.oid) "
+					 "WHERE c.relkind IN ('r', 'm', 'i') "
+					 "  AND n.nspname NOT IN ('pg_catalog', 'information_schema') "
+					 "  AND n.nspname !~ '^pg_toast'");
+		if (PQresultStatus(res) != PGRES_TUPLES_OK)
+			ereport(ERROR,
+					(errmsg("bdr init_replica: getting relation sizes of the remote node failed: %s",
+							PQerrorMessage(conn))));
+
+		for (i = 0; i < PQntuples(res); i++)
+		{
+			BdrSyncRelKey key;
+			BdrSyncRelSize *entry;
+
+			memset(&key, 0, sizeof(key));
+			strlcpy(NameStr(key.nspname), PQgetvalue(res, i, 0), NAMEDATALEN);
+			strlcpy(NameStr(key.relname), PQgetvalue(res, i, 1), NAMEDATALEN);
+
+			entry = hash_search(sizes, &key, HASH_ENTER, NULL);
+			entry->size = DatumGetInt64(
+				DirectFunctionCall1(int8in, CStringGetDatum(PQgetvalue(res, i, 2))));
+		}
+
+		PQclear(res);
+	}
+	PG_END_ENSURE_ERROR_CLEANUP(bdr_cleanup_conn_close,
+								PointerGetDatum(&conn));
+	PQfinish(conn);
+
+	return sizes;
+}
+
+/*
+ * Look up the indexes, constraints, triggers and rules that already exist in
+ * the local database at target_dsn, as keyed by bdr_init_sync_list_parse.
+ */
+static HTAB *
+bdr_init_sync_list_existing(const char *target_dsn)
+{
+	PGconn	   *conn;
+	PGresult   *res;
+	HASHCTL		ctl;
+	HTAB	   *existing;
+	int			i;
+
+	MemSet(&ctl, 0, sizeof(ctl));
+	ctl.keysize = sizeof(BdrSyncObjKey);
+	ctl.entrysize = sizeof(BdrSyncObjKey);
+	ctl.hash = tag_hash;
+	ctl.hcxt = CurrentMemoryContext;
+	existing = hash_create("bdr init_replica existing objects", 1024, &ctl,
+						   HASH_ELEM | HASH_FUNCTION | HASH_CONTEXT);
+
+	conn = bdr_connect_nonrepl(target_dsn, "init_replica objects");
+
+	PG_ENSURE_ERROR_CLEANUP(bdr_cleanup_conn_close,
+							PointerGetDatum(&conn));
+	{
+		res = PQexec(conn,
+					 "SELECT 'i', n.nspname, c.relname, '' "
+					 "FROM pg_class c "
+					 "JOIN pg_namespace n ON (n.oid = c.relnamespace) "
+					 "WHERE c.relkind = 'i' "
+					 "UNION ALL "
+					 "SELECT 'c', n.nspname, c.relname, co.conname "
+					 "FROM pg_constraint co "
+					 "JOIN pg_class c ON (c.oid = co.conrelid) "
+					 "JOIN pg_namespace n ON (n.oid = c.relnamespace) "
+					 "UNION ALL "
+					 "SELECT 't', n.nspname, c.relname, t.tgname "
+					 "FROM pg_trigger t "
+					 "JOIN pg_class c ON (c.oid = t.tgrelid) "
+					 "JOIN pg_namespace n ON (n.oid = c.relnamespace) "
+					 "WHERE NOT t.tgisinternal "
+					 "UNION ALL "
+					 "SELECT 'r', n.nspname, c.relname, r.rulename "
+					 "FROM pg_rewrite r "
+					 "JOIN pg_class c ON (c.oid = r.ev_class) "
+					 "JOIN pg_namespace n ON (n.oid = c.relnamespace) "
+					 "WHERE r.rulename <> '_RETURN' "
+					 "UNION ALL "
+					 "SELECT 'e', '', evtname, '' FROM pg_event_trigger");
+		if (PQresultStatus(res) != PGRES_TUPLES_OK)
+			ereport(ERROR,
+					(errmsg("bdr init_replica: listing existing objects of the local node failed: %s",
+							PQerrorMessage(conn))));
+
+		for (i = 0; i < PQntuples(res); i++)
+		{
+			BdrSyncObjKey key;
+
+			memset(&key, 0, sizeof(key));
+			key.kind = PQgetvalue(res, i, 0)[0];
+			strlcpy(NameStr(key.rel.nspname), PQgetvalue(res, i, 1), NAMEDATALEN);
+			strlcpy(NameStr(key.rel.relname), PQgetvalue(res, i, 2), NAMEDATALEN);
+			strlcpy(NameStr(key.name), PQgetvalue(res, i, 3), NAMEDATALEN);
+
+			hash_search(existing, &key, HASH_ENTER, NULL);
+		}
+
+		PQclear(res);
+	}
+	PG_END_ENSURE_ERROR_CLEANUP(bdr_cleanup_conn_close,
+								PointerGetDatum(&conn));
+	PQfinish(conn);
+
+	return existing;
+}
+
+/*
+ * Reorder the pg_restore -l listing in listfile so that pg_restore -L
+ * starts building indexes and checking constraints on the largest tables
+ * first. Otherwise a big index started last would be built while all other
+ * jobs are idle. Sizes are looked up on the node at source_dsn.
+ *
+ * Only the indexes and the constraints other than foreign keys are sorted,
+ * and they're all moved ahead of the rest of the listing, which keeps its
+ * order. With a single job pg_restore restores the entries in the order of
+ * the listing without looking at their dependencies, so a foreign key must
+ * not come before the primary key or unique constraint it references.
+ *
+ * Indexes, constraints, triggers and rules an earlier attempt at the join
+ * already created in the local database at target_dsn are left out, so
+ * restoring the post-data section can be resumed.
+ */
+void
+bdr_init_sync_order_post_data(const char *source_dsn, const char *target_dsn,
+							  const char *listfile)
+{
+	HTAB	   *sizes;
+	HTAB	   *existing;
+	FILE	   *file;
+	StringInfoData buf;
+	BdrSyncListEntry *entries;
+	int			nentries = 0;
+	int			nskipped = 0;
+	char	   *line;
+	char	   *next;
+	size_t		nread;
+	char		readbuf[8192];
+	int			i;
+
+	sizes = bdr_init_sync_list_sizes(source_dsn);
+	existing = bdr_init_sync_list_existing(target_dsn);
+
+	/* read the whole listing */
+	file = AllocateFile(listfile, PG_BINARY_R);
+	if (file == NULL)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not open file \"%s\": %m", listfile)));
+
+	initStringInfo(&buf);
+	while ((nread = fread(readbuf, 1, sizeof(readbuf), file)) > 0)
+		appendBinaryStringInfo(&buf, readbuf, nread);
+
+	if (ferror(file))
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not read file \"%s\": %m", listfile)));
+	FreeFile(file);
+
+	/* one entry per line */
+	entries = palloc(sizeof(BdrSyncListEntry) * (buf.len / 2 + 1));
+	for (line = buf.data; *line != '\0'; line = next)
+	{
+		BdrSyncObjKey key;
+		int			pass;
+
+		next = strchr(line, '\n');
+		if (next != NULL)
+			*next++ = '\0';
+		else
+			next = line + strlen(line);
+
+		pass = bdr_init_sync_list_parse(line, &key);
+		if (key.kind != '\0' &&
+			hash_search(existing, &key, HASH_FIND, NULL) != NULL)
+		{
+			nskipped++;
+			continue;
+		}
+
+		entries[nentries].line = line;
+		entries[nentries].pass = pass;
+		entries[nentries].cost =
+			pass == 0 ? bdr_init_sync_list_cost(sizes, &key) : 0;
+		entries[nentries].pos = nentries;
+		nentries++;
+	}
+
+	if (nskipped > 0)
+		elog(LOG, "bdr init_replica: skipping %d indexes, constraints, triggers and rules created by an earlier attempt",
+			 nskipped);
+
+	qsort(entries, nentries, sizeof(BdrSyncListEntry), bdr_init_sync_list_cmp);
+
+	file = AllocateFile(listfile, PG_BINARY_W);
+	if (file == NULL)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not open file \"%s\": %m", listfile)));
+
+	for (i = 0; i < nentries; i++)
+		fprintf(file, "%s\n", entries[i].line);
+
+	if (FreeFile(file))
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not write file \"%s\": %m", listfile)));
+
+	hash_destroy(existing);
+	hash_destroy(sizes);
+	pfree(entries);
+	pfree(buf.data);
+}
+
+/*
+ * Compute the md5 of the file at path into md5, which must have room for 33
+ * bytes. Used to tell whether the remote schema changed between attempts at
+ * a join.
+ */
+void
+bdr_init_sync_file_md5(const char *path, char *md5)
+{
+	FILE	   *file;
+	StringInfoData buf;
+	size_t		nread;
+	char		readbuf[8192];
+
+	file = AllocateFile(path, PG_BINARY_R);
+	if (file == NULL)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not open file \"%s\": %m", path)));
+
+	initStringInfo(&buf);
+	while ((nread = fread(readbuf, 1, sizeof(readbuf), file)) > 0)
+		appendBinaryStringInfo(&buf, readbuf, nread);
+
+	if (ferror(file))
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not read file \"%s\": %m", path)));
+	FreeFile(file);
+
+	if (!pg_md5_hash(buf.data, buf.len, md5))
+		ereport(ERROR,
+				(errcode(ERRCODE_OUT_OF_MEMORY),
+				 errmsg("out of memory")));
+
+	pfree(buf.data);
+}
+
+/*
+ * Return the snapshot an earlier attempt at joining this database was in
+ * when it finished step, or NULL if it didn't. For the "schema" step the
+ * md5 of the schema restored is returned in schema_md5, if not NULL.
+ *
+ * Called by the perdb worker, outside of a transaction.
+ */
+char *
+bdr_init_checkpoint_get(const char *step, char **schema_md5)
+{
+	MemoryContext caller_ctx = CurrentMemoryContext;
+	Oid			argtypes[] = { TEXTOID };
+	Datum		values[1];
+	char	   *snapshot = NULL;
+	int			spi_ret;
+	bool		tx_started = false;
+	bool		spi_pushed;
+
+	if (!IsTransactionState())
+	{
+		tx_started = true;
+		StartTransactionCommand();
+	}
+	spi_pushed = SPI_push_conditional();
+	SPI_connect();
+
+	values[0] = CStringGetTextDatum(step);
+
+	spi_ret = SPI_execute_with_args(
+		"SELECT snapshot, schema_md5 FROM bdr.bdr_init_checkpoints "
+		" WHERE step = $1 ORDER BY done_at DESC",
+		1, argtypes, values, NULL, false, 1);
+
+	if (spi_ret != SPI_OK_SELECT)
+		elog(ERROR, "Unable to query bdr.bdr_init_checkpoints, SPI error %d",
+			 spi_ret);
+
+	if (SPI_processed > 0)
+	{
+		char	   *value;
+
+		value = SPI_getvalue(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1);
+		snapshot = MemoryContextStrdup(caller_ctx, value);
+
+		if (schema_md5 != NULL)
+		{
+			value = SPI_getvalue(SPI_tuptable->vals[0],
+								 SPI_tuptable->tupdesc, 2);
+			*schema_md5 = value != NULL ?
+				MemoryContextStrdup(caller_ctx, value) : NULL;
+		}
+	}
+
+	SPI_finish();
+	SPI_pop_conditional(spi_pushed);
+	if (tx_started)
+	{
+		CommitTransactionCommand();
+		MemoryContextSwitchTo(caller_ctx);
+	}
+
+	return snapshot;
+}
+
+/*
+ * Record that the schema was restored in snapshot, with its md5.
+ */
+void
+bdr_init_checkpoint_schema(const char *snapshot, const char *schema_md5)
+{
+	Oid			argtypes[] = { TEXTOID, TEXTOID };
+	Datum		values[2];
+	int			spi_ret;
+	bool		tx_started = false;
+	bool		spi_pushed;
+
+	if (!IsTransactionState())
+	{
+		tx_started = true;
+		StartTransactionCommand();
+	}
+	spi_pushed = SPI_push_conditional();
+	SPI_connect();
+
+	values[0] = CStringGetTextDatum(snapshot);
+	values[1] = CStringGetTextDatum(schema_md5);
+
+	spi_ret = SPI_execute_with_args(
+		"INSERT INTO bdr.bdr_init_checkpoints (step, snapshot, schema_md5) "
+		"VALUES ('schema', $1, $2)",
+		2, argtypes, values, NULL, false, 0);
+
+	if (spi_ret != SPI_OK_INSERT)
+		elog(ERROR, "Unable to insert into bdr.bdr_init_checkpoints, SPI error %d",
+			 spi_ret);
+
+	SPI_finish();
+	SPI_pop_conditional(spi_pushed);
+	if (tx_started)
+		CommitTransactionCommand();
+}
+
+/*
+ * Forget the checkpoints of step, or of all steps if step is NULL.
+ */
+void
+bdr_init_checkpoint_forget(const char *step)
+{
+	Oid			argtypes[] = { TEXTOID };
+	Datum		values[1];
+	char		nulls[1];
+	int			spi_ret;
+	bool		tx_started = false;
+	bool		spi_pushed;
+
+	if (!IsTransactionState())
+	{
+		tx_started = true;
+		StartTransactionCommand();
+	}
+	spi_pushed = SPI_push_conditional();
+	SPI_connect();
+
+	values[0] = step != NULL ? CStringGetTextDatum(step) : (Datum) 0;
+	nulls[0] = step != NULL ? ' ' : 'n';
+
+	spi_ret = SPI_execute_with_args(
+		"DELETE FROM bdr.bdr_init_checkpoints WHERE $1 IS NULL OR step = $1",
+		1, argtypes, values, nulls, false, 0);
+
+	if (spi_ret != SPI_OK_DELETE)
+		elog(ERROR, "Unable to delete from bdr.bdr_init_checkpoints, SPI error %d",
+			 spi_ret);
+
+	SPI_finish();
+	SPI_pop_conditional(spi_pushed);
+	if (tx_started)
+		CommitTransactionCommand();
+}
+
+/*
+ * Whether the local database contains no tables, views or schemas but those
+ * of extensions, i.e. an interrupted join didn't restore any of the schema
+ * yet.
+ */
+bool
+bdr_init_local_schema_empty(void)
+{
+	bool		empty;
+	int			spi_ret;
+	bool		isnull;
+	bool		tx_started = false;
+	bool		spi_pushed;
+
+	if (!IsTransactionState())
+	{
+		tx_started = true;
+		StartTransactionCommand();
+	}
+	spi_pushed = SPI_push_conditional();
+	SPI_connect();
+
+	spi_ret = SPI_execute(
+		"SELECT NOT EXISTS ( "
+		"    SELECT 1 FROM pg_catalog.pg_class c "
+		"    JOIN pg_catalog.pg_namespace n ON (n.oid = c.relnamespace) "
+		"    WHERE c.relkind IN ('r', 'v', 'm', 'f', 'c') "
+		"      AND n.nspname NOT IN ('pg_catalog', 'information_schema') "
+		"      AND NOT EXISTS (SELECT 1 FROM pg_catalog.pg_depend d "
+		"                      WHERE d.classid = 'pg_class'::regclass "
+		"                        AND d.objid = c.oid AND d.deptype = 'e')) "
+		"AND NOT EXISTS ( "
+		"    SELECT 1 FROM pg_catalog.pg_namespace n "
+		"    WHERE n.nspname NOT IN ('information_schema', 'public') "
+		"      AND n.nspname !~ '^pg_' "
+		"      AND NOT EXISTS (SELECT 1 FROM pg_catalog.pg_depend d "
+		"                      WHERE d.classid = 'pg_namespace'::regclass "
+		"                        AND d.objid = n.oid AND d.deptype = 'e'))",
+		true, 1);
+
+	if (spi_ret != SPI_OK_SELECT)
+		elog(ERROR, "Unable to query the local schema, SPI error %d", spi_ret);
+
+	empty = DatumGetBool(SPI_getbinval(SPI_tuptable->vals[0],
+									   SPI_tuptable->tupdesc, 1, &isnull));
+
+	SPI_finish();
+	SPI_pop_conditional(spi_pushed);
+	if (tx_started)
+		CommitTransactionCommand();
+
+	return empty;
+}
+
+static Tuplestorestate *
+bdr_init_progress_begin_srf(FunctionCallInfo fcinfo, int natts,
+							TupleDesc *tupdesc)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	Tuplestorestate *tupstore;
+	MemoryContext per_query_ctx;
+	MemoryContext oldcontext;
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not allowed in this context")));
+	if (get_call_result_type(fcinfo, NULL, tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	if ((*tupdesc)->natts != natts)
+		elog(ERROR, "wrong function definition");
+
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = *tupdesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	return tupstore;
+}
+
+/*
+ * Copy the entries of the joins in progress.
+ */
+static BdrInitProgress *
+bdr_init_progress_read(int *nentries)
+{
+	BdrInitProgressControl *ctl = BdrInitProgressCtl;
+	BdrInitProgress *entries;
+	int			i;
+
+	entries = palloc(Max(ctl->nentries, 1) * sizeof(BdrInitProgress));
+	*nentries = 0;
+
+	LWLockAcquire(ctl->lock, LW_SHARED);
+	for (i = 0; i < ctl->nentries; i++)
+	{
+		if (ctl->entries[i].dboid != InvalidOid)
+			memcpy(&entries[(*nentries)++], &ctl->entries[i],
+				   sizeof(BdrInitProgress));
+	}
+	LWLockRelease(ctl->lock);
+
+	return entries;
+}
+
+/*
+ * Progress of each database currently being joined, with an estimate of
+ * the time the data copy still takes.
+ */
+Datum
+bdr_get_init_progress(PG_FUNCTION_ARGS)
+{
+	TupleDesc	tupdesc;
+	Tuplestorestate *tupstore;
+	BdrInitProgress *entries;
+	int			nentries;
+	int			i;
+	TimestampTz now = GetCurrentTimestamp();
+
+	tupstore = bdr_init_progress_begin_srf(fcinfo, BDR_INIT_PROGRESS_COLS,
+										   &tupdesc);
+
+	entries = bdr_init_progress_read(&nentries);
+
+	for (i = 0; i < nentries; i++)
+	{
+		BdrInitProgress *entry = &entries[i];
+		Datum		values[BDR_INIT_PROGRESS_COLS];
+		bool		nulls[BDR_INIT_PROGRESS_COLS];
+		int64		rows = entry->rows_done;
+		int64		bytes = entry->bytes_done;
+		double		bytes_per_size;
+		double		size_copied;
+		int			j;
+
+		memset(nulls, 0, sizeof(nulls));
+
+		/*
+		 * COPY data is larger or smaller than the table on disk; judge how
+		 * far along tables still being copied are by the ratio seen so far.
+		 */
+		bytes_per_size = entry->size_done > 0 ?
+			(double) entry->bytes_done / entry->size_done : 1.0;
+		size_copied = entry->size_done;
+
+		for (j = 0; j < entry->njobs; j++)
+		{
+			BdrInitJobProgress *job = &entry->jobs[j];
+
+			if (NameStr(job->relname)[0] == '\0')
+				continue;
+			rows += job->rows;
+			bytes += job->bytes;
+			if (bytes_per_size > 0)
+				size_copied += Min(job->bytes / bytes_per_size, job->size);
+		}
+
+		values[0] = ObjectIdGetDatum(entry->dboid);
+		values[1] = Int32GetDatum(entry->pid);
+		values[2] = CStringGetTextDatum(bdr_init_phase_names[entry->phase]);
+		values[3] = TimestampTzGetDatum(entry->started);
+		values[4] = Int32GetDatum(entry->ntables);
+		values[5] = Int32GetDatum(entry->ntables_done);
+		values[6] = Int64GetDatum(entry->size);
+		values[7] = Int64GetDatum((int64) size_copied);
+		values[8] = Int64GetDatum(rows);
+		values[9] = Int64GetDatum(bytes);
+
+		/* remaining time at the average rate since the copy started */
+		if (entry->phase == BDR_INIT_PHASE_COPY_DATA &&
+			entry->copy_started != 0 && size_copied > 0)
+		{
+			double		elapsed = now - entry->copy_started;
+			Interval   *remaining = palloc0(sizeof(Interval));
+
+			remaining->time = (TimeOffset)
+				(elapsed * Max(entry->size - size_copied, 0) / size_copied);
+			values[10] = IntervalPGetDatum(remaining);
+		}
+		else
+			nulls[10] = true;
+
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+
+	PG_RETURN_VOID();
+}
+
+/*
+ * Progress of each table currently being copied into a joining database.
+ */
+Datum
+bdr_get_init_table_progress(PG_FUNCTION_ARGS)
+{
+	TupleDesc	tupdesc;
+	Tuplestorestate *tupstore;
+	BdrInitProgress *entries;
+	int			nentries;
+	int			i;
+
+	tupstore = bdr_init_progress_begin_srf(fcinfo, BDR_INIT_TABLE_PROGRESS_COLS,
+										   &tupdesc);
+
+	entries = bdr_init_progress_read(&nentries);
+
+	for (i = 0; i < nentries; i++)
+	{
+		BdrInitProgress *entry = &entries[i];
+		int			j;
+
+		for (j = 0; j < entry->njobs; j++)
+		{
+			BdrInitJobProgress *job = &entry->jobs[j];
+			Datum		values[BDR_INIT_TABLE_PROGRESS_COLS];
+			bool		nulls[BDR_INIT_TABLE_PROGRESS_COLS];
+
+			if (NameStr(job->relname)[0] == '\0')
+				continue;
+
+			memset(nulls, 0, sizeof(nulls));
+
+			values[0] = ObjectIdGetDatum(entry->dboid);
+			values[1] = Int32GetDatum(entry->pid);
+			values[2] = CStringGetTextDatum(
+				quote_qualified_identifier(NameStr(job->nspname),
+										   NameStr(job->relname)));
+			values[3] = BoolGetDatum(job->binary);
+			values[4] = Int64GetDatum(job->size);
+			values[5] = Int64GetDatum(job->rows);
+			values[6] = Int64GetDatum(job->bytes);
+			values[7] = TimestampTzGetDatum(job->started);
+
+			tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+		}
+	}
+
+	PG_RETURN_VOID();
+}
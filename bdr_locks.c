@@ -59,13 +59,55 @@
  *    9) Once all nodes have replied with 'confirm_lock' messages the ddl lock
  *       has been acquired.
  *
+ *    That requires two sequential round trips through the replication
+ *    streams, each bounded by the slowest node's apply lag. Requests
+ *    carrying the requestor's insert LSN in the 'acquire_lock' message use a
+ *    pipelined protocol instead, which only needs one:
+ *
+ *    6') Instead of sending 'request_replay_confirm' the node immediately
+ *        sends 'confirm_lock', identifying the request by its LSN. As that
+ *        message follows all of the node's changes from before the lock in
+ *        its replication stream, every node seeing it has replayed them.
+ *
+ *    7') Every node, not just the requestor, keeps track of the nodes whose
+ *        'confirm_lock' messages for a request it has seen, in shared
+ *        memory. Nodes granting the request start doing so right away.
+ *
+ *    8') Once the requestor has seen all confirmations, it holds the lock,
+ *        and sends a 'lock_acquired' message.
+ *
+ *    9') A node replaying the requestor's changes waits, before applying any
+ *        transaction following 'lock_acquired', until it has seen all other
+ *        nodes' confirmations too; i.e. replayed all their changes from
+ *        before the lock. That's the same guarantee the replay confirmation
+ *        round provides, but the waiting overlaps with the requestor's DDL
+ *        instead of preceding it.
+ *
+ *    Write locks can be restricted to the relations a DDL statement touches,
+ *    which are sent along with the 'acquire_lock' message. Only transactions
+ *    writing to those relations are then cancelled in 5), and only DML on
+ *    them is blocked while the lock is held. Writes to other relations, and
+ *    DML while only a DDL lock is held, proceed normally.
+ *
  *    There's some additional complications to handle crash safety:
  *
  *    Everytime a node crashes it sends out a 'startup' message causing all
  *    other nodes to release locks held by it before the crash.
  *    Then the bdr_global_locks table is read. All existing locks are
  *    acquired. If a lock still is in 'catchup' phase the lock acquiration
- *    process is re-started at step 6)
+ *    process is re-started at step 6). The relations a write lock was
+ *    restricted to aren't persisted, so after a restart it covers the whole
+ *    database. Neither are counts of pipelined confirmations; a node that
+ *    restarts between granting a lock and seeing 'lock_acquired', or loses
+ *    track of the confirmations otherwise, sends a 'request_replay_confirm'
+ *    of its own in 9') and waits for all other nodes' replies instead.
+ *
+ *    Backends whose DML has to wait, either because locks haven't been
+ *    reloaded yet after startup or because a write lock covers a relation
+ *    they write to, register themselves as waiters and sleep on their latch.
+ *    They're woken once the locks are loaded or the lock is released. The
+ *    time spent waiting, and waiting for lock acquisition, is counted per
+ *    database; see bdr.bdr_global_lock_wait_stats.
  *
  * IDENTIFICATION
  *		bdr_locks.c
@@ -80,6 +122,7 @@
 
 #ifdef BUILDING_BDR
 
+#include "funcapi.h"
 #include "miscadmin.h"
 
 #include "access/xact.h"
@@ -87,6 +130,8 @@
 
 #include "commands/dbcommands.h"
 #include "catalog/indexing.h"
+#include "catalog/namespace.h"
+#include "catalog/pg_type.h"
 
 #include "executor/executor.h"
 
@@ -96,6 +141,7 @@
 
 #include "storage/barrier.h"
 #include "storage/ipc.h"
+#include "storage/lmgr.h"
 #include "storage/lwlock.h"
 #include "storage/proc.h"
 #include "storage/procarray.h"
@@ -103,9 +149,12 @@
 #include "storage/sinvaladt.h"
 #include "storage/standby.h"
 
+#include "utils/array.h"
 #include "utils/builtins.h"
 #include "utils/fmgroids.h"
+#include "utils/lsyscache.h"
 #include "utils/snapmgr.h"
+#include "utils/timestamp.h"
 
 #endif
 
@@ -118,9 +167,86 @@ int bdr_ddl_grace_timeout = 10000;
 
 typedef struct BDRLockWaiter {
 	PGPROC	   *proc;
-	slist_node	node;
+	/* database whose waiters list this is on, if any */
+	struct BdrLocksDBState *db;
+	dlist_node	node;
 } BDRLockWaiter;
 
+/* What a backend can be blocked on */
+typedef enum BdrLocksWaitKind {
+	BDR_LOCKS_WAIT_STARTUP,		/* DML, until locks are loaded */
+	BDR_LOCKS_WAIT_DML,			/* DML, until a write lock is released */
+	BDR_LOCKS_WAIT_ACQUIRE,		/* DDL, until the lock is acquired */
+	BDR_LOCKS_WAIT_NKINDS
+} BdrLocksWaitKind;
+
+static const char *bdr_locks_wait_kind_names[BDR_LOCKS_WAIT_NKINDS] = {
+	"startup", "dml", "acquire"
+};
+
+/*
+ * Upper bounds, in milliseconds, of the wait time histogram buckets. The
+ * last bucket counts everything longer.
+ */
+#define BDR_LOCKS_WAIT_BUCKETS 6
+static const int bdr_locks_wait_bucket_ms[BDR_LOCKS_WAIT_BUCKETS - 1] = {
+	1, 10, 100, 1000, 10000
+};
+
+typedef struct BdrLocksWaitStats {
+	int64		nr_waits;
+	int64		total_us;
+	int64		max_us;
+	int64		buckets[BDR_LOCKS_WAIT_BUCKETS];
+} BdrLocksWaitStats;
+
+/*
+ * Nodes that confirmed a lock request, so a confirmation replayed again, e.g.
+ * after an apply worker restart, isn't counted twice.
+ */
+typedef struct BdrLockConfirmedSet {
+	int			nconfirmed;
+	uint8		origins[BDR_LOCKS_CONFIRM_ORIGINS / 8];
+} BdrLockConfirmedSet;
+
+/*
+ * Confirmations seen for a lock request using the pipelined protocol.
+ */
+typedef struct BdrLockConfirmations {
+	/* requesting node, and request */
+	uint64		sysid;
+	TimeLineID	tli;
+	Oid			datid;
+	XLogRecPtr	request_lsn;
+
+	/* nodes other than the requestor that confirmed it */
+	BdrLockConfirmedSet confirmed;
+
+	/* to evict the oldest tracked request */
+	uint32		generation;
+
+	/* apply worker waiting for confirmations, if any */
+	Latch	   *waiter;
+} BdrLockConfirmations;
+
+/*
+ * The latest pipelined lock request seen from a node, so requests arriving
+ * both via the control channel and the replication stream are only
+ * processed once.
+ */
+typedef struct BdrLockRequestSeen {
+	uint64		sysid;
+	TimeLineID	tli;
+	Oid			datid;
+	XLogRecPtr	request_lsn;
+} BdrLockRequestSeen;
+
+/* A message queued for or received from the control channel */
+typedef struct BdrControlMessage {
+	int			len;
+	char		data[BDR_LOCKS_CONTROL_MSG_SIZE];
+} BdrControlMessage;
+
 typedef struct BdrLocksDBState {
 	/* db slot used */
 	bool		in_use;
@@ -139,16 +265,46 @@ typedef struct BdrLocksDBState {
 
 	BDRLockType	lock_type;
 
+	/*
+	 * Relations a write lock is restricted to, if lock_scoped. Otherwise it
+	 * covers the whole database.
+	 */
+	bool		lock_scoped;
+	int			nlock_relations;
+	Oid			lock_relations[BDR_LOCKS_MAX_RELATIONS];
+
 	/* progress of lock acquiration */
-	int			acquire_confirmed;
+	BdrLockConfirmedSet acquire_confirmed;
 	int			acquire_declined;
 
 	/* progress of replay confirmation */
 	int			replay_confirmed;
 	XLogRecPtr	replay_confirmed_lsn;
 
+	/*
+	 * Pipelined request the lock was requested by us or granted to another
+	 * node for, if any, and the generation of its tracked confirmations.
+	 */
+	XLogRecPtr	lock_request_lsn;
+	uint32		lock_generation;
+
+	/* recent pipelined requests by any node */
+	BdrLockConfirmations confirmations[BDR_LOCKS_TRACKED_REQUESTS];
+	uint32		confirmations_generation;
+	BdrLockRequestSeen requests_seen[BDR_LOCKS_TRACKED_NODES];
+
+	/* control channel queues, handled by the perdb worker */
+	Latch	   *perdb_latch;
+	int			ncontrol_out;
+	int			ncontrol_in;
+	BdrControlMessage control_out[BDR_LOCKS_CONTROL_QUEUE];
+	BdrControlMessage control_in[BDR_LOCKS_CONTROL_QUEUE];
+
 	Latch	   *requestor;
-	slist_head	waiters;		/* list of waiting PGPROCs */
+	dlist_head	waiters;		/* list of waiting PGPROCs */
+
+	/* time backends spent blocked, by BdrLocksWaitKind */
+	BdrLocksWaitStats wait_stats[BDR_LOCKS_WAIT_NKINDS];
 } BdrLocksDBState;
 
 typedef struct BdrLocksCtl {
@@ -159,16 +315,24 @@ typedef struct BdrLocksCtl {
 
 static BdrLocksDBState * bdr_locks_find_database(Oid dbid, bool create);
 static void bdr_locks_find_my_database(bool create);
-static void bdr_prepare_message(StringInfo s, BdrMessageType message_type);
+static void bdr_locks_set_scope(bool scoped, Oid *relids, int nrelids);
+static void bdr_locks_queue_control_message(StringInfo s);
 
 static char *bdr_lock_type_to_name(BDRLockType lock_type);
 static BDRLockType bdr_lock_name_to_type(const char *lock_type);
 
 static void bdr_request_replay_confirmation(void);
-static void bdr_send_confirm_lock(void);
+static void bdr_locks_request_peer_replay(void);
+static void bdr_send_confirm_lock(XLogRecPtr request_lsn);
+static BdrLockConfirmations *bdr_locks_find_confirmations(uint64 sysid,
+							 TimeLineID tli, Oid datid, XLogRecPtr request_lsn);
+static BdrLockConfirmations *bdr_locks_get_confirmations(uint64 sysid,
+							TimeLineID tli, Oid datid, XLogRecPtr request_lsn);
 
 static void bdr_locks_addwaiter(PGPROC *proc);
+static void bdr_locks_removewaiter(PGPROC *proc);
 static void bdr_locks_on_unlock(void);
+static void bdr_locks_count_wait(BdrLocksWaitKind kind, TimestampTz start);
 
 static BdrLocksCtl *bdr_locks_ctl;
 
@@ -180,6 +344,59 @@ static BdrLocksDBState *bdr_my_locks_database = NULL;
 
 static bool this_xact_acquired_lock = false;
 
+/*
+ * Whether the origin this apply worker replays has announced holding a lock
+ * it requested using the pipelined protocol, and which request. If we lost
+ * track of its confirmations, wait_round is set and the confirmations waited
+ * for are the replies to our own replay confirmation request at
+ * wait_request_lsn instead, see bdr_locks_request_peer_replay.
+ */
+static bool wait_for_peer_replay = false;
+static uint64 wait_sysid;
+static TimeLineID wait_tli;
+static Oid wait_datid;
+static XLogRecPtr wait_request_lsn;
+static uint32 wait_generation;
+static bool wait_round;
+
+/* perdb worker's connections to other nodes for the control channel */
+typedef struct BdrControlConn {
+	uint64		sysid;
+	TimeLineID	tli;
+	Oid			datid;
+	char	   *dsn;
+	PGconn	   *conn;
+	TimestampTz	retry_after;
+} BdrControlConn;
+
+static List *control_conns = NIL;
+static Size control_conns_nnodes = 0;
+
+/*
+ * Lock the perdb worker granted over the control channel, but not confirmed
+ * yet because conflicting transactions are still given time to finish. It
+ * re-checks them from its latch loop instead of sleeping, see
+ * bdr_locks_process_pending_grant.
+ */
+static bool grant_pending = false;
+static RepNodeId grant_origin;
+static uint64 grant_sysid;
+static TimeLineID grant_tli;
+static Oid grant_datid;
+static BDRLockType grant_lock_type;
+static XLogRecPtr grant_request_lsn;
+static bool grant_scoped;
+static int grant_nscope;
+static Oid grant_scope[BDR_LOCKS_MAX_RELATIONS];
+static TimestampTz grant_endtime;
+static long grant_waittime;
+
+/*
+ * How long the perdb worker waits for connecting to a node, or for it to
+ * accept a control message, before giving up on it for a while.
+ */
+#define BDR_LOCKS_CONTROL_TIMEOUT_MS 5000
+
 
 static size_t
 bdr_locks_shmem_size(void)
@@ -210,9 +427,11 @@ bdr_locks_shmem_startup(void)
 	{
 		memset(bdr_locks_ctl, 0, bdr_locks_shmem_size());
 		bdr_locks_ctl->lock = LWLockAssign();
-		bdr_locks_ctl->dbstate = (BdrLocksDBState *) bdr_locks_ctl + sizeof(BdrLocksCtl);
-		bdr_locks_ctl->waiters = (BDRLockWaiter *) bdr_locks_ctl + sizeof(BdrLocksCtl) +
-			mul_size(sizeof(BdrLocksDBState), bdr_max_databases);
+		bdr_locks_ctl->dbstate = (BdrLocksDBState *)
+			((char *) bdr_locks_ctl + sizeof(BdrLocksCtl));
+		bdr_locks_ctl->waiters = (BDRLockWaiter *)
+			((char *) bdr_locks_ctl->dbstate +
+			 mul_size(sizeof(BdrLocksDBState), bdr_max_databases));
 	}
 	LWLockRelease(AddinShmemInitLock);
 }
@@ -233,31 +452,85 @@ bdr_locks_shmem_init()
 	shmem_startup_hook = bdr_locks_shmem_startup;
 }
 
-/* Waiter manipulation. */
+/*
+ * Waiter manipulation. Caller needs to hold bdr_locks_ctl->lock exclusively.
+ *
+ * A backend erroring out while waiting stays registered; that only costs a
+ * spurious wakeup, and the entry is moved when the PGPROC next waits.
+ */
 void
 bdr_locks_addwaiter(PGPROC *proc)
 {
 	BDRLockWaiter  *waiter = &bdr_locks_ctl->waiters[proc->pgprocno];
 
+	if (waiter->db == bdr_my_locks_database)
+		return;
+
+	if (waiter->db != NULL)
+		dlist_delete(&waiter->node);
+
 	waiter->proc = proc;
-	slist_push_head(&bdr_my_locks_database->waiters, &waiter->node);
+	waiter->db = bdr_my_locks_database;
+	dlist_push_head(&bdr_my_locks_database->waiters, &waiter->node);
 }
 
+void
+bdr_locks_removewaiter(PGPROC *proc)
+{
+	BDRLockWaiter  *waiter = &bdr_locks_ctl->waiters[proc->pgprocno];
+
+	if (waiter->db == NULL)
+		return;
+
+	dlist_delete(&waiter->node);
+	waiter->db = NULL;
+}
+
+/* Wake up all waiters, which recheck what they're waiting for. */
 void
 bdr_locks_on_unlock(void)
 {
-	while (!slist_is_empty(&bdr_my_locks_database->waiters))
+	while (!dlist_is_empty(&bdr_my_locks_database->waiters))
 	{
-		slist_node *node;
+		dlist_node *node;
 		BDRLockWaiter  *waiter;
-		PGPROC	   *proc;
 
-		node = slist_pop_head_node(&bdr_my_locks_database->waiters);
-		waiter = slist_container(BDRLockWaiter, node, node);
-		proc = waiter->proc;
+		node = dlist_pop_head_node(&bdr_my_locks_database->waiters);
+		waiter = dlist_container(BDRLockWaiter, node, node);
+		waiter->db = NULL;
+
+		SetLatch(&waiter->proc->procLatch);
+	}
+}
+
+/*
+ * Count a wait that started at start and just ended.
+ */
+static void
+bdr_locks_count_wait(BdrLocksWaitKind kind, TimestampTz start)
+{
+	BdrLocksWaitStats *stats;
+	long		secs;
+	int			usecs;
+	int64		waited_us;
+	int			bucket;
+
+	TimestampDifference(start, GetCurrentTimestamp(), &secs, &usecs);
+	waited_us = (int64) secs * USECS_PER_SEC + usecs;
 
-		SetLatch(&proc->procLatch);
+	for (bucket = 0; bucket < BDR_LOCKS_WAIT_BUCKETS - 1; bucket++)
+	{
+		if (waited_us < (int64) bdr_locks_wait_bucket_ms[bucket] * 1000)
+			break;
 	}
+
+	LWLockAcquire(bdr_locks_ctl->lock, LW_EXCLUSIVE);
+	stats = &bdr_my_locks_database->wait_stats[kind];
+	stats->nr_waits++;
+	stats->total_us += waited_us;
+	stats->max_us = Max(stats->max_us, waited_us);
+	stats->buckets[bucket]++;
+	LWLockRelease(bdr_locks_ctl->lock);
 }
 
 /*
@@ -297,6 +570,7 @@ bdr_locks_find_database(Oid dboid, bool create)
 	{
 		BdrLocksDBState *db = &bdr_locks_ctl->dbstate[free_off];
 		db->dboid = MyDatabaseId;
+		dlist_init(&db->waiters);
 		db->in_use = true;
 		return db;
 	}
@@ -343,6 +617,13 @@ bdr_locks_startup()
 
 	bdr_locks_find_my_database(true);
 
+	/* the control channel is handled by us */
+	LWLockAcquire(bdr_locks_ctl->lock, LW_EXCLUSIVE);
+	bdr_my_locks_database->perdb_latch = &MyProc->procLatch;
+	bdr_my_locks_database->ncontrol_in = 0;
+	bdr_my_locks_database->ncontrol_out = 0;
+	LWLockRelease(bdr_locks_ctl->lock);
+
 	/*
 	 * Don't initialize database level lock state twice. An crash requiring
 	 * that has to be severe enough to trigger a crash-restart cycle.
@@ -350,8 +631,6 @@ bdr_locks_startup()
 	if (bdr_my_locks_database->locked_and_loaded)
 		return;
 
-	slist_init(&bdr_my_locks_database->waiters);
-
 	/* We haven't yet established how many nodes we're connected to. */
 	bdr_my_locks_database->nnodes = 0;
 
@@ -410,6 +689,8 @@ bdr_locks_startup()
 			bdr_my_locks_database->lock_holder = node_id;
 			bdr_my_locks_database->lockcount++;
 			bdr_my_locks_database->lock_type = lock_type;
+			bdr_locks_set_scope(false, NULL, 0);
+			bdr_my_locks_database->lock_request_lsn = InvalidXLogRecPtr;
 			/* A remote node might have held the local lock before restart */
 			elog(DEBUG1, "reacquiring local lock held before shutdown");
 		}
@@ -431,6 +712,8 @@ bdr_locks_startup()
 			bdr_my_locks_database->lock_holder = node_id;
 			bdr_my_locks_database->lockcount++;
 			bdr_my_locks_database->lock_type = lock_type;
+			bdr_locks_set_scope(false, NULL, 0);
+			bdr_my_locks_database->lock_request_lsn = InvalidXLogRecPtr;
 			bdr_my_locks_database->replay_confirmed = 0;
 			bdr_my_locks_database->replay_confirmed_lsn = wait_for_lsn;
 
@@ -448,8 +731,11 @@ bdr_locks_startup()
 
 	elog(DEBUG2, "global locking startup completed, local DML enabled");
 
-	/* allow local DML */
+	/* allow local DML, and wake up backends waiting for that */
+	LWLockAcquire(bdr_locks_ctl->lock, LW_EXCLUSIVE);
 	bdr_my_locks_database->locked_and_loaded = true;
+	bdr_locks_on_unlock();
+	LWLockRelease(bdr_locks_ctl->lock);
 }
 
 void
@@ -489,7 +775,10 @@ bdr_locks_set_nnodes(Size nnodes)
 }
 
 
-static void
+/*
+ * Start a message on the "bdr" channel, identifying this node as its origin.
+ */
+void
 bdr_prepare_message(StringInfo s, BdrMessageType message_type)
 {
 	/* channel */
@@ -506,6 +795,69 @@ bdr_prepare_message(StringInfo s, BdrMessageType message_type)
 	/* caller's data will follow */
 }
 
+/*
+ * Restrict the lock held in this database to the passed relations, or make
+ * it cover the whole database if !scoped.
+ *
+ * Caller needs to hold bdr_locks_ctl->lock.
+ */
+static void
+bdr_locks_set_scope(bool scoped, Oid *relids, int nrelids)
+{
+	Assert(nrelids <= BDR_LOCKS_MAX_RELATIONS);
+
+	bdr_my_locks_database->lock_scoped = scoped;
+	bdr_my_locks_database->nlock_relations = 0;
+
+	if (scoped)
+	{
+		memcpy(bdr_my_locks_database->lock_relations, relids,
+			   sizeof(Oid) * nrelids);
+		bdr_my_locks_database->nlock_relations = nrelids;
+	}
+}
+
+static bool
+bdr_locks_scope_contains(Oid relid)
+{
+	int			i;
+
+	for (i = 0; i < bdr_my_locks_database->nlock_relations; i++)
+	{
+		if (bdr_my_locks_database->lock_relations[i] == relid)
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * Does the lock held in this database already prevent writes to the passed
+ * relations, or to all relations if !scoped?
+ */
+static bool
+bdr_locks_covers(bool scoped, Oid *relids, int nrelids)
+{
+	int			i;
+
+	if (bdr_my_locks_database->lock_type < BDR_LOCK_WRITE)
+		return false;
+
+	if (!bdr_my_locks_database->lock_scoped)
+		return true;
+
+	if (!scoped)
+		return false;
+
+	for (i = 0; i < nrelids; i++)
+	{
+		if (!bdr_locks_scope_contains(relids[i]))
+			return false;
+	}
+
+	return true;
+}
+
 static void
 bdr_lock_xact_callback(XactEvent event, void *arg)
 {
@@ -537,6 +889,8 @@ bdr_lock_xact_callback(XactEvent event, void *arg)
 
 		this_xact_acquired_lock = false;
 		bdr_my_locks_database->lock_type = BDR_LOCK_NOLOCK;
+		bdr_locks_set_scope(false, NULL, 0);
+		bdr_my_locks_database->lock_request_lsn = InvalidXLogRecPtr;
 		bdr_my_locks_database->replay_confirmed = 0;
 		bdr_my_locks_database->replay_confirmed_lsn = InvalidXLogRecPtr;
 		bdr_my_locks_database->requestor = NULL;
@@ -588,14 +942,25 @@ locks_begin_scan(Relation rel, Snapshot snap, uint64 sysid, TimeLineID tli, Oid
 /*
  * Acquire DDL lock on the side that wants to perform DDL.
  *
+ * A write lock can be restricted to the relations in relids; if relids is
+ * NIL it covers the whole database. Subsequent requests in the same
+ * transaction extend the set of locked relations.
+ *
  * Called from a user backend when the command filter spots a DDL attempt; runs
  * in the user backend.
  */
 void
-bdr_acquire_ddl_lock(BDRLockType lock_type)
+bdr_acquire_ddl_lock(BDRLockType lock_type, List *relids)
 {
 	XLogRecPtr	lsn;
+	XLogRecPtr	request_lsn;
 	StringInfoData s;
+	TimestampTz	wait_start;
+	Oid			scope[BDR_LOCKS_MAX_RELATIONS];
+	int			nscope = 0;
+	bool		scoped;
+	ListCell   *lc;
+	int			i;
 
 	Assert(IsTransactionState());
 	/* Not called from within a BDR worker */
@@ -606,10 +971,46 @@ bdr_acquire_ddl_lock(BDRLockType lock_type)
 
 	bdr_locks_find_my_database(false);
 
+	scoped = lock_type == BDR_LOCK_WRITE && relids != NIL &&
+		list_length(relids) <= BDR_LOCKS_MAX_RELATIONS;
+	if (scoped)
+	{
+		foreach(lc, relids)
+			scope[nscope++] = lfirst_oid(lc);
+	}
+
 	/* No need to do anything if already holding requested lock. */
-	if (this_xact_acquired_lock &&
-		bdr_my_locks_database->lock_type >= lock_type)
-		return;
+	if (this_xact_acquired_lock)
+	{
+		if (lock_type < BDR_LOCK_WRITE &&
+			bdr_my_locks_database->lock_type >= lock_type)
+			return;
+
+		if (lock_type == BDR_LOCK_WRITE &&
+			bdr_locks_covers(scoped, scope, nscope))
+			return;
+
+		/* we're extending a scoped write lock, keep what we already hold */
+		if (scoped && bdr_my_locks_database->lock_type == BDR_LOCK_WRITE)
+		{
+			for (i = 0; i < bdr_my_locks_database->nlock_relations; i++)
+			{
+				Oid			relid = bdr_my_locks_database->lock_relations[i];
+
+				if (list_member_oid(relids, relid))
+					continue;
+
+				if (nscope >= BDR_LOCKS_MAX_RELATIONS)
+				{
+					scoped = false;
+					break;
+				}
+				scope[nscope++] = relid;
+			}
+		}
+
+		lock_type = Max(lock_type, bdr_my_locks_database->lock_type);
+	}
 
 	/*
 	 * If this is the first time in current transaction that we are trying to
@@ -668,6 +1069,49 @@ bdr_acquire_ddl_lock(BDRLockType lock_type)
 	/* Add lock type */
 	pq_sendint(&s, lock_type, 4);
 
+	/*
+	 * Add the relations the lock is restricted to, by name. No relations
+	 * means the whole database.
+	 */
+	if (scoped)
+	{
+		StringInfoData rels;
+
+		initStringInfo(&rels);
+		for (i = 0; i < nscope; i++)
+		{
+			char	   *relname = get_rel_name(scope[i]);
+			char	   *nspname = get_namespace_name(get_rel_namespace(scope[i]));
+
+			/* concurrently dropped, better lock everything */
+			if (relname == NULL || nspname == NULL)
+			{
+				scoped = false;
+				break;
+			}
+
+			pq_sendstring(&rels, nspname);
+			pq_sendstring(&rels, relname);
+		}
+
+		if (scoped)
+		{
+			pq_sendint(&s, nscope, 4);
+			appendBinaryStringInfo(&s, rels.data, rels.len);
+		}
+		else
+			pq_sendint(&s, 0, 4);
+	}
+	else
+		pq_sendint(&s, 0, 4);
+
+	/*
+	 * Identify the request, which also asks other nodes to use the pipelined
+	 * protocol.
+	 */
+	request_lsn = GetXLogInsertRecPtr();
+	pq_sendint64(&s, request_lsn);
+
 	START_CRIT_SECTION();
 
 	/*
@@ -680,10 +1124,13 @@ bdr_acquire_ddl_lock(BDRLockType lock_type)
 		bdr_my_locks_database->lockcount++;
 		this_xact_acquired_lock = true;
 	}
-	bdr_my_locks_database->acquire_confirmed = 0;
+	memset(&bdr_my_locks_database->acquire_confirmed, 0,
+		   sizeof(BdrLockConfirmedSet));
 	bdr_my_locks_database->acquire_declined = 0;
 	bdr_my_locks_database->requestor = &MyProc->procLatch;
 	bdr_my_locks_database->lock_type = lock_type;
+	bdr_locks_set_scope(scoped, scope, nscope);
+	bdr_my_locks_database->lock_request_lsn = request_lsn;
 
 	/* lock looks to be free, try to acquire it */
 
@@ -692,6 +1139,9 @@ bdr_acquire_ddl_lock(BDRLockType lock_type)
 
 	END_CRIT_SECTION();
 
+	/* and don't wait for the other nodes to replay up to the request */
+	bdr_locks_queue_control_message(&s);
+
 	LWLockRelease(bdr_locks_ctl->lock);
 
 	/* ---
@@ -700,6 +1150,8 @@ bdr_acquire_ddl_lock(BDRLockType lock_type)
 	 */
 	elog(DEBUG2, "sent global lock request, waiting for confirmation");
 
+	wait_start = GetCurrentTimestamp();
+
 	while (true)
 	{
 		int rc;
@@ -711,6 +1163,9 @@ bdr_acquire_ddl_lock(BDRLockType lock_type)
 		/* check for confirmations in shared memory */
 		if (bdr_my_locks_database->acquire_declined > 0)
 		{
+			LWLockRelease(bdr_locks_ctl->lock);
+			bdr_locks_count_wait(BDR_LOCKS_WAIT_ACQUIRE, wait_start);
+
 			ereport(ERROR,
 					(errcode(ERRCODE_LOCK_NOT_AVAILABLE),
 					 errmsg("could not acquire global lock - another node has declined our lock request"),
@@ -718,9 +1173,10 @@ bdr_acquire_ddl_lock(BDRLockType lock_type)
 		}
 
 		/* wait till all have given their consent */
-		if (bdr_my_locks_database->acquire_confirmed >= bdr_my_locks_database->nnodes)
+		if (bdr_my_locks_database->acquire_confirmed.nconfirmed >= bdr_my_locks_database->nnodes)
 		{
 			LWLockRelease(bdr_locks_ctl->lock);
+			bdr_locks_count_wait(BDR_LOCKS_WAIT_ACQUIRE, wait_start);
 			break;
 		}
 		LWLockRelease(bdr_locks_ctl->lock);
@@ -739,13 +1195,30 @@ bdr_acquire_ddl_lock(BDRLockType lock_type)
 	LWLockAcquire(bdr_locks_ctl->lock, LW_EXCLUSIVE);
 
 	/* TODO: recheck it's ours */
-	bdr_my_locks_database->acquire_confirmed = 0;
+	memset(&bdr_my_locks_database->acquire_confirmed, 0,
+		   sizeof(BdrLockConfirmedSet));
 	bdr_my_locks_database->acquire_declined = 0;
 	bdr_my_locks_database->requestor = NULL;
 
 	elog(DEBUG1, "global lock acquired successfully by (" BDR_LOCALID_FORMAT ")", BDR_LOCALID_FORMAT_ARGS);
 
 	LWLockRelease(bdr_locks_ctl->lock);
+
+	/*
+	 * Tell the other nodes that our changes from now on may rely on the
+	 * lock, so they have to finish replaying everyone's changes from before
+	 * it first. DDL locks don't block writes, so there's nothing to wait
+	 * for.
+	 */
+	if (lock_type >= BDR_LOCK_WRITE)
+	{
+		resetStringInfo(&s);
+		bdr_prepare_message(&s, BDR_MESSAGE_LOCK_ACQUIRED);
+		pq_sendint64(&s, request_lsn);
+
+		lsn = LogStandbyMessage(s.data, s.len, false);
+		XLogFlush(lsn);
+	}
 }
 
 static bool
@@ -757,10 +1230,15 @@ check_is_my_origin_node(uint64 sysid, TimeLineID tli, Oid datid)
 
 	Assert(!IsTransactionState());
 
-	StartTransactionCommand();
-	bdr_fetch_sysid_via_node_id(replication_origin_id, &replay_sysid,
-								&replay_tli, &replay_datid);
-	CommitTransactionCommand();
+	/* only need a transaction if the node isn't in the cache yet */
+	if (!bdr_nodecache_lookup(replication_origin_id, &replay_sysid,
+							  &replay_tli, &replay_datid))
+	{
+		StartTransactionCommand();
+		bdr_fetch_sysid_via_node_id(replication_origin_id, &replay_sysid,
+									&replay_tli, &replay_datid);
+		CommitTransactionCommand();
+	}
 
 	if (sysid != replay_sysid ||
 		tli != replay_tli ||
@@ -780,28 +1258,27 @@ check_is_my_node(uint64 sysid, TimeLineID tli, Oid datid)
 }
 
 /*
- * Kill any writing transactions while giving them some grace period for
- * finishing.
- *
- * Caller is responsible for ensuring that no new writes can be started during
- * the execution of this function.
+ * Kill the writing transactions among the passed ones, while giving them
+ * until endtime for finishing. Unless wait is set, returns false instead of
+ * waiting for one that still has time left.
  */
-static void
-cancel_conflicting_transactions(void)
+static bool
+cancel_conflicting_vxids(VirtualTransactionId *conflict, TimestampTz endtime,
+						 bool wait)
 {
-	VirtualTransactionId *conflict;
-	TimestampTz		endtime = TimestampTzPlusMilliseconds(GetCurrentTimestamp(), bdr_ddl_grace_timeout),
-					waittime = 1000;
-
-	conflict = GetConflictingVirtualXIDs(InvalidTransactionId, MyDatabaseId);
+	TimestampTz		waittime = 1000;
 
 	while (conflict->backendId != InvalidBackendId)
 	{
 		PGPROC	   *pgproc = BackendIdGetProc(conflict->backendId);
 		PGXACT	   *pgxact;
 
+		/* already gone */
 		if (pgproc == NULL)
+		{
+			conflict++;
 			continue;
+		}
 
 		pgxact = &ProcGlobal->allPgXact[pgproc->pgprocno];
 
@@ -815,6 +1292,9 @@ cancel_conflicting_transactions(void)
 		/* If here is writing transaction give it time to finish */
 		if (GetCurrentTimestamp() < endtime)
 		{
+			if (!wait)
+				return false;
+
 			/* Increasing backoff interval for wait time with limit of 1s */
 			pg_usleep(waittime);
 			waittime *= 2;
@@ -838,6 +1318,47 @@ cancel_conflicting_transactions(void)
 			elog(DEBUG2, "signaled pid %d to terminate because it conflicts with a global lock requested by another node", p);
 		}
 	}
+
+	return true;
+}
+
+/*
+ * Kill any writing transactions while giving them some grace period for
+ * finishing. If the lock is restricted to some relations, only transactions
+ * that have written to them (or hold locks conflicting with writes) are
+ * affected.
+ *
+ * The grace period ends at endtime. Unless wait is set, returns false
+ * instead of waiting for writing transactions to finish before that, so the
+ * caller can check again later; once it's over they're killed either way.
+ *
+ * Caller is responsible for ensuring that no new writes can be started during
+ * the execution of this function.
+ */
+static bool
+cancel_conflicting_transactions(bool scoped, Oid *relids, int nrelids,
+								TimestampTz endtime, bool wait)
+{
+	int				i;
+
+	if (!scoped)
+		return cancel_conflicting_vxids(GetConflictingVirtualXIDs(InvalidTransactionId,
+																  MyDatabaseId),
+										endtime, wait);
+
+	for (i = 0; i < nrelids; i++)
+	{
+		LOCKTAG		tag;
+
+		SET_LOCKTAG_RELATION(tag, MyDatabaseId, relids[i]);
+
+		/* writers hold RowExclusiveLock, which conflicts with ShareLock */
+		if (!cancel_conflicting_vxids(GetLockConflicts(&tag, ShareLock),
+									  endtime, wait))
+			return false;
+	}
+
+	return true;
 }
 
 static void
@@ -849,11 +1370,12 @@ bdr_request_replay_confirmation(void)
 
 	initStringInfo(&s);
 
+	/* under the lock, so no other replay confirmation request shares it */
+	LWLockAcquire(bdr_locks_ctl->lock, LW_EXCLUSIVE);
 	wait_for_lsn = GetXLogInsertRecPtr();
 	bdr_prepare_message(&s, BDR_MESSAGE_REQUEST_REPLAY_CONFIRM);
 	pq_sendint64(&s, wait_for_lsn);
 
-	LWLockAcquire(bdr_locks_ctl->lock, LW_EXCLUSIVE);
 	lsn = LogStandbyMessage(s.data, s.len, false);
 	XLogFlush(lsn);
 
@@ -865,62 +1387,270 @@ bdr_request_replay_confirmation(void)
 }
 
 /*
- * Another node has asked for a DDL lock. Try to acquire the local ddl lock.
+ * Queue a message for the perdb worker to send to all other nodes over the
+ * control channel, in addition to the replication stream. If the queue is
+ * full the message just takes the slow path.
  *
- * Runs in the apply worker.
+ * Caller needs to hold bdr_locks_ctl->lock.
  */
-void
-bdr_process_acquire_ddl_lock(uint64 sysid, TimeLineID tli, Oid datid, BDRLockType lock_type)
+static void
+bdr_locks_queue_control_message(StringInfo s)
 {
-	StringInfoData	s;
-	const char *lock_name = bdr_lock_type_to_name(lock_type);
+	BdrControlMessage *msg;
 
-	Assert(!IsTransactionState());
-	Assert(bdr_worker_type == BDR_WORKER_APPLY);
-
-	/* Don't care about locks acquired locally. Already held. */
-	if (!check_is_my_origin_node(sysid, tli, datid))
+	if (bdr_my_locks_database->perdb_latch == NULL ||
+		bdr_my_locks_database->ncontrol_out >= BDR_LOCKS_CONTROL_QUEUE ||
+		s->len > BDR_LOCKS_CONTROL_MSG_SIZE)
 		return;
 
-	bdr_locks_find_my_database(false);
+	msg = &bdr_my_locks_database->control_out[bdr_my_locks_database->ncontrol_out++];
+	msg->len = s->len;
+	memcpy(msg->data, s->data, s->len);
 
-	elog(DEBUG1, "global lock (%s) requested by node ("UINT64_FORMAT",%u,%u)",
-		 lock_name, sysid, tli, datid);
+	SetLatch(bdr_my_locks_database->perdb_latch);
+}
 
-	initStringInfo(&s);
+/*
+ * Note that a pipelined lock request is being processed. Returns false if
+ * it, or a later request by the same node, already has been, i.e. it
+ * arrived both over the control channel and the replication stream.
+ */
+static bool
+bdr_locks_note_request(uint64 sysid, TimeLineID tli, Oid datid,
+					   XLogRecPtr request_lsn)
+{
+	BdrLockRequestSeen *seen = NULL;
+	bool		first = true;
+	int			i;
 
 	LWLockAcquire(bdr_locks_ctl->lock, LW_EXCLUSIVE);
 
-	if (bdr_my_locks_database->lockcount == 0)
+	for (i = 0; i < BDR_LOCKS_TRACKED_NODES; i++)
 	{
-		Relation rel;
-		Datum	values[10];
-		bool	nulls[10];
-		HeapTuple tup;
-
-		/*
-		 * No previous DDL lock found. Start acquiring it.
-		 */
-		elog(DEBUG1, "no prior global lock found, acquiring global lock locally");
-
-		/* Add a row to bdr_locks */
-		StartTransactionCommand();
+		BdrLockRequestSeen *r = &bdr_my_locks_database->requests_seen[i];
 
-		memset(nulls, 0, sizeof(nulls));
+		if (r->sysid == sysid && r->tli == tli && r->datid == datid)
+		{
+			seen = r;
+			break;
+		}
 
-		rel = heap_open(BdrLocksRelid, RowExclusiveLock);
+		/* otherwise reuse an empty, or the least recent, entry */
+		if (seen == NULL || r->request_lsn < seen->request_lsn)
+			seen = r;
+	}
 
-		values[0] = CStringGetTextDatum(lock_name);
+	if (seen->sysid == sysid && seen->tli == tli && seen->datid == datid &&
+		seen->request_lsn >= request_lsn)
+		first = false;
+	else
+	{
+		seen->sysid = sysid;
+		seen->tli = tli;
+		seen->datid = datid;
+		seen->request_lsn = request_lsn;
+	}
 
-		appendStringInfo(&s, UINT64_FORMAT, sysid);
-		values[1] = CStringGetTextDatum(s.data);
-		resetStringInfo(&s);
-		values[2] = ObjectIdGetDatum(tli);
-		values[3] = ObjectIdGetDatum(datid);
+	LWLockRelease(bdr_locks_ctl->lock);
 
-		values[4] = TimestampTzGetDatum(GetCurrentTimestamp());
+	return first;
+}
 
-		appendStringInfo(&s, UINT64_FORMAT, GetSystemIdentifier());
+/*
+ * Confirm a lock granted to another node, once no conflicting transactions
+ * are left.
+ */
+static void
+bdr_locks_confirm_grant(uint64 sysid, TimeLineID tli, Oid datid,
+						BDRLockType lock_type, XLogRecPtr request_lsn)
+{
+	if (lock_type >= BDR_LOCK_WRITE && request_lsn == InvalidXLogRecPtr)
+	{
+		/*
+		 * We now have to wait till all our local pending changes have been
+		 * streamed out. We do this by sending a message which is then acked
+		 * by all other nodes. When the required number of messages is back we
+		 * can confirm the lock to the original requestor
+		 * (c.f. bdr_process_replay_confirm()).
+		 *
+		 * If we didn't wait for everyone to replay local changes then a DDL
+		 * change that caused those local changes not to apply on remote
+		 * nodes might occur, causing a divergent conflict.
+		 */
+		elog(DEBUG1, "requesting replay confirmation from all other nodes before confirming global lock granted");
+		bdr_request_replay_confirmation();
+	}
+	else
+	{
+		/*
+		 * Simple DDL locks that are not conflicting with existing
+		 * transactions can be just confirmed immediatelly. So can write
+		 * locks requested using the pipelined protocol, as our
+		 * confirmation follows all our pending changes in the stream; the
+		 * other nodes wait for having replayed them when they see the
+		 * requestor actually relying on the lock.
+		 */
+		elog(DEBUG1, "logging confirmation of this node's acquisition of global lock");
+		bdr_send_confirm_lock(request_lsn);
+	}
+
+	elog(DEBUG1, "global lock granted to remote node (" BDR_LOCALID_FORMAT ")",
+		 sysid, tli, datid, "");
+}
+
+/*
+ * Finish granting a lock to another node after it has been set up in shared
+ * memory: kill the local transactions it conflicts with, and confirm it.
+ *
+ * The apply worker waits for those transactions to finish within the grace
+ * period. The perdb worker mustn't, as it relays the control channel
+ * messages of all other lock requests meanwhile, so it leaves the lock
+ * pending and re-checks from its latch loop, see
+ * bdr_locks_process_pending_grant.
+ */
+static void
+bdr_locks_grant(RepNodeId origin, uint64 sysid, TimeLineID tli, Oid datid,
+				BDRLockType lock_type, XLogRecPtr request_lsn,
+				bool scoped, Oid *scope, int nscope)
+{
+	if (lock_type >= BDR_LOCK_WRITE)
+	{
+		TimestampTz endtime =
+			TimestampTzPlusMilliseconds(GetCurrentTimestamp(),
+										bdr_ddl_grace_timeout);
+		bool		wait = bdr_worker_type != BDR_WORKER_PERDB;
+
+		/*
+		 * Now kill all local processes that are still writing. We can't just
+		 * prevent them from writing via the acquired lock as they are still
+		 * running.
+		 */
+		elog(DEBUG1, "terminating any local processes that conflict with the global lock");
+		if (!cancel_conflicting_transactions(scoped, scope, nscope, endtime,
+											 wait))
+		{
+			elog(DEBUG1, "waiting for local processes that conflict with the global lock to finish before confirming it");
+
+			grant_pending = true;
+			grant_origin = origin;
+			grant_sysid = sysid;
+			grant_tli = tli;
+			grant_datid = datid;
+			grant_lock_type = lock_type;
+			grant_request_lsn = request_lsn;
+			grant_scoped = scoped;
+			grant_nscope = nscope;
+			memcpy(grant_scope, scope, sizeof(Oid) * nscope);
+			grant_endtime = endtime;
+			grant_waittime = 1;
+			return;
+		}
+	}
+
+	bdr_locks_confirm_grant(sysid, tli, datid, lock_type, request_lsn);
+}
+
+/*
+ * Another node has asked for a DDL lock. Try to acquire the local ddl lock.
+ *
+ * A write lock may be restricted to some relations, in which case only
+ * transactions writing to those of them that exist locally are affected.
+ *
+ * If the request is identified by request_lsn, the lock is confirmed as soon
+ * as it is granted locally, see the pipelined protocol in the notes above.
+ * Such requests may arrive twice, over the control channel and the
+ * replication stream, and are processed by whichever is first.
+ *
+ * Runs in the apply worker, or the perdb worker for the control channel,
+ * which doesn't wait for conflicting transactions, see bdr_locks_grant.
+ */
+static void
+bdr_locks_process_acquire(RepNodeId origin, uint64 sysid, TimeLineID tli,
+						  Oid datid, BDRLockType lock_type,
+						  int nrelations, BDRLockRelation *relations,
+						  XLogRecPtr request_lsn)
+{
+	StringInfoData	s;
+	const char *lock_name = bdr_lock_type_to_name(lock_type);
+	Oid			scope[BDR_LOCKS_MAX_RELATIONS];
+	int			nscope = 0;
+	bool		scoped;
+
+	Assert(!IsTransactionState());
+
+	bdr_locks_find_my_database(false);
+
+	if (request_lsn != InvalidXLogRecPtr &&
+		!bdr_locks_note_request(sysid, tli, datid, request_lsn))
+	{
+		elog(DEBUG2, "global lock request %X/%X by node ("UINT64_FORMAT",%u,%u) already processed",
+			 (uint32) (request_lsn >> 32), (uint32) request_lsn,
+			 sysid, tli, datid);
+		return;
+	}
+
+	elog(DEBUG1, "global lock (%s) requested by node ("UINT64_FORMAT",%u,%u) for %d relations",
+		 lock_name, sysid, tli, datid, nrelations);
+
+	/* look up the relations the lock is restricted to */
+	scoped = lock_type >= BDR_LOCK_WRITE && nrelations > 0 &&
+		nrelations <= BDR_LOCKS_MAX_RELATIONS;
+	if (scoped)
+	{
+		int			i;
+
+		StartTransactionCommand();
+		for (i = 0; i < nrelations; i++)
+		{
+			Oid			nspid = get_namespace_oid(relations[i].nspname, true);
+			Oid			relid;
+
+			/* doesn't exist here (yet), so nobody can be writing to it */
+			if (!OidIsValid(nspid))
+				continue;
+			relid = get_relname_relid(relations[i].relname, nspid);
+			if (!OidIsValid(relid))
+				continue;
+
+			scope[nscope++] = relid;
+		}
+		CommitTransactionCommand();
+	}
+
+	initStringInfo(&s);
+
+	LWLockAcquire(bdr_locks_ctl->lock, LW_EXCLUSIVE);
+
+	if (bdr_my_locks_database->lockcount == 0)
+	{
+		Relation rel;
+		Datum	values[10];
+		bool	nulls[10];
+		HeapTuple tup;
+
+		/*
+		 * No previous DDL lock found. Start acquiring it.
+		 */
+		elog(DEBUG1, "no prior global lock found, acquiring global lock locally");
+
+		/* Add a row to bdr_locks */
+		StartTransactionCommand();
+
+		memset(nulls, 0, sizeof(nulls));
+
+		rel = heap_open(BdrLocksRelid, RowExclusiveLock);
+
+		values[0] = CStringGetTextDatum(lock_name);
+
+		appendStringInfo(&s, UINT64_FORMAT, sysid);
+		values[1] = CStringGetTextDatum(s.data);
+		resetStringInfo(&s);
+		values[2] = ObjectIdGetDatum(tli);
+		values[3] = ObjectIdGetDatum(datid);
+
+		values[4] = TimestampTzGetDatum(GetCurrentTimestamp());
+
+		appendStringInfo(&s, UINT64_FORMAT, GetSystemIdentifier());
 		values[5] = CStringGetTextDatum(s.data);
 		resetStringInfo(&s);
 		values[6] = ObjectIdGetDatum(ThisTimeLineID);
@@ -955,46 +1685,23 @@ bdr_process_acquire_ddl_lock(uint64 sysid, TimeLineID tli, Oid datid, BDRLockTyp
 		/* setup ddl lock */
 		bdr_my_locks_database->lockcount++;
 		bdr_my_locks_database->lock_type = lock_type;
-		bdr_my_locks_database->lock_holder = replication_origin_id;
+		bdr_locks_set_scope(scoped, scope, nscope);
+		bdr_my_locks_database->lock_holder = origin;
+		bdr_my_locks_database->lock_request_lsn = request_lsn;
+		/* we'll have to wait for the other nodes' confirmations, see them */
+		if (lock_type >= BDR_LOCK_WRITE && request_lsn != InvalidXLogRecPtr)
+			bdr_my_locks_database->lock_generation =
+				bdr_locks_get_confirmations(sysid, tli, datid,
+											request_lsn)->generation;
 		LWLockRelease(bdr_locks_ctl->lock);
 
-		if (lock_type >= BDR_LOCK_WRITE)
-		{
-			/*
-			 * Now kill all local processes that are still writing. We can't just
-			 * prevent them from writing via the acquired lock as they are still
-			 * running.
-			 */
-			elog(DEBUG1, "terminating any local processes that conflict with the global lock");
-			cancel_conflicting_transactions();
-
-			/*
-			 * We now have to wait till all our local pending changes have been
-			 * streamed out. We do this by sending a message which is then acked
-			 * by all other nodes. When the required number of messages is back we
-			 * can confirm the lock to the original requestor
-			 * (c.f. bdr_process_replay_confirm()).
-			 *
-			 * If we didn't wait for everyone to replay local changes then a DDL
-			 * change that caused those local changes not to apply on remote
-			 * nodes might occur, causing a divergent conflict.
-			 */
-			elog(DEBUG1, "requesting replay confirmation from all other nodes before confirming global lock granted");
-			bdr_request_replay_confirmation();
-		} else {
-			/*
-			 * Simple DDL locks that are not conflicting with existing
-			 * transactions can be just confirmed immediatelly.
-			 */
-
-			elog(DEBUG1, "non-conflicting lock requested, logging confirmation of this node's acquisition of global lock");
-			bdr_send_confirm_lock();
-		}
-		elog(DEBUG1, "global lock granted to remote node (" BDR_LOCALID_FORMAT ")",
-			 sysid, tli, datid, "");
+		bdr_locks_grant(origin, sysid, tli, datid, lock_type, request_lsn,
+						scoped, scope, nscope);
 	}
-	else if (bdr_my_locks_database->lock_holder == replication_origin_id &&
-			 lock_type > bdr_my_locks_database->lock_type)
+	else if (bdr_my_locks_database->lock_holder == origin &&
+			 (lock_type > bdr_my_locks_database->lock_type ||
+			  (lock_type == BDR_LOCK_WRITE &&
+			   !bdr_locks_covers(scoped, scope, nscope))))
 	{
 		Relation	rel;
 		SysScanDesc	scan;
@@ -1054,43 +1761,16 @@ bdr_process_acquire_ddl_lock(uint64 sysid, TimeLineID tli, Oid datid, BDRLockTyp
 
 		/* update inmemory lock state */
 		bdr_my_locks_database->lock_type = lock_type;
+		bdr_locks_set_scope(scoped, scope, nscope);
+		bdr_my_locks_database->lock_request_lsn = request_lsn;
+		if (lock_type >= BDR_LOCK_WRITE && request_lsn != InvalidXLogRecPtr)
+			bdr_my_locks_database->lock_generation =
+				bdr_locks_get_confirmations(sysid, tli, datid,
+											request_lsn)->generation;
 		LWLockRelease(bdr_locks_ctl->lock);
 
-		if (lock_type >= BDR_LOCK_WRITE)
-		{
-			/*
-			 * Now kill all local processes that are still writing. We can't just
-			 * prevent them from writing via the acquired lock as they are still
-			 * running.
-			 */
-			elog(DEBUG1, "terminating any local processes that conflict with the global lock");
-			cancel_conflicting_transactions();
-
-			/*
-			 * We now have to wait till all our local pending changes have been
-			 * streamed out. We do this by sending a message which is then acked
-			 * by all other nodes. When the required number of messages is back we
-			 * can confirm the lock to the original requestor
-			 * (c.f. bdr_process_replay_confirm()).
-			 *
-			 * If we didn't wait for everyone to replay local changes then a DDL
-			 * change that caused those local changes not to apply on remote
-			 * nodes might occur, causing a divergent conflict.
-			 */
-			elog(DEBUG1, "requesting replay confirmation from all other nodes before confirming global lock granted");
-			bdr_request_replay_confirmation();
-		} else {
-			/*
-			 * Simple DDL locks that are not conflicting with existing
-			 * transactions can be just confirmed immediatelly.
-			 */
-
-			elog(DEBUG1, "non-conflicting lock requested, logging confirmation of this node's acquisition of global lock");
-			bdr_send_confirm_lock();
-		}
-
-		elog(DEBUG1, "global lock granted to remote node (" BDR_LOCALID_FORMAT ")",
-			 sysid, tli, datid, "");
+		bdr_locks_grant(origin, sysid, tli, datid, lock_type, request_lsn,
+						scoped, scope, nscope);
 	}
 	else
 	{
@@ -1118,13 +1798,45 @@ decline:
 		/* no name! locks are db wide */
 
 		pq_sendint(&s, lock_type, 4);
+		/* the request we're declining */
+		pq_sendint64(&s, request_lsn);
 
 		lsn = LogStandbyMessage(s.data, s.len, false);
 		XLogFlush(lsn);
+
+		/* let a pipelined requestor know without waiting for replay */
+		if (request_lsn != InvalidXLogRecPtr)
+		{
+			LWLockAcquire(bdr_locks_ctl->lock, LW_EXCLUSIVE);
+			bdr_locks_queue_control_message(&s);
+			LWLockRelease(bdr_locks_ctl->lock);
+		}
+
 		resetStringInfo(&s);
 	}
 }
 
+/*
+ * Another node has asked for a DDL lock via the replication stream.
+ *
+ * Runs in the apply worker.
+ */
+void
+bdr_process_acquire_ddl_lock(uint64 sysid, TimeLineID tli, Oid datid,
+							 BDRLockType lock_type,
+							 int nrelations, BDRLockRelation *relations,
+							 XLogRecPtr request_lsn)
+{
+	Assert(bdr_worker_type == BDR_WORKER_APPLY);
+
+	/* Don't care about locks acquired locally. Already held. */
+	if (!check_is_my_origin_node(sysid, tli, datid))
+		return;
+
+	bdr_locks_process_acquire(replication_origin_id, sysid, tli, datid,
+							  lock_type, nrelations, relations, request_lsn);
+}
+
 /*
  * Another node has released the global DDL lock, update our local state.
  *
@@ -1151,6 +1863,8 @@ bdr_process_release_ddl_lock(uint64 origin_sysid, TimeLineID origin_tli, Oid ori
 
 	bdr_locks_find_my_database(false);
 
+	wait_for_peer_replay = false;
+
 	initStringInfo(&s);
 
 	elog(DEBUG1, "global lock released by (" BDR_LOCALID_FORMAT ")",
@@ -1203,6 +1917,8 @@ bdr_process_release_ddl_lock(uint64 origin_sysid, TimeLineID origin_tli, Oid ori
 	latch = bdr_my_locks_database->requestor;
 
 	bdr_my_locks_database->lock_type = BDR_LOCK_NOLOCK;
+	bdr_locks_set_scope(false, NULL, 0);
+	bdr_my_locks_database->lock_request_lsn = InvalidXLogRecPtr;
 	bdr_my_locks_database->replay_confirmed = 0;
 	bdr_my_locks_database->replay_confirmed_lsn = InvalidXLogRecPtr;
 	bdr_my_locks_database->requestor = NULL;
@@ -1219,17 +1935,187 @@ bdr_process_release_ddl_lock(uint64 origin_sysid, TimeLineID origin_tli, Oid ori
 		SetLatch(latch);
 }
 
+/*
+ * Look up the confirmations tracked for a pipelined request. An invalid
+ * request_lsn matches the requesting node's newest tracked request.
+ *
+ * Caller needs to hold bdr_locks_ctl->lock.
+ */
+static BdrLockConfirmations *
+bdr_locks_find_confirmations(uint64 sysid, TimeLineID tli, Oid datid,
+							 XLogRecPtr request_lsn)
+{
+	BdrLockConfirmations *found = NULL;
+	int			i;
+
+	for (i = 0; i < BDR_LOCKS_TRACKED_REQUESTS; i++)
+	{
+		BdrLockConfirmations *c = &bdr_my_locks_database->confirmations[i];
+
+		if (c->request_lsn == InvalidXLogRecPtr ||
+			c->sysid != sysid || c->tli != tli || c->datid != datid)
+			continue;
+
+		if (request_lsn != InvalidXLogRecPtr)
+		{
+			if (c->request_lsn == request_lsn)
+				return c;
+		}
+		else if (found == NULL || c->generation > found->generation)
+			found = c;
+	}
+
+	return found;
+}
+
+/*
+ * Whether the confirmations tracked for a request are still needed: an apply
+ * worker is waiting for them, or they're those of the lock we've granted.
+ *
+ * Caller needs to hold bdr_locks_ctl->lock.
+ */
+static bool
+bdr_locks_confirmations_needed(BdrLockConfirmations *c)
+{
+	if (c->waiter != NULL)
+		return true;
+
+	return bdr_my_locks_database->lockcount > 0 &&
+		c->request_lsn != InvalidXLogRecPtr &&
+		c->request_lsn == bdr_my_locks_database->lock_request_lsn &&
+		c->generation == bdr_my_locks_database->lock_generation;
+}
+
+/*
+ * Look up the confirmations tracked for a pipelined request, starting to
+ * track it if it isn't yet. That evicts the oldest request tracked, if
+ * possible one whose confirmations aren't needed anymore. An apply worker
+ * losing track of the ones it needs asks all nodes to confirm again, see
+ * bdr_locks_request_peer_replay.
+ *
+ * Caller needs to hold bdr_locks_ctl->lock exclusively.
+ */
+static BdrLockConfirmations *
+bdr_locks_get_confirmations(uint64 sysid, TimeLineID tli, Oid datid,
+							XLogRecPtr request_lsn)
+{
+	BdrLockConfirmations *c;
+	BdrLockConfirmations *victim = NULL;
+	bool		victim_needed = false;
+	int			i;
+
+	Assert(request_lsn != InvalidXLogRecPtr);
+
+	c = bdr_locks_find_confirmations(sysid, tli, datid, request_lsn);
+	if (c != NULL)
+		return c;
+
+	for (i = 0; i < BDR_LOCKS_TRACKED_REQUESTS; i++)
+	{
+		bool		needed;
+
+		c = &bdr_my_locks_database->confirmations[i];
+		needed = bdr_locks_confirmations_needed(c);
+
+		if (victim == NULL ||
+			(victim_needed && !needed) ||
+			(victim_needed == needed && c->generation < victim->generation))
+		{
+			victim = c;
+			victim_needed = needed;
+		}
+	}
+
+	if (victim_needed)
+		elog(LOG, "evicting confirmations of global lock request %X/%X, which are still needed",
+			 (uint32) (victim->request_lsn >> 32), (uint32) victim->request_lsn);
+	else if (victim->request_lsn != InvalidXLogRecPtr)
+		elog(DEBUG1, "no longer tracking confirmations of global lock request %X/%X",
+			 (uint32) (victim->request_lsn >> 32), (uint32) victim->request_lsn);
+
+	memset(victim, 0, sizeof(BdrLockConfirmations));
+	victim->sysid = sysid;
+	victim->tli = tli;
+	victim->datid = datid;
+	victim->request_lsn = request_lsn;
+	victim->generation = ++bdr_my_locks_database->confirmations_generation;
+
+	return victim;
+}
+
+/*
+ * Add the node whose changes the current apply worker replays to the
+ * confirmations of a lock request. Returns false if it had already
+ * confirmed it.
+ */
+static bool
+bdr_locks_add_confirmation(BdrLockConfirmedSet *set)
+{
+	RepNodeId	origin = replication_origin_id;
+
+	if (origin < BDR_LOCKS_CONFIRM_ORIGINS)
+	{
+		if (set->origins[origin / 8] & (1 << (origin % 8)))
+			return false;
+		set->origins[origin / 8] |= 1 << (origin % 8);
+	}
+	else
+		elog(WARNING, "cannot tell confirmations of global lock by node with replication identifier %u apart",
+			 origin);
+
+	set->nconfirmed++;
+	return true;
+}
+
+/*
+ * Count a confirmation of another node's pipelined lock request. It might
+ * arrive before we've seen the request itself, so requests are tracked from
+ * their first confirmation.
+ */
+static void
+bdr_locks_track_confirmation(uint64 sysid, TimeLineID tli, Oid datid,
+							 XLogRecPtr request_lsn)
+{
+	BdrLockConfirmations *c;
+	Latch	   *latch = NULL;
+
+	LWLockAcquire(bdr_locks_ctl->lock, LW_EXCLUSIVE);
+
+	if (request_lsn != InvalidXLogRecPtr)
+		c = bdr_locks_get_confirmations(sysid, tli, datid, request_lsn);
+	else
+		c = bdr_locks_find_confirmations(sysid, tli, datid, request_lsn);
+
+	if (c != NULL && bdr_locks_add_confirmation(&c->confirmed))
+	{
+		latch = c->waiter;
+
+		elog(DEBUG2, "counted confirmation %d/%zu of global lock request %X/%X by ("BDR_LOCALID_FORMAT")",
+			 c->confirmed.nconfirmed, bdr_my_locks_database->nnodes,
+			 (uint32) (c->request_lsn >> 32), (uint32) c->request_lsn,
+			 sysid, tli, datid, "");
+	}
+
+	LWLockRelease(bdr_locks_ctl->lock);
+
+	if (latch)
+		SetLatch(latch);
+}
+
 /*
  * Another node has confirmed that a node has acquired the DDL lock
  * successfully. If the acquiring node was us, change shared memory state and
  * wake up the user backend that was trying to acquire the lock.
  *
+ * Confirmations of other nodes' pipelined requests are counted, so we know
+ * when we've replayed every node's changes from before the lock.
+ *
  * Runs in the apply worker.
  */
 void
 bdr_process_confirm_ddl_lock(uint64 origin_sysid, TimeLineID origin_tli, Oid origin_datid,
 							 uint64 lock_sysid, TimeLineID lock_tli, Oid lock_datid,
-							 BDRLockType lock_type)
+							 BDRLockType lock_type, XLogRecPtr request_lsn)
 {
 	Latch *latch;
 
@@ -1238,11 +2124,16 @@ bdr_process_confirm_ddl_lock(uint64 origin_sysid, TimeLineID origin_tli, Oid ori
 	if (!check_is_my_origin_node(origin_sysid, origin_tli, origin_datid))
 		return;
 
-	/* don't care if another database has gotten the lock */
+	bdr_locks_find_my_database(false);
+
+	/* another node's lock, we might have to wait for the confirmation */
 	if (!check_is_my_node(lock_sysid, lock_tli, lock_datid))
+	{
+		if (lock_type >= BDR_LOCK_WRITE)
+			bdr_locks_track_confirmation(lock_sysid, lock_tli, lock_datid,
+										 request_lsn);
 		return;
-
-	bdr_locks_find_my_database(false);
+	}
 
 	if (bdr_my_locks_database->lock_type != lock_type)
 	{
@@ -1253,11 +2144,27 @@ bdr_process_confirm_ddl_lock(uint64 origin_sysid, TimeLineID origin_tli, Oid ori
 	}
 
 	LWLockAcquire(bdr_locks_ctl->lock, LW_EXCLUSIVE);
-	bdr_my_locks_database->acquire_confirmed++;
+
+	/* like declines, confirmations of older requests may still arrive */
+	if (request_lsn != InvalidXLogRecPtr &&
+		request_lsn != bdr_my_locks_database->lock_request_lsn)
+	{
+		LWLockRelease(bdr_locks_ctl->lock);
+		return;
+	}
+
+	if (!bdr_locks_add_confirmation(&bdr_my_locks_database->acquire_confirmed))
+	{
+		LWLockRelease(bdr_locks_ctl->lock);
+		elog(DEBUG2, "ignoring repeated global lock confirmation from ("BDR_LOCALID_FORMAT")",
+			 origin_sysid, origin_tli, origin_datid, "");
+		return;
+	}
 	latch = bdr_my_locks_database->requestor;
 
 	elog(DEBUG2, "received global lock confirmation number %d/%zu from ("BDR_LOCALID_FORMAT")",
-		 bdr_my_locks_database->acquire_confirmed, bdr_my_locks_database->nnodes,
+		 bdr_my_locks_database->acquire_confirmed.nconfirmed,
+		 bdr_my_locks_database->nnodes,
 		 origin_sysid, origin_tli, origin_datid, "");
 	LWLockRelease(bdr_locks_ctl->lock);
 
@@ -1269,21 +2176,18 @@ bdr_process_confirm_ddl_lock(uint64 origin_sysid, TimeLineID origin_tli, Oid ori
  * Another node has declined a lock. If it was us, change shared memory state
  * and wakeup the user backend that tried to acquire the lock.
  *
- * Runs in the apply worker.
+ * Declines of pipelined requests arrive both over the control channel and the
+ * replication stream; the latter might only arrive once we're already trying
+ * again, so ignore declines of requests other than the current one.
+ *
+ * Runs in the apply worker, or the perdb worker for the control channel.
  */
-void
-bdr_process_decline_ddl_lock(uint64 origin_sysid, TimeLineID origin_tli, Oid origin_datid,
-							 uint64 lock_sysid, TimeLineID lock_tli, Oid lock_datid,
-							 BDRLockType lock_type)
+static void
+bdr_locks_process_decline(uint64 origin_sysid, TimeLineID origin_tli, Oid origin_datid,
+						  BDRLockType lock_type, XLogRecPtr request_lsn)
 {
 	Latch *latch;
 
-	Assert(bdr_worker_type == BDR_WORKER_APPLY);
-
-	/* don't care if another database has been declined a lock */
-	if (!check_is_my_origin_node(origin_sysid, origin_tli, origin_datid))
-		return;
-
 	bdr_locks_find_my_database(false);
 
 	if (bdr_my_locks_database->lock_type != lock_type)
@@ -1295,6 +2199,12 @@ bdr_process_decline_ddl_lock(uint64 origin_sysid, TimeLineID origin_tli, Oid ori
 	}
 
 	LWLockAcquire(bdr_locks_ctl->lock, LW_EXCLUSIVE);
+	if (request_lsn != InvalidXLogRecPtr &&
+		request_lsn != bdr_my_locks_database->lock_request_lsn)
+	{
+		LWLockRelease(bdr_locks_ctl->lock);
+		return;
+	}
 	bdr_my_locks_database->acquire_declined++;
 	latch = bdr_my_locks_database->requestor;
 	LWLockRelease(bdr_locks_ctl->lock);
@@ -1306,22 +2216,42 @@ bdr_process_decline_ddl_lock(uint64 origin_sysid, TimeLineID origin_tli, Oid ori
 }
 
 /*
- * Another node has asked us to confirm that we've replayed up to a given LSN.
- * We've seen the request message, so send the requested confirmation.
+ * Another node has declined a lock, as seen in the replication stream.
  *
  * Runs in the apply worker.
  */
 void
-bdr_process_request_replay_confirm(uint64 sysid, TimeLineID tli,
-								   Oid datid, XLogRecPtr request_lsn)
+bdr_process_decline_ddl_lock(uint64 origin_sysid, TimeLineID origin_tli, Oid origin_datid,
+							 uint64 lock_sysid, TimeLineID lock_tli, Oid lock_datid,
+							 BDRLockType lock_type, XLogRecPtr request_lsn)
 {
-	XLogRecPtr lsn;
-	StringInfoData s;
-
 	Assert(bdr_worker_type == BDR_WORKER_APPLY);
 
-	if (!check_is_my_origin_node(sysid, tli, datid))
-		return;
+	/* don't care if another database has been declined a lock */
+	if (!check_is_my_origin_node(origin_sysid, origin_tli, origin_datid))
+		return;
+
+	bdr_locks_process_decline(origin_sysid, origin_tli, origin_datid,
+							  lock_type, request_lsn);
+}
+
+/*
+ * Another node has asked us to confirm that we've replayed up to a given LSN.
+ * We've seen the request message, so send the requested confirmation.
+ *
+ * Runs in the apply worker.
+ */
+void
+bdr_process_request_replay_confirm(uint64 sysid, TimeLineID tli,
+								   Oid datid, XLogRecPtr request_lsn)
+{
+	XLogRecPtr lsn;
+	StringInfoData s;
+
+	Assert(bdr_worker_type == BDR_WORKER_APPLY);
+
+	if (!check_is_my_origin_node(sysid, tli, datid))
+		return;
 
 	bdr_locks_find_my_database(false);
 
@@ -1337,8 +2267,12 @@ bdr_process_request_replay_confirm(uint64 sysid, TimeLineID tli,
 }
 
 
+/*
+ * Confirm the lock we granted to the current lock holder. A valid
+ * request_lsn identifies the pipelined request being confirmed.
+ */
 static void
-bdr_send_confirm_lock(void)
+bdr_send_confirm_lock(XLogRecPtr request_lsn)
 {
 	Relation		rel;
 	SysScanDesc		scan;
@@ -1371,6 +2305,7 @@ bdr_send_confirm_lock(void)
 	/* no name! locks are db wide */
 
 	pq_sendint(&s, bdr_my_locks_database->lock_type, 4);
+	pq_sendint64(&s, request_lsn);
 
 	LogStandbyMessage(s.data, s.len, true); /* transactional */
 
@@ -1432,6 +2367,8 @@ bdr_process_replay_confirm(uint64 sysid, TimeLineID tli,
 						   Oid datid, XLogRecPtr request_lsn)
 {
 	bool quorum_reached = false;
+	BdrLockConfirmations *c;
+	Latch	   *latch = NULL;
 
 	Assert(bdr_worker_type == BDR_WORKER_APPLY);
 
@@ -1465,12 +2402,226 @@ bdr_process_replay_confirm(uint64 sysid, TimeLineID tli,
 	{
 		elog(DEBUG2, "global lock quorum reached, logging confirmation of this node's acquisition of global lock");
 
-		bdr_send_confirm_lock();
+		bdr_send_confirm_lock(InvalidXLogRecPtr);
 
 		elog(DEBUG2, "sent confirmation of successful global lock acquisition");
 	}
 
+	/*
+	 * A reply to an apply worker's request, see bdr_locks_request_peer_replay.
+	 * The lock holder's doesn't count, it's only seen by the worker waiting.
+	 */
+	c = bdr_locks_find_confirmations(GetSystemIdentifier(), ThisTimeLineID,
+									 MyDatabaseId, request_lsn);
+	if (c != NULL && c->waiter != &MyProc->procLatch &&
+		bdr_locks_add_confirmation(&c->confirmed))
+		latch = c->waiter;
+
+	LWLockRelease(bdr_locks_ctl->lock);
+
+	if (latch)
+		SetLatch(latch);
+}
+
+/*
+ * Ask all other nodes to confirm having replayed our changes up to here,
+ * and track their replies as the confirmations the current apply worker
+ * waits for in bdr_locks_wait_for_peer_replay.
+ *
+ * Used when we don't know which nodes confirmed the pipelined lock request
+ * the origin announced holding. Each node's reply follows its confirmation
+ * of the request in its stream, as the request precedes the announcement
+ * we've just replayed, which precedes our replay confirmation request. So
+ * once we've seen the replies, we've replayed all changes from before the
+ * lock too.
+ */
+static void
+bdr_locks_request_peer_replay(void)
+{
+	StringInfoData s;
+	XLogRecPtr	lsn;
+	XLogRecPtr	wait_for_lsn;
+	BdrLockConfirmations *c;
+
+	initStringInfo(&s);
+
+	/*
+	 * Under the lock, so no other replay confirmation request shares the
+	 * position, and replies aren't processed before we track them.
+	 */
+	LWLockAcquire(bdr_locks_ctl->lock, LW_EXCLUSIVE);
+	wait_for_lsn = GetXLogInsertRecPtr();
+	bdr_prepare_message(&s, BDR_MESSAGE_REQUEST_REPLAY_CONFIRM);
+	pq_sendint64(&s, wait_for_lsn);
+
+	lsn = LogStandbyMessage(s.data, s.len, false);
+	XLogFlush(lsn);
+
+	c = bdr_locks_get_confirmations(GetSystemIdentifier(), ThisTimeLineID,
+									MyDatabaseId, wait_for_lsn);
+	c->waiter = &MyProc->procLatch;
+
+	wait_round = true;
+	wait_request_lsn = wait_for_lsn;
+	wait_generation = c->generation;
+	LWLockRelease(bdr_locks_ctl->lock);
+
+	elog(DEBUG1, "requested replay confirmation %X/%X from all other nodes before applying changes relying on global lock of ("BDR_LOCALID_FORMAT")",
+		 (uint32) (wait_for_lsn >> 32), (uint32) wait_for_lsn,
+		 wait_sysid, wait_tli, wait_datid, "");
+
+	pfree(s.data);
+}
+
+/*
+ * A remote node has acquired the global write lock using the pipelined
+ * protocol; its changes from here on may rely on it. Remember to wait for
+ * having replayed the other nodes' changes from before the lock before
+ * applying them.
+ *
+ * Runs in the apply worker.
+ */
+void
+bdr_process_lock_acquired(uint64 sysid, TimeLineID tli, Oid datid,
+						  XLogRecPtr request_lsn)
+{
+	BdrLockConfirmations *c = NULL;
+	bool		granted;
+
+	Assert(bdr_worker_type == BDR_WORKER_APPLY);
+
+	if (!check_is_my_origin_node(sysid, tli, datid))
+		return;
+
+	bdr_locks_find_my_database(false);
+
+	wait_for_peer_replay = true;
+	wait_sysid = sysid;
+	wait_tli = tli;
+	wait_datid = datid;
+	wait_request_lsn = request_lsn;
+	wait_round = false;
+
+	LWLockAcquire(bdr_locks_ctl->lock, LW_EXCLUSIVE);
+	granted = bdr_my_locks_database->lockcount > 0 &&
+		bdr_my_locks_database->lock_holder == replication_origin_id &&
+		bdr_my_locks_database->lock_request_lsn == request_lsn;
+
+	/* we started tracking the request's confirmations when granting it */
+	if (granted)
+		c = bdr_locks_find_confirmations(sysid, tli, datid, request_lsn);
+	if (c != NULL)
+	{
+		wait_generation = c->generation;
+		c->waiter = &MyProc->procLatch;
+	}
 	LWLockRelease(bdr_locks_ctl->lock);
+
+	if (c != NULL)
+		return;
+
+	/*
+	 * If we haven't granted the request ourselves, e.g. because we restarted
+	 * since, or lost track of its confirmations, we don't know which nodes
+	 * confirmed it. Ask all of them to confirm again instead.
+	 */
+	if (granted)
+		elog(LOG, "lost track of confirmations of global lock request %X/%X by ("BDR_LOCALID_FORMAT"), asking all nodes to confirm replay",
+			 (uint32) (request_lsn >> 32), (uint32) request_lsn,
+			 sysid, tli, datid, "");
+	else
+		elog(LOG, "global lock request %X/%X by ("BDR_LOCALID_FORMAT") not granted by this node, asking all nodes to confirm replay",
+			 (uint32) (request_lsn >> 32), (uint32) request_lsn,
+			 sysid, tli, datid, "");
+
+	bdr_locks_request_peer_replay();
+}
+
+/*
+ * Wait until we've seen all other nodes confirm the pipelined lock request
+ * the origin of the transaction we're about to apply has announced holding.
+ * Their confirmations follow all their changes from before the lock, so
+ * the origin's changes relying on the lock can be applied safely afterwards.
+ *
+ * Called from the apply worker before applying a transaction.
+ */
+void
+bdr_locks_wait_for_peer_replay(void)
+{
+	Assert(bdr_worker_type == BDR_WORKER_APPLY);
+
+	if (!wait_for_peer_replay)
+		return;
+
+	bdr_locks_find_my_database(false);
+
+	for (;;)
+	{
+		BdrLockConfirmations *c;
+		bool		done;
+		int			confirmed = 0;
+		int			rc;
+
+		ResetLatch(&MyProc->procLatch);
+
+		LWLockAcquire(bdr_locks_ctl->lock, LW_EXCLUSIVE);
+
+		if (wait_round)
+			c = bdr_locks_find_confirmations(GetSystemIdentifier(),
+											 ThisTimeLineID, MyDatabaseId,
+											 wait_request_lsn);
+		else
+			c = bdr_locks_find_confirmations(wait_sysid, wait_tli,
+											 wait_datid, wait_request_lsn);
+
+		/*
+		 * Entries being waited on are only evicted by newer requests if all
+		 * of them are needed. We can't tell anymore which nodes confirmed
+		 * then, so ask all of them again rather than going ahead without.
+		 */
+		if (c == NULL || c->generation != wait_generation)
+		{
+			LWLockRelease(bdr_locks_ctl->lock);
+			elog(LOG, "lost track of confirmations of global lock of ("BDR_LOCALID_FORMAT"), asking all nodes to confirm replay",
+				 wait_sysid, wait_tli, wait_datid, "");
+			bdr_locks_request_peer_replay();
+			continue;
+		}
+
+		/*
+		 * Every node except the requestor and us confirms. The requestor's
+		 * reply to a replay confirmation request of ours would be behind the
+		 * changes we're about to apply, so it isn't waited for.
+		 */
+		confirmed = c->confirmed.nconfirmed;
+		done = confirmed >= (int) bdr_my_locks_database->nnodes - 1;
+		c->waiter = done ? NULL : &MyProc->procLatch;
+
+		LWLockRelease(bdr_locks_ctl->lock);
+
+		if (done)
+			break;
+
+		rc = WaitLatch(&MyProc->procLatch,
+					   WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
+					   10000L);
+
+		/* emergency bailout if postmaster has died */
+		if (rc & WL_POSTMASTER_DEATH)
+			proc_exit(1);
+
+		if (rc & WL_TIMEOUT)
+			elog(LOG, "still waiting for replay of other nodes' changes preceding global lock of ("BDR_LOCALID_FORMAT"), %d/%zu confirmations seen",
+				 wait_sysid, wait_tli, wait_datid, "",
+				 confirmed, bdr_my_locks_database->nnodes - 1);
+
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	elog(DEBUG2, "replayed other nodes' changes preceding global lock of ("BDR_LOCALID_FORMAT")",
+		 wait_sysid, wait_tli, wait_datid, "");
+
+	wait_for_peer_replay = false;
 }
 
 /*
@@ -1492,6 +2643,9 @@ bdr_locks_process_remote_startup(uint64 sysid, TimeLineID tli, Oid datid)
 
 	bdr_locks_find_my_database(false);
 
+	/* whatever it requested before is moot */
+	wait_for_peer_replay = false;
+
 	initStringInfo(&s);
 
 	elog(DEBUG2, "got startup message from node ("BDR_LOCALID_FORMAT"), clearing any locks it held",
@@ -1517,6 +2671,8 @@ bdr_locks_process_remote_startup(uint64 sysid, TimeLineID tli, Oid datid)
 			bdr_my_locks_database->lockcount--;
 			bdr_my_locks_database->lock_holder = InvalidRepNodeId;
 			bdr_my_locks_database->lock_type = BDR_LOCK_NOLOCK;
+			bdr_locks_set_scope(false, NULL, 0);
+			bdr_my_locks_database->lock_request_lsn = InvalidXLogRecPtr;
 			bdr_my_locks_database->replay_confirmed = 0;
 			bdr_my_locks_database->replay_confirmed_lsn = InvalidXLogRecPtr;
 		}
@@ -1534,13 +2690,658 @@ bdr_locks_process_remote_startup(uint64 sysid, TimeLineID tli, Oid datid)
 }
 
 /*
- * Function for checking if there is no conflicting BDR lock.
+ * Parse the rest of an 'acquire_lock' message after the common header. Older
+ * nodes send less, in which case the defaults apply.
+ */
+void
+bdr_locks_parse_acquire(StringInfo message, BDRLockType *lock_type,
+						int *nrelations, BDRLockRelation **relations,
+						XLogRecPtr *request_lsn)
+{
+	*nrelations = 0;
+	*relations = NULL;
+	*request_lsn = InvalidXLogRecPtr;
+
+	if (message->cursor == message->len) 		/* Old proto */
+		*lock_type = BDR_LOCK_WRITE;
+	else
+		*lock_type = pq_getmsgint(message, 4);
+
+	/* relations a write lock is restricted to, if any */
+	if (message->cursor < message->len)
+	{
+		int			i;
+
+		*nrelations = pq_getmsgint(message, 4);
+		if (*nrelations < 0 || *nrelations > BDR_LOCKS_MAX_RELATIONS)
+			elog(ERROR, "invalid number of relations %d in global lock request",
+				 *nrelations);
+
+		*relations = palloc(sizeof(BDRLockRelation) * Max(*nrelations, 1));
+		for (i = 0; i < *nrelations; i++)
+		{
+			(*relations)[i].nspname = pq_getmsgstring(message);
+			(*relations)[i].relname = pq_getmsgstring(message);
+		}
+	}
+
+	/* requests using the pipelined protocol identify themselves */
+	if (message->cursor < message->len)
+		*request_lsn = pq_getmsgint64(message);
+}
+
+/*
+ * (Re-)read the connections to the other nodes the control channel uses,
+ * dropping the current ones.
+ */
+static void
+bdr_locks_load_control_conns(void)
+{
+	List	   *configs;
+	ListCell   *lc;
+	MemoryContext saved_ctx;
+
+	foreach(lc, control_conns)
+	{
+		BdrControlConn *cc = (BdrControlConn *) lfirst(lc);
+
+		if (cc->conn != NULL)
+			PQfinish(cc->conn);
+		pfree(cc->dsn);
+	}
+	list_free_deep(control_conns);
+	control_conns = NIL;
+
+	StartTransactionCommand();
+
+	saved_ctx = MemoryContextSwitchTo(TopMemoryContext);
+	configs = bdr_read_connection_configs();
+
+	foreach(lc, configs)
+	{
+		BdrConnectionConfig *cfg = (BdrConnectionConfig *) lfirst(lc);
+		BdrControlConn *cc = palloc0(sizeof(BdrControlConn));
+
+		cc->sysid = cfg->sysid;
+		cc->tli = cfg->timeline;
+		cc->datid = cfg->dboid;
+		cc->dsn = pstrdup(cfg->dsn);
+		control_conns = lappend(control_conns, cc);
+
+		bdr_free_connection_config(cfg);
+	}
+	list_free_deep(configs);
+	MemoryContextSwitchTo(saved_ctx);
+
+	CommitTransactionCommand();
+
+	control_conns_nnodes = bdr_my_locks_database->nnodes;
+}
+
+/*
+ * Give up on a control channel connection for a while.
+ */
+static void
+bdr_locks_control_conn_failed(BdrControlConn *cc, const char *what)
+{
+	elog(DEBUG1, "could not %s node ("BDR_LOCALID_FORMAT") for control messages: %s",
+		 what, cc->sysid, cc->tli, cc->datid, "",
+		 cc->conn != NULL ? PQerrorMessage(cc->conn) : "out of memory");
+
+	if (cc->conn != NULL)
+		PQfinish(cc->conn);
+	cc->conn = NULL;
+	cc->retry_after = TimestampTzPlusMilliseconds(GetCurrentTimestamp(), 10000);
+}
+
+/*
+ * Wait for a control channel connection's socket to become readable or
+ * writable. Returns false once the deadline has passed.
+ *
+ * We don't wait for our latch, the perdb worker will look at whatever woke
+ * it up once we're done; the deadline bounds how long that can take.
+ */
+static bool
+bdr_locks_control_wait(PGconn *conn, bool for_write, TimestampTz deadline)
+{
+	long		secs;
+	int			usecs;
+	int			rc;
+
+	TimestampDifference(GetCurrentTimestamp(), deadline, &secs, &usecs);
+	if (secs == 0 && usecs == 0)
+		return false;
+
+	rc = WaitLatchOrSocket(&MyProc->procLatch,
+						   (for_write ? WL_SOCKET_WRITEABLE : WL_SOCKET_READABLE) |
+						   WL_TIMEOUT | WL_POSTMASTER_DEATH,
+						   PQsocket(conn), secs * 1000L + usecs / 1000);
+
+	/* emergency bailout if postmaster has died */
+	if (rc & WL_POSTMASTER_DEATH)
+		proc_exit(1);
+
+	CHECK_FOR_INTERRUPTS();
+
+	return true;
+}
+
+/*
+ * Connect to a node for the control channel, without blocking for longer
+ * than BDR_LOCKS_CONTROL_TIMEOUT_MS. Keepalives make sure we notice nodes
+ * that vanished while the connection sits idle.
+ */
+static bool
+bdr_locks_control_connect(BdrControlConn *cc)
+{
+	StringInfoData dsn;
+	PostgresPollingStatusType status = PGRES_POLLING_WRITING;
+	TimestampTz	deadline;
+
+	initStringInfo(&dsn);
+	appendStringInfo(&dsn, "keepalives=1 keepalives_idle=20 keepalives_interval=5 keepalives_count=3 "
+					 "%s fallback_application_name='"BDR_LOCALID_FORMAT": control'",
+					 cc->dsn, BDR_LOCALID_FORMAT_ARGS);
+
+	cc->conn = PQconnectStart(dsn.data);
+	pfree(dsn.data);
+
+	if (cc->conn == NULL || PQstatus(cc->conn) == CONNECTION_BAD)
+	{
+		bdr_locks_control_conn_failed(cc, "connect to");
+		return false;
+	}
+
+	deadline = TimestampTzPlusMilliseconds(GetCurrentTimestamp(),
+										   BDR_LOCKS_CONTROL_TIMEOUT_MS);
+
+	while (status != PGRES_POLLING_OK)
+	{
+		if (status == PGRES_POLLING_FAILED ||
+			!bdr_locks_control_wait(cc->conn, status == PGRES_POLLING_WRITING,
+									deadline))
+		{
+			bdr_locks_control_conn_failed(cc, "connect to");
+			return false;
+		}
+
+		status = PQconnectPoll(cc->conn);
+	}
+
+	if (PQsetnonblocking(cc->conn, 1) != 0)
+	{
+		bdr_locks_control_conn_failed(cc, "connect to");
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Send a message to all other nodes over the control channel: a plain
+ * connection to each node's database calling bdr.bdr_control_message(),
+ * kept open by the perdb worker. Failures aren't fatal, as every message
+ * also travels through the replication stream; unreachable nodes are only
+ * retried every few seconds.
+ *
+ * The connections are non-blocking, so a node that stopped responding
+ * delays the perdb worker by at most BDR_LOCKS_CONTROL_TIMEOUT_MS.
+ */
+static void
+bdr_locks_send_control_message(BdrControlMessage *msg)
+{
+	ListCell   *lc;
+	Oid			paramTypes[1] = {BYTEAOID};
+	const char *paramValues[1];
+	int			paramLengths[1];
+	int			paramFormats[1] = {1};
+
+	if (control_conns == NIL ||
+		control_conns_nnodes != bdr_my_locks_database->nnodes)
+		bdr_locks_load_control_conns();
+
+	paramValues[0] = msg->data;
+	paramLengths[0] = msg->len;
+
+	foreach(lc, control_conns)
+	{
+		BdrControlConn *cc = (BdrControlConn *) lfirst(lc);
+		PGresult   *res;
+		TimestampTz	deadline;
+		int			rc;
+
+		if (cc->conn == NULL)
+		{
+			if (GetCurrentTimestamp() < cc->retry_after)
+				continue;
+
+			if (!bdr_locks_control_connect(cc))
+				continue;
+		}
+
+		deadline = TimestampTzPlusMilliseconds(GetCurrentTimestamp(),
+											   BDR_LOCKS_CONTROL_TIMEOUT_MS);
+
+		if (!PQsendQueryParams(cc->conn, "SELECT bdr.bdr_control_message($1)",
+							   1, paramTypes, paramValues, paramLengths,
+							   paramFormats, 0))
+		{
+			bdr_locks_control_conn_failed(cc, "send message to");
+			continue;
+		}
+
+		while ((rc = PQflush(cc->conn)) == 1)
+		{
+			if (!bdr_locks_control_wait(cc->conn, true, deadline))
+				break;
+		}
+
+		/* PQgetResult() only doesn't block once PQisBusy() says so */
+		while (rc == 0)
+		{
+			if (PQisBusy(cc->conn))
+			{
+				if (!bdr_locks_control_wait(cc->conn, false, deadline) ||
+					!PQconsumeInput(cc->conn))
+					rc = -1;
+				continue;
+			}
+
+			res = PQgetResult(cc->conn);
+			if (res == NULL)
+				break;
+
+			if (PQresultStatus(res) != PGRES_TUPLES_OK)
+				elog(DEBUG1, "could not send control message to node ("BDR_LOCALID_FORMAT"): %s",
+					 cc->sysid, cc->tli, cc->datid, "",
+					 PQresultErrorMessage(res));
+			PQclear(res);
+		}
+
+		/* we can't tell where the connection is at, start over later */
+		if (rc != 0 || PQstatus(cc->conn) != CONNECTION_OK)
+			bdr_locks_control_conn_failed(cc, "send message to");
+	}
+}
+
+/*
+ * Handle a message another node sent over the control channel. Only the
+ * messages that don't depend on their position in the replication stream
+ * are sent that way: pipelined lock requests and their declines.
+ */
+static void
+bdr_locks_receive_control_message(BdrControlMessage *msg)
+{
+	StringInfoData message;
+	int			chanlen;
+	int			msg_type;
+	uint64		origin_sysid;
+	TimeLineID	origin_tli;
+	Oid			origin_datid;
+	RepNodeId	origin;
+
+	message.data = msg->data;
+	message.len = msg->len;
+	message.maxlen = msg->len;
+	message.cursor = 0;
+
+	chanlen = pq_getmsgint(&message, 4);
+	pq_getmsgbytes(&message, chanlen);
+	msg_type = pq_getmsgint(&message, 4);
+	origin_sysid = pq_getmsgint64(&message);
+	origin_tli = pq_getmsgint(&message, 4);
+	origin_datid = pq_getmsgint(&message, 4);
+	pq_getmsgint(&message, 4);		/* no names */
+
+	if (check_is_my_node(origin_sysid, origin_tli, origin_datid))
+		return;
+
+	elog(DEBUG1, "control message type %d from "UINT64_FORMAT":%u database %u",
+		 msg_type, origin_sysid, origin_tli, origin_datid);
+
+	if (!bdr_nodecache_lookup_node_id(origin_sysid, origin_tli, origin_datid,
+									  MyDatabaseId, &origin))
+	{
+		StartTransactionCommand();
+		origin = bdr_fetch_node_id_via_sysid(origin_sysid, origin_tli,
+											 origin_datid);
+		CommitTransactionCommand();
+	}
+
+	if (msg_type == BDR_MESSAGE_ACQUIRE_LOCK)
+	{
+		BDRLockType	lock_type;
+		int			nrelations;
+		BDRLockRelation *relations;
+		XLogRecPtr	request_lsn;
+
+		bool		held;
+
+		bdr_locks_parse_acquire(&message, &lock_type, &nrelations, &relations,
+								&request_lsn);
+
+		/*
+		 * If the node still holds a lock here, we might not have replayed it
+		 * releasing that lock yet, or it's upgrading it. Leave the request to
+		 * the replication stream, which has it in order.
+		 */
+		LWLockAcquire(bdr_locks_ctl->lock, LW_SHARED);
+		held = bdr_my_locks_database->lockcount > 0 &&
+			bdr_my_locks_database->lock_holder == origin;
+		LWLockRelease(bdr_locks_ctl->lock);
+
+		if (request_lsn != InvalidXLogRecPtr && !held)
+			bdr_locks_process_acquire(origin, origin_sysid, origin_tli,
+									  origin_datid, lock_type,
+									  nrelations, relations, request_lsn);
+	}
+	else if (msg_type == BDR_MESSAGE_DECLINE_LOCK)
+	{
+		int			lock_type;
+		XLogRecPtr	request_lsn;
+
+		/* lock holder, unused */
+		pq_getmsgint64(&message);
+		pq_getmsgint(&message, 4);
+		pq_getmsgint(&message, 4);
+
+		lock_type = pq_getmsgint(&message, 4);
+		request_lsn = pq_getmsgint64(&message);
+
+		bdr_locks_process_decline(origin_sysid, origin_tli, origin_datid,
+								  lock_type, request_lsn);
+	}
+	else
+		elog(LOG, "unexpected control message type %d", msg_type);
+}
+
+/*
+ * Send the control messages queued by local backends, and process the ones
+ * received from other nodes. Returns whether there were any.
+ *
+ * Runs in the perdb worker.
+ */
+bool
+bdr_locks_process_control_messages(void)
+{
+	static BdrControlMessage msg;
+	bool		found = false;
+
+	Assert(bdr_worker_type == BDR_WORKER_PERDB);
+
+	if (bdr_my_locks_database == NULL)
+		return false;
+
+	for (;;)
+	{
+		bool		outbound = false;
+		bool		inbound = false;
+
+		LWLockAcquire(bdr_locks_ctl->lock, LW_EXCLUSIVE);
+		if (bdr_my_locks_database->ncontrol_out > 0)
+		{
+			memcpy(&msg, &bdr_my_locks_database->control_out[0],
+				   sizeof(BdrControlMessage));
+			memmove(&bdr_my_locks_database->control_out[0],
+					&bdr_my_locks_database->control_out[1],
+					sizeof(BdrControlMessage) * (--bdr_my_locks_database->ncontrol_out));
+			outbound = true;
+		}
+		else if (bdr_my_locks_database->ncontrol_in > 0)
+		{
+			memcpy(&msg, &bdr_my_locks_database->control_in[0],
+				   sizeof(BdrControlMessage));
+			memmove(&bdr_my_locks_database->control_in[0],
+					&bdr_my_locks_database->control_in[1],
+					sizeof(BdrControlMessage) * (--bdr_my_locks_database->ncontrol_in));
+			inbound = true;
+		}
+		LWLockRelease(bdr_locks_ctl->lock);
+
+		if (outbound)
+			bdr_locks_send_control_message(&msg);
+		else if (inbound)
+			bdr_locks_receive_control_message(&msg);
+		else
+			break;
+
+		found = true;
+	}
+
+	return found;
+}
+
+/*
+ * Confirm the lock left pending by bdr_locks_grant once the transactions it
+ * conflicts with have finished, or kill them once the grace period is over.
+ * Returns the number of milliseconds until it wants to check again.
+ *
+ * Runs in the perdb worker.
+ */
+long
+bdr_locks_process_pending_grant(void)
+{
+	bool		held;
+	TimestampTz now;
+	TimestampTz next;
+	long		secs;
+	int			usecs;
+
+	Assert(bdr_worker_type == BDR_WORKER_PERDB);
+
+	if (!grant_pending)
+		return 180000L;
+
+	/* released meanwhile, e.g. because another node declined the request */
+	LWLockAcquire(bdr_locks_ctl->lock, LW_SHARED);
+	held = bdr_my_locks_database->lockcount > 0 &&
+		bdr_my_locks_database->lock_holder == grant_origin &&
+		bdr_my_locks_database->lock_request_lsn == grant_request_lsn;
+	LWLockRelease(bdr_locks_ctl->lock);
+
+	if (!held)
+	{
+		elog(DEBUG1, "global lock request %X/%X by node ("UINT64_FORMAT",%u,%u) released before it was confirmed",
+			 (uint32) (grant_request_lsn >> 32), (uint32) grant_request_lsn,
+			 grant_sysid, grant_tli, grant_datid);
+		grant_pending = false;
+		return 180000L;
+	}
+
+	if (cancel_conflicting_transactions(grant_scoped, grant_scope,
+										grant_nscope, grant_endtime, false))
+	{
+		grant_pending = false;
+		bdr_locks_confirm_grant(grant_sysid, grant_tli, grant_datid,
+								grant_lock_type, grant_request_lsn);
+		return 180000L;
+	}
+
+	/* increasing backoff interval, with a limit of 1s, until the deadline */
+	now = GetCurrentTimestamp();
+	next = TimestampTzPlusMilliseconds(now, grant_waittime);
+	if (next > grant_endtime)
+		next = grant_endtime;
+	grant_waittime = Min(grant_waittime * 2, 1000L);
+
+	TimestampDifference(now, next, &secs, &usecs);
+
+	return secs * 1000L + usecs / 1000;
+}
+
+PGDLLEXPORT Datum bdr_control_message(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(bdr_control_message);
+
+/*
+ * Receive a message from another node's control channel, and queue it for
+ * our perdb worker.
+ */
+Datum
+bdr_control_message(PG_FUNCTION_ARGS)
+{
+	bytea	   *data = PG_GETARG_BYTEA_PP(0);
+	int			len = VARSIZE_ANY_EXHDR(data);
+	StringInfoData message;
+	BdrLocksDBState *db;
+	BdrControlMessage *msg;
+	int			chanlen;
+	const char *chan;
+	int			msg_type;
+
+	/* sanity check the header, so the perdb worker doesn't have to */
+	message.data = VARDATA_ANY(data);
+	message.len = len;
+	message.maxlen = len;
+	message.cursor = 0;
+
+	chanlen = pq_getmsgint(&message, 4);
+	chan = pq_getmsgbytes(&message, chanlen);
+	if (chanlen != strlen("bdr") || strncmp(chan, "bdr", chanlen) != 0)
+		elog(ERROR, "unexpected control message channel");
+
+	msg_type = pq_getmsgint(&message, 4);
+	if (msg_type != BDR_MESSAGE_ACQUIRE_LOCK &&
+		msg_type != BDR_MESSAGE_DECLINE_LOCK)
+		elog(ERROR, "unexpected control message type %d", msg_type);
+
+	if (len > BDR_LOCKS_CONTROL_MSG_SIZE)
+		elog(ERROR, "control message too long");
+
+	db = bdr_locks_find_database(MyDatabaseId, false);
+	if (db == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("BDR is not active in this database")));
+
+	LWLockAcquire(bdr_locks_ctl->lock, LW_EXCLUSIVE);
+
+	if (db->perdb_latch == NULL ||
+		db->ncontrol_in >= BDR_LOCKS_CONTROL_QUEUE)
+	{
+		LWLockRelease(bdr_locks_ctl->lock);
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("control message queue is full")));
+	}
+
+	msg = &db->control_in[db->ncontrol_in++];
+	msg->len = len;
+	memcpy(msg->data, VARDATA_ANY(data), len);
+
+	SetLatch(db->perdb_latch);
+
+	LWLockRelease(bdr_locks_ctl->lock);
+
+	PG_RETURN_VOID();
+}
+
+PGDLLEXPORT Datum bdr_acquire_global_ddl_lock(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(bdr_acquire_global_ddl_lock);
+
+/*
+ * Acquire the global DDL lock for the rest of the current transaction,
+ * without running any DDL.
+ *
+ * Used by joining nodes to serialize changes to bdr.bdr_nodes that have to
+ * be unique across the group, like handing out node_seq_ids. Holding the lock
+ * also means we've replayed all changes other nodes made before it was
+ * granted, so no other join can be in progress or still on its way to us.
+ *
+ * Without peers there's nobody to serialize against, beyond whoever locks
+ * the local bdr.bdr_nodes.
+ */
+Datum
+bdr_acquire_global_ddl_lock(PG_FUNCTION_ARGS)
+{
+	bdr_locks_find_my_database(false);
+
+	if (bdr_my_locks_database->nnodes > 0)
+		bdr_acquire_ddl_lock(BDR_LOCK_DDL, NIL);
+
+	PG_RETURN_VOID();
+}
+
+/*
+ * Would writing to the passed relations conflict with the lock held in this
+ * database? DDL locks don't affect DML, and write locks restricted to some
+ * relations only affect DML on those.
+ *
+ * Caller needs to hold bdr_locks_ctl->lock.
+ */
+static bool
+bdr_locks_dml_conflicts(List *relids)
+{
+	ListCell   *lc;
+
+	if (bdr_my_locks_database->lockcount == 0)
+		return false;
+
+	if (bdr_my_locks_database->lock_type < BDR_LOCK_WRITE)
+		return false;
+
+	if (!bdr_my_locks_database->lock_scoped)
+		return true;
+
+	foreach(lc, relids)
+	{
+		if (bdr_locks_scope_contains(lfirst_oid(lc)))
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * Check whether DML to relids may proceed, or with startup, whether locks
+ * have been loaded. If not, register as a waiter and sleep until woken up,
+ * or a timeout passes, and return false so the caller rechecks.
+ */
+static bool
+bdr_locks_wait(List *relids, bool startup)
+{
+	int			rc;
+	bool		blocked;
+
+	CHECK_FOR_INTERRUPTS();
+
+	ResetLatch(&MyProc->procLatch);
+
+	LWLockAcquire(bdr_locks_ctl->lock, LW_EXCLUSIVE);
+	if (startup)
+		blocked = !bdr_my_locks_database->locked_and_loaded;
+	else
+		blocked = bdr_locks_dml_conflicts(relids);
+
+	if (blocked)
+		bdr_locks_addwaiter(MyProc);
+	else
+		bdr_locks_removewaiter(MyProc);
+	LWLockRelease(bdr_locks_ctl->lock);
+
+	if (!blocked)
+		return true;
+
+	rc = WaitLatch(&MyProc->procLatch,
+				   WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
+				   10000L);
+
+	/* emergency bailout if postmaster has died */
+	if (rc & WL_POSTMASTER_DEATH)
+		proc_exit(1);
+
+	return false;
+}
+
+/*
+ * Function for checking if there is no BDR lock conflicting with writes to
+ * the passed relations.
  *
  * Should be caled from ExecutorStart_hook.
  */
 void
-bdr_locks_check_dml(void)
+bdr_locks_check_dml(List *relids)
 {
+	TimestampTz	wait_start;
 
 	if (bdr_skip_ddl_locking)
 		return;
@@ -1548,45 +3349,131 @@ bdr_locks_check_dml(void)
 	bdr_locks_find_my_database(false);
 
 	/*
-	 * The bdr is still starting up and hasn't loaded locks, wait for it.
-	 * The statement_timeout will kill us if necessary.
+	 * The bdr is still starting up and hasn't loaded locks, wait for it. The
+	 * perdb worker wakes us once it has. The statement_timeout will kill us
+	 * if necessary.
 	 */
-	while (!bdr_my_locks_database->locked_and_loaded)
+	pg_memory_barrier();
+	if (!bdr_my_locks_database->locked_and_loaded)
 	{
-		CHECK_FOR_INTERRUPTS();
+		wait_start = GetCurrentTimestamp();
 
-		/* Probably can't use latch here easily, since init didn't happen yet. */
-		pg_usleep(5000L);
+		while (!bdr_locks_wait(NIL, true))
+			;
+
+		bdr_locks_count_wait(BDR_LOCKS_WAIT_STARTUP, wait_start);
 	}
 
 	/* Is this database locked against user initiated ddl? */
 	pg_memory_barrier();
 	if (bdr_my_locks_database->lockcount > 0 && !this_xact_acquired_lock)
 	{
-		bdr_locks_addwaiter(MyProc);
+		wait_start = GetCurrentTimestamp();
+
+		/* only wait if the lock actually covers what we're writing to */
+		if (bdr_locks_wait(relids, false))
+			return;
 
 		/* Wait for lock to be released. */
-		for (;;)
-		{
-			int rc;
+		while (!bdr_locks_wait(relids, false))
+			;
 
-			CHECK_FOR_INTERRUPTS();
+		bdr_locks_count_wait(BDR_LOCKS_WAIT_DML, wait_start);
+	}
+}
 
-			pg_memory_barrier();
-			if (bdr_my_locks_database->lockcount == 0)
-				break;
+#define BDR_LOCKS_WAIT_STAT_COLS 5
+
+PGDLLEXPORT Datum bdr_get_global_lock_wait_stats(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(bdr_get_global_lock_wait_stats);
+
+/*
+ * Return how often and how long backends of the current database were
+ * blocked by global locking, for each kind of wait.
+ */
+Datum
+bdr_get_global_lock_wait_stats(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc	tupdesc;
+	Tuplestorestate *tupstore;
+	MemoryContext per_query_ctx;
+	MemoryContext oldcontext;
+	BdrLocksWaitStats stats[BDR_LOCKS_WAIT_NKINDS];
+	bool		found = false;
+	int			off;
+	int			kind;
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not allowed in this context")));
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
 
-			rc = WaitLatch(&MyProc->procLatch,
-						   WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
-						   10000L);
+	if (tupdesc->natts != BDR_LOCKS_WAIT_STAT_COLS)
+		elog(ERROR, "wrong function definition");
 
-			ResetLatch(&MyProc->procLatch);
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
 
-			/* emergency bailout if postmaster has died */
-			if (rc & WL_POSTMASTER_DEATH)
-				proc_exit(1);
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	/* copy, so we don't hold the lock while building tuples */
+	LWLockAcquire(bdr_locks_ctl->lock, LW_SHARED);
+	for (off = 0; off < bdr_max_databases; off++)
+	{
+		BdrLocksDBState *db = &bdr_locks_ctl->dbstate[off];
+
+		if (db->in_use && db->dboid == MyDatabaseId)
+		{
+			memcpy(stats, db->wait_stats, sizeof(stats));
+			found = true;
+			break;
 		}
 	}
+	LWLockRelease(bdr_locks_ctl->lock);
+
+	/* not a bdr database, or bdr is still starting up */
+	if (!found)
+		memset(stats, 0, sizeof(stats));
+
+	for (kind = 0; kind < BDR_LOCKS_WAIT_NKINDS; kind++)
+	{
+		Datum		values[BDR_LOCKS_WAIT_STAT_COLS];
+		bool		nulls[BDR_LOCKS_WAIT_STAT_COLS];
+		Datum		buckets[BDR_LOCKS_WAIT_BUCKETS];
+		int			i;
+
+		memset(nulls, 0, sizeof(nulls));
+
+		for (i = 0; i < BDR_LOCKS_WAIT_BUCKETS; i++)
+			buckets[i] = Int64GetDatum(stats[kind].buckets[i]);
+
+		values[0] = CStringGetTextDatum(bdr_locks_wait_kind_names[kind]);
+		values[1] = Int64GetDatum(stats[kind].nr_waits);
+		values[2] = Float8GetDatum(stats[kind].total_us / 1000.0);
+		values[3] = Float8GetDatum(stats[kind].max_us / 1000.0);
+		values[4] = PointerGetDatum(construct_array(buckets,
+													BDR_LOCKS_WAIT_BUCKETS,
+													INT8OID, 8,
+													FLOAT8PASSBYVAL, 'd'));
+
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+
+	tuplestore_donestoring(tupstore);
+
+	return (Datum) 0;
 }
 
 #else
@@ -1603,13 +3490,57 @@ bdr_locks_shmem_init()
 }
 
 void
-bdr_acquire_ddl_lock(BDRLockType lock_type)
+bdr_acquire_ddl_lock(BDRLockType lock_type, List *relids)
 {
 }
 
 void
-bdr_locks_check_dml(void)
+bdr_locks_check_dml(List *relids)
+{
+}
+
+bool
+bdr_locks_process_control_messages(void)
+{
+	return false;
+}
+
+long
+bdr_locks_process_pending_grant(void)
 {
+	return 180000L;
+}
+
+PGDLLEXPORT Datum bdr_control_message(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(bdr_control_message);
+
+Datum
+bdr_control_message(PG_FUNCTION_ARGS)
+{
+	ereport(ERROR,
+			(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+			 errmsg("global locking is not supported by this build")));
+}
+
+PGDLLEXPORT Datum bdr_acquire_global_ddl_lock(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(bdr_acquire_global_ddl_lock);
+
+/* nothing to serialize against without global locks */
+Datum
+bdr_acquire_global_ddl_lock(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_VOID();
+}
+
+PGDLLEXPORT Datum bdr_get_global_lock_wait_stats(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(bdr_get_global_lock_wait_stats);
+
+Datum
+bdr_get_global_lock_wait_stats(PG_FUNCTION_ARGS)
+{
+	ereport(ERROR,
+			(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+			 errmsg("global locking is not supported by this build")));
 }
 #endif
 
@@ -10,6 +10,8 @@
 #ifndef BDR_LOCKS_H
 #define BDR_LOCKS_H
 
+#include "lib/stringinfo.h"
+
 typedef enum BdrMessageType
 {
 	BDR_MESSAGE_START = 0, /* bdr started */
@@ -18,7 +20,9 @@ typedef enum BdrMessageType
 	BDR_MESSAGE_CONFIRM_LOCK = 3,
 	BDR_MESSAGE_DECLINE_LOCK = 4,
 	BDR_MESSAGE_REQUEST_REPLAY_CONFIRM = 5,
-	BDR_MESSAGE_REPLAY_CONFIRM = 6
+	BDR_MESSAGE_REPLAY_CONFIRM = 6,
+	BDR_MESSAGE_LOCK_ACQUIRED = 7,
+	BDR_MESSAGE_HEARTBEAT = 8
 } BdrMessageType;
 
 typedef enum BDRLockType
@@ -28,21 +32,60 @@ typedef enum BDRLockType
 	BDR_LOCK_WRITE = 2		/* lock against any write */
 } BDRLockType;
 
+/*
+ * A relation a write lock is restricted to, as sent to other nodes. Oids
+ * differ between nodes, so relations are identified by name.
+ */
+typedef struct BDRLockRelation
+{
+	const char *nspname;
+	const char *relname;
+} BDRLockRelation;
+
+/* more relations than this make a write lock cover the whole database */
+#define BDR_LOCKS_MAX_RELATIONS 32
+
+/* number of pipelined lock requests whose confirmations are tracked */
+#define BDR_LOCKS_TRACKED_REQUESTS 4
+
+/* number of nodes whose latest lock request is remembered */
+#define BDR_LOCKS_TRACKED_NODES 32
+
+/*
+ * Nodes confirming a lock request are told apart by the RepNodeId of their
+ * replication stream, up to this one; ids are handed out lowest free first.
+ */
+#define BDR_LOCKS_CONFIRM_ORIGINS 1024
+
+/* control channel queue length and maximum message size */
+#define BDR_LOCKS_CONTROL_QUEUE 8
+#define BDR_LOCKS_CONTROL_MSG_SIZE (128 + BDR_LOCKS_MAX_RELATIONS * 2 * NAMEDATALEN)
+
 void bdr_locks_startup(void);
 void bdr_locks_set_nnodes(Size nnodes);
-void bdr_acquire_ddl_lock(BDRLockType lock_type);
+void bdr_acquire_ddl_lock(BDRLockType lock_type, List *relids);
 void bdr_process_acquire_ddl_lock(uint64 sysid, TimeLineID tli, Oid datid,
-								  BDRLockType lock_type);
+								  BDRLockType lock_type,
+								  int nrelations, BDRLockRelation *relations,
+								  XLogRecPtr request_lsn);
 void bdr_process_release_ddl_lock(uint64 sysid, TimeLineID tli, Oid datid,
 								  uint64 lock_sysid, TimeLineID lock_tli, Oid lock_datid);
 void bdr_process_confirm_ddl_lock(uint64 origin_sysid, TimeLineID origin_tli, Oid origin_datid,
 								  uint64 lock_sysid, TimeLineID lock_tli, Oid lock_datid,
-								  BDRLockType lock_type);
+								  BDRLockType lock_type, XLogRecPtr request_lsn);
 void bdr_process_decline_ddl_lock(uint64 origin_sysid, TimeLineID origin_tli, Oid origin_datid,
 								  uint64 lock_sysid, TimeLineID lock_tli, Oid lock_datid,
-								  BDRLockType lock_type);
+								  BDRLockType lock_type, XLogRecPtr request_lsn);
 void bdr_process_request_replay_confirm(uint64 sysid, TimeLineID tli, Oid datid, XLogRecPtr lsn);
 void bdr_process_replay_confirm(uint64 sysid, TimeLineID tli, Oid datid, XLogRecPtr lsn);
+void bdr_process_lock_acquired(uint64 sysid, TimeLineID tli, Oid datid, XLogRecPtr request_lsn);
 void bdr_locks_process_remote_startup(uint64 sysid, TimeLineID tli, Oid datid);
+void bdr_locks_wait_for_peer_replay(void);
+void bdr_locks_parse_acquire(StringInfo message, BDRLockType *lock_type,
+							 int *nrelations, BDRLockRelation **relations,
+							 XLogRecPtr *request_lsn);
+bool bdr_locks_process_control_messages(void);
+long bdr_locks_process_pending_grant(void);
+void bdr_prepare_message(StringInfo s, BdrMessageType message_type);
 
 #endif
@@ -0,0 +1,422 @@
+/* -------------------------------------------------------------------------
+ *
+ * bdr_nodecache.c
+ *		shared memory cache of node identities for replication identifiers
+ *
+ * Copyright (C) 2015, PostgreSQL Global Development Group
+ *
+ * NOTES
+ *
+ *    Each replication identifier created by BDR encodes the (sysid, timeline,
+ *    dboid) of the remote node and the local database oid in its name, see
+ *    BDR_NODE_ID_FORMAT. Mapping a RepNodeId back to the node it belongs to
+ *    thus requires a catalog scan and parsing of that name, which is far too
+ *    expensive for the paths that need it (conflict resolution, forwarding of
+ *    changesets, DDL locking).
+ *
+ *    The reverse direction, finding the local RepNodeId for a node identity
+ *    received from a peer, has the same problem.
+ *
+ *    A replication identifier never changes the node it refers to during its
+ *    lifetime, so the mapping is kept here, in shared memory, for the benefit
+ *    of all backends. It's populated by the per-db worker at startup and
+ *    whenever the set of connections changes, when a node's connection is
+ *    established, and whenever a lookup misses. Entries of parted nodes are
+ *    removed again.
+ *
+ *    Two hash tables are kept, one keyed by RepNodeId and one keyed by the
+ *    node identity, so lookups in both directions are O(1). Both are
+ *    protected by the same lock.
+ *
+ *    If the cache fills up we simply stop adding entries; callers always fall
+ *    back to the catalogs.
+ *
+ * IDENTIFICATION
+ *		bdr_nodecache.c
+ *
+ * -------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "bdr.h"
+
+#include "miscadmin.h"
+
+#include "access/xact.h"
+
+#include "executor/spi.h"
+
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+
+#include "utils/builtins.h"
+#include "utils/hsearch.h"
+
+#ifdef BUILDING_BDR
+#define BDR_NODECACHE_IDENTIFIER_QUERY \
+	"SELECT riident, riname FROM pg_catalog.pg_replication_identifier"
+#else
+#define BDR_NODECACHE_IDENTIFIER_QUERY \
+	"SELECT riident, riname FROM bdr.bdr_replication_identifier"
+#endif
+
+/*
+ * Key of the identity hash. Always zero it before filling it in, as it's
+ * hashed including padding.
+ */
+typedef struct BdrNodeIdentity
+{
+	uint64		sysid;
+	TimeLineID	timeline;
+	Oid			dboid;
+	Oid			local_dboid;
+} BdrNodeIdentity;
+
+typedef struct BdrNodeCacheEntry
+{
+	/* hash key, needs to be first */
+	RepNodeId	node_id;
+
+	/* identity of the remote node */
+	uint64		sysid;
+	TimeLineID	timeline;
+	Oid			dboid;
+
+	/* local database the identifier was created for */
+	Oid			local_dboid;
+} BdrNodeCacheEntry;
+
+typedef struct BdrNodeIdentityEntry
+{
+	/* hash key, needs to be first */
+	BdrNodeIdentity ident;
+
+	RepNodeId	node_id;
+} BdrNodeIdentityEntry;
+
+typedef struct BdrNodeCacheControl
+{
+	LWLockId	lock;
+} BdrNodeCacheControl;
+
+static BdrNodeCacheControl *BdrNodeCacheCtl = NULL;
+static HTAB *BdrNodeCacheHash = NULL;
+static HTAB *BdrNodeIdentityHash = NULL;
+
+/* number of entries we have built shmem for */
+static int bdr_nodecache_size = 0;
+
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+static void bdr_nodecache_shmem_startup(void);
+
+static Size
+bdr_nodecache_shmem_size(void)
+{
+	Size		size = 0;
+
+	size = add_size(size, sizeof(BdrNodeCacheControl));
+	size = add_size(size, hash_estimate_size(bdr_nodecache_size,
+											 sizeof(BdrNodeCacheEntry)));
+	size = add_size(size, hash_estimate_size(bdr_nodecache_size,
+											 sizeof(BdrNodeIdentityEntry)));
+
+	return size;
+}
+
+/*
+ * Reserve shared memory for up to nentries node identities.
+ *
+ * Needs to be called from a shared_preload_library _PG_init().
+ */
+void
+bdr_nodecache_shmem_init(int nentries)
+{
+	Assert(process_shared_preload_libraries_in_progress);
+
+	bdr_nodecache_size = nentries;
+
+	RequestAddinShmemSpace(bdr_nodecache_shmem_size());
+	RequestAddinLWLocks(1);
+
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = bdr_nodecache_shmem_startup;
+}
+
+static void
+bdr_nodecache_shmem_startup(void)
+{
+	bool		found;
+	HASHCTL		ctl;
+
+	if (prev_shmem_startup_hook != NULL)
+		prev_shmem_startup_hook();
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+	BdrNodeCacheCtl = ShmemInitStruct("bdr_nodecache",
+									  sizeof(BdrNodeCacheControl),
+									  &found);
+	if (!found)
+	{
+		memset(BdrNodeCacheCtl, 0, sizeof(BdrNodeCacheControl));
+		BdrNodeCacheCtl->lock = LWLockAssign();
+	}
+
+	MemSet(&ctl, 0, sizeof(ctl));
+	ctl.keysize = sizeof(RepNodeId);
+	ctl.entrysize = sizeof(BdrNodeCacheEntry);
+	ctl.hash = tag_hash;
+
+	BdrNodeCacheHash = ShmemInitHash("bdr node identity cache",
+									 bdr_nodecache_size, bdr_nodecache_size,
+									 &ctl,
+									 HASH_ELEM | HASH_FUNCTION);
+
+	MemSet(&ctl, 0, sizeof(ctl));
+	ctl.keysize = sizeof(BdrNodeIdentity);
+	ctl.entrysize = sizeof(BdrNodeIdentityEntry);
+	ctl.hash = tag_hash;
+
+	BdrNodeIdentityHash = ShmemInitHash("bdr node identity reverse cache",
+										bdr_nodecache_size, bdr_nodecache_size,
+										&ctl,
+										HASH_ELEM | HASH_FUNCTION);
+	LWLockRelease(AddinShmemInitLock);
+}
+
+static void
+bdr_nodecache_make_identity(BdrNodeIdentity *ident, uint64 sysid,
+							TimeLineID tli, Oid dboid, Oid local_dboid)
+{
+	memset(ident, 0, sizeof(BdrNodeIdentity));
+	ident->sysid = sysid;
+	ident->timeline = tli;
+	ident->dboid = dboid;
+	ident->local_dboid = local_dboid;
+}
+
+/*
+ * Look up the node identity for a replication identifier.
+ *
+ * Returns false if the identifier isn't cached (yet), in which case the out
+ * parameters are left alone.
+ */
+bool
+bdr_nodecache_lookup(RepNodeId node_id, uint64 *sysid, TimeLineID *tli,
+					 Oid *dboid)
+{
+	BdrNodeCacheEntry *entry;
+	bool		found = false;
+
+	if (BdrNodeCacheHash == NULL)
+		return false;
+
+	LWLockAcquire(BdrNodeCacheCtl->lock, LW_SHARED);
+	entry = hash_search(BdrNodeCacheHash, &node_id, HASH_FIND, NULL);
+	if (entry != NULL)
+	{
+		*sysid = entry->sysid;
+		*tli = entry->timeline;
+		*dboid = entry->dboid;
+		found = true;
+	}
+	LWLockRelease(BdrNodeCacheCtl->lock);
+
+	return found;
+}
+
+/*
+ * Look up the replication identifier the local database local_dboid uses
+ * for the node (sysid, tli, dboid).
+ *
+ * Returns false if the node isn't cached (yet), in which case node_id is left
+ * alone.
+ */
+bool
+bdr_nodecache_lookup_node_id(uint64 sysid, TimeLineID tli, Oid dboid,
+							 Oid local_dboid, RepNodeId *node_id)
+{
+	BdrNodeIdentityEntry *entry;
+	BdrNodeIdentity ident;
+	bool		found = false;
+
+	if (BdrNodeIdentityHash == NULL)
+		return false;
+
+	bdr_nodecache_make_identity(&ident, sysid, tli, dboid, local_dboid);
+
+	LWLockAcquire(BdrNodeCacheCtl->lock, LW_SHARED);
+	entry = hash_search(BdrNodeIdentityHash, &ident, HASH_FIND, NULL);
+	if (entry != NULL)
+	{
+		*node_id = entry->node_id;
+		found = true;
+	}
+	LWLockRelease(BdrNodeCacheCtl->lock);
+
+	return found;
+}
+
+/*
+ * Remove the entries for node_id from both hashes. Caller must hold the lock
+ * exclusively.
+ */
+static void
+bdr_nodecache_remove_locked(RepNodeId node_id)
+{
+	BdrNodeCacheEntry *entry;
+
+	entry = hash_search(BdrNodeCacheHash, &node_id, HASH_FIND, NULL);
+	if (entry != NULL)
+	{
+		BdrNodeIdentity ident;
+
+		bdr_nodecache_make_identity(&ident, entry->sysid, entry->timeline,
+									entry->dboid, entry->local_dboid);
+		hash_search(BdrNodeIdentityHash, &ident, HASH_REMOVE, NULL);
+		hash_search(BdrNodeCacheHash, &node_id, HASH_REMOVE, NULL);
+	}
+}
+
+/*
+ * Remember the node identity of a replication identifier.
+ *
+ * Silently does nothing if the cache is full.
+ */
+void
+bdr_nodecache_insert(RepNodeId node_id, uint64 sysid, TimeLineID tli,
+					 Oid dboid, Oid local_dboid)
+{
+	BdrNodeCacheEntry *entry;
+	BdrNodeIdentityEntry *idententry;
+	BdrNodeIdentity ident;
+	bool		found;
+
+	if (BdrNodeCacheHash == NULL || node_id == InvalidRepNodeId)
+		return;
+
+	bdr_nodecache_make_identity(&ident, sysid, tli, dboid, local_dboid);
+
+	LWLockAcquire(BdrNodeCacheCtl->lock, LW_EXCLUSIVE);
+
+	/* the identifier might have been reused since we last saw it */
+	bdr_nodecache_remove_locked(node_id);
+
+	idententry = hash_search(BdrNodeIdentityHash, &ident, HASH_FIND, NULL);
+	if (idententry != NULL)
+		bdr_nodecache_remove_locked(idententry->node_id);
+
+	entry = hash_search(BdrNodeCacheHash, &node_id, HASH_ENTER_NULL, &found);
+	if (entry != NULL)
+	{
+		idententry = hash_search(BdrNodeIdentityHash, &ident,
+								 HASH_ENTER_NULL, &found);
+		if (idententry == NULL)
+		{
+			/* keep both directions consistent */
+			hash_search(BdrNodeCacheHash, &node_id, HASH_REMOVE, NULL);
+		}
+		else
+		{
+			entry->sysid = sysid;
+			entry->timeline = tli;
+			entry->dboid = dboid;
+			entry->local_dboid = local_dboid;
+			idententry->node_id = node_id;
+		}
+	}
+	LWLockRelease(BdrNodeCacheCtl->lock);
+}
+
+/*
+ * Forget about a node, e.g. because it has been parted.
+ */
+void
+bdr_nodecache_forget_node(uint64 sysid, TimeLineID tli, Oid dboid,
+						  Oid local_dboid)
+{
+	BdrNodeIdentityEntry *idententry;
+	BdrNodeIdentity ident;
+
+	if (BdrNodeIdentityHash == NULL)
+		return;
+
+	bdr_nodecache_make_identity(&ident, sysid, tli, dboid, local_dboid);
+
+	LWLockAcquire(BdrNodeCacheCtl->lock, LW_EXCLUSIVE);
+	idententry = hash_search(BdrNodeIdentityHash, &ident, HASH_FIND, NULL);
+	if (idententry != NULL)
+		bdr_nodecache_remove_locked(idententry->node_id);
+	LWLockRelease(BdrNodeCacheCtl->lock);
+}
+
+/*
+ * Forget about a replication identifier, e.g. because it has been dropped.
+ */
+void
+bdr_nodecache_forget_node_id(RepNodeId node_id)
+{
+	if (BdrNodeCacheHash == NULL)
+		return;
+
+	LWLockAcquire(BdrNodeCacheCtl->lock, LW_EXCLUSIVE);
+	bdr_nodecache_remove_locked(node_id);
+	LWLockRelease(BdrNodeCacheCtl->lock);
+}
+
+/*
+ * Add the node identities of all existing BDR replication identifiers to
+ * the cache.
+ *
+ * Identifiers not created by BDR are skipped.
+ *
+ * SPI must be connected, and you must be in a running transaction.
+ */
+void
+bdr_nodecache_populate(void)
+{
+	int			spi_ret;
+	int			i;
+
+	Assert(IsTransactionState());
+
+	spi_ret = SPI_execute(BDR_NODECACHE_IDENTIFIER_QUERY, true, 0);
+
+	if (spi_ret != SPI_OK_SELECT)
+		elog(ERROR, "Unable to query replication identifiers, SPI error %d",
+			 spi_ret);
+
+	for (i = 0; i < SPI_processed; i++)
+	{
+		HeapTuple	tuple = SPI_tuptable->vals[i];
+		bool		isnull;
+		RepNodeId	node_id;
+		char	   *riname;
+		uint64		remote_sysid;
+		TimeLineID	remote_tli;
+		Oid			remote_dboid;
+		Oid			local_dboid;
+		NameData	replication_name;
+
+		node_id = DatumGetObjectId(
+			SPI_getbinval(tuple, SPI_tuptable->tupdesc, 1, &isnull));
+		Assert(!isnull);
+
+		riname = SPI_getvalue(tuple, SPI_tuptable->tupdesc, 2);
+
+		if (sscanf(riname, BDR_NODE_ID_FORMAT,
+				   &remote_sysid, &remote_tli, &remote_dboid, &local_dboid,
+				   NameStr(replication_name)) != 4)
+		{
+			elog(DEBUG2, "skipping non-bdr replication identifier %s", riname);
+			continue;
+		}
+
+		bdr_nodecache_insert(node_id, remote_sysid, remote_tli, remote_dboid,
+							 local_dboid);
+	}
+
+	elog(DEBUG2, "loaded %u replication identifiers into node identity cache",
+		 SPI_processed);
+}
@@ -42,6 +42,7 @@
 #include "replication/logical.h"
 #include "replication/output_plugin.h"
 #include "replication/slot.h"
+#include "replication/walsender.h"
 #include "replication/walsender_private.h"
 
 #include "storage/proc.h"
@@ -650,6 +651,25 @@ pg_decode_startup(LogicalDecodingContext * ctx, OutputPluginOptions *opt, bool i
 		 * prevent slot creation, only START_REPLICATION from the slot.
 		 */
 		bdr_ensure_node_ready(data);
+
+		/*
+		 * Count what we send to the peer in the statistics of the node id
+		 * we replay its changes under, if we do. Only a walsender streams to
+		 * the peer; a backend using the SQL interface mustn't take over its
+		 * slot's counters.
+		 */
+		if (am_walsender)
+		{
+			char		ident[256];
+			RepNodeId	node_id;
+
+			snprintf(ident, sizeof(ident), BDR_NODE_ID_FORMAT,
+					 data->remote_sysid, data->remote_timeline,
+					 data->remote_dboid, MyDatabaseId, "");
+			node_id = GetReplicationIdentifier(ident, true);
+			if (node_id != InvalidRepNodeId)
+				bdr_count_set_current_node(node_id);
+		}
 	}
 
 	if (tx_started)
@@ -811,6 +831,7 @@ pg_decode_begin_txn(LogicalDecodingContext *ctx, ReorderBufferTXN *txn)
 	}
 #endif
 
+	bdr_count_sent(ctx->out->len, false);
 	OutputPluginWrite(ctx, true);
 	return;
 }
@@ -850,6 +871,7 @@ pg_decode_commit_txn(LogicalDecodingContext *ctx, ReorderBufferTXN *txn,
 	pq_sendint64(ctx->out, txn->end_lsn);
 	pq_sendint64(ctx->out, txn->commit_time);
 
+	bdr_count_sent(ctx->out->len, true);
 	OutputPluginWrite(ctx, true);
 }
 
@@ -912,6 +934,7 @@ pg_decode_change(LogicalDecodingContext *ctx, ReorderBufferTXN *txn,
 		default:
 			Assert(false);
 	}
+	bdr_count_sent(ctx->out->len, false);
 	OutputPluginWrite(ctx, true);
 
 	MemoryContextSwitchTo(old);
@@ -1141,6 +1164,7 @@ pg_decode_message(LogicalDecodingContext *ctx,
 	pq_sendint64(ctx->out, lsn);
 	pq_sendint(ctx->out, sz, 4);
 	pq_sendbytes(ctx->out, message, sz);
+	bdr_count_sent(ctx->out->len, false);
 	OutputPluginWrite(ctx, true);
 }
 #endif
@@ -19,6 +19,7 @@
 #include "pgstat.h"
 
 #include "access/xact.h"
+#include "access/xlog.h"
 
 #include "catalog/pg_type.h"
 
@@ -32,17 +33,20 @@
 
 /* For struct Port only! */
 #include "libpq/libpq-be.h"
+#include "libpq/pqformat.h"
 
 #include "storage/latch.h"
 #include "storage/lwlock.h"
 #include "storage/proc.h"
 #include "storage/ipc.h"
+#include "storage/standby.h"
 
 #include "utils/builtins.h"
 #include "utils/elog.h"
 #include "utils/guc.h"
 #include "utils/memutils.h"
 #include "utils/snapmgr.h"
+#include "utils/timestamp.h"
 
 PG_FUNCTION_INFO_V1(bdr_connections_changed);
 
@@ -268,6 +272,13 @@ bdr_maintain_db_workers(void)
 	our_status = bdr_nodes_get_local_status(
 		GetSystemIdentifier(), ThisTimeLineID, MyDatabaseId);
 
+	/*
+	 * Make sure the node identity cache knows about all nodes we have
+	 * replication identifiers for, including ones that just joined. Parted
+	 * nodes are removed again below.
+	 */
+	bdr_nodecache_populate();
+
 	/*
 	 * First check whether any existing processes to/from this database need
 	 * to be killed of because of the node status.
@@ -435,6 +446,10 @@ bdr_maintain_db_workers(void)
 				elog(LOG, "dropped slot %s due to node part", slot_name);
 			}
 
+			/* the parted node's identity isn't needed anymore */
+			bdr_nodecache_forget_node(node_sysid, node_timeline, node_datoid,
+									  MyDatabaseId);
+
 			/*
 			 * TODO: It'd be a good idea to set the slot to dead (in contrast
 			 * to being killed) here. That way we wouldn't constantly rescan
@@ -675,6 +690,52 @@ out:
 	elog(DEBUG2, "updated worker counts");
 }
 
+#ifdef BUILDING_BDR
+/*
+ * Log a heartbeat message every bdr.heartbeat_interval, if enabled. Apply
+ * workers on the peers use it to keep their replication lag current while
+ * there's nothing else to replay. Returns the number of milliseconds until
+ * the next one is due.
+ */
+static long
+bdr_perdb_heartbeat(void)
+{
+	static TimestampTz last_heartbeat = 0;
+	TimestampTz now;
+	TimestampTz next;
+	long		secs;
+	int			usecs;
+
+	if (bdr_heartbeat_interval <= 0)
+		return 180000L;
+
+	now = GetCurrentTimestamp();
+	next = TimestampTzPlusMilliseconds(last_heartbeat,
+									   bdr_heartbeat_interval * 1000L);
+	if (now >= next)
+	{
+		StringInfoData s;
+		XLogRecPtr	lsn;
+
+		initStringInfo(&s);
+		bdr_prepare_message(&s, BDR_MESSAGE_HEARTBEAT);
+		pq_sendint64(&s, now);
+		lsn = LogStandbyMessage(s.data, s.len, false);
+		/* nontransactional, so nothing else makes sure it's sent out */
+		XLogFlush(lsn);
+		pfree(s.data);
+
+		last_heartbeat = now;
+		next = TimestampTzPlusMilliseconds(now,
+										   bdr_heartbeat_interval * 1000L);
+	}
+
+	TimestampDifference(now, next, &secs, &usecs);
+
+	return secs * 1000L + usecs / 1000 + 1;
+}
+#endif
+
 /*
  * Each database with BDR enabled on it has a static background worker,
  * registered at shared_preload_libraries time during postmaster start. This is
@@ -695,6 +756,10 @@ bdr_perdb_worker_main(Datum main_arg)
 	BdrPerdbWorker		*perdb;
 	StringInfoData		si;
 	bool				wait;
+	long				timeout;
+#ifdef BUILDING_BDR
+	TimestampTz			last_full_round = GetCurrentTimestamp();
+#endif
 
 	initStringInfo(&si);
 
@@ -786,6 +851,7 @@ bdr_perdb_worker_main(Datum main_arg)
 	while (!got_SIGTERM)
 	{
 		wait = true;
+		timeout = 180000L;
 
 		if (got_SIGHUP)
 		{
@@ -794,19 +860,18 @@ bdr_perdb_worker_main(Datum main_arg)
 		}
 
 #ifdef BUILDING_BDR
-		/* check whether we need to start new elections */
-		if (bdr_sequencer_start_elections())
+		/* relay global lock messages over the control channel */
+		if (bdr_locks_process_control_messages())
 			wait = false;
 
-		/* check whether we need to vote */
-		if (bdr_sequencer_vote())
-			wait = false;
+		/* confirm a lock granted meanwhile once nothing conflicts with it */
+		timeout = Min(timeout, bdr_locks_process_pending_grant());
 
-		/* check whether any of our elections needs to be tallied */
-		bdr_sequencer_tally();
+		/* do the sequencer work requested since the last round */
+		if (bdr_sequencer_round())
+			wait = false;
 
-		/* check all bdr sequences for used up chunks */
-		bdr_sequencer_fill_sequences();
+		timeout = Min(timeout, bdr_perdb_heartbeat());
 #endif
 
 		pgstat_report_activity(STATE_IDLE, NULL);
@@ -817,15 +882,17 @@ bdr_perdb_worker_main(Datum main_arg)
 		 * necessary, but is awakened if postmaster dies.  That way the
 		 * background process goes away immediately in an emergency.
 		 *
-		 * We wake up everytime our latch gets set or if 180 seconds have
-		 * passed without events. That's a stopgap for the case a backend
-		 * committed sequencer changes but died before setting the latch.
+		 * We wake up everytime our latch gets set, a heartbeat or a check for
+		 * a pending global lock is due or if 180 seconds have passed without
+		 * events. That's a stopgap for the case a backend committed sequencer
+		 * changes but died before setting the latch, so every 180 seconds the
+		 * sequencer looks at everything.
 		 */
 		if (wait)
 		{
 			rc = WaitLatch(&MyProc->procLatch,
 						   WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
-						   180000L);
+						   timeout);
 
 			ResetLatch(&MyProc->procLatch);
 
@@ -833,6 +900,16 @@ bdr_perdb_worker_main(Datum main_arg)
 			if (rc & WL_POSTMASTER_DEATH)
 				proc_exit(1);
 
+#ifdef BUILDING_BDR
+			if ((rc & WL_TIMEOUT) &&
+				TimestampDifferenceExceeds(last_full_round,
+										   GetCurrentTimestamp(), 180000))
+			{
+				bdr_sequencer_request_full_round();
+				last_full_round = GetCurrentTimestamp();
+			}
+#endif
+
 			if (rc & WL_LATCH_SET)
 			{
 				/*
@@ -270,6 +270,9 @@ bdr_heap_open(Oid reloid, LOCKMODE lockmode)
 	/* possibly a new relcache.c relcache entry */
 	entry->rel = rel;
 
+	if (!found)
+		entry->remote_natts = 0;
+
 	if (found && entry->valid)
 		return entry;
 	else if (found)
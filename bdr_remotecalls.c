@@ -120,11 +120,8 @@ free_remote_node_info(remote_node_info *ri)
 
 /*
  * Given two connections, execute a COPY ... TO stdout on one connection
- * and feed the results to a COPY ... FROM stdin on the other connection
- * for the purpose of copying a set of rows between two nodes.
- *
- * It copies bdr_connections entries from the remote table to the
- * local table of the same name, optionally with a filtering query.
+ * and start a COPY ... FROM stdin on the other connection, to relay rows
+ * between them with bdr_copytable_pump.
  *
  * "from" here is from the client perspective, i.e. to copy from
  * the server we "COPY ... TO stdout", and to copy to the server we
@@ -137,13 +134,16 @@ free_remote_node_info(remote_node_info *ri)
  * table name. Be careful of SQL injection opportunities.
  */
 void
-bdr_copytable(PGconn *copyfrom_conn, PGconn *copyto_conn,
+bdr_copytable_begin(BdrCopyState *copy,
+		PGconn *copyfrom_conn, PGconn *copyto_conn,
 		const char * copyfrom_query, const char *copyto_query)
 {
 	PGresult *copyfrom_result;
 	PGresult *copyto_result;
-	int	copyinresult, copyoutresult;
-	char * copybuf;
+
+	memset(copy, 0, sizeof(BdrCopyState));
+	copy->from = copyfrom_conn;
+	copy->to = copyto_conn;
 
 	copyfrom_result = PQexec(copyfrom_conn, copyfrom_query);
 	if (PQresultStatus(copyfrom_result) != PGRES_COPY_OUT)
@@ -153,6 +153,7 @@ bdr_copytable(PGconn *copyfrom_conn, PGconn *copyto_conn,
 				 errdetail("Query '%s': %s", copyfrom_query,
 					 PQerrorMessage(copyfrom_conn))));
 	}
+	PQclear(copyfrom_result);
 
 	copyto_result = PQexec(copyto_conn, copyto_query);
 	if (PQresultStatus(copyto_result) != PGRES_COPY_IN)
@@ -162,35 +163,273 @@ bdr_copytable(PGconn *copyfrom_conn, PGconn *copyto_conn,
 				 errdetail("Query '%s': %s", copyto_query,
 					 PQerrorMessage(copyto_conn))));
 	}
+	PQclear(copyto_result);
 
-	while ((copyoutresult = PQgetCopyData(copyfrom_conn, &copybuf, false)) > 0)
+	copy->buf = palloc(BDR_COPY_BUFFER_SIZE);
+}
+
+/*
+ * Send data to the destination of a copy.
+ */
+static void
+bdr_copytable_put(BdrCopyState *copy, const char *data, int len)
+{
+	/*
+	 * A nonblocking connection enlarges its buffer rather than failing to
+	 * queue, bdr_copytable_pump keeps that bounded.
+	 */
+	if (PQputCopyData(copy->to, data, len) != 1)
 	{
-		if ((copyinresult = PQputCopyData(copyto_conn, copybuf, copyoutresult)) != 1)
+		ereport(ERROR,
+				(errmsg("writing to destination table failed"),
+				 errdetail("destination connection reported: %s",
+					 PQerrorMessage(copy->to))));
+	}
+}
+
+/*
+ * Collect the results of a COPY conn finished, the first of which must be
+ * successful; source says which end of the copy conn is, for error messages.
+ * Sets *confirmed once the successful result was seen.
+ *
+ * With async, returns false if getting another result would block, true once
+ * all were collected.
+ */
+static bool
+bdr_copytable_results(PGconn *conn, bool source, bool async, bool *confirmed)
+{
+	PGresult   *res;
+
+	for (;;)
+	{
+		if (async && PQconsumeInput(conn) == 0)
 		{
+			*confirmed = false;
+			break;
+		}
+		if (async && PQisBusy(conn))
+			return false;
+
+		res = PQgetResult(conn);
+		if (res == NULL)
+			break;
+
+		if (!*confirmed && PQresultStatus(res) == PGRES_COMMAND_OK)
+			*confirmed = true;
+		PQclear(res);
+
+		if (!*confirmed)
+			break;
+	}
+
+	if (!*confirmed)
+	{
+		if (source)
+			ereport(ERROR,
+					(errmsg("reading from origin table/query failed"),
+					 errdetail("source connection reported: %s",
+						PQerrorMessage(conn))));
+		else
 			ereport(ERROR,
 					(errmsg("writing to destination table failed"),
 					 errdetail("destination connection reported: %s",
-						 PQerrorMessage(copyto_conn))));
+						 PQerrorMessage(conn))));
+	}
+
+	return true;
+}
+
+/*
+ * Relay rows of a COPY started with bdr_copytable_begin.
+ *
+ * Rows are collected into messages of up to BDR_COPY_BUFFER_SIZE bytes;
+ * COPY data doesn't have to be sent row by row.
+ *
+ * Without async this blocks until all rows have been copied and returns
+ * BDR_COPY_DONE.
+ *
+ * With async, the destination connection must be in nonblocking mode. At
+ * most BDR_COPY_ROWS_PER_PUMP rows already received are relayed, so a
+ * caller can interleave several copies. Returns BDR_COPY_WAIT_READ if the
+ * source has no complete row buffered, BDR_COPY_WAIT_WRITE if the
+ * destination isn't keeping up, BDR_COPY_RUNNING if there may be more rows
+ * buffered already and BDR_COPY_WAIT_RESULT while waiting for the
+ * destination to confirm the COPY. The caller should wait for the respective
+ * socket to become readable or writable and call again; never blocks.
+ *
+ * Once the destination has confirmed the COPY the status of both
+ * connections has been checked and BDR_COPY_DONE is returned.
+ */
+BdrCopyStatus
+bdr_copytable_pump(BdrCopyState *copy, bool async)
+{
+	char	   *copybuf;
+	int			copyoutresult = 0;
+	int			flushresult;
+	int			nrows;
+
+	if (!copy->from_done && !copy->from_eof)
+	{
+		/* Don't queue up more than a batch on a slow destination */
+		if (async && (flushresult = PQflush(copy->to)) != 0)
+		{
+			if (flushresult < 0)
+				ereport(ERROR,
+						(errmsg("writing to destination table failed"),
+						 errdetail("destination connection reported: %s",
+							 PQerrorMessage(copy->to))));
+			return BDR_COPY_WAIT_WRITE;
+		}
+
+		if (async && PQconsumeInput(copy->from) == 0)
+			ereport(ERROR,
+					(errmsg("reading from origin table/query failed"),
+					 errdetail("source connection reported: %s",
+						PQerrorMessage(copy->from))));
+
+		for (nrows = 0; !async || nrows < BDR_COPY_ROWS_PER_PUMP; nrows++)
+		{
+			copyoutresult = PQgetCopyData(copy->from, &copybuf, async);
+			if (copyoutresult <= 0)
+				break;
+
+			if (copy->len + copyoutresult > BDR_COPY_BUFFER_SIZE)
+			{
+				bdr_copytable_put(copy, copy->buf, copy->len);
+				copy->len = 0;
+			}
+
+			if (copyoutresult >= BDR_COPY_BUFFER_SIZE)
+				bdr_copytable_put(copy, copybuf, copyoutresult);
+			else
+			{
+				memcpy(copy->buf + copy->len, copybuf, copyoutresult);
+				copy->len += copyoutresult;
+			}
+			PQfreemem(copybuf);
+
+			copy->rows++;
+			copy->bytes += copyoutresult;
+		}
+
+		if (async && nrows == BDR_COPY_ROWS_PER_PUMP)
+			return BDR_COPY_RUNNING;
+
+		/* Nothing more to add for now, send what we have */
+		if (copy->len > 0)
+		{
+			bdr_copytable_put(copy, copy->buf, copy->len);
+			copy->len = 0;
+		}
+
+		if (copyoutresult == 0)
+			return BDR_COPY_WAIT_READ;
+
+		if (copyoutresult != -1)
+		{
+			ereport(ERROR,
+					(errmsg("reading from origin table/query failed"),
+					 errdetail("source connection returned %d: %s",
+						copyoutresult, PQerrorMessage(copy->from))));
+		}
+
+		copy->from_eof = true;
+	}
+
+	if (!copy->from_done)
+	{
+		if (!bdr_copytable_results(copy->from, true, async,
+								   &copy->from_confirmed))
+			return BDR_COPY_WAIT_READ;
+
+		/* Send local finish */
+		if (PQputCopyEnd(copy->to, NULL) != 1)
+		{
+			ereport(ERROR,
+					(errmsg("sending copy-completion to destination connection failed"),
+					 errdetail("destination connection reported: %s",
+						 PQerrorMessage(copy->to))));
 		}
-		PQfreemem(copybuf);
+
+		copy->from_done = true;
 	}
 
-	if (copyoutresult != -1)
+	if (async && (flushresult = PQflush(copy->to)) != 0)
 	{
-		ereport(ERROR,
-				(errmsg("reading from origin table/query failed"),
-				 errdetail("source connection returned %d: %s",
-					copyoutresult, PQerrorMessage(copyfrom_conn))));
+		if (flushresult < 0)
+			ereport(ERROR,
+					(errmsg("sending copy-completion to destination connection failed"),
+					 errdetail("destination connection reported: %s",
+						 PQerrorMessage(copy->to))));
+		return BDR_COPY_WAIT_WRITE;
 	}
 
-	// Send local finish
-	if (PQputCopyEnd(copyto_conn, NULL) != 1)
+	/*
+	 * All data is sent, but the destination may still be busy with it, e.g.
+	 * checking constraints. Don't block on that, so the caller can check for
+	 * interrupts meanwhile.
+	 */
+	if (!bdr_copytable_results(copy->to, false, async, &copy->to_confirmed))
+		return BDR_COPY_WAIT_RESULT;
+
+	pfree(copy->buf);
+	copy->buf = NULL;
+
+	return BDR_COPY_DONE;
+}
+
+/*
+ * Given two connections, execute a COPY ... TO stdout on one connection
+ * and feed the results to a COPY ... FROM stdin on the other connection
+ * for the purpose of copying a set of rows between two nodes.
+ *
+ * It copies bdr_connections entries from the remote table to the
+ * local table of the same name, optionally with a filtering query.
+ *
+ * See bdr_copytable_begin. On failure an ERROR will be raised.
+ */
+void
+bdr_copytable(PGconn *copyfrom_conn, PGconn *copyto_conn,
+		const char * copyfrom_query, const char *copyto_query)
+{
+	BdrCopyState copy;
+
+	bdr_copytable_begin(&copy, copyfrom_conn, copyto_conn,
+						copyfrom_query, copyto_query);
+	(void) bdr_copytable_pump(&copy, false);
+}
+
+/*
+ * Can the node at conn and we exchange COPY data in binary format?
+ *
+ * Binary COPY uses the types' send/recv functions. Like the output plugin's
+ * binary protocol checks, require the same major version and the same
+ * representation of timestamps. Whether the types of a particular table can
+ * be sent that way is up to the caller.
+ */
+bool
+bdr_copy_binary_compatible(PGconn *conn)
+{
+	PGresult   *res;
+	bool		compatible;
+
+	res = PQexec(conn, "SELECT current_setting('server_version_num'), "
+					   "current_setting('integer_datetimes')");
+	if (PQresultStatus(res) != PGRES_TUPLES_OK)
 	{
 		ereport(ERROR,
-				(errmsg("sending copy-completion to destination connection failed"),
-				 errdetail("destination connection reported: %s",
-					 PQerrorMessage(copyto_conn))));
+				(errmsg("getting remote server settings failed"),
+				 errdetail("remote node reported: %s",
+					 PQerrorMessage(conn))));
 	}
+
+	compatible =
+		atoi(PQgetvalue(res, 0, 0)) / 100 == PG_VERSION_NUM / 100 &&
+		(strcmp(PQgetvalue(res, 0, 1), "on") == 0) == bdr_get_integer_timestamps();
+
+	PQclear(res);
+
+	return compatible;
 }
 
 /*
@@ -334,6 +334,9 @@ DropReplicationIdentifier(RepNodeId riident)
 	/* now release lock again,  */
 	heap_close(rel, ExclusiveLock);
 	heap_close(relpos, ExclusiveLock);
+
+	/* the id may get reused for another node */
+	bdr_nodecache_forget_node_id(riident);
 }
 
 void
@@ -14,8 +14,11 @@
  */
 #include "postgres.h"
 
+#include <math.h>
+
 #include "bdr.h"
 
+#include "funcapi.h"
 #include "miscadmin.h"
 #include "pgstat.h"
 
@@ -31,29 +34,157 @@
 
 #include "executor/spi.h"
 
+#include "nodes/execnodes.h"
+
+#include "utils/array.h"
 #include "utils/builtins.h"
+#include "utils/hsearch.h"
 #include "utils/lsyscache.h"
 #include "utils/snapmgr.h"
+#include "utils/timestamp.h"
 
 #include "storage/bufmgr.h"
 #include "storage/ipc.h"
 #include "storage/latch.h"
 #include "storage/lmgr.h"
+#include "storage/lwlock.h"
 #include "storage/proc.h"
+#include "storage/shmem.h"
+#include "storage/spin.h"
+
+/*
+ * Chunk sizing.
+ *
+ * The sequencer tries to keep at least BDR_SEQ_MIN_FREE_VALUES values of
+ * each sequence allocated ahead of need. For sequences consumed faster than
+ * that, enough values to last bdr.sequence_lookahead seconds at the observed
+ * rate of consumption are requested instead, spread over
+ * BDR_SEQ_TARGET_CHUNKS chunks. That way a burst of nextval() calls leads to
+ * fewer, bigger, chunks being voted on instead of running dry.
+ */
+#define BDR_SEQ_MIN_CHUNK_SIZE		1000
+#define BDR_SEQ_MAX_CHUNK_SIZE		1000000
+#define BDR_SEQ_TARGET_CHUNKS		5
+#define BDR_SEQ_MIN_FREE_VALUES		(BDR_SEQ_MIN_CHUNK_SIZE * BDR_SEQ_TARGET_CHUNKS)
+#define BDR_SEQ_MAX_CHUNKS_PER_ROUND 10
+
+/* don't recompute the consumption rate more often than this */
+#define BDR_SEQ_RATE_INTERVAL_MS	1000
+
+/* number of sequences per database we keep statistics for */
+#define BDR_SEQ_STATS_PER_DB		1000
+
+#define BDR_SEQ_STAT_COLS			8
+
+/*
+ * Layout of values generated by timeshard sequences: milliseconds since
+ * BDR_TIMESHARD_EPOCH_MS in the upper 41 bits (good till 2084), followed by
+ * the node's bdr.bdr_nodes.node_seq_id and a per-node counter that makes
+ * values generated within the same millisecond unique.
+ */
+#define BDR_TIMESHARD_NODE_BITS		10
+#define BDR_TIMESHARD_COUNTER_BITS	12
+#define BDR_TIMESHARD_TIMESTAMP_BITS 41
+#define BDR_TIMESHARD_MAX_NODE		((1 << BDR_TIMESHARD_NODE_BITS) - 1)
+#define BDR_TIMESHARD_MAX_COUNTER	((1 << BDR_TIMESHARD_COUNTER_BITS) - 1)
+#define BDR_TIMESHARD_MAX_MS		((INT64CONST(1) << BDR_TIMESHARD_TIMESTAMP_BITS) - 1)
+#define BDR_TIMESHARD_TIMESTAMP_SHIFT (BDR_TIMESHARD_NODE_BITS + BDR_TIMESHARD_COUNTER_BITS)
+
+#define BDR_TIMESHARD_MAKE_VALUE(ms, node, counter) \
+	(((int64) (ms) << BDR_TIMESHARD_TIMESTAMP_SHIFT) | \
+	 ((int64) (node) << BDR_TIMESHARD_COUNTER_BITS) | \
+	 (int64) (counter))
+
+/* 2015-01-01 00:00:00 UTC, in milliseconds since the postgres epoch */
+#define BDR_TIMESHARD_EPOCH_MS		INT64CONST(473385600000)
+
+/* how far ahead, in milliseconds, timeshard sequences are WAL-logged */
+#define BDR_TIMESHARD_LOG_MS		1000
+
+/*
+ * How many sequences needing attention we remember individually before
+ * falling back to looking at all of them.
+ */
+#define BDR_SEQ_MAX_DIRTY			64
 
 typedef struct BdrSequencerSlot
 {
-	Oid			database_oid;
 	Size		nnodes;
+
+	/*
+	 * Protects the database and latch of the sequencer owning the slot, the
+	 * requested work and the timeshard state below.
+	 */
+	slock_t		mutex;
+	Oid			database_oid;
 	Latch	   *proclatch;
+	/* BDR_SEQ_WORK_* the sequencer has been asked to do */
+	uint32		work;
+	/* sequences work has been requested for, all of them if dirty_all */
+	bool		dirty_all;
+	int			ndirty;
+	Oid			dirty[BDR_SEQ_MAX_DIRTY];
+	/* our bdr.bdr_nodes.node_seq_id, 0 if not known (yet) */
+	int32		node_seq_id;
+	/* millisecond and counter of the last generated timeshard value */
+	int64		timeshard_ms;
+	int32		timeshard_counter;
 } BdrSequencerSlot;
 
 typedef struct BdrSequencerControl
 {
+	/* protects BdrSequenceStatsHash */
+	LWLockId	stats_lock;
+	/* no space left in BdrSequenceStatsHash, reset when pruning it */
+	bool		stats_full;
 	int	        next_slot;
 	BdrSequencerSlot slots[FLEXIBLE_ARRAY_MEMBER];
 } BdrSequencerControl;
 
+typedef struct BdrSequenceStatsKey
+{
+	Oid			dboid;
+	Oid			seqoid;
+} BdrSequenceStatsKey;
+
+/*
+ * Consumption and allocation statistics of a single sequence, kept in shared
+ * memory.
+ */
+typedef struct BdrSequenceStats
+{
+	/* hash key, needs to be first */
+	BdrSequenceStatsKey key;
+
+	/* protects all following fields */
+	slock_t		mutex;
+
+	/* maintained by backends in bdr_sequence_alloc() */
+	int64		nvalues;			/* values handed out */
+	int64		nexhausted;			/* nextval() calls that found no value */
+
+	/* maintained by the sequencer */
+	int64		nchunks_requested;
+	int64		nchunks_acquired;
+	int64		nchunks_used_up;
+	int64		chunk_size;			/* size of the last requested chunks */
+	int64		sample_nvalues;		/* nvalues as of sample_time */
+	TimestampTz	sample_time;
+	double		rate;				/* decaying peak of values used per second */
+	uint32		round;				/* last sequencer round that saw us */
+} BdrSequenceStats;
+
+/* parsed reloptions of a bdr sequence, see bdr_sequence_options() */
+typedef struct BdrSequenceOptions
+{
+	int32		vl_len_;		/* varlena header (do not touch directly!) */
+	bool		timeshard;
+} BdrSequenceOptions;
+
+#define BdrSequenceIsTimeshard(relation) \
+	((relation)->rd_options != NULL && \
+	 ((BdrSequenceOptions *) (relation)->rd_options)->timeshard)
+
 typedef struct BdrSequenceValues {
 	int64		start_value;
 	int64		next_value;
@@ -69,24 +200,56 @@ Oid	BdrSequenceElectionsRelid;	/* bdr_sequence_elections */
 Oid	BdrVotesRelid;		/* bdr_votes */
 
 static BdrSequencerControl *BdrSequencerCtl = NULL;
+static HTAB *BdrSequenceStatsHash = NULL;
+
+/* sequencer round, used to forget about dropped sequences */
+static uint32 bdr_seq_stats_round = 0;
+
+static relopt_kind bdr_seq_relopt_kind;
 
 /* how many nodes have we built shmem for */
 static size_t bdr_seq_nsequencers = 0;
 
 static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
 
-static bool bdr_seq_pending_wakeup = false;
+/*
+ * Sequencer work requested by the current transaction, passed on to the
+ * sequencer at the end of it.
+ */
+static uint32 bdr_seq_eoxact_work = 0;
+static bool bdr_seq_eoxact_dirty_all = false;
+static int	bdr_seq_eoxact_ndirty = 0;
+static Oid	bdr_seq_eoxact_dirty[BDR_SEQ_MAX_DIRTY];
+
+/*
+ * Work the sequencer still has to do, and for which sequences. Only used in
+ * the sequencer itself. We start out with a full round.
+ */
+static uint32 seq_work = BDR_SEQ_WORK_ALL;
+static bool seq_dirty_all = true;
+static int	seq_ndirty = 0;
+static Oid	seq_dirty[BDR_SEQ_MAX_DIRTY];
 
 /* vote, the logic is in a function */
 const char* vote_sql = ""
 "SELECT bdr.bdr_sequencer_vote($1, $2, $3, $4);\n";
 
+/*
+ * Start elections for all sequences (or those in $5) running low on
+ * pre-allocated values.
+ * How many chunks of which size to ask for is decided by
+ * bdr_sequence_chunk_demand(), based on the number of values still free and
+ * the sequence's rate of consumption.
+ */
 const char *start_elections_sql =
-"WITH to_be_updated_sequences AS (\n"
+"WITH free_sequence_values AS (\n"
 "    SELECT\n"
+"        pg_class.oid AS seqoid,\n"
 "        pg_namespace.nspname AS seqschema,\n"
 "        pg_class.relname AS seqname,\n"
-"        COUNT(bdr_sequence_values) AS open_seq_chunks,\n"
+"        COALESCE(SUM(upper(bdr_sequence_values.seqrange)\n"
+"                     - lower(bdr_sequence_values.seqrange)), 0)::int8\n"
+"        AS free_values,\n"
 "        GREATEST(COALESCE((\n"
 "            SELECT max(upper(seqrange))\n"
 "            FROM bdr_sequence_values max_val\n"
@@ -112,23 +275,43 @@ const char *start_elections_sql =
 "    WHERE\n"
 "        pg_class.relkind = 'S'\n"
 "        AND pg_class.relam = (SELECT oid FROM pg_seqam WHERE seqamname = 'bdr')\n"
+"        -- timeshard sequences don't need chunks\n"
+"        AND NOT EXISTS (\n"
+"            SELECT 1\n"
+"            FROM pg_options_to_table(pg_class.reloptions)\n"
+"            WHERE option_name = 'timeshard' AND option_value::bool\n"
+"        )\n"
+"        -- only the sequences we've been asked to look at, if any\n"
+"        AND ($5 IS NULL OR pg_class.oid = ANY($5))\n"
 "    GROUP BY\n"
 "        pg_class.relname,\n"
 "        pg_namespace.nspname,\n"
 "        pg_class.oid\n"
-"    HAVING\n"
-"        count(bdr_sequence_values) <= 5\n"
+"),\n"
+"to_be_updated_sequences AS (\n"
+"    SELECT\n"
+"        seqschema,\n"
+"        seqname,\n"
+"        current_max,\n"
+"        demand.chunk_size,\n"
+"        demand.nchunks\n"
+"    FROM\n"
+"        free_sequence_values,\n"
+"        LATERAL bdr.bdr_sequence_chunk_demand(seqoid, free_values) demand\n"
+"    WHERE\n"
+"        demand.nchunks > 0\n"
 "),\n"
 "to_be_inserted_chunks AS (\n"
 "    SELECT\n"
 "        seqschema,\n"
 "        seqname,\n"
 "        current_max,\n"
+"        chunk_size,\n"
 "        generate_series(\n"
 "            current_max,\n"
-"            -- 1000 is the chunk size, -1 is to get < instead <= out of generate_series\n"
-"            current_max + 1000 * (5 - open_seq_chunks) - 1,\n"
-"            1000) chunk_start\n"
+"            -- -1 is to get < instead <= out of generate_series\n"
+"            current_max + chunk_size * nchunks - 1,\n"
+"            chunk_size) chunk_start\n"
 "    FROM to_be_updated_sequences\n"
 "    LIMIT 500\n"
 "),\n"
@@ -163,7 +346,7 @@ const char *start_elections_sql =
 "        true AS open,\n"
 "        seqschema,\n"
 "        seqname,\n"
-"        int8range(chunk_start, chunk_start + 1000) AS seqrange\n"
+"        int8range(chunk_start, chunk_start + chunk_size) AS seqrange\n"
 "    FROM to_be_inserted_chunks\n"
 "    RETURNING\n"
 "        seqschema,\n"
@@ -193,7 +376,7 @@ const char *start_elections_sql =
 "    false AS confirmed,\n"
 "    false AS in_use,\n"
 "    false AS emptied,\n"
-"    int8range(chunk_start, chunk_start + 1000)\n"
+"    int8range(chunk_start, chunk_start + chunk_size)\n"
 "FROM to_be_inserted_chunks\n"
 "-- force evaluation \n"
 "WHERE (SELECT count(*) FROM inserted_chunks) >= 0\n"
@@ -302,7 +485,9 @@ const char *tally_elections_sql =
 "    seqschema,\n"
 "    seqname,\n"
 "    seqrange,\n"
-"    'success'::text\n"
+"    'success'::text,\n"
+"    -- the sequence can be filled now\n"
+"    to_regclass((quote_ident(seqschema) || '.' || quote_ident(seqname))::cstring)::oid\n"
 "FROM successfull_sequence_values\n"
 "\n"
 "UNION ALL\n"
@@ -311,7 +496,8 @@ const char *tally_elections_sql =
 "    seqschema,\n"
 "    seqname,\n"
 "    seqrange,\n"
-"    'failed'::text\n"
+"    'failed'::text,\n"
+"    NULL::oid\n"
 "FROM failed_sequence_values\n"
 "\n"
 "UNION ALL\n"
@@ -320,7 +506,8 @@ const char *tally_elections_sql =
 "    seqschema,\n"
 "    seqname,\n"
 "    seqrange,\n"
-"    'pending'::text\n"
+"    'pending'::text,\n"
+"    NULL::oid\n"
 "FROM tallied_votes\n"
 "WHERE NOT sufficient\n"
 ;
@@ -336,9 +523,24 @@ const char *fill_sequences_sql =
 "WHERE\n"
 "    relkind = 'S'\n"
 "    AND seqamname = 'bdr'\n"
+"    AND NOT EXISTS (\n"
+"        SELECT 1\n"
+"        FROM pg_options_to_table(pg_class.reloptions)\n"
+"        WHERE option_name = 'timeshard' AND option_value::bool\n"
+"    )\n"
+"    AND ($1 IS NULL OR pg_class.oid = ANY($1))\n"
 "ORDER BY pg_class.oid\n"
 ;
 
+const char *node_seq_id_sql =
+"SELECT node_seq_id\n"
+"FROM bdr.bdr_nodes\n"
+"WHERE\n"
+"    node_sysid = $1\n"
+"    AND node_timeline = $2\n"
+"    AND node_dboid = $3\n"
+;
+
 
 const char *get_chunk_sql =
 "UPDATE bdr_sequence_values\n"
@@ -394,6 +596,12 @@ bdr_sequencer_shmem_size(void)
 	return size;
 }
 
+static long
+bdr_sequence_stats_size(void)
+{
+	return bdr_seq_nsequencers * BDR_SEQ_STATS_PER_DB;
+}
+
 static void
 bdr_sequencer_shmem_shutdown(int code, Datum arg)
 {
@@ -405,8 +613,10 @@ bdr_sequencer_shmem_shutdown(int code, Datum arg)
 
 	slot = &BdrSequencerCtl->slots[seq_slot];
 
+	SpinLockAcquire(&slot->mutex);
 	slot->database_oid = InvalidOid;
 	slot->proclatch = NULL;
+	SpinLockRelease(&slot->mutex);
 	seq_slot = -1;
 }
 
@@ -414,6 +624,8 @@ static void
 bdr_sequencer_shmem_startup(void)
 {
 	bool		found;
+	HASHCTL		ctl;
+	size_t		off;
 
 	if (prev_shmem_startup_hook != NULL)
 		prev_shmem_startup_hook();
@@ -426,6 +638,9 @@ bdr_sequencer_shmem_startup(void)
 	{
 		/* initialize */
 		memset(BdrSequencerCtl, 0, bdr_sequencer_shmem_size());
+		BdrSequencerCtl->stats_lock = LWLockAssign();
+		for (off = 0; off < bdr_seq_nsequencers; off++)
+			SpinLockInit(&BdrSequencerCtl->slots[off].mutex);
 		/*
 		 * next_slot allows perdb workers to allocate seq slots.
 		 * The sequencer will likely be separated into a different
@@ -433,6 +648,17 @@ bdr_sequencer_shmem_startup(void)
 		 */
 		BdrSequencerCtl->next_slot = 0;
 	}
+
+	MemSet(&ctl, 0, sizeof(ctl));
+	ctl.keysize = sizeof(BdrSequenceStatsKey);
+	ctl.entrysize = sizeof(BdrSequenceStats);
+	ctl.hash = tag_hash;
+
+	BdrSequenceStatsHash = ShmemInitHash("bdr sequence statistics",
+										 bdr_sequence_stats_size(),
+										 bdr_sequence_stats_size(),
+										 &ctl,
+										 HASH_ELEM | HASH_FUNCTION);
 	LWLockRelease(AddinShmemInitLock);
 
 	on_shmem_exit(bdr_sequencer_shmem_shutdown, (Datum) 0);
@@ -446,11 +672,149 @@ bdr_sequencer_shmem_init(int sequencers)
 	bdr_seq_nsequencers = sequencers;
 
 	RequestAddinShmemSpace(bdr_sequencer_shmem_size());
+	RequestAddinShmemSpace(hash_estimate_size(bdr_sequence_stats_size(),
+											  sizeof(BdrSequenceStats)));
+	/* lock protecting the sequence statistics */
+	RequestAddinLWLocks(1);
 
 	prev_shmem_startup_hook = shmem_startup_hook;
 	shmem_startup_hook = bdr_sequencer_shmem_startup;
 }
 
+/*
+ * Register the reloptions bdr sequences accept. Needs to be called in every
+ * backend, from _PG_init().
+ */
+void
+bdr_sequence_reloptions_init(void)
+{
+	bdr_seq_relopt_kind = add_reloption_kind();
+
+	add_bool_reloption(bdr_seq_relopt_kind, "timeshard",
+					   "Generate values from timestamp, node and counter instead of voting on chunks",
+					   false);
+}
+
+/*
+ * Look up the statistics entry of a sequence in the current database. If
+ * create is true and there is none, create it.
+ *
+ * Returns with stats_lock held, in share or exclusive mode, which the caller
+ * has to release after it's done with the entry. Returns NULL, without the
+ * lock held, if there's no entry and it couldn't or shouldn't be created.
+ *
+ * Only the sequencer creates entries, so nextval() never needs stats_lock in
+ * exclusive mode; the sequencer sees every sequence in its first round.
+ */
+static BdrSequenceStats *
+bdr_sequence_stats_acquire(Oid seqoid, bool create)
+{
+	BdrSequenceStatsKey key;
+	BdrSequenceStats *stats;
+	bool		found;
+
+	memset(&key, 0, sizeof(key));
+	key.dboid = MyDatabaseId;
+	key.seqoid = seqoid;
+
+	LWLockAcquire(BdrSequencerCtl->stats_lock, LW_SHARED);
+	stats = hash_search(BdrSequenceStatsHash, &key, HASH_FIND, NULL);
+	if (stats != NULL)
+		return stats;
+	LWLockRelease(BdrSequencerCtl->stats_lock);
+
+	/* an unlocked read is fine, it's just a hint */
+	if (!create || BdrSequencerCtl->stats_full)
+		return NULL;
+
+	LWLockAcquire(BdrSequencerCtl->stats_lock, LW_EXCLUSIVE);
+	stats = hash_search(BdrSequenceStatsHash, &key, HASH_ENTER_NULL, &found);
+	if (stats == NULL)
+	{
+		BdrSequencerCtl->stats_full = true;
+		LWLockRelease(BdrSequencerCtl->stats_lock);
+		return NULL;
+	}
+
+	if (!found)
+	{
+		memset((char *) stats + sizeof(BdrSequenceStatsKey), 0,
+			   sizeof(BdrSequenceStats) - sizeof(BdrSequenceStatsKey));
+		SpinLockInit(&stats->mutex);
+	}
+
+	return stats;
+}
+
+/*
+ * Forget about statistics of sequences of the current database that weren't
+ * seen in the given sequencer round, i.e. that have been dropped.
+ */
+static void
+bdr_sequence_stats_prune(uint32 round)
+{
+	HASH_SEQ_STATUS status;
+	BdrSequenceStats *stats;
+
+	LWLockAcquire(BdrSequencerCtl->stats_lock, LW_EXCLUSIVE);
+
+	hash_seq_init(&status, BdrSequenceStatsHash);
+	while ((stats = hash_seq_search(&status)) != NULL)
+	{
+		if (stats->key.dboid != MyDatabaseId)
+			continue;
+
+		if (stats->round != round)
+		{
+			hash_search(BdrSequenceStatsHash, &stats->key, HASH_REMOVE, NULL);
+			BdrSequencerCtl->stats_full = false;
+		}
+	}
+
+	LWLockRelease(BdrSequencerCtl->stats_lock);
+}
+
+/*
+ * Recompute the rate a sequence is being consumed at.
+ *
+ * We track a decaying peak rather than an average, so a burst of nextval()
+ * calls immediately leads to bigger chunks being requested, while it takes a
+ * while, with a half-life of bdr.sequence_lookahead, until we go back to
+ * requesting small ones.
+ *
+ * Caller needs to hold the entry's mutex.
+ */
+static void
+bdr_sequence_stats_update_rate(BdrSequenceStats *stats, TimestampTz now)
+{
+	long		secs;
+	int			usecs;
+	double		elapsed;
+	double		current;
+
+	if (stats->sample_time == 0)
+	{
+		stats->sample_time = now;
+		stats->sample_nvalues = stats->nvalues;
+		return;
+	}
+
+	if (!TimestampDifferenceExceeds(stats->sample_time, now,
+									BDR_SEQ_RATE_INTERVAL_MS))
+		return;
+
+	TimestampDifference(stats->sample_time, now, &secs, &usecs);
+	elapsed = secs + usecs / 1000000.0;
+
+	current = (stats->nvalues - stats->sample_nvalues) / elapsed;
+
+	stats->rate *= pow(0.5, elapsed / Max(bdr_sequence_lookahead, 1));
+	stats->rate = Max(stats->rate, current);
+
+	stats->sample_time = now;
+	stats->sample_nvalues = stats->nvalues;
+}
+
 /*
  * The perdb worker doing sequencer setup needs to know what slot to
  * allocate for the next sequencer.
@@ -469,49 +833,153 @@ bdr_sequencer_wakeup(void)
 {
 	size_t off;
 	BdrSequencerSlot *slot;
+	Latch	   *latch;
 
+	for (off = 0; off < bdr_seq_nsequencers; off++)
+	{
+		slot = &BdrSequencerCtl->slots[off];
+
+		SpinLockAcquire(&slot->mutex);
+		latch = NULL;
+		if (slot->database_oid == MyDatabaseId)
+			latch = slot->proclatch;
+		SpinLockRelease(&slot->mutex);
+
+		/* a latch stays valid after its owner exits, setting it is harmless */
+		if (latch != NULL)
+			SetLatch(latch);
+	}
+}
+
+/*
+ * Find the sequencer slot of the current database, or NULL if its sequencer
+ * isn't running.
+ */
+static BdrSequencerSlot *
+bdr_sequencer_find_slot(void)
+{
+	size_t off;
+	BdrSequencerSlot *slot;
 
 	for (off = 0; off < bdr_seq_nsequencers; off++)
 	{
+		bool		found;
+
 		slot = &BdrSequencerCtl->slots[off];
 
-		/* FIXME: locking! */
-		if (slot->database_oid == InvalidOid)
-			continue;
+		SpinLockAcquire(&slot->mutex);
+		found = slot->database_oid == MyDatabaseId;
+		SpinLockRelease(&slot->mutex);
 
-		if (slot->database_oid != MyDatabaseId)
-			continue;
+		if (found)
+			return slot;
+	}
 
-		SetLatch(slot->proclatch);
+	return NULL;
+}
+
+/*
+ * Remember a sequence in a set of sequences needing attention, giving up on
+ * remembering them individually once the set is full.
+ */
+static void
+bdr_sequence_add_dirty(Oid *dirty, int *ndirty, bool *dirty_all, Oid seqoid)
+{
+	int			i;
+
+	if (*dirty_all || !OidIsValid(seqoid))
+		return;
+
+	for (i = 0; i < *ndirty; i++)
+	{
+		if (dirty[i] == seqoid)
+			return;
+	}
+
+	if (*ndirty >= BDR_SEQ_MAX_DIRTY)
+	{
+		*dirty_all = true;
+		return;
 	}
+
+	dirty[(*ndirty)++] = seqoid;
+}
+
+/*
+ * Ask the sequencer of the current database to do some work, for the passed
+ * sequences or for all of them, and wake it up.
+ *
+ * If the sequencer isn't running, there's nothing to do: it starts out with
+ * looking at everything anyway.
+ */
+static void
+bdr_sequencer_request_work(uint32 work, Oid *seqoids, int nseqoids,
+						   bool dirty_all)
+{
+	BdrSequencerSlot *slot = bdr_sequencer_find_slot();
+	Latch	   *latch;
+	int			i;
+
+	if (slot == NULL)
+		return;
+
+	SpinLockAcquire(&slot->mutex);
+	/* the sequencer may have exited since we looked */
+	if (slot->database_oid != MyDatabaseId)
+	{
+		SpinLockRelease(&slot->mutex);
+		return;
+	}
+	slot->work |= work;
+	if (dirty_all)
+		slot->dirty_all = true;
+	for (i = 0; i < nseqoids; i++)
+		bdr_sequence_add_dirty(slot->dirty, &slot->ndirty, &slot->dirty_all,
+							   seqoids[i]);
+	latch = slot->proclatch;
+	SpinLockRelease(&slot->mutex);
+
+	if (latch != NULL)
+		SetLatch(latch);
 }
 
 static void
 bdr_sequence_xact_callback(XactEvent event, void *arg)
 {
-	if (event != XACT_EVENT_COMMIT)
+	/*
+	 * nextval() isn't transactional, so work requested by aborted
+	 * transactions needs to be done as well.
+	 */
+	if (event != XACT_EVENT_COMMIT && event != XACT_EVENT_ABORT)
 		return;
 
-	if (bdr_seq_pending_wakeup)
+	if (bdr_seq_eoxact_work != 0)
 	{
-		bdr_sequencer_wakeup();
-		bdr_seq_pending_wakeup = false;
+		bdr_sequencer_request_work(bdr_seq_eoxact_work,
+								   bdr_seq_eoxact_dirty,
+								   bdr_seq_eoxact_ndirty,
+								   bdr_seq_eoxact_dirty_all);
+		bdr_seq_eoxact_work = 0;
+		bdr_seq_eoxact_dirty_all = false;
+		bdr_seq_eoxact_ndirty = 0;
 	}
 }
 
 /*
- * Schedule a wakeup of all sequencer workers, as soon as this transaction
- * commits.
+ * Schedule some work for the sequencer of the current database, to be
+ * requested as soon as this transaction ends. seqoid is the sequence the
+ * work is about, or InvalidOid if it's about all sequences or none in
+ * particular.
  *
- * This is e.g. useful when a new sequnece is created, and the voting process
- * should start immediately.
+ * That way the sequencer only needs to look at what actually changed instead
+ * of re-checking all elections and sequences every time it's woken up.
  *
  * NB: There's a window between the commit and this callback in which this
- * backend could die without causing a cluster wide restart. So we need to
- * periodically check whether we've missed wakeups.
+ * backend could die without causing a cluster wide restart. So the
+ * sequencer periodically does a full round to catch up on missed requests.
  */
 void
-bdr_schedule_eoxact_sequencer_wakeup(void)
+bdr_schedule_eoxact_sequencer_work(uint32 work, Oid seqoid)
 {
 	static bool registered = false;
 
@@ -520,13 +988,166 @@ bdr_schedule_eoxact_sequencer_wakeup(void)
 		RegisterXactCallback(bdr_sequence_xact_callback, NULL);
 		registered = true;
 	}
-	bdr_seq_pending_wakeup = true;
+
+	bdr_seq_eoxact_work |= work;
+
+	if (!(work & (BDR_SEQ_WORK_ELECT | BDR_SEQ_WORK_FILL)))
+		return;
+
+	if (OidIsValid(seqoid))
+		bdr_sequence_add_dirty(bdr_seq_eoxact_dirty, &bdr_seq_eoxact_ndirty,
+							   &bdr_seq_eoxact_dirty_all, seqoid);
+	else
+		bdr_seq_eoxact_dirty_all = true;
+}
+
+/*
+ * Schedule a full round of the sequencer, as soon as this transaction
+ * commits.
+ *
+ * This is e.g. useful when a new sequnece is created, and the voting process
+ * should start immediately.
+ */
+void
+bdr_schedule_eoxact_sequencer_wakeup(void)
+{
+	bdr_schedule_eoxact_sequencer_work(BDR_SEQ_WORK_ALL, InvalidOid);
+}
+
+/*
+ * Make the sequencer look at all elections and sequences in its next round.
+ *
+ * Only to be called in the sequencer.
+ */
+void
+bdr_sequencer_request_full_round(void)
+{
+	seq_work = BDR_SEQ_WORK_ALL;
+	seq_dirty_all = true;
+}
+
+/*
+ * Move the work requested by other backends into the sequencer's own state.
+ */
+static void
+bdr_sequencer_collect_work(void)
+{
+	BdrSequencerSlot *slot = &BdrSequencerCtl->slots[seq_slot];
+	int			i;
+
+	SpinLockAcquire(&slot->mutex);
+	seq_work |= slot->work;
+	if (slot->dirty_all)
+		seq_dirty_all = true;
+	for (i = 0; i < slot->ndirty; i++)
+		bdr_sequence_add_dirty(seq_dirty, &seq_ndirty, &seq_dirty_all,
+							   slot->dirty[i]);
+	slot->work = 0;
+	slot->dirty_all = false;
+	slot->ndirty = 0;
+	SpinLockRelease(&slot->mutex);
+}
+
+/*
+ * Build the oid[] of the sequences the sequencer needs to look at, for use
+ * as a query parameter. NULL means all sequences.
+ */
+static Datum
+bdr_sequencer_dirty_array(char *null)
+{
+	Datum	   *elems;
+	int			i;
+
+	if (seq_dirty_all)
+	{
+		*null = 'n';
+		return (Datum) 0;
+	}
+
+	elems = palloc(sizeof(Datum) * Max(seq_ndirty, 1));
+	for (i = 0; i < seq_ndirty; i++)
+		elems[i] = ObjectIdGetDatum(seq_dirty[i]);
+
+	*null = ' ';
+	return PointerGetDatum(construct_array(elems, seq_ndirty, OIDOID,
+										   sizeof(Oid), true, 'i'));
+}
+
+/*
+ * Do one round of the work that other backends, apply workers and earlier
+ * rounds have asked the sequencer to do. Instead of re-running all sequencer
+ * queries against all sequences every time we're woken up, we only vote if
+ * remote elections came in, only tally if votes came in or we started
+ * elections, and only start elections for and fill sequences that have been
+ * used since the last round.
+ *
+ * Returns whether there's more work to do right away.
+ */
+bool
+bdr_sequencer_round(void)
+{
+	bool		more = false;
+
+	bdr_sequencer_collect_work();
+
+	if (!seq_dirty_all && seq_ndirty == 0)
+		seq_work &= ~(BDR_SEQ_WORK_ELECT | BDR_SEQ_WORK_FILL);
+
+	/* check whether we need to start new elections */
+	if (seq_work & BDR_SEQ_WORK_ELECT)
+	{
+		seq_work &= ~BDR_SEQ_WORK_ELECT;
+		if (bdr_sequencer_start_elections())
+		{
+			/* there might be more, and we might already have a majority */
+			seq_work |= BDR_SEQ_WORK_ELECT | BDR_SEQ_WORK_TALLY;
+			more = true;
+		}
+	}
+
+	/* check whether we need to vote */
+	if (seq_work & BDR_SEQ_WORK_VOTE)
+	{
+		seq_work &= ~BDR_SEQ_WORK_VOTE;
+		if (bdr_sequencer_vote())
+		{
+			seq_work |= BDR_SEQ_WORK_VOTE;
+			more = true;
+		}
+	}
+
+	/* check whether any of our elections needs to be tallied */
+	if (seq_work & BDR_SEQ_WORK_TALLY)
+	{
+		seq_work &= ~BDR_SEQ_WORK_TALLY;
+		bdr_sequencer_tally();
+	}
+
+	/* check the sequences for used up chunks */
+	if (seq_work & BDR_SEQ_WORK_FILL)
+	{
+		seq_work &= ~BDR_SEQ_WORK_FILL;
+		bdr_sequencer_fill_sequences();
+	}
+
+	if (!(seq_work & (BDR_SEQ_WORK_ELECT | BDR_SEQ_WORK_FILL)))
+	{
+		seq_dirty_all = false;
+		seq_ndirty = 0;
+	}
+
+	return more;
 }
 
 void
 bdr_sequencer_set_nnodes(Size nnodes)
 {
 	BdrSequencerSlot *slot = &BdrSequencerCtl->slots[seq_slot];
+
+	/* the majority needed changed, re-check everything */
+	if (slot->nnodes != nnodes)
+		bdr_sequencer_request_full_round();
+
 	slot->nnodes = nnodes;
 }
 
@@ -539,9 +1160,76 @@ bdr_sequencer_init(int new_seq_slot, Size nnodes)
 	seq_slot = new_seq_slot;
 
 	slot = &BdrSequencerCtl->slots[seq_slot];
+
+	/* forget about requests made to a previous sequencer, we do a full round */
+	slot->nnodes = nnodes;
+
+	SpinLockAcquire(&slot->mutex);
+	slot->work = 0;
+	slot->dirty_all = false;
+	slot->ndirty = 0;
 	slot->database_oid = MyDatabaseId;
 	slot->proclatch = &MyProc->procLatch;
-	slot->nnodes = nnodes;
+	SpinLockRelease(&slot->mutex);
+}
+
+/*
+ * Make our node's node_seq_id, which is assigned when the node joins,
+ * available to backends generating timeshard sequence values.
+ *
+ * Must be called in a transaction with SPI connected.
+ */
+static void
+bdr_sequencer_load_node_seq_id(void)
+{
+	static SPIPlanPtr plan;
+	Oid			argtypes[3];
+	Datum		values[3];
+	char		nulls[3];
+	char		local_sysid[32];
+	int			ret;
+	int32		node_seq_id = 0;
+	BdrSequencerSlot *slot = &BdrSequencerCtl->slots[seq_slot];
+
+	snprintf(local_sysid, sizeof(local_sysid), UINT64_FORMAT,
+			 GetSystemIdentifier());
+
+	argtypes[0] = TEXTOID;
+	nulls[0] = false;
+	values[0] = CStringGetTextDatum(local_sysid);
+
+	argtypes[1] = OIDOID;
+	nulls[1] = false;
+	values[1] = ObjectIdGetDatum(ThisTimeLineID);
+
+	argtypes[2] = OIDOID;
+	values[2] = ObjectIdGetDatum(MyDatabaseId);
+	nulls[2] = false;
+
+	if (plan == NULL)
+	{
+		plan = SPI_prepare(node_seq_id_sql, 3, argtypes);
+		SPI_keepplan(plan);
+	}
+
+	ret = SPI_execute_plan(plan, values, nulls, true, 1);
+	if (ret != SPI_OK_SELECT)
+		elog(ERROR, "expected SPI state %u, got %u", SPI_OK_SELECT, ret);
+
+	if (SPI_processed == 1)
+	{
+		bool		isnull;
+		Datum		d;
+
+		d = SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1,
+						  &isnull);
+		if (!isnull)
+			node_seq_id = DatumGetInt16(d);
+	}
+
+	SpinLockAcquire(&slot->mutex);
+	slot->node_seq_id = node_seq_id;
+	SpinLockRelease(&slot->mutex);
 }
 
 /*
@@ -635,18 +1323,20 @@ bdr_sequencer_vote(void)
 
 /*
  * Check whether we need to initiate a voting procedure for getting new
- * sequence chunks.
+ * sequence chunks, for the sequences bdr_sequencer_round() has been asked to
+ * look at.
  */
 bool
 bdr_sequencer_start_elections(void)
 {
 	static SPIPlanPtr plan;
-	Oid			argtypes[4];
-	Datum		values[4];
-	char		nulls[4];
+	Oid			argtypes[5];
+	Datum		values[5];
+	char		nulls[5];
 	char		local_sysid[32];
 	int			ret;
 	int			processed;
+	int			i;
 
 	snprintf(local_sysid, sizeof(local_sysid), UINT64_FORMAT,
 			 GetSystemIdentifier());
@@ -670,12 +1360,15 @@ bdr_sequencer_start_elections(void)
 	values[3] = CStringGetTextDatum("");
 	nulls[3] = false;
 
+	argtypes[4] = OIDARRAYOID;
+	values[4] = bdr_sequencer_dirty_array(&nulls[4]);
+
 	bdr_sequencer_lock();
 	PushActiveSnapshot(GetTransactionSnapshot());
 
 	if (plan == NULL)
 	{
-		plan = SPI_prepare(start_elections_sql, 4, argtypes);
+		plan = SPI_prepare(start_elections_sql, 5, argtypes);
 		SPI_keepplan(plan);
 	}
 
@@ -690,6 +1383,31 @@ bdr_sequencer_start_elections(void)
 	elog(DEBUG1, "started %d elections", SPI_processed);
 	processed = SPI_processed;
 
+	for (i = 0; i < processed; i++)
+	{
+		HeapTuple	tuple = SPI_tuptable->vals[i];
+		TupleDesc	desc = SPI_tuptable->tupdesc;
+		char	   *seqschema;
+		char	   *seqname;
+		Oid			seqoid;
+		BdrSequenceStats *stats;
+
+		seqschema = SPI_getvalue(tuple, desc, SPI_fnumber(desc, "seqschema"));
+		seqname = SPI_getvalue(tuple, desc, SPI_fnumber(desc, "seqname"));
+		seqoid = get_relname_relid(seqname, get_namespace_oid(seqschema, true));
+		if (!OidIsValid(seqoid))
+			continue;
+
+		stats = bdr_sequence_stats_acquire(seqoid, true);
+		if (stats != NULL)
+		{
+			SpinLockAcquire(&stats->mutex);
+			stats->nchunks_requested++;
+			SpinLockRelease(&stats->mutex);
+			LWLockRelease(BdrSequencerCtl->stats_lock);
+		}
+	}
+
 	PopActiveSnapshot();
 	SPI_finish();
 	CommitTransactionCommand();
@@ -711,6 +1429,7 @@ bdr_sequencer_tally(void)
 	char		nulls[5];
 	char		local_sysid[32];
 	int			ret;
+	int			i;
 
 	snprintf(local_sysid, sizeof(local_sysid), UINT64_FORMAT,
 			 GetSystemIdentifier());
@@ -757,6 +1476,22 @@ bdr_sequencer_tally(void)
 
 	elog(DEBUG1, "tallied %d elections", SPI_processed);
 
+	/* sequences that got new chunks need to be filled */
+	for (i = 0; i < SPI_processed; i++)
+	{
+		bool		isnull;
+		Datum		seqoid;
+
+		seqoid = SPI_getbinval(SPI_tuptable->vals[i], SPI_tuptable->tupdesc,
+							   5, &isnull);
+		if (isnull)
+			continue;
+
+		seq_work |= BDR_SEQ_WORK_FILL;
+		bdr_sequence_add_dirty(seq_dirty, &seq_ndirty, &seq_dirty_all,
+							   DatumGetObjectId(seqoid));
+	}
+
 	PopActiveSnapshot();
 	SPI_finish();
 	CommitTransactionCommand();
@@ -884,7 +1619,10 @@ bdr_sequencer_fill_sequence(Oid seqoid, char *seqschema, char *seqname)
 	HeapTuple	newtup;
 	Page		page, temppage;
 	BdrSequenceValues *curval, *firstval;
+	BdrSequenceStats *stats;
 	int i;
+	int nused_up = 0;
+	int nacquired = 0;
 	bool acquired_new = false;
 
 	/* lock page, fill heaptup */
@@ -913,19 +1651,37 @@ bdr_sequencer_fill_sequence(Oid seqoid, char *seqschema, char *seqname)
 		if (curval->next_value == curval->end_value)
 		{
 			if (curval->end_value > 0)
+			{
 				elog(DEBUG1, "sequence %s.%s: used up old chunk",
 					 seqschema, seqname);
+				nused_up++;
+			}
 
 			elog(DEBUG2, "sequence %s.%s: needs new batch %i",
 				 seqschema, seqname, i);
 			if (bdr_sequencer_fill_chunk(seqoid, seqschema, seqname, curval))
+			{
 				acquired_new = true;
+				nacquired++;
+			}
 			else
 				break;
 		}
 		curval++;
 	}
 
+	/* account, and remember that the sequence still exists */
+	stats = bdr_sequence_stats_acquire(seqoid, true);
+	if (stats != NULL)
+	{
+		SpinLockAcquire(&stats->mutex);
+		stats->nchunks_used_up += nused_up;
+		stats->nchunks_acquired += nacquired;
+		stats->round = bdr_seq_stats_round;
+		SpinLockRelease(&stats->mutex);
+		LWLockRelease(BdrSequencerCtl->stats_lock);
+	}
+
 	if (!acquired_new)
 		goto done_with_sequence;
 
@@ -976,34 +1732,45 @@ done_with_sequence:
 }
 
 /*
- * Check whether all BDR sequences have enough values inline. If not, add
- * some. This should be called after tallying (so we have a better chance to
- * have enough chunks) but before starting new elections since we might use up
- * existing chunks.
+ * Check whether all BDR sequences (or the ones bdr_sequencer_round() has been
+ * asked to look at) have enough values inline. If not, add some. This should
+ * be called after tallying (so we have a better chance to have enough chunks)
+ * but before starting new elections since we might use up existing chunks.
  */
 void
 bdr_sequencer_fill_sequences(void)
 {
 	static SPIPlanPtr plan;
 	Portal		cursor;
+	Oid			argtypes[1];
+	Datum		values[1];
+	char		nulls[1];
+	bool		all = seq_dirty_all;
 	int			total = 0;
 
+	bdr_seq_stats_round++;
+
 	StartTransactionCommand();
 	SPI_connect();
 
 	bdr_sequencer_lock();
 	PushActiveSnapshot(GetTransactionSnapshot());
 
+	bdr_sequencer_load_node_seq_id();
+
+	argtypes[0] = OIDARRAYOID;
+	values[0] = bdr_sequencer_dirty_array(&nulls[0]);
+
 	if (plan == NULL)
 	{
-		plan = SPI_prepare(fill_sequences_sql, 0, NULL);
+		plan = SPI_prepare(fill_sequences_sql, 1, argtypes);
 		SPI_keepplan(plan);
 	}
 
 	SetCurrentStatementStartTimestamp();
 	pgstat_report_activity(STATE_RUNNING, "fill_sequences");
 
-	cursor = SPI_cursor_open("seq", plan, NULL, NULL, 0);
+	cursor = SPI_cursor_open("seq", plan, values, nulls, 0);
 
 	SPI_cursor_fetch(cursor, true, 1);
 
@@ -1036,13 +1803,173 @@ bdr_sequencer_fill_sequences(void)
 	CommitTransactionCommand();
 	pgstat_report_stat(false);
 
+	/* only a full round sees all sequences that still exist */
+	if (all)
+		bdr_sequence_stats_prune(bdr_seq_stats_round);
+
 	elog(DEBUG1, "checked %d sequences for filling", total);
 }
 
 
+/*
+ * Generate the next value of a timeshard sequence, guaranteed to be bigger
+ * than min_value.
+ *
+ * The millisecond and counter are shared by all timeshard sequences of the
+ * database, so values are unique across sequences and monotonically
+ * increasing even when the clock goes backwards. If the counter overflows
+ * within a millisecond, we borrow the next one.
+ */
+static int64
+bdr_timeshard_nextval(Relation seqrel, int64 min_value)
+{
+	BdrSequencerSlot *slot = bdr_sequencer_find_slot();
+	int64		now_ms;
+	int64		min_ms;
+	int64		ms;
+	int32		counter;
+	int32		node_seq_id = 0;
+
+	if (slot != NULL)
+	{
+		SpinLockAcquire(&slot->mutex);
+		node_seq_id = slot->node_seq_id;
+		SpinLockRelease(&slot->mutex);
+	}
+
+	if (node_seq_id > BDR_TIMESHARD_MAX_NODE)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("global sequence %s.%s cannot be used on this node",
+						get_namespace_name(RelationGetNamespace(seqrel)),
+						RelationGetRelationName(seqrel)),
+				 errdetail("The local node's node_seq_id %d is too large.",
+						   node_seq_id),
+				 errhint("Timeshard sequences can only be used on the first %d nodes that joined the BDR group.",
+						 BDR_TIMESHARD_MAX_NODE)));
+
+	/*
+	 * Ids are assigned when joining, or by the extension update for nodes
+	 * that joined before, and the sequencer loads them at its next round.
+	 */
+	if (node_seq_id <= 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("global sequence %s.%s is not initialized yet",
+						get_namespace_name(RelationGetNamespace(seqrel)),
+						RelationGetRelationName(seqrel)),
+				 errdetail("The local node has no node_seq_id in bdr.bdr_nodes yet."),
+				 errhint("Wait for the node to finish joining, or for the bdr extension to be updated on it.")));
+
+	now_ms = GetCurrentIntegerTimestamp() / 1000 - BDR_TIMESHARD_EPOCH_MS;
+	min_ms = Max(min_value, 0) >> BDR_TIMESHARD_TIMESTAMP_SHIFT;
+
+	SpinLockAcquire(&slot->mutex);
+	ms = Max(now_ms, slot->timeshard_ms);
+	if (ms == slot->timeshard_ms)
+		counter = slot->timeshard_counter + 1;
+	else
+		counter = 0;
+
+	if (counter > BDR_TIMESHARD_MAX_COUNTER)
+	{
+		ms++;
+		counter = 0;
+	}
+
+	/* after a crash we may only continue after the WAL-logged value */
+	if (BDR_TIMESHARD_MAKE_VALUE(ms, node_seq_id, counter) <= min_value)
+	{
+		ms = min_ms + 1;
+		counter = 0;
+	}
+
+	slot->timeshard_ms = ms;
+	slot->timeshard_counter = counter;
+	SpinLockRelease(&slot->mutex);
+
+	if (ms < 0 || ms > BDR_TIMESHARD_MAX_MS)
+		ereport(ERROR,
+				(errcode(ERRCODE_SEQUENCE_GENERATOR_LIMIT_EXCEEDED),
+				 errmsg("current time is out of range for timeshard global sequence %s.%s",
+						get_namespace_name(RelationGetNamespace(seqrel)),
+						RelationGetRelationName(seqrel))));
+
+	return BDR_TIMESHARD_MAKE_VALUE(ms, node_seq_id, counter);
+}
+
+/*
+ * nextval() of a timeshard sequence.
+ *
+ * No chunks are needed, so values can be generated without ever waiting for
+ * other nodes. For crash safety the sequence tuple is WAL-logged with a value
+ * BDR_TIMESHARD_LOG_MS ahead of the one handed out, similar to what
+ * SEQ_LOG_VALS does for normal sequences. The in-buffer tuple's log_cnt holds
+ * the value up to which we've logged; after crash recovery it's 0, and
+ * last_value is the logged value, which we then skip past.
+ */
+static void
+bdr_sequence_alloc_timeshard(Relation seqrel, SeqTable elm, Buffer buf,
+							 HeapTuple seqtuple)
+{
+	Page		page = BufferGetPage(buf);
+	Form_pg_sequence seq = (Form_pg_sequence) GETSTRUCT(seqtuple);
+	int64		result;
+	int64		logged = 0;
+	bool		logit = false;
+
+	result = bdr_timeshard_nextval(seqrel, seq->last_value);
+
+	if (!seq->is_called || result > seq->log_cnt ||
+		PageGetLSN(page) <= GetRedoRecPtr())
+	{
+		logit = true;
+		logged = result +
+			((int64) BDR_TIMESHARD_LOG_MS << BDR_TIMESHARD_TIMESTAMP_SHIFT);
+	}
+
+	elm->last = result;
+	elm->cached = result;
+	elm->last_valid = true;
+
+	/* ready to change the on-disk (or really, in-buffer) tuple */
+	START_CRIT_SECTION();
+
+	MarkBufferDirty(buf);
+
+	if (logit)
+	{
+		seq->last_value = logged;
+		seq->is_called = true;
+		seq->log_cnt = 0;
+		log_sequence_tuple(seqrel, seqtuple, page);
+		seq->log_cnt = logged;
+	}
+
+	/* Now update sequence tuple to the intended final state */
+	seq->last_value = result;
+	seq->is_called = true;
+
+	END_CRIT_SECTION();
+}
+
 /* check sequence.c */
 #define SEQ_LOG_VALS	32
 
+/*
+ * A sequence is running out of values, ask the sequencer to get more chunks
+ * right away. In case the sequence isn't visible to it yet, ask again at the
+ * end of the transaction.
+ */
+static void
+bdr_sequence_request_chunks(Oid seqoid)
+{
+	bdr_sequencer_request_work(BDR_SEQ_WORK_ELECT | BDR_SEQ_WORK_FILL,
+							   &seqoid, 1, false);
+	bdr_schedule_eoxact_sequencer_work(BDR_SEQ_WORK_ELECT | BDR_SEQ_WORK_FILL,
+									   seqoid);
+}
+
 PGDLLEXPORT Datum bdr_sequence_alloc(PG_FUNCTION_ARGS);
 
 PG_FUNCTION_INFO_V1(bdr_sequence_alloc);
@@ -1066,14 +1993,25 @@ bdr_sequence_alloc(PG_FUNCTION_ARGS)
 	Datum	    values;
 	bool		isnull;
 	BdrSequenceValues *curval;
+	BdrSequenceStats *stats;
+	Oid			seqoid = RelationGetRelid(seqrel);
 	int			i;
 	bool		wakeup = false;
 
+	if (BdrSequenceIsTimeshard(seqrel))
+	{
+		bdr_sequence_alloc_timeshard(seqrel, elm, buf, seqtuple);
+		PG_RETURN_VOID();
+	}
+
 	page = BufferGetPage(buf);
 	seq = (Form_pg_sequence) GETSTRUCT(seqtuple);
 
 	values = fastgetattr(seqtuple, 11, RelationGetDescr(seqrel), &isnull);
 	if (isnull)
+	{
+		bdr_sequence_request_chunks(seqoid);
+
 		ereport(ERROR,
 				(errcode(ERRCODE_T_R_SERIALIZATION_FAILURE),
 				 errmsg("global sequence %s.%s is not initialized yet",
@@ -1082,6 +2020,7 @@ bdr_sequence_alloc(PG_FUNCTION_ARGS)
 				 errhint("All nodes must agree before the sequence is usable. "
 						 "Try again soon. Check all nodes are up if the condition "
 						 "persists.")));
+	}
 
 	curval = (BdrSequenceValues *) VARDATA_ANY(DatumGetByteaP(values));
 
@@ -1146,10 +2085,21 @@ bdr_sequence_alloc(PG_FUNCTION_ARGS)
 		break;
 	}
 
+	stats = bdr_sequence_stats_acquire(seqoid, false);
+	if (stats != NULL)
+	{
+		SpinLockAcquire(&stats->mutex);
+		if (result == 0)
+			stats->nexhausted++;
+		else
+			stats->nvalues += last - result + 1;
+		SpinLockRelease(&stats->mutex);
+		LWLockRelease(BdrSequencerCtl->stats_lock);
+	}
+
 	if (result == 0)
 	{
-		bdr_sequencer_wakeup();
-		bdr_schedule_eoxact_sequencer_wakeup();
+		bdr_sequence_request_chunks(seqoid);
 
 		ereport(ERROR,
 				(errcode(ERRCODE_T_R_SERIALIZATION_FAILURE),
@@ -1161,10 +2111,7 @@ bdr_sequence_alloc(PG_FUNCTION_ARGS)
 	}
 
 	if (wakeup)
-	{
-		bdr_sequencer_wakeup();
-		bdr_schedule_eoxact_sequencer_wakeup();
-	}
+		bdr_sequence_request_chunks(seqoid);
 
 	next = result + log - 1;
 
@@ -1209,8 +2156,11 @@ bdr_sequence_alloc(PG_FUNCTION_ARGS)
 
 	END_CRIT_SECTION();
 
-	/* schedule wakeup as soon as other xacts can see the sequence */
-	bdr_schedule_eoxact_sequencer_wakeup();
+	/*
+	 * Have the sequencer re-check the demand for chunks, as soon as other
+	 * xacts can see the sequence.
+	 */
+	bdr_schedule_eoxact_sequencer_work(BDR_SEQ_WORK_ELECT, seqoid);
 
 	PG_RETURN_VOID();
 }
@@ -1254,7 +2204,8 @@ bdr_sequence_setval(PG_FUNCTION_ARGS)
 	END_CRIT_SECTION();
 
 	/* schedule wakeup as soon as other xacts can see the seuqence */
-	bdr_schedule_eoxact_sequencer_wakeup();
+	bdr_schedule_eoxact_sequencer_work(BDR_SEQ_WORK_ELECT | BDR_SEQ_WORK_FILL,
+									   RelationGetRelid(seqrel));
 
 	PG_RETURN_VOID();
 }
@@ -1263,21 +2214,200 @@ PGDLLEXPORT Datum bdr_sequence_options(PG_FUNCTION_ARGS);
 
 PG_FUNCTION_INFO_V1(bdr_sequence_options);
 
+/*
+ * Parse the reloptions of a bdr sequence.
+ *
+ * The only option so far is "timeshard", which switches the sequence from
+ * voting on chunks to generating values locally, see
+ * bdr_sequence_alloc_timeshard().
+ */
 Datum
 bdr_sequence_options(PG_FUNCTION_ARGS)
 {
 	Datum       reloptions = PG_GETARG_DATUM(0);
 	bool        validate = PG_GETARG_BOOL(1);
-	bytea      *result;
+	relopt_value *options;
+	BdrSequenceOptions *rdopts;
+	int			numoptions;
+	static const relopt_parse_elt tab[] = {
+		{"timeshard", RELOPT_TYPE_BOOL, offsetof(BdrSequenceOptions, timeshard)}
+	};
 
-	result = default_reloptions(reloptions, validate, RELOPT_KIND_SEQUENCE);
-	if (result)
-		PG_RETURN_BYTEA_P(result);
+	options = parseRelOptions(reloptions, validate, bdr_seq_relopt_kind,
+							  &numoptions);
 
-	PG_RETURN_NULL();
+	/* if none set, we're done */
+	if (numoptions == 0)
+		PG_RETURN_NULL();
 
-	/* schedule wakeup as soon as other xacts can see the seuqence */
-	bdr_schedule_eoxact_sequencer_wakeup();
+	rdopts = allocateReloptStruct(sizeof(BdrSequenceOptions), options,
+								  numoptions);
 
-	PG_RETURN_VOID();
+	fillRelOptions((void *) rdopts, sizeof(BdrSequenceOptions), options,
+				   numoptions, validate, tab, lengthof(tab));
+
+	pfree(options);
+
+	PG_RETURN_BYTEA_P(rdopts);
+}
+
+PGDLLEXPORT Datum bdr_sequence_chunk_demand(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(bdr_sequence_chunk_demand);
+
+/*
+ * Decide how many new chunks, and of which size, the sequencer should start
+ * elections for, given the number of values of the sequence not yet handed
+ * out. Called by the sequencer for every sequence, see start_elections_sql.
+ *
+ * A sequence needs new chunks once the free values wouldn't last for
+ * bdr.sequence_lookahead seconds at its current rate of consumption, or fall
+ * below BDR_SEQ_MIN_FREE_VALUES, whichever is more.
+ */
+Datum
+bdr_sequence_chunk_demand(PG_FUNCTION_ARGS)
+{
+	Oid			seqoid = PG_GETARG_OID(0);
+	int64		free_values = PG_GETARG_INT64(1);
+	TupleDesc	tupdesc;
+	Datum		values[2];
+	bool		nulls[2];
+	BdrSequenceStats *stats;
+	double		rate = 0;
+	double		target;
+	int64		chunk_size = BDR_SEQ_MIN_CHUNK_SIZE;
+	int64		nchunks = 0;
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	stats = bdr_sequence_stats_acquire(seqoid, true);
+	if (stats != NULL)
+	{
+		SpinLockAcquire(&stats->mutex);
+		bdr_sequence_stats_update_rate(stats, GetCurrentTimestamp());
+		rate = stats->rate;
+		SpinLockRelease(&stats->mutex);
+	}
+
+	target = Max(BDR_SEQ_MIN_FREE_VALUES, rate * bdr_sequence_lookahead);
+	target = Min(target, (double) BDR_SEQ_MAX_CHUNK_SIZE * BDR_SEQ_TARGET_CHUNKS);
+
+	if (free_values < (int64) target)
+	{
+		/* round up to a multiple of the minimal chunk size */
+		chunk_size = (int64) ceil(target / BDR_SEQ_TARGET_CHUNKS
+								  / BDR_SEQ_MIN_CHUNK_SIZE);
+		chunk_size *= BDR_SEQ_MIN_CHUNK_SIZE;
+
+		nchunks = ((int64) target - free_values + chunk_size - 1) / chunk_size;
+		nchunks = Min(nchunks, BDR_SEQ_MAX_CHUNKS_PER_ROUND);
+
+		/*
+		 * nchunks_requested is counted once the elections have actually been
+		 * started, start_elections_sql may not start all of them.
+		 */
+		if (stats != NULL)
+		{
+			SpinLockAcquire(&stats->mutex);
+			stats->chunk_size = chunk_size;
+			SpinLockRelease(&stats->mutex);
+		}
+
+		elog(DEBUG2, "sequence %u: " INT64_FORMAT " free values, consumed at %.0f/s, requesting " INT64_FORMAT " chunks of " INT64_FORMAT,
+			 seqoid, free_values, rate, nchunks, chunk_size);
+	}
+
+	if (stats != NULL)
+		LWLockRelease(BdrSequencerCtl->stats_lock);
+
+	memset(nulls, 0, sizeof(nulls));
+	values[0] = Int64GetDatum(chunk_size);
+	values[1] = Int32GetDatum((int32) nchunks);
+
+	PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(tupdesc, values, nulls)));
+}
+
+PGDLLEXPORT Datum bdr_get_sequence_stats(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(bdr_get_sequence_stats);
+
+/*
+ * Return chunk allocation and consumption statistics for all global
+ * sequences of the current database.
+ */
+Datum
+bdr_get_sequence_stats(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc	tupdesc;
+	Tuplestorestate *tupstore;
+	MemoryContext per_query_ctx;
+	MemoryContext oldcontext;
+	HASH_SEQ_STATUS status;
+	BdrSequenceStats *stats;
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not allowed in this context")));
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	if (tupdesc->natts != BDR_SEQ_STAT_COLS)
+		elog(ERROR, "wrong function definition");
+
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	LWLockAcquire(BdrSequencerCtl->stats_lock, LW_SHARED);
+
+	hash_seq_init(&status, BdrSequenceStatsHash);
+	while ((stats = hash_seq_search(&status)) != NULL)
+	{
+		BdrSequenceStats copy;
+		Datum		values[BDR_SEQ_STAT_COLS];
+		bool		nulls[BDR_SEQ_STAT_COLS];
+
+		if (stats->key.dboid != MyDatabaseId)
+			continue;
+
+		SpinLockAcquire(&stats->mutex);
+		memcpy(&copy, stats, sizeof(BdrSequenceStats));
+		SpinLockRelease(&stats->mutex);
+
+		memset(values, 0, sizeof(values));
+		memset(nulls, 0, sizeof(nulls));
+
+		values[0] = ObjectIdGetDatum(copy.key.seqoid);
+		values[1] = Int64GetDatumFast(copy.nvalues);
+		values[2] = Int64GetDatumFast(copy.nexhausted);
+		values[3] = Int64GetDatumFast(copy.nchunks_requested);
+		values[4] = Int64GetDatumFast(copy.nchunks_acquired);
+		values[5] = Int64GetDatumFast(copy.nchunks_used_up);
+		values[6] = Int64GetDatumFast(copy.chunk_size);
+		values[7] = Float8GetDatumFast(copy.rate);
+
+		if (copy.chunk_size == 0)
+			nulls[6] = true;
+
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+
+	LWLockRelease(BdrSequencerCtl->stats_lock);
+
+	tuplestore_donestoring(tupstore);
+
+	return (Datum) 0;
 }
@@ -0,0 +1,337 @@
+#!/usr/bin/env bash
+#
+# Global sequence benchmark
+#
+# Sets up a BDR group of several local nodes, each its own Postgres
+# instance, and has pgbench hammer nextval() on BDR global sequences on all
+# of them at once. Reports nextval()s per second, nextval() latency, how
+# often nextval() failed because a sequence wasn't initialized yet or had
+# run out of values, and how long chunk elections took from being started
+# until they were tallied.
+#
+# Knobs, all taken from the environment:
+#
+#   BDR_SEQBENCH_NODES          number of nodes, 2-5 (default 3)
+#   BDR_SEQBENCH_SEQUENCES      number of sequences nextval() is spread over
+#                               (default 1)
+#   BDR_SEQBENCH_CLIENTS        pgbench clients per node (default 4)
+#   BDR_SEQBENCH_RUNTIME        seconds to run (default 60)
+#   BDR_SEQBENCH_LOOKAHEAD      bdr.sequence_lookahead in seconds, which
+#                               determines the size of the chunks requested
+#                               (default 30)
+#   BDR_SEQBENCH_OUTAGE_NODE    node to take down during the run; no load is
+#                               run against it (default none)
+#   BDR_SEQBENCH_OUTAGE_START   seconds into the run the node goes down
+#                               (default a third of the runtime)
+#   BDR_SEQBENCH_OUTAGE_LENGTH  seconds the node stays down (default a third
+#                               of the runtime)
+#
+# Election times are sampled every 100ms, so elections finishing quicker than
+# that are not seen.
+
+#CONFIG
+DATADIR=./tmp_check_seqbench
+
+NODES="$BDR_SEQBENCH_NODES"
+if [ ! -n "$NODES" ]; then
+    NODES=3
+fi
+if [ $NODES -lt 2 ] || [ $NODES -gt 5 ]; then
+    echo "ERROR: BDR_SEQBENCH_NODES must be between 2 and 5"
+    exit 1
+fi
+
+SEQUENCES="$BDR_SEQBENCH_SEQUENCES"
+if [ ! -n "$SEQUENCES" ]; then
+    SEQUENCES=1
+fi
+
+CLIENTS="$BDR_SEQBENCH_CLIENTS"
+if [ ! -n "$CLIENTS" ]; then
+    CLIENTS=4
+fi
+
+RUNTIME="$BDR_SEQBENCH_RUNTIME"
+if [ ! -n "$RUNTIME" ]; then
+    RUNTIME=60
+fi
+
+LOOKAHEAD="$BDR_SEQBENCH_LOOKAHEAD"
+if [ ! -n "$LOOKAHEAD" ]; then
+    LOOKAHEAD=30
+fi
+
+OUTAGE_NODE="$BDR_SEQBENCH_OUTAGE_NODE"
+
+OUTAGE_START="$BDR_SEQBENCH_OUTAGE_START"
+if [ ! -n "$OUTAGE_START" ]; then
+    OUTAGE_START=$(($RUNTIME/3))
+fi
+
+OUTAGE_LENGTH="$BDR_SEQBENCH_OUTAGE_LENGTH"
+if [ ! -n "$OUTAGE_LENGTH" ]; then
+    OUTAGE_LENGTH=$(($RUNTIME/3))
+fi
+
+#INTERNAL
+TOPBUILDDIR=@top_srcdir@
+BINDIR=@bindir@
+LIBDIR=@libdir@
+MAKE=@MAKE@
+PGCONF=bdr_seqbench.conf
+HBACONF=pg_hba.conf
+HOST=localhost
+BASE_PORT=7440
+DB=bdr_seqbench
+SCRIPTDIR="$( cd "$(dirname "$0")" ; pwd -P )"
+LOG=$SCRIPTDIR/bdr_seqbench_check.log
+
+node_port () {
+	echo $(($BASE_PORT + $1))
+}
+
+node_dsn () {
+	echo "dbname=$DB host=$HOST port=$(node_port $1)"
+}
+
+node_psql () {
+	local node=$1
+	shift
+	$BINDIR/psql -X -h $HOST -p $(node_port $node) $DB "$@"
+}
+
+# print count, average, median and 99th percentile of the numbers on stdin
+summarize () {
+	sort -n | awk '
+		{ v[NR] = $1; sum += $1 }
+		END {
+			if (NR == 0) { print "n/a"; exit }
+			printf "n=%d avg=%.2f p50=%.2f p99=%.2f max=%.2f\n", NR, sum / NR,
+				v[int((NR - 1) * 0.50) + 1], v[int((NR - 1) * 0.99) + 1], v[NR]
+		}'
+}
+
+# Poll the open elections started by a node until told to stop, printing a
+# "time in ms|election id" line per open election and a "time in ms|" line
+# per sample.
+sample_elections () {
+	local node=$1
+	while [ ! -e $DATADIR/stop_sampling ]; do
+		node_psql $node -qAt -c "
+			SELECT (extract(epoch FROM now()) * 1000)::int8, NULL::int8
+			UNION ALL
+			SELECT (extract(epoch FROM now()) * 1000)::int8, e.owning_election_id
+			FROM bdr.bdr_sequence_elections e, bdr.bdr_get_local_nodeid() l
+			WHERE
+				e.open
+				AND e.owning_sysid = l.sysid
+				AND e.owning_tlid = l.timeline
+				AND e.owning_dboid = l.dboid
+				AND e.owning_riname = ''" 2>/dev/null
+		sleep 0.1
+	done
+}
+
+# Turn the output of sample_elections into how long, in ms, each election
+# was seen open.
+election_rtts () {
+	awk -F'|' '
+		function close_sample(   id) {
+			for (id in started)
+				if (!(id in current)) {
+					print ts - started[id]
+					delete started[id]
+				}
+			for (id in current)
+				if (!(id in started))
+					started[id] = ts
+			split("", current)
+		}
+		{
+			if ($1 != ts) {
+				if (ts != "")
+					close_sample()
+				ts = $1
+			}
+			if ($2 != "")
+				current[$2] = 1
+		}
+		END { if (ts != "") close_sample() }'
+}
+
+# get full paths
+mkdir -p $DATADIR
+rm -rf $DATADIR/*
+cd $DATADIR
+DATADIR=`pwd -P`
+
+BINDIR=$DATADIR/install/$BINDIR
+LIBDIR=$DATADIR/install/$LIBDIR
+
+cd $SCRIPTDIR
+
+cd $TOPBUILDDIR
+TOPBUILDDIR=`pwd -P`
+
+echo >$LOG 2>&1
+on_exit() {
+	for i in `seq 1 $NODES`; do
+		$BINDIR/pg_ctl -D $DATADIR/node$i stop -w -mfast >>$LOG 2>&1
+	done
+	echo "Error occured, check $LOG for more info"
+	exit 1
+}
+trap 'on_exit' ERR
+
+
+# install pg and contrib
+echo "Installing Postgres"
+cd $TOPBUILDDIR
+$MAKE DESTDIR="$DATADIR/install" install >>$LOG 2>&1
+echo "Installing Postgres contrib modules"
+cd contrib
+$MAKE DESTDIR="$DATADIR/install" install >>$LOG 2>&1
+
+# setup environment
+LD_LIBRARY_PATH=$LD_LIBRARY_PATH:$LIBDIR
+DYLD_LIBRARY_PATH=$DYLD_LIBRARY_PATH:$LIBDIR
+LIBPATH=$LIBPATH:$LIBDIR
+
+# create and start pg instances
+echo "Initializing $NODES Postgres instances"
+cd $SCRIPTDIR
+for i in `seq 1 $NODES`; do
+	$BINDIR/initdb -D $DATADIR/node$i >>$LOG 2>&1
+	cp $PGCONF $DATADIR/node$i/postgresql.conf
+	cp $HBACONF $DATADIR/node$i/pg_hba.conf
+	echo "port = $(node_port $i)" >> $DATADIR/node$i/postgresql.conf
+	echo "bdr.sequence_lookahead = $LOOKAHEAD" >> $DATADIR/node$i/postgresql.conf
+
+	$BINDIR/pg_ctl -D $DATADIR/node$i start -w -l $DATADIR/node$i.log >>$LOG 2>&1
+	$BINDIR/psql -X -h $HOST -p $(node_port $i) postgres -c "CREATE DATABASE $DB" >>$LOG 2>&1
+	node_psql $i -c "CREATE EXTENSION btree_gist; CREATE EXTENSION bdr;" >>$LOG 2>&1
+done
+
+# build the group
+echo "Creating BDR group"
+node_psql 1 >>$LOG 2>&1 <<SQL
+SELECT bdr.bdr_group_create(
+	local_node_name := 'node1',
+	node_external_dsn := '$(node_dsn 1)'
+	);
+SELECT bdr.bdr_node_join_wait_for_ready();
+SQL
+
+for i in `seq 2 $NODES`; do
+	echo "Joining node$i"
+	node_psql $i >>$LOG 2>&1 <<SQL
+SELECT bdr.bdr_group_join(
+	local_node_name := 'node$i',
+	node_external_dsn := '$(node_dsn $i)',
+	join_using_dsn := '$(node_dsn 1)'
+	);
+SELECT bdr.bdr_node_join_wait_for_ready();
+SQL
+done
+
+# create the sequences, and a wrapper around nextval() that logs instead of
+# erroring out, so pgbench keeps going
+echo "Creating $SEQUENCES global sequences"
+node_psql 1 >>$LOG 2>&1 <<SQL
+DO \$\$
+BEGIN
+FOR i IN 1..$SEQUENCES LOOP
+	EXECUTE 'CREATE SEQUENCE public.seqbench_' || i || ' USING bdr';
+END LOOP;
+END;\$\$;
+
+CREATE FUNCTION public.seqbench_nextval(seqno int)
+RETURNS int8 LANGUAGE plpgsql AS \$\$
+BEGIN
+	RETURN nextval(('public.seqbench_' || seqno)::regclass);
+EXCEPTION WHEN serialization_failure THEN
+	RAISE LOG 'seqbench: %', SQLERRM;
+	RETURN NULL;
+END;\$\$;
+
+SELECT pg_xlog_wait_remote_apply(pg_current_xlog_location()::text, pid) FROM pg_stat_replication;
+SQL
+
+cat > $DATADIR/seqbench.sql <<SQL
+\setrandom seqno 1 :sequences
+SELECT public.seqbench_nextval(:seqno);
+SQL
+
+# run the benchmark
+echo "Running nextval() benchmark on $NODES nodes, $SEQUENCES sequences, $CLIENTS clients per node (for $RUNTIME seconds) ..."
+
+for i in `seq 1 $NODES`; do
+	sample_elections $i > $DATADIR/node$i.elections &
+	SAMPLERPIDS="$SAMPLERPIDS $!"
+done
+
+for i in `seq 1 $NODES`; do
+	if [ "$i" = "$OUTAGE_NODE" ]; then
+		continue
+	fi
+	mkdir -p $DATADIR/bench$i
+	(cd $DATADIR/bench$i && \
+	 $BINDIR/pgbench -n -l -f $DATADIR/seqbench.sql -D sequences=$SEQUENCES \
+		-T $RUNTIME -j $CLIENTS -c $CLIENTS -h $HOST -p $(node_port $i) $DB \
+		> $DATADIR/bench$i/pgbench.out 2>&1) &
+	BENCHPIDS="$BENCHPIDS $!"
+done
+
+if [ -n "$OUTAGE_NODE" ]; then
+	sleep $OUTAGE_START
+	echo "Stopping node$OUTAGE_NODE for $OUTAGE_LENGTH seconds"
+	$BINDIR/pg_ctl -D $DATADIR/node$OUTAGE_NODE stop -w -mimmediate >>$LOG 2>&1
+	sleep $OUTAGE_LENGTH
+	echo "Restarting node$OUTAGE_NODE"
+	$BINDIR/pg_ctl -D $DATADIR/node$OUTAGE_NODE start -w -l $DATADIR/node$OUTAGE_NODE.log >>$LOG 2>&1
+fi
+
+# wait for pgbench instances to finish
+for pid in $BENCHPIDS; do
+	wait $pid
+done
+
+touch $DATADIR/stop_sampling
+for pid in $SAMPLERPIDS; do
+	wait $pid
+done
+
+# report
+echo
+echo "Results:"
+TOTAL_OK=0
+for i in `seq 1 $NODES`; do
+	NOT_INITIALIZED=$(grep -c "\[$DB\] LOG:  seqbench: global sequence .* is not initialized yet" $DATADIR/node$i.log || true)
+	NO_FREE_VALUE=$(grep -c "\[$DB\] LOG:  seqbench: could not find free sequence value" $DATADIR/node$i.log || true)
+
+	echo "node$i:"
+	if [ "$i" = "$OUTAGE_NODE" ]; then
+		echo "  (taken down after $OUTAGE_START seconds for $OUTAGE_LENGTH seconds, no load)"
+	else
+		CALLS=$(cat $DATADIR/bench$i/pgbench_log.* | wc -l)
+		OK=$(($CALLS - $NOT_INITIALIZED - $NO_FREE_VALUE))
+		TOTAL_OK=$(($TOTAL_OK + $OK))
+		echo "  nextval/s:        $(($OK / $RUNTIME))"
+		echo "  latency (ms):     $(awk '{ print $3 / 1000.0 }' $DATADIR/bench$i/pgbench_log.* | summarize)"
+	fi
+	echo "  not initialized:  $NOT_INITIALIZED"
+	echo "  no free value:    $NO_FREE_VALUE"
+	echo "  election rtt (ms): $(election_rtts < $DATADIR/node$i.elections | summarize)"
+done
+echo "total nextval/s:    $(($TOTAL_OK / $RUNTIME))"
+echo
+
+for i in `seq 1 $NODES`; do
+	echo "node$i sequence statistics:"
+	node_psql $i -c "SELECT * FROM bdr.bdr_sequence_stats ORDER BY sequence" 2>>$LOG
+done
+
+echo "Benchmark finished, cleaning up"
+for i in `seq 1 $NODES`; do
+	$BINDIR/pg_ctl -D $DATADIR/node$i stop -w -mfast >>$LOG 2>&1
+done
@@ -64,10 +64,18 @@ bdr_shmem_init(void)
 	/* initialize other modules that need shared memory. */
 	bdr_count_shmem_init(bdr_max_workers);
 
+	/*
+	 * Every apply worker has its own replication identifier; leave some
+	 * headroom for identifiers of nodes that are currently not connected.
+	 */
+	bdr_nodecache_shmem_init(bdr_max_workers * 2);
+
 #ifdef BUILDING_BDR
 	bdr_sequencer_shmem_init(bdr_max_databases);
 #endif
 	bdr_locks_shmem_init();
+	bdr_backpressure_shmem_init();
+	bdr_init_sync_shmem_init(bdr_max_databases);
 }
 
 /*
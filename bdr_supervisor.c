@@ -374,16 +374,18 @@ bdr_supervisor_worker_main(Datum main_arg)
 	while (!got_SIGTERM)
 	{
 		int rc;
+		long timeout;
 
 		/*
-		 * After startup the supervisor doesn't currently have anything to do,
-		 * so it can just go to sleep on its latch. It could exit after running
-		 * startup, but we're expecting to need it to do other things down the
-		 * track, so might as well keep it alive...
+		 * After startup the supervisor only has to snapshot and flush the
+		 * replication statistics periodically, so it sleeps on its latch
+		 * until that's due or it's asked to rescan the databases.
 		 */
+		timeout = Min(bdr_count_maintain(), 180000L);
+
 		rc = WaitLatch(&MyProc->procLatch,
 					   WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
-					   180000L);
+					   timeout);
 
 		ResetLatch(&MyProc->procLatch);
 
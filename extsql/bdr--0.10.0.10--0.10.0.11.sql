@@ -0,0 +1,22 @@
+SET LOCAL search_path = bdr;
+SET bdr.permit_unsafe_ddl_commands = true;
+SET bdr.skip_ddl_replication = true;
+
+-- Progress of this node's join, so an interrupted join can be resumed. Not
+-- dumped, it only means something on the joining node.
+CREATE TABLE bdr.bdr_init_checkpoints (
+    step text NOT NULL CHECK (step IN ('schema', 'table', 'data')),
+    snapshot text NOT NULL,
+    relation text,
+    part int4,
+    nparts int4,
+    rows_copied int8,
+    bytes_copied int8,
+    schema_md5 text,
+    done_at timestamptz NOT NULL DEFAULT current_timestamp
+);
+REVOKE ALL ON TABLE bdr.bdr_init_checkpoints FROM PUBLIC;
+
+RESET bdr.permit_unsafe_ddl_commands;
+RESET bdr.skip_ddl_replication;
+RESET search_path;
@@ -0,0 +1,18 @@
+SET LOCAL search_path = bdr;
+SET bdr.permit_unsafe_ddl_commands = true;
+SET bdr.skip_ddl_replication = true;
+
+-- The peers a join catches up from directly, and the position their changes
+-- are replayed from, see bdr.init_parallel_catchup.
+ALTER TABLE bdr.bdr_init_checkpoints
+    DROP CONSTRAINT bdr_init_checkpoints_step_check,
+    ADD CONSTRAINT bdr_init_checkpoints_step_check
+        CHECK (step IN ('schema', 'table', 'data', 'peer')),
+    ADD COLUMN peer_sysid text,
+    ADD COLUMN peer_timeline oid,
+    ADD COLUMN peer_dboid oid,
+    ADD COLUMN peer_lsn pg_lsn;
+
+RESET bdr.permit_unsafe_ddl_commands;
+RESET bdr.skip_ddl_replication;
+RESET search_path;
@@ -0,0 +1,51 @@
+SET LOCAL search_path = bdr;
+SET bdr.permit_unsafe_ddl_commands = true;
+SET bdr.skip_ddl_replication = true;
+
+-- adaptive global sequence chunk allocation, only if seqam is supported
+DO $DO$BEGIN
+PERFORM 1 FROM pg_catalog.pg_class WHERE relname = 'pg_seqam' AND relnamespace = 11;
+IF NOT FOUND THEN
+    RETURN;
+END IF;
+
+CREATE FUNCTION bdr.bdr_sequence_chunk_demand(
+    p_seqoid oid,
+    p_free_values int8,
+    OUT chunk_size int8,
+    OUT nchunks int4
+)
+RETURNS record
+LANGUAGE C
+VOLATILE STRICT
+AS 'MODULE_PATHNAME';
+
+REVOKE ALL ON FUNCTION bdr.bdr_sequence_chunk_demand(oid, int8) FROM PUBLIC;
+
+COMMENT ON FUNCTION bdr.bdr_sequence_chunk_demand(oid, int8) IS
+'Internal BDR function, used by the sequencer to decide how many chunks of which size to request for a global sequence';
+
+CREATE FUNCTION bdr.bdr_get_sequence_stats(
+    OUT sequence regclass,
+    OUT nr_values int8,
+    OUT nr_exhausted int8,
+    OUT nr_chunks_requested int8,
+    OUT nr_chunks_acquired int8,
+    OUT nr_chunks_used_up int8,
+    OUT chunk_size int8,
+    OUT consumption_rate float8
+)
+RETURNS SETOF record
+LANGUAGE C
+VOLATILE
+AS 'MODULE_PATHNAME';
+
+REVOKE ALL ON FUNCTION bdr.bdr_get_sequence_stats() FROM PUBLIC;
+
+CREATE VIEW bdr.bdr_sequence_stats AS SELECT * FROM bdr.bdr_get_sequence_stats();
+
+END;$DO$;
+
+RESET bdr.permit_unsafe_ddl_commands;
+RESET bdr.skip_ddl_replication;
+RESET search_path;
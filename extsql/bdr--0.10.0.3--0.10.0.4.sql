@@ -0,0 +1,42 @@
+SET LOCAL search_path = bdr;
+SET bdr.permit_unsafe_ddl_commands = true;
+SET bdr.skip_ddl_replication = true;
+
+--
+-- Small per-node number, assigned when a node joins, that timeshard global
+-- sequences embed in the values they generate.
+--
+ALTER TABLE bdr.bdr_nodes
+  ADD COLUMN node_seq_id smallint;
+
+COMMENT ON COLUMN bdr.bdr_nodes.node_seq_id IS 'Node number used by timeshard global sequences, assigned at join time';
+
+-- number the existing nodes; every node computes the same numbers from the
+-- same bdr_nodes contents, so it doesn't matter which one's update wins
+UPDATE bdr.bdr_nodes SET node_seq_id = n.node_seq_id
+FROM (
+	SELECT node_sysid, node_timeline, node_dboid,
+		ROW_NUMBER() OVER (ORDER BY node_sysid, node_timeline, node_dboid) node_seq_id
+	FROM bdr.bdr_nodes
+) n
+WHERE bdr_nodes.node_sysid = n.node_sysid
+  AND bdr_nodes.node_timeline = n.node_timeline
+  AND bdr_nodes.node_dboid = n.node_dboid;
+
+CREATE UNIQUE INDEX bdr_nodes_node_seq_id
+ON bdr.bdr_nodes(node_seq_id);
+
+CREATE FUNCTION bdr.bdr_acquire_global_ddl_lock()
+RETURNS void
+LANGUAGE C
+VOLATILE
+AS 'MODULE_PATHNAME';
+
+REVOKE ALL ON FUNCTION bdr.bdr_acquire_global_ddl_lock() FROM PUBLIC;
+
+COMMENT ON FUNCTION bdr.bdr_acquire_global_ddl_lock() IS
+'Internal BDR function, acquires the global DDL lock for the current transaction when joining nodes';
+
+RESET bdr.permit_unsafe_ddl_commands;
+RESET bdr.skip_ddl_replication;
+RESET search_path;
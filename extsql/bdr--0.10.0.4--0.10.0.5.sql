@@ -0,0 +1,22 @@
+SET LOCAL search_path = bdr;
+SET bdr.permit_unsafe_ddl_commands = true;
+SET bdr.skip_ddl_replication = true;
+
+--
+-- Receives global lock messages other nodes' perdb workers send over the
+-- control channel, bypassing the replication stream.
+--
+CREATE FUNCTION bdr.bdr_control_message(message bytea)
+RETURNS void
+LANGUAGE C
+VOLATILE STRICT
+AS 'MODULE_PATHNAME';
+
+REVOKE ALL ON FUNCTION bdr.bdr_control_message(bytea) FROM PUBLIC;
+
+COMMENT ON FUNCTION bdr.bdr_control_message(bytea) IS
+'Internal BDR function, receives global lock messages sent directly by other nodes';
+
+RESET bdr.permit_unsafe_ddl_commands;
+RESET bdr.skip_ddl_replication;
+RESET search_path;
@@ -0,0 +1,26 @@
+SET LOCAL search_path = bdr;
+SET bdr.permit_unsafe_ddl_commands = true;
+SET bdr.skip_ddl_replication = true;
+
+CREATE FUNCTION bdr.bdr_get_global_lock_wait_stats(
+    OUT wait_type text,
+    OUT nr_waits int8,
+    OUT total_wait_time float8,
+    OUT max_wait_time float8,
+    OUT wait_time_histogram int8[]
+)
+RETURNS SETOF record
+LANGUAGE C
+VOLATILE
+AS 'MODULE_PATHNAME';
+
+REVOKE ALL ON FUNCTION bdr.bdr_get_global_lock_wait_stats() FROM PUBLIC;
+
+COMMENT ON FUNCTION bdr.bdr_get_global_lock_wait_stats() IS
+'How often and how long (in milliseconds) backends of the current database were blocked by global locking. The histogram counts waits shorter than 1ms, 10ms, 100ms, 1s, 10s, and longer.';
+
+CREATE VIEW bdr.bdr_global_lock_wait_stats AS SELECT * FROM bdr.bdr_get_global_lock_wait_stats();
+
+RESET bdr.permit_unsafe_ddl_commands;
+RESET bdr.skip_ddl_replication;
+RESET search_path;
@@ -0,0 +1,66 @@
+SET LOCAL search_path = bdr;
+SET bdr.permit_unsafe_ddl_commands = true;
+SET bdr.skip_ddl_replication = true;
+
+CREATE FUNCTION bdr.bdr_get_apply_stats(
+    OUT rep_node_id oid,
+    OUT riremoteid text,
+    OUT nr_commit int8,
+    OUT nr_rollback int8,
+    OUT nr_insert int8,
+    OUT nr_update int8,
+    OUT nr_delete int8,
+    OUT nr_insert_conflict int8,
+    OUT nr_update_conflict int8,
+    OUT nr_delete_conflict int8,
+    OUT nr_conflict_insert_insert int8,
+    OUT nr_conflict_insert_update int8,
+    OUT nr_conflict_update_update int8,
+    OUT nr_conflict_update_delete int8,
+    OUT nr_conflict_delete_delete int8,
+    OUT nr_conflict_unhandled_tx_abort int8,
+    OUT nr_bytes_in int8,
+    OUT apply_time float8,
+    OUT nr_disconnect int8,
+    OUT nr_xact_out int8,
+    OUT nr_bytes_out int8
+)
+RETURNS SETOF record
+LANGUAGE C
+VOLATILE
+AS 'MODULE_PATHNAME';
+
+REVOKE ALL ON FUNCTION bdr.bdr_get_apply_stats() FROM PUBLIC;
+
+CREATE VIEW bdr.bdr_apply_stats AS SELECT * FROM bdr.bdr_get_apply_stats();
+
+CREATE FUNCTION bdr.bdr_get_relation_stats(
+    OUT rep_node_id oid,
+    OUT relid regclass,
+    OUT nr_insert int8,
+    OUT nr_update int8,
+    OUT nr_delete int8,
+    OUT nr_insert_conflict int8,
+    OUT nr_update_conflict int8,
+    OUT nr_delete_conflict int8,
+    OUT nr_conflict_insert_insert int8,
+    OUT nr_conflict_insert_update int8,
+    OUT nr_conflict_update_update int8,
+    OUT nr_conflict_update_delete int8,
+    OUT nr_conflict_delete_delete int8,
+    OUT nr_conflict_unhandled_tx_abort int8,
+    OUT nr_bytes_in int8,
+    OUT apply_time float8
+)
+RETURNS SETOF record
+LANGUAGE C
+VOLATILE
+AS 'MODULE_PATHNAME';
+
+REVOKE ALL ON FUNCTION bdr.bdr_get_relation_stats() FROM PUBLIC;
+
+CREATE VIEW bdr.bdr_relation_stats AS SELECT * FROM bdr.bdr_get_relation_stats();
+
+RESET bdr.permit_unsafe_ddl_commands;
+RESET bdr.skip_ddl_replication;
+RESET search_path;
@@ -0,0 +1,36 @@
+SET LOCAL search_path = bdr;
+SET bdr.permit_unsafe_ddl_commands = true;
+SET bdr.skip_ddl_replication = true;
+
+CREATE FUNCTION bdr.bdr_get_apply_rates(
+    period interval DEFAULT '1 minute',
+    OUT rep_node_id oid,
+    OUT riremoteid text,
+    OUT window_start timestamptz,
+    OUT window_end timestamptz,
+    OUT commits_per_sec float8,
+    OUT rollbacks_per_sec float8,
+    OUT inserts_per_sec float8,
+    OUT updates_per_sec float8,
+    OUT deletes_per_sec float8,
+    OUT conflicts_per_sec float8,
+    OUT bytes_in_per_sec float8,
+    OUT xacts_out_per_sec float8,
+    OUT bytes_out_per_sec float8,
+    OUT apply_busy float8
+)
+RETURNS SETOF record
+LANGUAGE C
+VOLATILE STRICT
+AS 'MODULE_PATHNAME';
+
+REVOKE ALL ON FUNCTION bdr.bdr_get_apply_rates(interval) FROM PUBLIC;
+
+COMMENT ON FUNCTION bdr.bdr_get_apply_rates(interval) IS
+'Per-second replication rates for each peer node over the given period, based on periodic snapshots of the statistics';
+
+CREATE VIEW bdr.bdr_apply_rates AS SELECT * FROM bdr.bdr_get_apply_rates();
+
+RESET bdr.permit_unsafe_ddl_commands;
+RESET bdr.skip_ddl_replication;
+RESET search_path;
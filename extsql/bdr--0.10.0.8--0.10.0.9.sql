@@ -0,0 +1,27 @@
+SET LOCAL search_path = bdr;
+SET bdr.permit_unsafe_ddl_commands = true;
+SET bdr.skip_ddl_replication = true;
+
+CREATE FUNCTION bdr.bdr_get_replication_lag(
+    OUT rep_node_id oid,
+    OUT riremoteid text,
+    OUT last_remote_time timestamptz,
+    OUT last_apply_time timestamptz,
+    OUT current_lag float8,
+    OUT avg_lag float8,
+    OUT max_lag float8,
+    OUT nr_commits int8,
+    OUT lag_histogram int8[]
+)
+RETURNS SETOF record
+LANGUAGE C
+VOLATILE
+AS 'MODULE_PATHNAME';
+
+REVOKE ALL ON FUNCTION bdr.bdr_get_replication_lag() FROM PUBLIC;
+
+CREATE VIEW bdr.bdr_replication_lag AS SELECT * FROM bdr.bdr_get_replication_lag();
+
+RESET bdr.permit_unsafe_ddl_commands;
+RESET bdr.skip_ddl_replication;
+RESET search_path;
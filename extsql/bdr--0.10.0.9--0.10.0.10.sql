@@ -0,0 +1,54 @@
+SET LOCAL search_path = bdr;
+SET bdr.permit_unsafe_ddl_commands = true;
+SET bdr.skip_ddl_replication = true;
+
+CREATE FUNCTION bdr.bdr_get_init_progress(
+    OUT dboid oid,
+    OUT pid int4,
+    OUT phase text,
+    OUT started timestamptz,
+    OUT tables_total int4,
+    OUT tables_done int4,
+    OUT size_total int8,
+    OUT size_done int8,
+    OUT rows_copied int8,
+    OUT bytes_copied int8,
+    OUT estimated_remaining interval
+)
+RETURNS SETOF record
+LANGUAGE C
+VOLATILE
+AS 'MODULE_PATHNAME';
+
+REVOKE ALL ON FUNCTION bdr.bdr_get_init_progress() FROM PUBLIC;
+
+CREATE VIEW bdr.bdr_init_progress AS
+SELECT d.datname, p.*
+FROM bdr.bdr_get_init_progress() p
+LEFT JOIN pg_catalog.pg_database d ON (d.oid = p.dboid);
+
+CREATE FUNCTION bdr.bdr_get_init_table_progress(
+    OUT dboid oid,
+    OUT pid int4,
+    OUT relation text,
+    OUT binary_format boolean,
+    OUT relation_size int8,
+    OUT rows_copied int8,
+    OUT bytes_copied int8,
+    OUT started timestamptz
+)
+RETURNS SETOF record
+LANGUAGE C
+VOLATILE
+AS 'MODULE_PATHNAME';
+
+REVOKE ALL ON FUNCTION bdr.bdr_get_init_table_progress() FROM PUBLIC;
+
+CREATE VIEW bdr.bdr_init_table_progress AS
+SELECT d.datname, p.*
+FROM bdr.bdr_get_init_table_progress() p
+LEFT JOIN pg_catalog.pg_database d ON (d.oid = p.dboid);
+
+RESET bdr.permit_unsafe_ddl_commands;
+RESET bdr.skip_ddl_replication;
+RESET search_path;
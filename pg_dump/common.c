@@ -28,20 +28,30 @@ static DumpableObject **dumpIdMap = NULL;
 static int	allocedDumpIds = 0;
 static DumpId lastDumpId = 0;
 
+/*
+ * Hash table of DumpableObjects, keyed by OID.  It uses open addressing with
+ * linear probing; the number of slots is a power of 2, at least twice the
+ * number of objects, so probe sequences stay short.  Lookups take constant
+ * time however many objects there are, which matters for databases with
+ * hundreds of thousands of tables.
+ */
+typedef struct
+{
+	DumpableObject **slots;		/* NULL for unused slots */
+	uint32		mask;			/* number of slots - 1 */
+} ObjectIndex;
+
 /*
  * Variables for mapping CatalogId to DumpableObject
  */
 static bool catalogIdMapValid = false;
-static DumpableObject **catalogIdMap = NULL;
-static int	numCatalogIds = 0;
+static ObjectIndex catalogIdMap = {NULL, 0};
 
 /*
  * These variables are static to avoid the notational cruft of having to pass
  * them into findTableByOid() and friends.  For each of these arrays, we
- * build a sorted-by-OID index array immediately after it's built, and then
- * we use binary search in findTableByOid() and friends.  (qsort'ing the base
- * arrays themselves would be simpler, but it doesn't work because pg_dump.c
- * may have already established pointers between items.)
+ * build a hash index on OID immediately after it's built, and then use it in
+ * findTableByOid() and friends.
  */
 static TableInfo *tblinfo;
 static TypeInfo *typinfo;
@@ -54,21 +64,24 @@ static int	numFuncs;
 static int	numOperators;
 static int	numCollations;
 static int	numNamespaces;
-static DumpableObject **tblinfoindex;
-static DumpableObject **typinfoindex;
-static DumpableObject **funinfoindex;
-static DumpableObject **oprinfoindex;
-static DumpableObject **collinfoindex;
-static DumpableObject **nspinfoindex;
+static ObjectIndex tblinfoindex;
+static ObjectIndex typinfoindex;
+static ObjectIndex funinfoindex;
+static ObjectIndex oprinfoindex;
+static ObjectIndex collinfoindex;
+static ObjectIndex nspinfoindex;
 
 
 static void flagInhTables(TableInfo *tbinfo, int numTables,
 			  InhInfo *inhinfo, int numInherits);
 static void flagInhAttrs(TableInfo *tblinfo, int numTables);
-static DumpableObject **buildIndexArray(void *objArray, int numObjs,
+static void buildIndexArray(ObjectIndex *index, void *objArray, int numObjs,
 				Size objSize);
-static int	DOCatalogIdCompare(const void *p1, const void *p2);
-static void findParentsByOid(TableInfo *self,
+static void buildObjectIndex(ObjectIndex *index, DumpableObject **objs,
+				 int numObjs);
+static DumpableObject *lookupObjectIndex(ObjectIndex *index,
+				  CatalogId catalogId, bool matchTableoid);
+static void findParentsByOid(TableInfo *tblinfo, int numTables,
 				 InhInfo *inhinfo, int numInherits);
 static int	strInArray(const char *pattern, char **arr, int arr_size);
 
@@ -104,7 +117,7 @@ getSchemaData(Archive *fout, int *numTablesPtr)
 	if (g_verbose)
 		write_msg(NULL, "reading schemas\n");
 	nspinfo = getNamespaces(fout, &numNamespaces);
-	nspinfoindex = buildIndexArray(nspinfo, numNamespaces, sizeof(NamespaceInfo));
+	buildIndexArray(&nspinfoindex, nspinfo, numNamespaces, sizeof(NamespaceInfo));
 
 	/*
 	 * getTables should be done as soon as possible, so as to minimize the
@@ -115,7 +128,7 @@ getSchemaData(Archive *fout, int *numTablesPtr)
 	if (g_verbose)
 		write_msg(NULL, "reading user-defined tables\n");
 	tblinfo = getTables(fout, &numTables);
-	tblinfoindex = buildIndexArray(tblinfo, numTables, sizeof(TableInfo));
+	buildIndexArray(&tblinfoindex, tblinfo, numTables, sizeof(TableInfo));
 
 	/* Do this after we've built tblinfoindex */
 	getOwnedSeqs(fout, tblinfo, numTables);
@@ -127,13 +140,13 @@ getSchemaData(Archive *fout, int *numTablesPtr)
 	if (g_verbose)
 		write_msg(NULL, "reading user-defined functions\n");
 	funinfo = getFuncs(fout, &numFuncs);
-	funinfoindex = buildIndexArray(funinfo, numFuncs, sizeof(FuncInfo));
+	buildIndexArray(&funinfoindex, funinfo, numFuncs, sizeof(FuncInfo));
 
 	/* this must be after getTables and getFuncs */
 	if (g_verbose)
 		write_msg(NULL, "reading user-defined types\n");
 	typinfo = getTypes(fout, &numTypes);
-	typinfoindex = buildIndexArray(typinfo, numTypes, sizeof(TypeInfo));
+	buildIndexArray(&typinfoindex, typinfo, numTypes, sizeof(TypeInfo));
 
 	/* this must be after getFuncs, too */
 	if (g_verbose)
@@ -147,7 +160,7 @@ getSchemaData(Archive *fout, int *numTablesPtr)
 	if (g_verbose)
 		write_msg(NULL, "reading user-defined operators\n");
 	oprinfo = getOperators(fout, &numOperators);
-	oprinfoindex = buildIndexArray(oprinfo, numOperators, sizeof(OprInfo));
+	buildIndexArray(&oprinfoindex, oprinfo, numOperators, sizeof(OprInfo));
 
 	if (g_verbose)
 		write_msg(NULL, "reading user-defined operator classes\n");
@@ -188,7 +201,7 @@ getSchemaData(Archive *fout, int *numTablesPtr)
 	if (g_verbose)
 		write_msg(NULL, "reading user-defined collations\n");
 	collinfo = getCollations(fout, &numCollations);
-	collinfoindex = buildIndexArray(collinfo, numCollations, sizeof(CollInfo));
+	buildIndexArray(&collinfoindex, collinfo, numCollations, sizeof(CollInfo));
 
 	if (g_verbose)
 		write_msg(NULL, "reading user-defined conversions\n");
@@ -267,6 +280,9 @@ flagInhTables(TableInfo *tblinfo, int numTables,
 	int			numParents;
 	TableInfo **parents;
 
+	/* Find all the immediate parent tables */
+	findParentsByOid(tblinfo, numTables, inhinfo, numInherits);
+
 	for (i = 0; i < numTables; i++)
 	{
 		/* Some kinds never have parents */
@@ -279,9 +295,6 @@ flagInhTables(TableInfo *tblinfo, int numTables,
 		if (!tblinfo[i].dobj.dump)
 			continue;
 
-		/* Find all the immediate parent tables */
-		findParentsByOid(&tblinfo[i], inhinfo, numInherits);
-
 		/* Mark the parents as interesting for getTableAttrs */
 		numParents = tblinfo[i].numParents;
 		parents = tblinfo[i].parents;
@@ -485,102 +498,55 @@ findObjectByDumpId(DumpId dumpId)
  *
  * Returns NULL for unknown ID
  *
- * We use binary search in a sorted list that is built on first call.
+ * We use a hash index that is built on first call.
  * If AssignDumpId() and findObjectByCatalogId() calls were freely intermixed,
  * the code would work, but possibly be very slow.  In the current usage
- * pattern that does not happen, indeed we build the list at most twice.
+ * pattern that does not happen, indeed we build the index at most twice.
  */
 DumpableObject *
 findObjectByCatalogId(CatalogId catalogId)
 {
-	DumpableObject **low;
-	DumpableObject **high;
-
 	if (!catalogIdMapValid)
 	{
-		if (catalogIdMap)
-			free(catalogIdMap);
-		getDumpableObjects(&catalogIdMap, &numCatalogIds);
-		if (numCatalogIds > 1)
-			qsort((void *) catalogIdMap, numCatalogIds,
-				  sizeof(DumpableObject *), DOCatalogIdCompare);
+		DumpableObject **objs;
+		int			numObjs;
+
+		if (catalogIdMap.slots)
+			free(catalogIdMap.slots);
+		getDumpableObjects(&objs, &numObjs);
+		buildObjectIndex(&catalogIdMap, objs, numObjs);
+		free(objs);
 		catalogIdMapValid = true;
 	}
 
-	/*
-	 * We could use bsearch() here, but the notational cruft of calling
-	 * bsearch is nearly as bad as doing it ourselves; and the generalized
-	 * bsearch function is noticeably slower as well.
-	 */
-	if (numCatalogIds <= 0)
-		return NULL;
-	low = catalogIdMap;
-	high = catalogIdMap + (numCatalogIds - 1);
-	while (low <= high)
-	{
-		DumpableObject **middle;
-		int			difference;
-
-		middle = low + (high - low) / 2;
-		/* comparison must match DOCatalogIdCompare, below */
-		difference = oidcmp((*middle)->catId.oid, catalogId.oid);
-		if (difference == 0)
-			difference = oidcmp((*middle)->catId.tableoid, catalogId.tableoid);
-		if (difference == 0)
-			return *middle;
-		else if (difference < 0)
-			low = middle + 1;
-		else
-			high = middle - 1;
-	}
-	return NULL;
+	return lookupObjectIndex(&catalogIdMap, catalogId, true);
 }
 
 /*
- * Find a DumpableObject by OID, in a pre-sorted array of one type of object
+ * Find a DumpableObject by OID, in the index of one type of object
  *
  * Returns NULL for unknown OID
  */
 static DumpableObject *
-findObjectByOid(Oid oid, DumpableObject **indexArray, int numObjs)
+findObjectByOid(Oid oid, ObjectIndex *index)
 {
-	DumpableObject **low;
-	DumpableObject **high;
+	CatalogId	catalogId;
 
 	/*
-	 * This is the same as findObjectByCatalogId except we assume we need not
-	 * look at table OID because the objects are all the same type.
-	 *
-	 * We could use bsearch() here, but the notational cruft of calling
-	 * bsearch is nearly as bad as doing it ourselves; and the generalized
-	 * bsearch function is noticeably slower as well.
+	 * This is the same as findObjectByCatalogId except we need not look at
+	 * table OID because the objects are all the same type.
 	 */
-	if (numObjs <= 0)
-		return NULL;
-	low = indexArray;
-	high = indexArray + (numObjs - 1);
-	while (low <= high)
-	{
-		DumpableObject **middle;
-		int			difference;
-
-		middle = low + (high - low) / 2;
-		difference = oidcmp((*middle)->catId.oid, oid);
-		if (difference == 0)
-			return *middle;
-		else if (difference < 0)
-			low = middle + 1;
-		else
-			high = middle - 1;
-	}
-	return NULL;
+	catalogId.tableoid = InvalidOid;
+	catalogId.oid = oid;
+
+	return lookupObjectIndex(index, catalogId, false);
 }
 
 /*
- * Build an index array of DumpableObject pointers, sorted by OID
+ * Build a hash index on OID of an array of objects
  */
-static DumpableObject **
-buildIndexArray(void *objArray, int numObjs, Size objSize)
+static void
+buildIndexArray(ObjectIndex *index, void *objArray, int numObjs, Size objSize)
 {
 	DumpableObject **ptrs;
 	int			i;
@@ -589,32 +555,74 @@ buildIndexArray(void *objArray, int numObjs, Size objSize)
 	for (i = 0; i < numObjs; i++)
 		ptrs[i] = (DumpableObject *) ((char *) objArray + i * objSize);
 
-	/* We can use DOCatalogIdCompare to sort since its first key is OID */
-	if (numObjs > 1)
-		qsort((void *) ptrs, numObjs, sizeof(DumpableObject *),
-			  DOCatalogIdCompare);
+	buildObjectIndex(index, ptrs, numObjs);
 
-	return ptrs;
+	free(ptrs);
 }
 
 /*
- * qsort comparator for pointers to DumpableObjects
+ * Hash an OID for ObjectIndex.  OIDs are mostly consecutive, so mix the
+ * bits rather than using the OID itself.
  */
-static int
-DOCatalogIdCompare(const void *p1, const void *p2)
+static uint32
+hashObjectOid(Oid oid)
 {
-	const DumpableObject *obj1 = *(DumpableObject *const *) p1;
-	const DumpableObject *obj2 = *(DumpableObject *const *) p2;
-	int			cmpval;
+	uint32		h = (uint32) oid * 0x9E3779B1;
 
-	/*
-	 * Compare OID first since it's usually unique, whereas there will only be
-	 * a few distinct values of tableoid.
-	 */
-	cmpval = oidcmp(obj1->catId.oid, obj2->catId.oid);
-	if (cmpval == 0)
-		cmpval = oidcmp(obj1->catId.tableoid, obj2->catId.tableoid);
-	return cmpval;
+	return h ^ (h >> 16);
+}
+
+/*
+ * Build a hash index on OID of the given objects
+ */
+static void
+buildObjectIndex(ObjectIndex *index, DumpableObject **objs, int numObjs)
+{
+	uint32		nslots = 16;
+	int			i;
+
+	while (nslots < (uint32) numObjs * 2)
+		nslots *= 2;
+
+	index->slots = (DumpableObject **)
+		pg_malloc0(nslots * sizeof(DumpableObject *));
+	index->mask = nslots - 1;
+
+	for (i = 0; i < numObjs; i++)
+	{
+		uint32		slot = hashObjectOid(objs[i]->catId.oid) & index->mask;
+
+		while (index->slots[slot] != NULL)
+			slot = (slot + 1) & index->mask;
+		index->slots[slot] = objs[i];
+	}
+}
+
+/*
+ * Look up an object in a hash index built by buildObjectIndex()
+ *
+ * If matchTableoid is false, only the OID of catalogId is compared.
+ * Returns NULL if there is no such object.
+ */
+static DumpableObject *
+lookupObjectIndex(ObjectIndex *index, CatalogId catalogId, bool matchTableoid)
+{
+	uint32		slot;
+
+	if (index->slots == NULL)
+		return NULL;
+
+	slot = hashObjectOid(catalogId.oid) & index->mask;
+	while (index->slots[slot] != NULL)
+	{
+		DumpableObject *obj = index->slots[slot];
+
+		if (obj->catId.oid == catalogId.oid &&
+			(!matchTableoid || obj->catId.tableoid == catalogId.tableoid))
+			return obj;
+		slot = (slot + 1) & index->mask;
+	}
+	return NULL;
 }
 
 /*
@@ -694,7 +702,7 @@ removeObjectDependency(DumpableObject *dobj, DumpId refId)
 TableInfo *
 findTableByOid(Oid oid)
 {
-	return (TableInfo *) findObjectByOid(oid, tblinfoindex, numTables);
+	return (TableInfo *) findObjectByOid(oid, &tblinfoindex);
 }
 
 /*
@@ -705,7 +713,7 @@ findTableByOid(Oid oid)
 TypeInfo *
 findTypeByOid(Oid oid)
 {
-	return (TypeInfo *) findObjectByOid(oid, typinfoindex, numTypes);
+	return (TypeInfo *) findObjectByOid(oid, &typinfoindex);
 }
 
 /*
@@ -716,7 +724,7 @@ findTypeByOid(Oid oid)
 FuncInfo *
 findFuncByOid(Oid oid)
 {
-	return (FuncInfo *) findObjectByOid(oid, funinfoindex, numFuncs);
+	return (FuncInfo *) findObjectByOid(oid, &funinfoindex);
 }
 
 /*
@@ -727,7 +735,7 @@ findFuncByOid(Oid oid)
 OprInfo *
 findOprByOid(Oid oid)
 {
-	return (OprInfo *) findObjectByOid(oid, oprinfoindex, numOperators);
+	return (OprInfo *) findObjectByOid(oid, &oprinfoindex);
 }
 
 /*
@@ -738,7 +746,7 @@ findOprByOid(Oid oid)
 CollInfo *
 findCollationByOid(Oid oid)
 {
-	return (CollInfo *) findObjectByOid(oid, collinfoindex, numCollations);
+	return (CollInfo *) findObjectByOid(oid, &collinfoindex);
 }
 
 /*
@@ -749,58 +757,68 @@ findCollationByOid(Oid oid)
 NamespaceInfo *
 findNamespaceByOid(Oid oid)
 {
-	return (NamespaceInfo *) findObjectByOid(oid, nspinfoindex, numNamespaces);
+	return (NamespaceInfo *) findObjectByOid(oid, &nspinfoindex);
 }
 
 
 /*
  * findParentsByOid
- *	  find a table's parents in tblinfo[]
+ *	  find the parents of all target tables in tblinfo[]
+ *
+ * This makes two passes over inhinfo[], one to count the parents of each
+ * table and one to fill them in, rather than scanning all of inhinfo[] for
+ * each table.
  */
 static void
-findParentsByOid(TableInfo *self,
+findParentsByOid(TableInfo *tblinfo, int numTables,
 				 InhInfo *inhinfo, int numInherits)
 {
-	Oid			oid = self->dobj.catId.oid;
-	int			i,
-				j;
-	int			numParents;
+	int			i;
 
-	numParents = 0;
-	for (i = 0; i < numInherits; i++)
+	for (i = 0; i < numTables; i++)
 	{
-		if (inhinfo[i].inhrelid == oid)
-			numParents++;
+		tblinfo[i].numParents = 0;
+		tblinfo[i].parents = NULL;
 	}
 
-	self->numParents = numParents;
+	for (i = 0; i < numInherits; i++)
+	{
+		TableInfo  *self = findTableByOid(inhinfo[i].inhrelid);
 
-	if (numParents > 0)
+		if (self != NULL && self->dobj.dump)
+			self->numParents++;
+	}
+
+	for (i = 0; i < numTables; i++)
 	{
-		self->parents = (TableInfo **)
-			pg_malloc(sizeof(TableInfo *) * numParents);
-		j = 0;
-		for (i = 0; i < numInherits; i++)
+		if (tblinfo[i].numParents > 0)
 		{
-			if (inhinfo[i].inhrelid == oid)
-			{
-				TableInfo  *parent;
+			tblinfo[i].parents = (TableInfo **)
+				pg_malloc(sizeof(TableInfo *) * tblinfo[i].numParents);
+			/* count up again while filling in */
+			tblinfo[i].numParents = 0;
+		}
+	}
 
-				parent = findTableByOid(inhinfo[i].inhparent);
-				if (parent == NULL)
-				{
-					write_msg(NULL, "failed sanity check, parent OID %u of table \"%s\" (OID %u) not found\n",
-							  inhinfo[i].inhparent,
-							  self->dobj.name,
-							  oid);
-					exit_nicely(1);
-				}
-				self->parents[j++] = parent;
-			}
+	for (i = 0; i < numInherits; i++)
+	{
+		TableInfo  *self = findTableByOid(inhinfo[i].inhrelid);
+		TableInfo  *parent;
+
+		if (self == NULL || !self->dobj.dump)
+			continue;
+
+		parent = findTableByOid(inhinfo[i].inhparent);
+		if (parent == NULL)
+		{
+			write_msg(NULL, "failed sanity check, parent OID %u of table \"%s\" (OID %u) not found\n",
+					  inhinfo[i].inhparent,
+					  self->dobj.name,
+					  self->dobj.catId.oid);
+			exit_nicely(1);
 		}
+		self->parents[self->numParents++] = parent;
 	}
-	else
-		self->parents = NULL;
 }
 
 /*
@@ -34,6 +34,11 @@
  *
  *	The interface is the same for compressed and uncompressed streams.
  *
+ *	If SetCompressionThreads() was called with more than one thread, zlib
+ *	streams, including the gzip files of the compressed stream API below, are
+ *	compressed in blocks by that many threads. The output is still a single
+ *	standard stream.
+ *
  * Compressed stream API
  * ----------------------
  *
@@ -56,6 +61,16 @@
 #include "pg_backup_utils.h"
 #include "parallel.h"
 
+#if defined(HAVE_LIBZ) && defined(ENABLE_THREAD_SAFETY) && !defined(WIN32)
+#define PARALLEL_COMPRESSION
+#include <pthread.h>
+
+typedef struct BlockCompressor BlockCompressor;
+
+/* number of threads compressing zlib streams, 1 means none */
+static int	compressThreads = 1;
+#endif
+
 /*----------------------
  * Compressor API
  *----------------------
@@ -72,6 +87,11 @@ struct CompressorState
 	char	   *zlibOut;
 	size_t		zlibOutSize;
 #endif
+#ifdef PARALLEL_COMPRESSION
+	/* used instead of zp if compressing in parallel */
+	BlockCompressor *bc;
+	ArchiveHandle *AH;
+#endif
 };
 
 /* translator: this is a module name */
@@ -215,18 +235,440 @@ EndCompressor(ArchiveHandle *AH, CompressorState *cs)
 	free(cs);
 }
 
+/*
+ * Set the number of threads compressing each zlib stream. Without thread
+ * support, streams are always compressed by the calling thread.
+ */
+void
+SetCompressionThreads(int nthreads)
+{
+#ifdef PARALLEL_COMPRESSION
+	compressThreads = nthreads;
+#endif
+}
+
 /* Private routines, specific to each compression method. */
 
+#ifdef PARALLEL_COMPRESSION
+/*
+ * Block-parallel zlib compression.
+ *
+ * The data is cut into blocks of BLOCK_COMPRESS_SIZE bytes that a pool of
+ * threads compresses independently into raw deflate data. Every block but
+ * the last ends with a sync flush, so it ends on a byte boundary, and the
+ * last one ends the stream. Written out in order between the usual zlib or
+ * gzip header and trailer, the blocks form a single standard stream, which
+ * ReadDataFromArchiveZlib() and gzread() read like any other. Each block
+ * starts with an empty history, which costs a little compression ratio.
+ *
+ * Only the thread calling BlockCompressorWrite() and BlockCompressorEnd()
+ * writes output, so writeF can report errors with exit_horribly() as usual.
+ */
+#define BLOCK_COMPRESS_SIZE		(128 * 1024)
+
+typedef void (*BlockWriteFunc) (void *arg, const char *buf, size_t len);
+
+typedef struct CompressBlock
+{
+	char	   *in;
+	size_t		inlen;
+	char	   *out;
+	size_t		outlen;
+	size_t		outsize;
+	uLong		check;			/* adler32 or crc32 of the input */
+	bool		last;
+	bool		done;
+	int			err;			/* zlib error code, Z_OK if none */
+} CompressBlock;
+
+struct BlockCompressor
+{
+	int			level;
+	bool		gzip;			/* gzip rather than zlib wrapper */
+	BlockWriteFunc writeF;
+	void	   *writeArg;
+
+	int			nthreads;
+	pthread_t  *threads;
+
+	/* ring of nblocks blocks, block number n is in blocks[n % nblocks] */
+	int			nblocks;
+	CompressBlock *blocks;
+
+	pthread_mutex_t lock;
+	pthread_cond_t queued;		/* a block was queued, or shutdown */
+	pthread_cond_t compressed;	/* a block is done */
+	uint64		nqueued;		/* blocks queued for compression */
+	uint64		ntaken;			/* blocks taken by a thread */
+	bool		shutdown;
+
+	/* only used by the writing thread */
+	uint64		nwritten;		/* blocks written out */
+	bool		headerWritten;
+	uLong		check;			/* adler32 or crc32 of all input */
+	uint64		totalIn;
+};
+
+/*
+ * Compress one block with the thread's raw deflate stream.
+ */
+static int
+BlockCompressOne(z_streamp zp, CompressBlock *block, bool gzip)
+{
+	int			res;
+
+	if (deflateReset(zp) != Z_OK)
+		return Z_STREAM_ERROR;
+
+	zp->next_in = (void *) block->in;
+	zp->avail_in = block->inlen;
+	zp->next_out = (void *) block->out;
+	zp->avail_out = block->outsize;
+
+	res = deflate(zp, block->last ? Z_FINISH : Z_SYNC_FLUSH);
+
+	/* the output buffer is big enough for any block */
+	if (block->last ? res != Z_STREAM_END : (res != Z_OK || zp->avail_out == 0))
+		return (res == Z_OK || res == Z_STREAM_END) ? Z_BUF_ERROR : res;
+
+	block->outlen = block->outsize - zp->avail_out;
+	if (gzip)
+		block->check = crc32(crc32(0L, Z_NULL, 0),
+							 (void *) block->in, block->inlen);
+	else
+		block->check = adler32(adler32(0L, Z_NULL, 0),
+							   (void *) block->in, block->inlen);
+
+	return Z_OK;
+}
+
+static void *
+BlockCompressorThread(void *arg)
+{
+	BlockCompressor *bc = (BlockCompressor *) arg;
+	z_stream	zs;
+	int			initres;
+
+	zs.zalloc = Z_NULL;
+	zs.zfree = Z_NULL;
+	zs.opaque = Z_NULL;
+
+	/* negative window bits for raw deflate, without zlib header */
+	initres = deflateInit2(&zs, bc->level, Z_DEFLATED, -MAX_WBITS, 8,
+						   Z_DEFAULT_STRATEGY);
+
+	for (;;)
+	{
+		CompressBlock *block;
+		int			err;
+
+		pthread_mutex_lock(&bc->lock);
+		while (!bc->shutdown && bc->ntaken == bc->nqueued)
+			pthread_cond_wait(&bc->queued, &bc->lock);
+		if (bc->ntaken == bc->nqueued)
+		{
+			pthread_mutex_unlock(&bc->lock);
+			break;
+		}
+		block = &bc->blocks[bc->ntaken % bc->nblocks];
+		bc->ntaken++;
+		pthread_mutex_unlock(&bc->lock);
+
+		if (initres == Z_OK)
+			err = BlockCompressOne(&zs, block, bc->gzip);
+		else
+			err = initres;
+
+		pthread_mutex_lock(&bc->lock);
+		block->err = err;
+		block->done = true;
+		pthread_cond_signal(&bc->compressed);
+		pthread_mutex_unlock(&bc->lock);
+	}
+
+	if (initres == Z_OK)
+		deflateEnd(&zs);
+
+	return NULL;
+}
+
+static BlockCompressor *
+BlockCompressorStart(int level, bool gzip, BlockWriteFunc writeF,
+					 void *writeArg)
+{
+	BlockCompressor *bc = pg_malloc0(sizeof(BlockCompressor));
+	int			i;
+
+	bc->level = level;
+	bc->gzip = gzip;
+	bc->writeF = writeF;
+	bc->writeArg = writeArg;
+
+	/* enough blocks to keep all threads busy while the oldest is written */
+	bc->nthreads = compressThreads;
+	bc->nblocks = 2 * compressThreads;
+	bc->blocks = pg_malloc0(bc->nblocks * sizeof(CompressBlock));
+	for (i = 0; i < bc->nblocks; i++)
+	{
+		/* room for incompressible data, the flush marker and then some */
+		bc->blocks[i].in = pg_malloc(BLOCK_COMPRESS_SIZE);
+		bc->blocks[i].outsize = compressBound(BLOCK_COMPRESS_SIZE) + 64;
+		bc->blocks[i].out = pg_malloc(bc->blocks[i].outsize);
+	}
+
+	bc->check = gzip ? crc32(0L, Z_NULL, 0) : adler32(0L, Z_NULL, 0);
+
+	pthread_mutex_init(&bc->lock, NULL);
+	pthread_cond_init(&bc->queued, NULL);
+	pthread_cond_init(&bc->compressed, NULL);
+
+	bc->threads = pg_malloc(bc->nthreads * sizeof(pthread_t));
+	for (i = 0; i < bc->nthreads; i++)
+	{
+		int			rc;
+
+		rc = pthread_create(&bc->threads[i], NULL, BlockCompressorThread, bc);
+		if (rc != 0)
+			exit_horribly(modulename, "could not create compression thread: %s\n",
+						  strerror(rc));
+	}
+
+	return bc;
+}
+
+static void
+BlockCompressorWriteHeader(BlockCompressor *bc)
+{
+	if (bc->gzip)
+	{
+		unsigned char header[10] = {0x1f, 0x8b, Z_DEFLATED, 0, 0, 0, 0, 0, 0, 3};
+
+		/* extra flags: maximum compression or fastest */
+		if (bc->level == Z_BEST_COMPRESSION)
+			header[8] = 2;
+		else if (bc->level == Z_BEST_SPEED)
+			header[8] = 4;
+
+		bc->writeF(bc->writeArg, (char *) header, sizeof(header));
+	}
+	else
+	{
+		unsigned char header[2];
+		unsigned int cmf_flg;
+		int			level_flags;
+
+		/* same as deflate() writes */
+		if (bc->level == Z_DEFAULT_COMPRESSION || bc->level == 6)
+			level_flags = 2;
+		else if (bc->level < 2)
+			level_flags = 0;
+		else if (bc->level < 6)
+			level_flags = 1;
+		else
+			level_flags = 3;
+
+		cmf_flg = (0x78 << 8) | (level_flags << 6);
+		cmf_flg += 31 - (cmf_flg % 31);
+		header[0] = (unsigned char) (cmf_flg >> 8);
+		header[1] = (unsigned char) (cmf_flg & 0xff);
+
+		bc->writeF(bc->writeArg, (char *) header, sizeof(header));
+	}
+
+	bc->headerWritten = true;
+}
+
+static void
+BlockCompressorWriteTrailer(BlockCompressor *bc)
+{
+	unsigned char trailer[8];
+	int			i;
+
+	if (bc->gzip)
+	{
+		/* crc32 and input size, least significant byte first */
+		for (i = 0; i < 4; i++)
+		{
+			trailer[i] = (unsigned char) (bc->check >> (i * 8));
+			trailer[4 + i] = (unsigned char) (bc->totalIn >> (i * 8));
+		}
+		bc->writeF(bc->writeArg, (char *) trailer, 8);
+	}
+	else
+	{
+		/* adler32, most significant byte first */
+		for (i = 0; i < 4; i++)
+			trailer[i] = (unsigned char) (bc->check >> ((3 - i) * 8));
+		bc->writeF(bc->writeArg, (char *) trailer, 4);
+	}
+}
+
+/*
+ * Write out the oldest block that's not written yet, once it's compressed.
+ * If wait is false, only do so if it is already.
+ *
+ * Returns true if a block was written.
+ */
+static bool
+BlockCompressorWriteOldest(BlockCompressor *bc, bool wait)
+{
+	CompressBlock *block;
+
+	if (bc->nwritten == bc->nqueued)
+		return false;
+
+	block = &bc->blocks[bc->nwritten % bc->nblocks];
+
+	pthread_mutex_lock(&bc->lock);
+	while (!block->done)
+	{
+		if (!wait)
+		{
+			pthread_mutex_unlock(&bc->lock);
+			return false;
+		}
+		pthread_cond_wait(&bc->compressed, &bc->lock);
+	}
+	pthread_mutex_unlock(&bc->lock);
+
+	if (block->err != Z_OK)
+		exit_horribly(modulename, "could not compress data: %s\n",
+					  zError(block->err));
+
+	if (!bc->headerWritten)
+		BlockCompressorWriteHeader(bc);
+
+	if (block->outlen > 0)
+		bc->writeF(bc->writeArg, block->out, block->outlen);
+
+	if (bc->gzip)
+		bc->check = crc32_combine(bc->check, block->check, block->inlen);
+	else
+		bc->check = adler32_combine(bc->check, block->check, block->inlen);
+	bc->totalIn += block->inlen;
+
+	block->inlen = 0;
+	block->done = false;
+	bc->nwritten++;
+
+	return true;
+}
+
+/*
+ * Hand the block being filled to the compression threads.
+ */
+static void
+BlockCompressorQueue(BlockCompressor *bc, bool last)
+{
+	CompressBlock *block = &bc->blocks[bc->nqueued % bc->nblocks];
+
+	block->last = last;
+
+	pthread_mutex_lock(&bc->lock);
+	bc->nqueued++;
+	pthread_cond_signal(&bc->queued);
+	pthread_mutex_unlock(&bc->lock);
+
+	/* write out what's ready, so the output keeps flowing */
+	while (BlockCompressorWriteOldest(bc, false))
+		;
+}
+
+static void
+BlockCompressorWrite(BlockCompressor *bc, const char *data, size_t dLen)
+{
+	while (dLen > 0)
+	{
+		CompressBlock *block;
+		size_t		n;
+
+		/* the slot of the block to fill must be written out */
+		while (bc->nqueued - bc->nwritten >= bc->nblocks)
+			BlockCompressorWriteOldest(bc, true);
+
+		block = &bc->blocks[bc->nqueued % bc->nblocks];
+		n = Min(dLen, BLOCK_COMPRESS_SIZE - block->inlen);
+		memcpy(block->in + block->inlen, data, n);
+		block->inlen += n;
+		data += n;
+		dLen -= n;
+
+		if (block->inlen == BLOCK_COMPRESS_SIZE)
+			BlockCompressorQueue(bc, false);
+	}
+}
+
+/*
+ * Compress and write out the remaining data, end the stream and stop the
+ * threads.
+ */
+static void
+BlockCompressorEnd(BlockCompressor *bc)
+{
+	int			i;
+
+	while (bc->nqueued - bc->nwritten >= bc->nblocks)
+		BlockCompressorWriteOldest(bc, true);
+
+	/* possibly empty, it has to end the stream anyway */
+	BlockCompressorQueue(bc, true);
+
+	while (BlockCompressorWriteOldest(bc, true))
+		;
+	BlockCompressorWriteTrailer(bc);
+
+	pthread_mutex_lock(&bc->lock);
+	bc->shutdown = true;
+	pthread_cond_broadcast(&bc->queued);
+	pthread_mutex_unlock(&bc->lock);
+
+	for (i = 0; i < bc->nthreads; i++)
+		pthread_join(bc->threads[i], NULL);
+
+	pthread_mutex_destroy(&bc->lock);
+	pthread_cond_destroy(&bc->queued);
+	pthread_cond_destroy(&bc->compressed);
+
+	for (i = 0; i < bc->nblocks; i++)
+	{
+		free(bc->blocks[i].in);
+		free(bc->blocks[i].out);
+	}
+	free(bc->blocks);
+	free(bc->threads);
+	free(bc);
+}
+#endif   /* PARALLEL_COMPRESSION */
+
+
 #ifdef HAVE_LIBZ
 /*
  * Functions for zlib compressed output.
  */
 
+#ifdef PARALLEL_COMPRESSION
+static void
+WriteBlockToArchiveZlib(void *arg, const char *buf, size_t len)
+{
+	CompressorState *cs = (CompressorState *) arg;
+
+	cs->writeF(cs->AH, buf, len);
+}
+#endif
+
 static void
 InitCompressorZlib(CompressorState *cs, int level)
 {
 	z_streamp	zp;
 
+#ifdef PARALLEL_COMPRESSION
+	if (compressThreads > 1)
+	{
+		cs->bc = BlockCompressorStart(level, false, WriteBlockToArchiveZlib, cs);
+		return;
+	}
+#endif
+
 	zp = cs->zp = (z_streamp) pg_malloc(sizeof(z_stream));
 	zp->zalloc = Z_NULL;
 	zp->zfree = Z_NULL;
@@ -255,6 +697,15 @@ EndCompressorZlib(ArchiveHandle *AH, CompressorState *cs)
 {
 	z_streamp	zp = cs->zp;
 
+#ifdef PARALLEL_COMPRESSION
+	if (cs->bc)
+	{
+		cs->AH = AH;
+		BlockCompressorEnd(cs->bc);
+		return;
+	}
+#endif
+
 	zp->next_in = NULL;
 	zp->avail_in = 0;
 
@@ -315,6 +766,15 @@ static void
 WriteDataToArchiveZlib(ArchiveHandle *AH, CompressorState *cs,
 					   const char *data, size_t dLen)
 {
+#ifdef PARALLEL_COMPRESSION
+	if (cs->bc)
+	{
+		cs->AH = AH;
+		BlockCompressorWrite(cs->bc, data, dLen);
+		return;
+	}
+#endif
+
 	cs->zp->next_in = (void *) data;
 	cs->zp->avail_in = dLen;
 	DeflateCompressorZlib(AH, cs, false);
@@ -446,12 +906,27 @@ struct cfp
 #ifdef HAVE_LIBZ
 	gzFile		compressedfp;
 #endif
+#ifdef PARALLEL_COMPRESSION
+	/* compresses into uncompressedfp, if compressing in parallel */
+	BlockCompressor *blockcompressedfp;
+#endif
 };
 
 #ifdef HAVE_LIBZ
 static int	hasSuffix(const char *filename, const char *suffix);
 #endif
 
+#ifdef PARALLEL_COMPRESSION
+static void
+cfWriteBlock(void *arg, const char *buf, size_t len)
+{
+	cfp		   *fp = (cfp *) arg;
+
+	if (fwrite(buf, 1, len, fp->uncompressedfp) != len)
+		WRITE_ERROR_EXIT;
+}
+#endif
+
 /*
  * Open a file for reading. 'path' is the file to open, and 'mode' should
  * be either "r" or "rb".
@@ -508,7 +983,18 @@ cfopen_write(const char *path, const char *mode, int compression)
 		char	   *fname;
 
 		fname = psprintf("%s.gz", path);
-		fp = cfopen(fname, mode, 1);
+#ifdef PARALLEL_COMPRESSION
+		if (compressThreads > 1)
+		{
+			/* write the gzip stream ourselves */
+			fp = cfopen(fname, mode, 0);
+			if (fp != NULL)
+				fp->blockcompressedfp = BlockCompressorStart(compression, true,
+															 cfWriteBlock, fp);
+		}
+		else
+#endif
+			fp = cfopen(fname, mode, 1);
 		free(fname);
 #else
 		exit_horribly(modulename, "not built with zlib support\n");
@@ -525,7 +1011,7 @@ cfopen_write(const char *path, const char *mode, int compression)
 cfp *
 cfopen(const char *path, const char *mode, int compression)
 {
-	cfp		   *fp = pg_malloc(sizeof(cfp));
+	cfp		   *fp = pg_malloc0(sizeof(cfp));
 
 	if (compression != 0)
 	{
@@ -587,6 +1073,13 @@ cfread(void *ptr, int size, cfp *fp)
 int
 cfwrite(const void *ptr, int size, cfp *fp)
 {
+#ifdef PARALLEL_COMPRESSION
+	if (fp->blockcompressedfp)
+	{
+		BlockCompressorWrite(fp->blockcompressedfp, ptr, size);
+		return size;
+	}
+#endif
 #ifdef HAVE_LIBZ
 	if (fp->compressedfp)
 		return gzwrite(fp->compressedfp, ptr, size);
@@ -646,6 +1139,13 @@ cfclose(cfp *fp)
 		errno = EBADF;
 		return EOF;
 	}
+#ifdef PARALLEL_COMPRESSION
+	if (fp->blockcompressedfp)
+	{
+		BlockCompressorEnd(fp->blockcompressedfp);
+		fp->blockcompressedfp = NULL;
+	}
+#endif
 #ifdef HAVE_LIBZ
 	if (fp->compressedfp)
 	{
@@ -22,6 +22,9 @@
 #define ZLIB_OUT_SIZE	4096
 #define ZLIB_IN_SIZE	4096
 
+/* upper limit of --compress-jobs, each thread holds two blocks in memory */
+#define MAX_COMPRESSION_THREADS	64
+
 typedef enum
 {
 	COMPR_ALG_NONE,
@@ -53,6 +56,7 @@ extern void ReadDataFromArchive(ArchiveHandle *AH, int compression,
 extern void WriteDataToArchive(ArchiveHandle *AH, CompressorState *cs,
 				   const void *data, size_t dLen);
 extern void EndCompressor(ArchiveHandle *AH, CompressorState *cs);
+extern void SetCompressionThreads(int nthreads);
 
 
 typedef struct cfp cfp;
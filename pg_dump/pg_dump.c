@@ -57,6 +57,7 @@
 #include "catalog/pg_type.h"
 #include "libpq/libpq-fs.h"
 
+#include "compress_io.h"
 #include "pg_backup_archiver.h"
 #include "pg_backup_db.h"
 #include "pg_backup_utils.h"
@@ -127,6 +128,12 @@ char		g_comment_end[10];
 
 static const CatalogId nilCatalogId = {0, 0};
 
+/* length of a LOCK TABLE statement locking many tables, in bytes */
+#define LOCK_BATCH_QUERY_LEN	100000
+
+/* tables of a schema whose indexes, triggers etc. are read by one query */
+#define TABLE_BATCH_SIZE		1000
+
 /* flags for various command-line long options */
 static int	binary_upgrade = 0;
 static int	disable_dollar_quoting = 0;
@@ -222,6 +229,11 @@ static void addBoundaryDependencies(DumpableObject **dobjs, int numObjs,
 						DumpableObject *boundaryObjs);
 
 static void getDomainConstraints(Archive *fout, TypeInfo *tyinfo);
+static void sortTablesByNamespace(TableInfo **tbls, int ntbls);
+static int	TableNamespaceCompare(const void *p1, const void *p2);
+static int	nextTableBatch(Archive *fout, TableInfo **tbls, int start, int ntbls);
+static void appendTableOidCond(Archive *fout, PQExpBuffer buf,
+				   TableInfo **tbls, int ntbls);
 static void getTableData(TableInfo *tblinfo, int numTables, bool oids);
 static void makeTableDataInfo(TableInfo *tbinfo, bool oids);
 static void buildMatViewRefreshDependencies(Archive *fout);
@@ -287,6 +299,7 @@ main(int argc, char **argv)
 	DumpableObject *boundaryObjs;
 	int			i;
 	int			numWorkers = 1;
+	int			compressThreads = 1;
 	enum trivalue prompt_password = TRI_DEFAULT;
 	int			compressLevel = -1;
 	int			plainText = 0;
@@ -360,6 +373,7 @@ main(int argc, char **argv)
 		{"no-synchronized-snapshots", no_argument, &no_synchronized_snapshots, 1},
 		{"no-unlogged-table-data", no_argument, &no_unlogged_table_data, 1},
 		{"snapshot", required_argument, NULL, 6},
+		{"compress-jobs", required_argument, NULL, 7},
 
 		{NULL, 0, NULL, 0}
 	};
@@ -541,6 +555,10 @@ main(int argc, char **argv)
 				dumpsnapshot = pg_strdup(optarg);
 				break;
 
+			case 7:				/* compression threads */
+				compressThreads = atoi(optarg);
+				break;
+
 			default:
 				fprintf(stderr, _("Try \"%s --help\" for more information.\n"), progname);
 				exit_nicely(1);
@@ -618,6 +636,11 @@ main(int argc, char **argv)
 		)
 		exit_horribly(NULL, "%s: invalid number of parallel jobs\n", progname);
 
+	if (compressThreads <= 0 || compressThreads > MAX_COMPRESSION_THREADS)
+		exit_horribly(NULL, "%s: invalid number of compression jobs, must be between 1 and %d\n",
+					  progname, MAX_COMPRESSION_THREADS);
+	SetCompressionThreads(compressThreads);
+
 	/* Parallel backup only in the directory archive format so far */
 	if (archiveFormat != archDirectory && numWorkers > 1)
 		exit_horribly(NULL, "parallel backup only supported by the directory format\n");
@@ -884,6 +907,9 @@ help(const char *progname)
 	printf(_("  -v, --verbose                verbose mode\n"));
 	printf(_("  -V, --version                output version information, then exit\n"));
 	printf(_("  -Z, --compress=0-9           compression level for compressed formats\n"));
+	printf(_("  --compress-jobs=NUM          use this many threads (1-%d) to compress each\n"
+			 "                               stream, not used by logical node joins\n"),
+		   MAX_COMPRESSION_THREADS);
 	printf(_("  --lock-wait-timeout=TIMEOUT  fail after waiting TIMEOUT for a table lock\n"));
 	printf(_("  -?, --help                   show this help, then exit\n"));
 
@@ -4793,6 +4819,8 @@ getTables(Archive *fout, int *numTables)
 		ExecuteSqlStatement(fout, query->data);
 	}
 
+	resetPQExpBuffer(query);
+
 	for (i = 0; i < ntups; i++)
 	{
 		tblinfo[i].dobj.objType = DO_TABLE;
@@ -4869,13 +4897,26 @@ getTables(Archive *fout, int *numTables)
 		 */
 		if (tblinfo[i].dobj.dump && tblinfo[i].relkind == RELKIND_RELATION)
 		{
-			resetPQExpBuffer(query);
-			appendPQExpBuffer(query,
-							  "LOCK TABLE %s IN ACCESS SHARE MODE",
-							  fmtQualifiedId(fout->remoteVersion,
+			/*
+			 * Lock many tables per statement, rather than spending a round
+			 * trip on each of them in databases with very many tables.
+			 */
+			if (query->len == 0)
+				appendPQExpBufferStr(query, "LOCK TABLE ");
+			else
+				appendPQExpBufferStr(query, ", ");
+			appendPQExpBufferStr(query,
+								 fmtQualifiedId(fout->remoteVersion,
 										tblinfo[i].dobj.namespace->dobj.name,
-											 tblinfo[i].dobj.name));
-			ExecuteSqlStatement(fout, query->data);
+												tblinfo[i].dobj.name));
+
+			if (query->len >= LOCK_BATCH_QUERY_LEN ||
+				fout->remoteVersion < 70400)
+			{
+				appendPQExpBufferStr(query, " IN ACCESS SHARE MODE");
+				ExecuteSqlStatement(fout, query->data);
+				resetPQExpBuffer(query);
+			}
 		}
 
 		/* Emit notice if join for owner failed */
@@ -4884,6 +4925,12 @@ getTables(Archive *fout, int *numTables)
 					  tblinfo[i].dobj.name);
 	}
 
+	if (query->len > 0)
+	{
+		appendPQExpBufferStr(query, " IN ACCESS SHARE MODE");
+		ExecuteSqlStatement(fout, query->data);
+	}
+
 	if (lockWaitTimeout && fout->remoteVersion >= 70300)
 	{
 		ExecuteSqlStatement(fout, "SET statement_timeout = 0");
@@ -4980,6 +5027,89 @@ getInherits(Archive *fout, int *numInherits)
 	return inhinfo;
 }
 
+/*
+ * sortTablesByNamespace
+ *	  sort an array of tables by schema, then by OID
+ *
+ * The catalog queries about tables made by getIndexes() and friends deparse
+ * expressions relative to the search_path, so they have to be issued per
+ * schema. Grouping the tables by schema lets them be issued for many tables
+ * at once, rather than once per table, which is what makes dumping databases
+ * with very many tables bearable.
+ */
+static void
+sortTablesByNamespace(TableInfo **tbls, int ntbls)
+{
+	if (ntbls > 1)
+		qsort((void *) tbls, ntbls, sizeof(TableInfo *),
+			  TableNamespaceCompare);
+}
+
+static int
+TableNamespaceCompare(const void *p1, const void *p2)
+{
+	const TableInfo *tbl1 = *(TableInfo *const *) p1;
+	const TableInfo *tbl2 = *(TableInfo *const *) p2;
+	int			cmpval;
+
+	cmpval = oidcmp(tbl1->dobj.namespace->dobj.catId.oid,
+					tbl2->dobj.namespace->dobj.catId.oid);
+	if (cmpval == 0)
+		cmpval = oidcmp(tbl1->dobj.catId.oid, tbl2->dobj.catId.oid);
+	return cmpval;
+}
+
+/*
+ * nextTableBatch
+ *	  find the batch of tables starting at tbls[start] and select their schema
+ *
+ * tbls[] must have been sorted by sortTablesByNamespace(). Returns the index
+ * just past the end of the batch. A batch holds up to TABLE_BATCH_SIZE tables
+ * of the same schema, or a single table if the server can't compare OIDs
+ * with an array.
+ */
+static int
+nextTableBatch(Archive *fout, TableInfo **tbls, int start, int ntbls)
+{
+	NamespaceInfo *nsinfo = tbls[start]->dobj.namespace;
+	int			end = start + 1;
+
+	if (fout->remoteVersion >= 70400)
+	{
+		while (end < ntbls && end - start < TABLE_BATCH_SIZE &&
+			   tbls[end]->dobj.namespace == nsinfo)
+			end++;
+	}
+
+	selectSourceSchema(fout, nsinfo->dobj.name);
+
+	return end;
+}
+
+/*
+ * appendTableOidCond
+ *	  append the right-hand side of a condition matching the OIDs of a batch
+ *	  of tables found by nextTableBatch()
+ */
+static void
+appendTableOidCond(Archive *fout, PQExpBuffer buf, TableInfo **tbls, int ntbls)
+{
+	int			i;
+
+	if (ntbls == 1)
+	{
+		appendPQExpBuffer(buf, "= '%u'::%s", tbls[0]->dobj.catId.oid,
+						  fout->remoteVersion >= 70300 ? "pg_catalog.oid" : "oid");
+		return;
+	}
+
+	appendPQExpBufferStr(buf, "= ANY ('{");
+	for (i = 0; i < ntbls; i++)
+		appendPQExpBuffer(buf, "%s%u", i > 0 ? "," : "",
+						  tbls[i]->dobj.catId.oid);
+	appendPQExpBufferStr(buf, "}'::pg_catalog.oid[])");
+}
+
 /*
  * getIndexes
  *	  get information about every index on a dumpable table
@@ -4996,7 +5126,8 @@ getIndexes(Archive *fout, TableInfo tblinfo[], int numTables)
 	PGresult   *res;
 	IndxInfo   *indxinfo;
 	ConstraintInfo *constrinfo;
-	int			i_tableoid,
+	int			i_indrelid,
+				i_tableoid,
 				i_oid,
 				i_indexname,
 				i_indexdef,
@@ -5015,7 +5146,14 @@ getIndexes(Archive *fout, TableInfo tblinfo[], int numTables)
 				i_options,
 				i_relpages;
 	int			ntups;
-
+	TableInfo **tbls;
+	int			ntbls,
+				start,
+				end;
+	PQExpBuffer tblcond = createPQExpBuffer();
+
+	tbls = (TableInfo **) pg_malloc(numTables * sizeof(TableInfo *));
+	ntbls = 0;
 	for (i = 0; i < numTables; i++)
 	{
 		TableInfo  *tbinfo = &tblinfo[i];
@@ -5031,12 +5169,23 @@ getIndexes(Archive *fout, TableInfo tblinfo[], int numTables)
 		if (!tbinfo->dobj.dump)
 			continue;
 
-		if (g_verbose)
-			write_msg(NULL, "reading indexes for table \"%s\"\n",
-					  tbinfo->dobj.name);
+		tbls[ntbls++] = tbinfo;
+	}
+	sortTablesByNamespace(tbls, ntbls);
+
+	for (start = 0; start < ntbls; start = end)
+	{
+		TableInfo  *tbinfo = NULL;
 
 		/* Make sure we are in proper schema so indexdef is right */
-		selectSourceSchema(fout, tbinfo->dobj.namespace->dobj.name);
+		end = nextTableBatch(fout, tbls, start, ntbls);
+
+		if (g_verbose)
+			write_msg(NULL, "reading indexes for %d tables in schema \"%s\"\n",
+					  end - start, tbls[start]->dobj.namespace->dobj.name);
+
+		resetPQExpBuffer(tblcond);
+		appendTableOidCond(fout, tblcond, tbls + start, end - start);
 
 		/*
 		 * The point of the messy-looking outer join is to find a constraint
@@ -5057,7 +5206,7 @@ getIndexes(Archive *fout, TableInfo tblinfo[], int numTables)
 			 * earlier/later versions
 			 */
 			appendPQExpBuffer(query,
-							  "SELECT t.tableoid, t.oid, "
+							  "SELECT i.indrelid, t.tableoid, t.oid, "
 							  "t.relname AS indexname, "
 					 "pg_catalog.pg_get_indexdef(i.indexrelid) AS indexdef, "
 							  "t.relnatts AS indnkeys, "
@@ -5076,10 +5225,10 @@ getIndexes(Archive *fout, TableInfo tblinfo[], int numTables)
 							  "ON (i.indrelid = c.conrelid AND "
 							  "i.indexrelid = c.conindid AND "
 							  "c.contype IN ('p','u','x')) "
-							  "WHERE i.indrelid = '%u'::pg_catalog.oid "
+							  "WHERE i.indrelid %s "
 							  "AND i.indisvalid AND i.indisready "
-							  "ORDER BY indexname",
-							  tbinfo->dobj.catId.oid);
+							  "ORDER BY i.indrelid, indexname",
+							  tblcond->data);
 		}
 		else if (fout->remoteVersion >= 90000)
 		{
@@ -5088,7 +5237,7 @@ getIndexes(Archive *fout, TableInfo tblinfo[], int numTables)
 			 * earlier/later versions
 			 */
 			appendPQExpBuffer(query,
-							  "SELECT t.tableoid, t.oid, "
+							  "SELECT i.indrelid, t.tableoid, t.oid, "
 							  "t.relname AS indexname, "
 					 "pg_catalog.pg_get_indexdef(i.indexrelid) AS indexdef, "
 							  "t.relnatts AS indnkeys, "
@@ -5107,15 +5256,15 @@ getIndexes(Archive *fout, TableInfo tblinfo[], int numTables)
 							  "ON (i.indrelid = c.conrelid AND "
 							  "i.indexrelid = c.conindid AND "
 							  "c.contype IN ('p','u','x')) "
-							  "WHERE i.indrelid = '%u'::pg_catalog.oid "
+							  "WHERE i.indrelid %s "
 							  "AND i.indisvalid AND i.indisready "
-							  "ORDER BY indexname",
-							  tbinfo->dobj.catId.oid);
+							  "ORDER BY i.indrelid, indexname",
+							  tblcond->data);
 		}
 		else if (fout->remoteVersion >= 80200)
 		{
 			appendPQExpBuffer(query,
-							  "SELECT t.tableoid, t.oid, "
+							  "SELECT i.indrelid, t.tableoid, t.oid, "
 							  "t.relname AS indexname, "
 					 "pg_catalog.pg_get_indexdef(i.indexrelid) AS indexdef, "
 							  "t.relnatts AS indnkeys, "
@@ -5137,15 +5286,15 @@ getIndexes(Archive *fout, TableInfo tblinfo[], int numTables)
 							  "LEFT JOIN pg_catalog.pg_constraint c "
 							  "ON (d.refclassid = c.tableoid "
 							  "AND d.refobjid = c.oid) "
-							  "WHERE i.indrelid = '%u'::pg_catalog.oid "
+							  "WHERE i.indrelid %s "
 							  "AND i.indisvalid "
-							  "ORDER BY indexname",
-							  tbinfo->dobj.catId.oid);
+							  "ORDER BY i.indrelid, indexname",
+							  tblcond->data);
 		}
 		else if (fout->remoteVersion >= 80000)
 		{
 			appendPQExpBuffer(query,
-							  "SELECT t.tableoid, t.oid, "
+							  "SELECT i.indrelid, t.tableoid, t.oid, "
 							  "t.relname AS indexname, "
 					 "pg_catalog.pg_get_indexdef(i.indexrelid) AS indexdef, "
 							  "t.relnatts AS indnkeys, "
@@ -5167,14 +5316,14 @@ getIndexes(Archive *fout, TableInfo tblinfo[], int numTables)
 							  "LEFT JOIN pg_catalog.pg_constraint c "
 							  "ON (d.refclassid = c.tableoid "
 							  "AND d.refobjid = c.oid) "
-							  "WHERE i.indrelid = '%u'::pg_catalog.oid "
-							  "ORDER BY indexname",
-							  tbinfo->dobj.catId.oid);
+							  "WHERE i.indrelid %s "
+							  "ORDER BY i.indrelid, indexname",
+							  tblcond->data);
 		}
 		else if (fout->remoteVersion >= 70300)
 		{
 			appendPQExpBuffer(query,
-							  "SELECT t.tableoid, t.oid, "
+							  "SELECT i.indrelid, t.tableoid, t.oid, "
 							  "t.relname AS indexname, "
 					 "pg_catalog.pg_get_indexdef(i.indexrelid) AS indexdef, "
 							  "t.relnatts AS indnkeys, "
@@ -5196,14 +5345,14 @@ getIndexes(Archive *fout, TableInfo tblinfo[], int numTables)
 							  "LEFT JOIN pg_catalog.pg_constraint c "
 							  "ON (d.refclassid = c.tableoid "
 							  "AND d.refobjid = c.oid) "
-							  "WHERE i.indrelid = '%u'::pg_catalog.oid "
-							  "ORDER BY indexname",
-							  tbinfo->dobj.catId.oid);
+							  "WHERE i.indrelid %s "
+							  "ORDER BY i.indrelid, indexname",
+							  tblcond->data);
 		}
 		else if (fout->remoteVersion >= 70100)
 		{
 			appendPQExpBuffer(query,
-							  "SELECT t.tableoid, t.oid, "
+							  "SELECT i.indrelid, t.tableoid, t.oid, "
 							  "t.relname AS indexname, "
 							  "pg_get_indexdef(i.indexrelid) AS indexdef, "
 							  "t.relnatts AS indnkeys, "
@@ -5221,14 +5370,14 @@ getIndexes(Archive *fout, TableInfo tblinfo[], int numTables)
 							  "null AS options "
 							  "FROM pg_index i, pg_class t "
 							  "WHERE t.oid = i.indexrelid "
-							  "AND i.indrelid = '%u'::oid "
-							  "ORDER BY indexname",
-							  tbinfo->dobj.catId.oid);
+							  "AND i.indrelid %s "
+							  "ORDER BY i.indrelid, indexname",
+							  tblcond->data);
 		}
 		else
 		{
 			appendPQExpBuffer(query,
-							  "SELECT "
+							  "SELECT i.indrelid, "
 							  "(SELECT oid FROM pg_class WHERE relname = 'pg_class') AS tableoid, "
 							  "t.oid, "
 							  "t.relname AS indexname, "
@@ -5248,15 +5397,16 @@ getIndexes(Archive *fout, TableInfo tblinfo[], int numTables)
 							  "null AS options "
 							  "FROM pg_index i, pg_class t "
 							  "WHERE t.oid = i.indexrelid "
-							  "AND i.indrelid = '%u'::oid "
-							  "ORDER BY indexname",
-							  tbinfo->dobj.catId.oid);
+							  "AND i.indrelid %s "
+							  "ORDER BY i.indrelid, indexname",
+							  tblcond->data);
 		}
 
 		res = ExecuteSqlQuery(fout, query->data, PGRES_TUPLES_OK);
 
 		ntups = PQntuples(res);
 
+		i_indrelid = PQfnumber(res, "indrelid");
 		i_tableoid = PQfnumber(res, "tableoid");
 		i_oid = PQfnumber(res, "oid");
 		i_indexname = PQfnumber(res, "indexname");
@@ -5281,8 +5431,17 @@ getIndexes(Archive *fout, TableInfo tblinfo[], int numTables)
 
 		for (j = 0; j < ntups; j++)
 		{
+			Oid			indrelid = atooid(PQgetvalue(res, j, i_indrelid));
 			char		contype;
 
+			if (tbinfo == NULL || tbinfo->dobj.catId.oid != indrelid)
+			{
+				tbinfo = findTableByOid(indrelid);
+				if (tbinfo == NULL)
+					exit_horribly(NULL, "failed sanity check, parent table OID %u of pg_index entry OID %u not found\n",
+								  indrelid, atooid(PQgetvalue(res, j, i_oid)));
+			}
+
 			indxinfo[j].dobj.objType = DO_INDEX;
 			indxinfo[j].dobj.catId.tableoid = atooid(PQgetvalue(res, j, i_tableoid));
 			indxinfo[j].dobj.catId.oid = atooid(PQgetvalue(res, j, i_oid));
@@ -5357,6 +5516,8 @@ getIndexes(Archive *fout, TableInfo tblinfo[], int numTables)
 		PQclear(res);
 	}
 
+	free(tbls);
+	destroyPQExpBuffer(tblcond);
 	destroyPQExpBuffer(query);
 }
 
@@ -5377,19 +5538,28 @@ getConstraints(Archive *fout, TableInfo tblinfo[], int numTables)
 	ConstraintInfo *constrinfo;
 	PQExpBuffer query;
 	PGresult   *res;
-	int			i_contableoid,
+	int			i_conrelid,
+				i_contableoid,
 				i_conoid,
 				i_conname,
 				i_confrelid,
 				i_condef;
 	int			ntups;
+	TableInfo **tbls;
+	int			ntbls,
+				start,
+				end;
+	PQExpBuffer tblcond;
 
 	/* pg_constraint was created in 7.3, so nothing to do if older */
 	if (fout->remoteVersion < 70300)
 		return;
 
 	query = createPQExpBuffer();
+	tblcond = createPQExpBuffer();
 
+	tbls = (TableInfo **) pg_malloc(numTables * sizeof(TableInfo *));
+	ntbls = 0;
 	for (i = 0; i < numTables; i++)
 	{
 		TableInfo  *tbinfo = &tblinfo[i];
@@ -5397,28 +5567,41 @@ getConstraints(Archive *fout, TableInfo tblinfo[], int numTables)
 		if (!tbinfo->hastriggers || !tbinfo->dobj.dump)
 			continue;
 
-		if (g_verbose)
-			write_msg(NULL, "reading foreign key constraints for table \"%s\"\n",
-					  tbinfo->dobj.name);
+		tbls[ntbls++] = tbinfo;
+	}
+	sortTablesByNamespace(tbls, ntbls);
+
+	for (start = 0; start < ntbls; start = end)
+	{
+		TableInfo  *tbinfo = NULL;
 
 		/*
 		 * select table schema to ensure constraint expr is qualified if
 		 * needed
 		 */
-		selectSourceSchema(fout, tbinfo->dobj.namespace->dobj.name);
+		end = nextTableBatch(fout, tbls, start, ntbls);
+
+		if (g_verbose)
+			write_msg(NULL, "reading foreign key constraints for %d tables in schema \"%s\"\n",
+					  end - start, tbls[start]->dobj.namespace->dobj.name);
+
+		resetPQExpBuffer(tblcond);
+		appendTableOidCond(fout, tblcond, tbls + start, end - start);
 
 		resetPQExpBuffer(query);
 		appendPQExpBuffer(query,
-						  "SELECT tableoid, oid, conname, confrelid, "
+						  "SELECT conrelid, tableoid, oid, conname, confrelid, "
 						  "pg_catalog.pg_get_constraintdef(oid) AS condef "
 						  "FROM pg_catalog.pg_constraint "
-						  "WHERE conrelid = '%u'::pg_catalog.oid "
-						  "AND contype = 'f'",
-						  tbinfo->dobj.catId.oid);
+						  "WHERE conrelid %s "
+						  "AND contype = 'f' "
+						  "ORDER BY conrelid",
+						  tblcond->data);
 		res = ExecuteSqlQuery(fout, query->data, PGRES_TUPLES_OK);
 
 		ntups = PQntuples(res);
 
+		i_conrelid = PQfnumber(res, "conrelid");
 		i_contableoid = PQfnumber(res, "tableoid");
 		i_conoid = PQfnumber(res, "oid");
 		i_conname = PQfnumber(res, "conname");
@@ -5429,6 +5612,16 @@ getConstraints(Archive *fout, TableInfo tblinfo[], int numTables)
 
 		for (j = 0; j < ntups; j++)
 		{
+			Oid			conrelid = atooid(PQgetvalue(res, j, i_conrelid));
+
+			if (tbinfo == NULL || tbinfo->dobj.catId.oid != conrelid)
+			{
+				tbinfo = findTableByOid(conrelid);
+				if (tbinfo == NULL)
+					exit_horribly(NULL, "failed sanity check, parent table OID %u of pg_constraint entry OID %u not found\n",
+								  conrelid, atooid(PQgetvalue(res, j, i_conoid)));
+			}
+
 			constrinfo[j].dobj.objType = DO_FK_CONSTRAINT;
 			constrinfo[j].dobj.catId.tableoid = atooid(PQgetvalue(res, j, i_contableoid));
 			constrinfo[j].dobj.catId.oid = atooid(PQgetvalue(res, j, i_conoid));
@@ -5450,6 +5643,8 @@ getConstraints(Archive *fout, TableInfo tblinfo[], int numTables)
 		PQclear(res);
 	}
 
+	free(tbls);
+	destroyPQExpBuffer(tblcond);
 	destroyPQExpBuffer(query);
 }
 
@@ -5711,7 +5906,8 @@ getTriggers(Archive *fout, TableInfo tblinfo[], int numTables)
 	PQExpBuffer query = createPQExpBuffer();
 	PGresult   *res;
 	TriggerInfo *tginfo;
-	int			i_tableoid,
+	int			i_tgrelid,
+				i_tableoid,
 				i_oid,
 				i_tgname,
 				i_tgfname,
@@ -5727,7 +5923,14 @@ getTriggers(Archive *fout, TableInfo tblinfo[], int numTables)
 				i_tginitdeferred,
 				i_tgdef;
 	int			ntups;
-
+	TableInfo **tbls;
+	int			ntbls,
+				start,
+				end;
+	PQExpBuffer tblcond = createPQExpBuffer();
+
+	tbls = (TableInfo **) pg_malloc(numTables * sizeof(TableInfo *));
+	ntbls = 0;
 	for (i = 0; i < numTables; i++)
 	{
 		TableInfo  *tbinfo = &tblinfo[i];
@@ -5735,14 +5938,25 @@ getTriggers(Archive *fout, TableInfo tblinfo[], int numTables)
 		if (!tbinfo->hastriggers || !tbinfo->dobj.dump)
 			continue;
 
-		if (g_verbose)
-			write_msg(NULL, "reading triggers for table \"%s\"\n",
-					  tbinfo->dobj.name);
+		tbls[ntbls++] = tbinfo;
+	}
+	sortTablesByNamespace(tbls, ntbls);
+
+	for (start = 0; start < ntbls; start = end)
+	{
+		TableInfo  *tbinfo = NULL;
 
 		/*
 		 * select table schema to ensure regproc name is qualified if needed
 		 */
-		selectSourceSchema(fout, tbinfo->dobj.namespace->dobj.name);
+		end = nextTableBatch(fout, tbls, start, ntbls);
+
+		if (g_verbose)
+			write_msg(NULL, "reading triggers for %d tables in schema \"%s\"\n",
+					  end - start, tbls[start]->dobj.namespace->dobj.name);
+
+		resetPQExpBuffer(tblcond);
+		appendTableOidCond(fout, tblcond, tbls + start, end - start);
 
 		resetPQExpBuffer(query);
 		if (fout->remoteVersion >= 90000)
@@ -5753,14 +5967,15 @@ getTriggers(Archive *fout, TableInfo tblinfo[], int numTables)
 			 * due to under-parenthesization.
 			 */
 			appendPQExpBuffer(query,
-							  "SELECT tgname, "
+							  "SELECT tgrelid, tgname, "
 							  "tgfoid::pg_catalog.regproc AS tgfname, "
 						"pg_catalog.pg_get_triggerdef(oid, false) AS tgdef, "
 							  "tgenabled, tableoid, oid "
 							  "FROM pg_catalog.pg_trigger t "
-							  "WHERE tgrelid = '%u'::pg_catalog.oid "
-							  "AND NOT tgisinternal",
-							  tbinfo->dobj.catId.oid);
+							  "WHERE tgrelid %s "
+							  "AND NOT tgisinternal "
+							  "ORDER BY tgrelid",
+							  tblcond->data);
 		}
 		else if (fout->remoteVersion >= 80300)
 		{
@@ -5768,16 +5983,17 @@ getTriggers(Archive *fout, TableInfo tblinfo[], int numTables)
 			 * We ignore triggers that are tied to a foreign-key constraint
 			 */
 			appendPQExpBuffer(query,
-							  "SELECT tgname, "
+							  "SELECT tgrelid, tgname, "
 							  "tgfoid::pg_catalog.regproc AS tgfname, "
 							  "tgtype, tgnargs, tgargs, tgenabled, "
 							  "tgisconstraint, tgconstrname, tgdeferrable, "
 							  "tgconstrrelid, tginitdeferred, tableoid, oid, "
 					 "tgconstrrelid::pg_catalog.regclass AS tgconstrrelname "
 							  "FROM pg_catalog.pg_trigger t "
-							  "WHERE tgrelid = '%u'::pg_catalog.oid "
-							  "AND tgconstraint = 0",
-							  tbinfo->dobj.catId.oid);
+							  "WHERE tgrelid %s "
+							  "AND tgconstraint = 0 "
+							  "ORDER BY tgrelid",
+							  tblcond->data);
 		}
 		else if (fout->remoteVersion >= 70300)
 		{
@@ -5787,38 +6003,40 @@ getTriggers(Archive *fout, TableInfo tblinfo[], int numTables)
 			 * to find out
 			 */
 			appendPQExpBuffer(query,
-							  "SELECT tgname, "
+							  "SELECT tgrelid, tgname, "
 							  "tgfoid::pg_catalog.regproc AS tgfname, "
 							  "tgtype, tgnargs, tgargs, tgenabled, "
 							  "tgisconstraint, tgconstrname, tgdeferrable, "
 							  "tgconstrrelid, tginitdeferred, tableoid, oid, "
 					 "tgconstrrelid::pg_catalog.regclass AS tgconstrrelname "
 							  "FROM pg_catalog.pg_trigger t "
-							  "WHERE tgrelid = '%u'::pg_catalog.oid "
+							  "WHERE tgrelid %s "
 							  "AND (NOT tgisconstraint "
 							  " OR NOT EXISTS"
 							  "  (SELECT 1 FROM pg_catalog.pg_depend d "
 							  "   JOIN pg_catalog.pg_constraint c ON (d.refclassid = c.tableoid AND d.refobjid = c.oid) "
-							  "   WHERE d.classid = t.tableoid AND d.objid = t.oid AND d.deptype = 'i' AND c.contype = 'f'))",
-							  tbinfo->dobj.catId.oid);
+							  "   WHERE d.classid = t.tableoid AND d.objid = t.oid AND d.deptype = 'i' AND c.contype = 'f')) "
+							  "ORDER BY tgrelid",
+							  tblcond->data);
 		}
 		else if (fout->remoteVersion >= 70100)
 		{
 			appendPQExpBuffer(query,
-							  "SELECT tgname, tgfoid::regproc AS tgfname, "
+							  "SELECT tgrelid, tgname, tgfoid::regproc AS tgfname, "
 							  "tgtype, tgnargs, tgargs, tgenabled, "
 							  "tgisconstraint, tgconstrname, tgdeferrable, "
 							  "tgconstrrelid, tginitdeferred, tableoid, oid, "
 				  "(SELECT relname FROM pg_class WHERE oid = tgconstrrelid) "
 							  "		AS tgconstrrelname "
 							  "FROM pg_trigger "
-							  "WHERE tgrelid = '%u'::oid",
-							  tbinfo->dobj.catId.oid);
+							  "WHERE tgrelid %s "
+							  "ORDER BY tgrelid",
+							  tblcond->data);
 		}
 		else
 		{
 			appendPQExpBuffer(query,
-							  "SELECT tgname, tgfoid::regproc AS tgfname, "
+							  "SELECT tgrelid, tgname, tgfoid::regproc AS tgfname, "
 							  "tgtype, tgnargs, tgargs, tgenabled, "
 							  "tgisconstraint, tgconstrname, tgdeferrable, "
 							  "tgconstrrelid, tginitdeferred, "
@@ -5827,13 +6045,15 @@ getTriggers(Archive *fout, TableInfo tblinfo[], int numTables)
 				  "(SELECT relname FROM pg_class WHERE oid = tgconstrrelid) "
 							  "		AS tgconstrrelname "
 							  "FROM pg_trigger "
-							  "WHERE tgrelid = '%u'::oid",
-							  tbinfo->dobj.catId.oid);
+							  "WHERE tgrelid %s "
+							  "ORDER BY tgrelid",
+							  tblcond->data);
 		}
 		res = ExecuteSqlQuery(fout, query->data, PGRES_TUPLES_OK);
 
 		ntups = PQntuples(res);
 
+		i_tgrelid = PQfnumber(res, "tgrelid");
 		i_tableoid = PQfnumber(res, "tableoid");
 		i_oid = PQfnumber(res, "oid");
 		i_tgname = PQfnumber(res, "tgname");
@@ -5854,6 +6074,16 @@ getTriggers(Archive *fout, TableInfo tblinfo[], int numTables)
 
 		for (j = 0; j < ntups; j++)
 		{
+			Oid			tgrelid = atooid(PQgetvalue(res, j, i_tgrelid));
+
+			if (tbinfo == NULL || tbinfo->dobj.catId.oid != tgrelid)
+			{
+				tbinfo = findTableByOid(tgrelid);
+				if (tbinfo == NULL)
+					exit_horribly(NULL, "failed sanity check, parent table OID %u of pg_trigger entry OID %u not found\n",
+								  tgrelid, atooid(PQgetvalue(res, j, i_oid)));
+			}
+
 			tginfo[j].dobj.objType = DO_TRIGGER;
 			tginfo[j].dobj.catId.tableoid = atooid(PQgetvalue(res, j, i_tableoid));
 			tginfo[j].dobj.catId.oid = atooid(PQgetvalue(res, j, i_oid));
@@ -5918,6 +6148,8 @@ getTriggers(Archive *fout, TableInfo tblinfo[], int numTables)
 		PQclear(res);
 	}
 
+	free(tbls);
+	destroyPQExpBuffer(tblcond);
 	destroyPQExpBuffer(query);
 }
 
@@ -6287,11 +6519,9 @@ getCasts(Archive *fout, int *numCasts)
  *	  for each interesting table, read info about its attributes
  *	  (names, types, default values, CHECK constraints, etc)
  *
- * This is implemented in a very inefficient way right now, looping
- * through the tblinfo and doing a join per table to find the attrs and their
- * types.  However, because we want type names and so forth to be named
- * relative to the schema of each table, we couldn't do it in just one
- * query.  (Maybe one query per schema?)
+ * Because we want type names and so forth to be named relative to the
+ * schema of each table, we can't do it in just one query.  Instead we issue
+ * the queries for batches of tables of the same schema, see nextTableBatch().
  *
  *	modifies tblinfo
  */
@@ -6299,8 +6529,11 @@ void
 getTableAttrs(Archive *fout, TableInfo *tblinfo, int numTables)
 {
 	int			i,
-				j;
+				j,
+				k;
 	PQExpBuffer q = createPQExpBuffer();
+	PQExpBuffer tblcond = createPQExpBuffer();
+	int			i_attrelid;
 	int			i_attnum;
 	int			i_attname;
 	int			i_atttypname;
@@ -6319,8 +6552,18 @@ getTableAttrs(Archive *fout, TableInfo *tblinfo, int numTables)
 	int			i_attfdwoptions;
 	PGresult   *res;
 	int			ntups;
-	bool		hasdefaults;
-
+	int			row;
+	TableInfo **tbls;
+	TableInfo **deftbls;
+	TableInfo **chktbls;
+	int			ntbls,
+				ndeftbls,
+				nchktbls,
+				start,
+				end;
+
+	tbls = (TableInfo **) pg_malloc(numTables * sizeof(TableInfo *));
+	ntbls = 0;
 	for (i = 0; i < numTables; i++)
 	{
 		TableInfo  *tbinfo = &tblinfo[i];
@@ -6333,11 +6576,24 @@ getTableAttrs(Archive *fout, TableInfo *tblinfo, int numTables)
 		if (!tbinfo->interesting)
 			continue;
 
+		tbls[ntbls++] = tbinfo;
+	}
+	sortTablesByNamespace(tbls, ntbls);
+
+	/* tables of the current batch having defaults and CHECK constraints */
+	deftbls = (TableInfo **) pg_malloc(TABLE_BATCH_SIZE * sizeof(TableInfo *));
+	chktbls = (TableInfo **) pg_malloc(TABLE_BATCH_SIZE * sizeof(TableInfo *));
+
+	for (start = 0; start < ntbls; start = end)
+	{
 		/*
-		 * Make sure we are in proper schema for this table; this allows
+		 * Make sure we are in proper schema for these tables; this allows
 		 * correct retrieval of formatted type names and default exprs
 		 */
-		selectSourceSchema(fout, tbinfo->dobj.namespace->dobj.name);
+		end = nextTableBatch(fout, tbls, start, ntbls);
+
+		resetPQExpBuffer(tblcond);
+		appendTableOidCond(fout, tblcond, tbls + start, end - start);
 
 		/* find all the user attributes and their types */
 
@@ -6349,8 +6605,8 @@ getTableAttrs(Archive *fout, TableInfo *tblinfo, int numTables)
 		 * the output of an indexscan on pg_attribute_relid_attnum_index.
 		 */
 		if (g_verbose)
-			write_msg(NULL, "finding the columns and types of table \"%s\"\n",
-					  tbinfo->dobj.name);
+			write_msg(NULL, "finding the columns and types of %d tables in schema \"%s\"\n",
+					  end - start, tbls[start]->dobj.namespace->dobj.name);
 
 		resetPQExpBuffer(q);
 
@@ -6359,7 +6615,7 @@ getTableAttrs(Archive *fout, TableInfo *tblinfo, int numTables)
 			/*
 			 * attfdwoptions is new in 9.2.
 			 */
-			appendPQExpBuffer(q, "SELECT a.attnum, a.attname, a.atttypmod, "
+			appendPQExpBuffer(q, "SELECT a.attrelid, a.attnum, a.attname, a.atttypmod, "
 							  "a.attstattarget, a.attstorage, t.typstorage, "
 							  "a.attnotnull, a.atthasdef, a.attisdropped, "
 							  "a.attlen, a.attalign, a.attislocal, "
@@ -6375,10 +6631,10 @@ getTableAttrs(Archive *fout, TableInfo *tblinfo, int numTables)
 							  "), E',\n    ') AS attfdwoptions "
 			 "FROM pg_catalog.pg_attribute a LEFT JOIN pg_catalog.pg_type t "
 							  "ON a.atttypid = t.oid "
-							  "WHERE a.attrelid = '%u'::pg_catalog.oid "
+							  "WHERE a.attrelid %s "
 							  "AND a.attnum > 0::pg_catalog.int2 "
 							  "ORDER BY a.attrelid, a.attnum",
-							  tbinfo->dobj.catId.oid);
+							  tblcond->data);
 		}
 		else if (fout->remoteVersion >= 90100)
 		{
@@ -6388,7 +6644,7 @@ getTableAttrs(Archive *fout, TableInfo *tblinfo, int numTables)
 			 * type's default, we use a CASE here to suppress uninteresting
 			 * attcollations cheaply.
 			 */
-			appendPQExpBuffer(q, "SELECT a.attnum, a.attname, a.atttypmod, "
+			appendPQExpBuffer(q, "SELECT a.attrelid, a.attnum, a.attname, a.atttypmod, "
 							  "a.attstattarget, a.attstorage, t.typstorage, "
 							  "a.attnotnull, a.atthasdef, a.attisdropped, "
 							  "a.attlen, a.attalign, a.attislocal, "
@@ -6399,15 +6655,15 @@ getTableAttrs(Archive *fout, TableInfo *tblinfo, int numTables)
 							  "NULL AS attfdwoptions "
 			 "FROM pg_catalog.pg_attribute a LEFT JOIN pg_catalog.pg_type t "
 							  "ON a.atttypid = t.oid "
-							  "WHERE a.attrelid = '%u'::pg_catalog.oid "
+							  "WHERE a.attrelid %s "
 							  "AND a.attnum > 0::pg_catalog.int2 "
 							  "ORDER BY a.attrelid, a.attnum",
-							  tbinfo->dobj.catId.oid);
+							  tblcond->data);
 		}
 		else if (fout->remoteVersion >= 90000)
 		{
 			/* attoptions is new in 9.0 */
-			appendPQExpBuffer(q, "SELECT a.attnum, a.attname, a.atttypmod, "
+			appendPQExpBuffer(q, "SELECT a.attrelid, a.attnum, a.attname, a.atttypmod, "
 							  "a.attstattarget, a.attstorage, t.typstorage, "
 							  "a.attnotnull, a.atthasdef, a.attisdropped, "
 							  "a.attlen, a.attalign, a.attislocal, "
@@ -6417,15 +6673,15 @@ getTableAttrs(Archive *fout, TableInfo *tblinfo, int numTables)
 							  "NULL AS attfdwoptions "
 			 "FROM pg_catalog.pg_attribute a LEFT JOIN pg_catalog.pg_type t "
 							  "ON a.atttypid = t.oid "
-							  "WHERE a.attrelid = '%u'::pg_catalog.oid "
+							  "WHERE a.attrelid %s "
 							  "AND a.attnum > 0::pg_catalog.int2 "
 							  "ORDER BY a.attrelid, a.attnum",
-							  tbinfo->dobj.catId.oid);
+							  tblcond->data);
 		}
 		else if (fout->remoteVersion >= 70300)
 		{
 			/* need left join here to not fail on dropped columns ... */
-			appendPQExpBuffer(q, "SELECT a.attnum, a.attname, a.atttypmod, "
+			appendPQExpBuffer(q, "SELECT a.attrelid, a.attnum, a.attname, a.atttypmod, "
 							  "a.attstattarget, a.attstorage, t.typstorage, "
 							  "a.attnotnull, a.atthasdef, a.attisdropped, "
 							  "a.attlen, a.attalign, a.attislocal, "
@@ -6434,10 +6690,10 @@ getTableAttrs(Archive *fout, TableInfo *tblinfo, int numTables)
 							  "NULL AS attfdwoptions "
 			 "FROM pg_catalog.pg_attribute a LEFT JOIN pg_catalog.pg_type t "
 							  "ON a.atttypid = t.oid "
-							  "WHERE a.attrelid = '%u'::pg_catalog.oid "
+							  "WHERE a.attrelid %s "
 							  "AND a.attnum > 0::pg_catalog.int2 "
 							  "ORDER BY a.attrelid, a.attnum",
-							  tbinfo->dobj.catId.oid);
+							  tblcond->data);
 		}
 		else if (fout->remoteVersion >= 70100)
 		{
@@ -6449,7 +6705,7 @@ getTableAttrs(Archive *fout, TableInfo *tblinfo, int numTables)
 			 * attislocal doesn't exist before 7.3, either; in older databases
 			 * we assume it's TRUE, else we'd fail to dump non-inherited atts.
 			 */
-			appendPQExpBuffer(q, "SELECT a.attnum, a.attname, a.atttypmod, "
+			appendPQExpBuffer(q, "SELECT a.attrelid, a.attnum, a.attname, a.atttypmod, "
 							  "-1 AS attstattarget, a.attstorage, "
 							  "t.typstorage, a.attnotnull, a.atthasdef, "
 							  "false AS attisdropped, a.attlen, "
@@ -6459,15 +6715,15 @@ getTableAttrs(Archive *fout, TableInfo *tblinfo, int numTables)
 							  "NULL AS attfdwoptions "
 							  "FROM pg_attribute a LEFT JOIN pg_type t "
 							  "ON a.atttypid = t.oid "
-							  "WHERE a.attrelid = '%u'::oid "
+							  "WHERE a.attrelid %s "
 							  "AND a.attnum > 0::int2 "
 							  "ORDER BY a.attrelid, a.attnum",
-							  tbinfo->dobj.catId.oid);
+							  tblcond->data);
 		}
 		else
 		{
 			/* format_type not available before 7.1 */
-			appendPQExpBuffer(q, "SELECT attnum, attname, atttypmod, "
+			appendPQExpBuffer(q, "SELECT attrelid, attnum, attname, atttypmod, "
 							  "-1 AS attstattarget, "
 							  "attstorage, attstorage AS typstorage, "
 							  "attnotnull, atthasdef, false AS attisdropped, "
@@ -6477,16 +6733,17 @@ getTableAttrs(Archive *fout, TableInfo *tblinfo, int numTables)
 							  "'' AS attoptions, 0 AS attcollation, "
 							  "NULL AS attfdwoptions "
 							  "FROM pg_attribute a "
-							  "WHERE attrelid = '%u'::oid "
+							  "WHERE attrelid %s "
 							  "AND attnum > 0::int2 "
 							  "ORDER BY attrelid, attnum",
-							  tbinfo->dobj.catId.oid);
+							  tblcond->data);
 		}
 
 		res = ExecuteSqlQuery(fout, q->data, PGRES_TUPLES_OK);
 
 		ntups = PQntuples(res);
 
+		i_attrelid = PQfnumber(res, "attrelid");
 		i_attnum = PQfnumber(res, "attnum");
 		i_attname = PQfnumber(res, "attname");
 		i_atttypname = PQfnumber(res, "atttypname");
@@ -6504,101 +6761,137 @@ getTableAttrs(Archive *fout, TableInfo *tblinfo, int numTables)
 		i_attcollation = PQfnumber(res, "attcollation");
 		i_attfdwoptions = PQfnumber(res, "attfdwoptions");
 
-		tbinfo->numatts = ntups;
-		tbinfo->attnames = (char **) pg_malloc(ntups * sizeof(char *));
-		tbinfo->atttypnames = (char **) pg_malloc(ntups * sizeof(char *));
-		tbinfo->atttypmod = (int *) pg_malloc(ntups * sizeof(int));
-		tbinfo->attstattarget = (int *) pg_malloc(ntups * sizeof(int));
-		tbinfo->attstorage = (char *) pg_malloc(ntups * sizeof(char));
-		tbinfo->typstorage = (char *) pg_malloc(ntups * sizeof(char));
-		tbinfo->attisdropped = (bool *) pg_malloc(ntups * sizeof(bool));
-		tbinfo->attlen = (int *) pg_malloc(ntups * sizeof(int));
-		tbinfo->attalign = (char *) pg_malloc(ntups * sizeof(char));
-		tbinfo->attislocal = (bool *) pg_malloc(ntups * sizeof(bool));
-		tbinfo->attoptions = (char **) pg_malloc(ntups * sizeof(char *));
-		tbinfo->attcollation = (Oid *) pg_malloc(ntups * sizeof(Oid));
-		tbinfo->attfdwoptions = (char **) pg_malloc(ntups * sizeof(char *));
-		tbinfo->notnull = (bool *) pg_malloc(ntups * sizeof(bool));
-		tbinfo->inhNotNull = (bool *) pg_malloc(ntups * sizeof(bool));
-		tbinfo->attrdefs = (AttrDefInfo **) pg_malloc(ntups * sizeof(AttrDefInfo *));
-		hasdefaults = false;
-
-		for (j = 0; j < ntups; j++)
+		/*
+		 * The rows are ordered by table OID, like the tables of the batch.
+		 */
+		row = 0;
+		ndeftbls = 0;
+		nchktbls = 0;
+		for (k = start; k < end; k++)
 		{
-			if (j + 1 != atoi(PQgetvalue(res, j, i_attnum)))
-				exit_horribly(NULL,
-							  "invalid column numbering in table \"%s\"\n",
-							  tbinfo->dobj.name);
-			tbinfo->attnames[j] = pg_strdup(PQgetvalue(res, j, i_attname));
-			tbinfo->atttypnames[j] = pg_strdup(PQgetvalue(res, j, i_atttypname));
-			tbinfo->atttypmod[j] = atoi(PQgetvalue(res, j, i_atttypmod));
-			tbinfo->attstattarget[j] = atoi(PQgetvalue(res, j, i_attstattarget));
-			tbinfo->attstorage[j] = *(PQgetvalue(res, j, i_attstorage));
-			tbinfo->typstorage[j] = *(PQgetvalue(res, j, i_typstorage));
-			tbinfo->attisdropped[j] = (PQgetvalue(res, j, i_attisdropped)[0] == 't');
-			tbinfo->attlen[j] = atoi(PQgetvalue(res, j, i_attlen));
-			tbinfo->attalign[j] = *(PQgetvalue(res, j, i_attalign));
-			tbinfo->attislocal[j] = (PQgetvalue(res, j, i_attislocal)[0] == 't');
-			tbinfo->notnull[j] = (PQgetvalue(res, j, i_attnotnull)[0] == 't');
-			tbinfo->attoptions[j] = pg_strdup(PQgetvalue(res, j, i_attoptions));
-			tbinfo->attcollation[j] = atooid(PQgetvalue(res, j, i_attcollation));
-			tbinfo->attfdwoptions[j] = pg_strdup(PQgetvalue(res, j, i_attfdwoptions));
-			tbinfo->attrdefs[j] = NULL; /* fix below */
-			if (PQgetvalue(res, j, i_atthasdef)[0] == 't')
-				hasdefaults = true;
-			/* these flags will be set in flagInhAttrs() */
-			tbinfo->inhNotNull[j] = false;
+			TableInfo  *tbinfo = tbls[k];
+			bool		hasdefaults = false;
+			int			natts;
+
+			for (natts = 0; row + natts < ntups; natts++)
+			{
+				if (atooid(PQgetvalue(res, row + natts, i_attrelid)) !=
+					tbinfo->dobj.catId.oid)
+					break;
+			}
+
+			tbinfo->numatts = natts;
+			tbinfo->attnames = (char **) pg_malloc(natts * sizeof(char *));
+			tbinfo->atttypnames = (char **) pg_malloc(natts * sizeof(char *));
+			tbinfo->atttypmod = (int *) pg_malloc(natts * sizeof(int));
+			tbinfo->attstattarget = (int *) pg_malloc(natts * sizeof(int));
+			tbinfo->attstorage = (char *) pg_malloc(natts * sizeof(char));
+			tbinfo->typstorage = (char *) pg_malloc(natts * sizeof(char));
+			tbinfo->attisdropped = (bool *) pg_malloc(natts * sizeof(bool));
+			tbinfo->attlen = (int *) pg_malloc(natts * sizeof(int));
+			tbinfo->attalign = (char *) pg_malloc(natts * sizeof(char));
+			tbinfo->attislocal = (bool *) pg_malloc(natts * sizeof(bool));
+			tbinfo->attoptions = (char **) pg_malloc(natts * sizeof(char *));
+			tbinfo->attcollation = (Oid *) pg_malloc(natts * sizeof(Oid));
+			tbinfo->attfdwoptions = (char **) pg_malloc(natts * sizeof(char *));
+			tbinfo->notnull = (bool *) pg_malloc(natts * sizeof(bool));
+			tbinfo->inhNotNull = (bool *) pg_malloc(natts * sizeof(bool));
+			tbinfo->attrdefs = (AttrDefInfo **) pg_malloc(natts * sizeof(AttrDefInfo *));
+
+			for (j = 0; j < natts; j++, row++)
+			{
+				if (j + 1 != atoi(PQgetvalue(res, row, i_attnum)))
+					exit_horribly(NULL,
+								  "invalid column numbering in table \"%s\"\n",
+								  tbinfo->dobj.name);
+				tbinfo->attnames[j] = pg_strdup(PQgetvalue(res, row, i_attname));
+				tbinfo->atttypnames[j] = pg_strdup(PQgetvalue(res, row, i_atttypname));
+				tbinfo->atttypmod[j] = atoi(PQgetvalue(res, row, i_atttypmod));
+				tbinfo->attstattarget[j] = atoi(PQgetvalue(res, row, i_attstattarget));
+				tbinfo->attstorage[j] = *(PQgetvalue(res, row, i_attstorage));
+				tbinfo->typstorage[j] = *(PQgetvalue(res, row, i_typstorage));
+				tbinfo->attisdropped[j] = (PQgetvalue(res, row, i_attisdropped)[0] == 't');
+				tbinfo->attlen[j] = atoi(PQgetvalue(res, row, i_attlen));
+				tbinfo->attalign[j] = *(PQgetvalue(res, row, i_attalign));
+				tbinfo->attislocal[j] = (PQgetvalue(res, row, i_attislocal)[0] == 't');
+				tbinfo->notnull[j] = (PQgetvalue(res, row, i_attnotnull)[0] == 't');
+				tbinfo->attoptions[j] = pg_strdup(PQgetvalue(res, row, i_attoptions));
+				tbinfo->attcollation[j] = atooid(PQgetvalue(res, row, i_attcollation));
+				tbinfo->attfdwoptions[j] = pg_strdup(PQgetvalue(res, row, i_attfdwoptions));
+				tbinfo->attrdefs[j] = NULL; /* fix below */
+				if (PQgetvalue(res, row, i_atthasdef)[0] == 't')
+					hasdefaults = true;
+				/* these flags will be set in flagInhAttrs() */
+				tbinfo->inhNotNull[j] = false;
+			}
+
+			if (hasdefaults)
+				deftbls[ndeftbls++] = tbinfo;
+			if (tbinfo->ncheck > 0)
+				chktbls[nchktbls++] = tbinfo;
 		}
 
+		if (row != ntups)
+			exit_horribly(NULL, "failed sanity check, table OID %u of pg_attribute entry not found\n",
+						  atooid(PQgetvalue(res, row, i_attrelid)));
+
 		PQclear(res);
 
 		/*
 		 * Get info about column defaults
 		 */
-		if (hasdefaults)
+		if (ndeftbls > 0)
 		{
 			AttrDefInfo *attrdefs;
 			int			numDefaults;
+			TableInfo  *tbinfo = NULL;
 
 			if (g_verbose)
-				write_msg(NULL, "finding default expressions of table \"%s\"\n",
-						  tbinfo->dobj.name);
+				write_msg(NULL, "finding default expressions of %d tables in schema \"%s\"\n",
+						  ndeftbls, tbls[start]->dobj.namespace->dobj.name);
+
+			resetPQExpBuffer(tblcond);
+			appendTableOidCond(fout, tblcond, deftbls, ndeftbls);
 
 			resetPQExpBuffer(q);
 			if (fout->remoteVersion >= 70300)
 			{
 				appendPQExpBuffer(q, "SELECT tableoid, oid, adnum, "
-						   "pg_catalog.pg_get_expr(adbin, adrelid) AS adsrc "
+						   "pg_catalog.pg_get_expr(adbin, adrelid) AS adsrc, adrelid "
 								  "FROM pg_catalog.pg_attrdef "
-								  "WHERE adrelid = '%u'::pg_catalog.oid",
-								  tbinfo->dobj.catId.oid);
+								  "WHERE adrelid %s "
+								  "ORDER BY adrelid",
+								  tblcond->data);
 			}
 			else if (fout->remoteVersion >= 70200)
 			{
 				/* 7.2 did not have OIDs in pg_attrdef */
 				appendPQExpBuffer(q, "SELECT tableoid, 0 AS oid, adnum, "
-								  "pg_get_expr(adbin, adrelid) AS adsrc "
+								  "pg_get_expr(adbin, adrelid) AS adsrc, adrelid "
 								  "FROM pg_attrdef "
-								  "WHERE adrelid = '%u'::oid",
-								  tbinfo->dobj.catId.oid);
+								  "WHERE adrelid %s "
+								  "ORDER BY adrelid",
+								  tblcond->data);
 			}
 			else if (fout->remoteVersion >= 70100)
 			{
 				/* no pg_get_expr, so must rely on adsrc */
-				appendPQExpBuffer(q, "SELECT tableoid, oid, adnum, adsrc "
+				appendPQExpBuffer(q, "SELECT tableoid, oid, adnum, adsrc, adrelid "
 								  "FROM pg_attrdef "
-								  "WHERE adrelid = '%u'::oid",
-								  tbinfo->dobj.catId.oid);
+								  "WHERE adrelid %s "
+								  "ORDER BY adrelid",
+								  tblcond->data);
 			}
 			else
 			{
 				/* no pg_get_expr, no tableoid either */
 				appendPQExpBuffer(q, "SELECT "
 								  "(SELECT oid FROM pg_class WHERE relname = 'pg_attrdef') AS tableoid, "
-								  "oid, adnum, adsrc "
+								  "oid, adnum, adsrc, adrelid "
 								  "FROM pg_attrdef "
-								  "WHERE adrelid = '%u'::oid",
-								  tbinfo->dobj.catId.oid);
+								  "WHERE adrelid %s "
+								  "ORDER BY adrelid",
+								  tblcond->data);
 			}
 			res = ExecuteSqlQuery(fout, q->data, PGRES_TUPLES_OK);
 
@@ -6607,11 +6900,20 @@ getTableAttrs(Archive *fout, TableInfo *tblinfo, int numTables)
 
 			for (j = 0; j < numDefaults; j++)
 			{
+				Oid			adrelid = atooid(PQgetvalue(res, j, 4));
 				int			adnum;
 
+				if (tbinfo == NULL || tbinfo->dobj.catId.oid != adrelid)
+				{
+					tbinfo = findTableByOid(adrelid);
+					if (tbinfo == NULL)
+						exit_horribly(NULL, "failed sanity check, parent table OID %u of pg_attrdef entry OID %u not found\n",
+									  adrelid, atooid(PQgetvalue(res, j, 1)));
+				}
+
 				adnum = atoi(PQgetvalue(res, j, 2));
 
-				if (adnum <= 0 || adnum > ntups)
+				if (adnum <= 0 || adnum > tbinfo->numatts)
 					exit_horribly(NULL,
 								  "invalid adnum value %d for table \"%s\"\n",
 								  adnum, tbinfo->dobj.name);
@@ -6679,14 +6981,17 @@ getTableAttrs(Archive *fout, TableInfo *tblinfo, int numTables)
 		/*
 		 * Get info about table CHECK constraints
 		 */
-		if (tbinfo->ncheck > 0)
+		if (nchktbls > 0)
 		{
 			ConstraintInfo *constrs;
 			int			numConstrs;
 
 			if (g_verbose)
-				write_msg(NULL, "finding check constraints for table \"%s\"\n",
-						  tbinfo->dobj.name);
+				write_msg(NULL, "finding check constraints for %d tables in schema \"%s\"\n",
+						  nchktbls, tbls[start]->dobj.namespace->dobj.name);
+
+			resetPQExpBuffer(tblcond);
+			appendTableOidCond(fout, tblcond, chktbls, nchktbls);
 
 			resetPQExpBuffer(q);
 			if (fout->remoteVersion >= 90200)
@@ -6697,47 +7002,47 @@ getTableAttrs(Archive *fout, TableInfo *tblinfo, int numTables)
 				 */
 				appendPQExpBuffer(q, "SELECT tableoid, oid, conname, "
 						   "pg_catalog.pg_get_constraintdef(oid) AS consrc, "
-								  "conislocal, convalidated "
+								  "conislocal, convalidated, conrelid "
 								  "FROM pg_catalog.pg_constraint "
-								  "WHERE conrelid = '%u'::pg_catalog.oid "
+								  "WHERE conrelid %s "
 								  "   AND contype = 'c' "
-								  "ORDER BY conname",
-								  tbinfo->dobj.catId.oid);
+								  "ORDER BY conrelid, conname",
+								  tblcond->data);
 			}
 			else if (fout->remoteVersion >= 80400)
 			{
 				/* conislocal is new in 8.4 */
 				appendPQExpBuffer(q, "SELECT tableoid, oid, conname, "
 						   "pg_catalog.pg_get_constraintdef(oid) AS consrc, "
-								  "conislocal, true AS convalidated "
+								  "conislocal, true AS convalidated, conrelid "
 								  "FROM pg_catalog.pg_constraint "
-								  "WHERE conrelid = '%u'::pg_catalog.oid "
+								  "WHERE conrelid %s "
 								  "   AND contype = 'c' "
-								  "ORDER BY conname",
-								  tbinfo->dobj.catId.oid);
+								  "ORDER BY conrelid, conname",
+								  tblcond->data);
 			}
 			else if (fout->remoteVersion >= 70400)
 			{
 				appendPQExpBuffer(q, "SELECT tableoid, oid, conname, "
 						   "pg_catalog.pg_get_constraintdef(oid) AS consrc, "
-								  "true AS conislocal, true AS convalidated "
+								  "true AS conislocal, true AS convalidated, conrelid "
 								  "FROM pg_catalog.pg_constraint "
-								  "WHERE conrelid = '%u'::pg_catalog.oid "
+								  "WHERE conrelid %s "
 								  "   AND contype = 'c' "
-								  "ORDER BY conname",
-								  tbinfo->dobj.catId.oid);
+								  "ORDER BY conrelid, conname",
+								  tblcond->data);
 			}
 			else if (fout->remoteVersion >= 70300)
 			{
 				/* no pg_get_constraintdef, must use consrc */
 				appendPQExpBuffer(q, "SELECT tableoid, oid, conname, "
 								  "'CHECK (' || consrc || ')' AS consrc, "
-								  "true AS conislocal, true AS convalidated "
+								  "true AS conislocal, true AS convalidated, conrelid "
 								  "FROM pg_catalog.pg_constraint "
-								  "WHERE conrelid = '%u'::pg_catalog.oid "
+								  "WHERE conrelid %s "
 								  "   AND contype = 'c' "
-								  "ORDER BY conname",
-								  tbinfo->dobj.catId.oid);
+								  "ORDER BY conrelid, conname",
+								  tblcond->data);
 			}
 			else if (fout->remoteVersion >= 70200)
 			{
@@ -6745,22 +7050,24 @@ getTableAttrs(Archive *fout, TableInfo *tblinfo, int numTables)
 				appendPQExpBuffer(q, "SELECT tableoid, 0 AS oid, "
 								  "rcname AS conname, "
 								  "'CHECK (' || rcsrc || ')' AS consrc, "
-								  "true AS conislocal, true AS convalidated "
+								  "true AS conislocal, true AS convalidated, "
+								  "rcrelid AS conrelid "
 								  "FROM pg_relcheck "
-								  "WHERE rcrelid = '%u'::oid "
-								  "ORDER BY rcname",
-								  tbinfo->dobj.catId.oid);
+								  "WHERE rcrelid %s "
+								  "ORDER BY rcrelid, rcname",
+								  tblcond->data);
 			}
 			else if (fout->remoteVersion >= 70100)
 			{
 				appendPQExpBuffer(q, "SELECT tableoid, oid, "
 								  "rcname AS conname, "
 								  "'CHECK (' || rcsrc || ')' AS consrc, "
-								  "true AS conislocal, true AS convalidated "
+								  "true AS conislocal, true AS convalidated, "
+								  "rcrelid AS conrelid "
 								  "FROM pg_relcheck "
-								  "WHERE rcrelid = '%u'::oid "
-								  "ORDER BY rcname",
-								  tbinfo->dobj.catId.oid);
+								  "WHERE rcrelid %s "
+								  "ORDER BY rcrelid, rcname",
+								  tblcond->data);
 			}
 			else
 			{
@@ -6769,80 +7076,105 @@ getTableAttrs(Archive *fout, TableInfo *tblinfo, int numTables)
 								  "(SELECT oid FROM pg_class WHERE relname = 'pg_relcheck') AS tableoid, "
 								  "oid, rcname AS conname, "
 								  "'CHECK (' || rcsrc || ')' AS consrc, "
-								  "true AS conislocal, true AS convalidated "
+								  "true AS conislocal, true AS convalidated, "
+								  "rcrelid AS conrelid "
 								  "FROM pg_relcheck "
-								  "WHERE rcrelid = '%u'::oid "
-								  "ORDER BY rcname",
-								  tbinfo->dobj.catId.oid);
+								  "WHERE rcrelid %s "
+								  "ORDER BY rcrelid, rcname",
+								  tblcond->data);
 			}
 			res = ExecuteSqlQuery(fout, q->data, PGRES_TUPLES_OK);
 
 			numConstrs = PQntuples(res);
-			if (numConstrs != tbinfo->ncheck)
-			{
-				write_msg(NULL, ngettext("expected %d check constraint on table \"%s\" but found %d\n",
-										 "expected %d check constraints on table \"%s\" but found %d\n",
-										 tbinfo->ncheck),
-						  tbinfo->ncheck, tbinfo->dobj.name, numConstrs);
-				write_msg(NULL, "(The system catalogs might be corrupted.)\n");
-				exit_nicely(1);
-			}
-
 			constrs = (ConstraintInfo *) pg_malloc(numConstrs * sizeof(ConstraintInfo));
-			tbinfo->checkexprs = constrs;
 
-			for (j = 0; j < numConstrs; j++)
+			/*
+			 * The rows are ordered by table OID, like chktbls[].
+			 */
+			row = 0;
+			for (k = 0; k < nchktbls; k++)
 			{
-				bool		validated = PQgetvalue(res, j, 5)[0] == 't';
-
-				constrs[j].dobj.objType = DO_CONSTRAINT;
-				constrs[j].dobj.catId.tableoid = atooid(PQgetvalue(res, j, 0));
-				constrs[j].dobj.catId.oid = atooid(PQgetvalue(res, j, 1));
-				AssignDumpId(&constrs[j].dobj);
-				constrs[j].dobj.name = pg_strdup(PQgetvalue(res, j, 2));
-				constrs[j].dobj.namespace = tbinfo->dobj.namespace;
-				constrs[j].contable = tbinfo;
-				constrs[j].condomain = NULL;
-				constrs[j].contype = 'c';
-				constrs[j].condef = pg_strdup(PQgetvalue(res, j, 3));
-				constrs[j].confrelid = InvalidOid;
-				constrs[j].conindex = 0;
-				constrs[j].condeferrable = false;
-				constrs[j].condeferred = false;
-				constrs[j].conislocal = (PQgetvalue(res, j, 4)[0] == 't');
+				TableInfo  *tbinfo = chktbls[k];
+				int			ncheck;
 
-				/*
-				 * An unvalidated constraint needs to be dumped separately, so
-				 * that potentially-violating existing data is loaded before
-				 * the constraint.
-				 */
-				constrs[j].separate = !validated;
+				for (ncheck = 0; row + ncheck < numConstrs; ncheck++)
+				{
+					if (atooid(PQgetvalue(res, row + ncheck, 6)) !=
+						tbinfo->dobj.catId.oid)
+						break;
+				}
 
-				constrs[j].dobj.dump = tbinfo->dobj.dump;
+				if (ncheck != tbinfo->ncheck)
+				{
+					write_msg(NULL, ngettext("expected %d check constraint on table \"%s\" but found %d\n",
+											 "expected %d check constraints on table \"%s\" but found %d\n",
+											 tbinfo->ncheck),
+							  tbinfo->ncheck, tbinfo->dobj.name, ncheck);
+					write_msg(NULL, "(The system catalogs might be corrupted.)\n");
+					exit_nicely(1);
+				}
 
-				/*
-				 * Mark the constraint as needing to appear before the table
-				 * --- this is so that any other dependencies of the
-				 * constraint will be emitted before we try to create the
-				 * table.  If the constraint is to be dumped separately, it
-				 * will be dumped after data is loaded anyway, so don't do it.
-				 * (There's an automatic dependency in the opposite direction
-				 * anyway, so don't need to add one manually here.)
-				 */
-				if (!constrs[j].separate)
-					addObjectDependency(&tbinfo->dobj,
-										constrs[j].dobj.dumpId);
+				tbinfo->checkexprs = constrs + row;
 
-				/*
-				 * If the constraint is inherited, this will be detected later
-				 * (in pre-8.4 databases).  We also detect later if the
-				 * constraint must be split out from the table definition.
-				 */
+				for (j = 0; j < ncheck; j++, row++)
+				{
+					bool		validated = PQgetvalue(res, row, 5)[0] == 't';
+
+					constrs[row].dobj.objType = DO_CONSTRAINT;
+					constrs[row].dobj.catId.tableoid = atooid(PQgetvalue(res, row, 0));
+					constrs[row].dobj.catId.oid = atooid(PQgetvalue(res, row, 1));
+					AssignDumpId(&constrs[row].dobj);
+					constrs[row].dobj.name = pg_strdup(PQgetvalue(res, row, 2));
+					constrs[row].dobj.namespace = tbinfo->dobj.namespace;
+					constrs[row].contable = tbinfo;
+					constrs[row].condomain = NULL;
+					constrs[row].contype = 'c';
+					constrs[row].condef = pg_strdup(PQgetvalue(res, row, 3));
+					constrs[row].confrelid = InvalidOid;
+					constrs[row].conindex = 0;
+					constrs[row].condeferrable = false;
+					constrs[row].condeferred = false;
+					constrs[row].conislocal = (PQgetvalue(res, row, 4)[0] == 't');
+
+					/*
+					 * An unvalidated constraint needs to be dumped
+					 * separately, so that potentially-violating existing data
+					 * is loaded before the constraint.
+					 */
+					constrs[row].separate = !validated;
+
+					constrs[row].dobj.dump = tbinfo->dobj.dump;
+
+					/*
+					 * Mark the constraint as needing to appear before the
+					 * table --- this is so that any other dependencies of the
+					 * constraint will be emitted before we try to create the
+					 * table.  If the constraint is to be dumped separately,
+					 * it will be dumped after data is loaded anyway, so don't
+					 * do it. (There's an automatic dependency in the opposite
+					 * direction anyway, so don't need to add one manually
+					 * here.)
+					 */
+					if (!constrs[row].separate)
+						addObjectDependency(&tbinfo->dobj,
+											constrs[row].dobj.dumpId);
+
+					/*
+					 * If the constraint is inherited, this will be detected
+					 * later (in pre-8.4 databases).  We also detect later if
+					 * the constraint must be split out from the table
+					 * definition.
+					 */
+				}
 			}
 			PQclear(res);
 		}
 	}
 
+	free(chktbls);
+	free(deftbls);
+	free(tbls);
+	destroyPQExpBuffer(tblcond);
 	destroyPQExpBuffer(q);
 }
 
@@ -14423,8 +14755,14 @@ dumpSequence(Archive *fout, TableInfo *tbinfo)
 
 	/* only dump sequence AM if pg_seqam exists */
 	if (amname)
+	{
 		appendPQExpBuffer(query, "\n    USING %s", fmtId(amname));
 
+		/* options of the sequence AM */
+		if (tbinfo->reloptions && strlen(tbinfo->reloptions) > 0)
+			appendPQExpBuffer(query, " WITH (%s)", tbinfo->reloptions);
+	}
+
 	appendPQExpBufferStr(query, ";\n");
 
 	appendPQExpBuffer(labelq, "SEQUENCE %s", fmtId(tbinfo->dobj.name));
@@ -138,6 +138,7 @@ static int findLoop(DumpableObject *obj,
 		 DumpId startPoint,
 		 bool *processed,
 		 DumpId *searchFailed,
+		 bool *inWorkspace,
 		 DumpableObject **workspace,
 		 int depth);
 static void repairDependencyLoop(DumpableObject **loop,
@@ -654,15 +655,22 @@ findDependencyLoops(DumpableObject **objs, int nObjs, int totObjs)
 	 * enough to hold all the objects in TopoSort's output, which is huge
 	 * overkill in most cases but could theoretically be necessary if there is
 	 * a single dependency chain linking all the objects.
+	 *
+	 * inWorkspace[] is a bool array indexed by dump ID, marking the objects
+	 * currently in workspace[], so that findLoop() needn't search it.  That
+	 * would take time proportional to the length of the dependency chain
+	 * for every object visited.
 	 */
 	bool	   *processed;
 	DumpId	   *searchFailed;
+	bool	   *inWorkspace;
 	DumpableObject **workspace;
 	bool		fixedloop;
 	int			i;
 
 	processed = (bool *) pg_malloc0((getMaxDumpId() + 1) * sizeof(bool));
 	searchFailed = (DumpId *) pg_malloc0((getMaxDumpId() + 1) * sizeof(DumpId));
+	inWorkspace = (bool *) pg_malloc0((getMaxDumpId() + 1) * sizeof(bool));
 	workspace = (DumpableObject **) pg_malloc(totObjs * sizeof(DumpableObject *));
 	fixedloop = false;
 
@@ -676,6 +684,7 @@ findDependencyLoops(DumpableObject **objs, int nObjs, int totObjs)
 						   obj->dumpId,
 						   processed,
 						   searchFailed,
+						   inWorkspace,
 						   workspace,
 						   0);
 
@@ -686,7 +695,10 @@ findDependencyLoops(DumpableObject **objs, int nObjs, int totObjs)
 			fixedloop = true;
 			/* Mark loop members as processed */
 			for (j = 0; j < looplen; j++)
+			{
 				processed[workspace[j]->dumpId] = true;
+				inWorkspace[workspace[j]->dumpId] = false;
+			}
 		}
 		else
 		{
@@ -705,6 +717,7 @@ findDependencyLoops(DumpableObject **objs, int nObjs, int totObjs)
 		exit_horribly(modulename, "could not identify dependency loop\n");
 
 	free(workspace);
+	free(inWorkspace);
 	free(searchFailed);
 	free(processed);
 }
@@ -717,11 +730,13 @@ findDependencyLoops(DumpableObject **objs, int nObjs, int totObjs)
  *	startPoint: dumpId of starting object for the hoped-for circular loop
  *	processed[]: flag array marking already-processed objects
  *	searchFailed[]: flag array marking already-unsuccessfully-visited objects
+ *	inWorkspace[]: flag array marking objects present in workspace[]
  *	workspace[]: work array in which we are building list of loop members
  *	depth: number of valid entries in workspace[] at call
  *
  * On success, the length of the loop is returned, and workspace[] is filled
- * with pointers to the members of the loop.  On failure, we return 0.
+ * with pointers to the members of the loop, which remain marked in
+ * inWorkspace[].  On failure, we return 0.
  *
  * Note: it is possible that the given starting object is a member of more
  * than one cycle; if so, we will find an arbitrary one of the cycles.
@@ -731,6 +746,7 @@ findLoop(DumpableObject *obj,
 		 DumpId startPoint,
 		 bool *processed,
 		 DumpId *searchFailed,
+		 bool *inWorkspace,
 		 DumpableObject **workspace,
 		 int depth)
 {
@@ -756,16 +772,14 @@ findLoop(DumpableObject *obj,
 	 * that links to a cycle it's not a member of, and it guarantees that we
 	 * can't overflow the allocated size of workspace[].
 	 */
-	for (i = 0; i < depth; i++)
-	{
-		if (workspace[i] == obj)
-			return 0;
-	}
+	if (inWorkspace[obj->dumpId])
+		return 0;
 
 	/*
 	 * Okay, tentatively add obj to workspace
 	 */
 	workspace[depth++] = obj;
+	inWorkspace[obj->dumpId] = true;
 
 	/*
 	 * See if we've found a loop back to the desired startPoint; if so, done
@@ -790,6 +804,7 @@ findLoop(DumpableObject *obj,
 							startPoint,
 							processed,
 							searchFailed,
+							inWorkspace,
 							workspace,
 							depth);
 		if (newDepth > 0)
@@ -800,6 +815,7 @@ findLoop(DumpableObject *obj,
 	 * Remember there is no path from here back to startPoint
 	 */
 	searchFailed[obj->dumpId] = startPoint;
+	inWorkspace[obj->dumpId] = false;
 
 	return 0;
 }
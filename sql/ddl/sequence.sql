@@ -115,3 +115,12 @@ SELECT pg_xlog_wait_remote_apply(pg_current_xlog_location(), pid) FROM pg_stat_r
 
 DROP TABLE test_tbl;
 SELECT pg_xlog_wait_remote_apply(pg_current_xlog_location(), pid) FROM pg_stat_replication;
+
+-- timeshard sequences are usable immediately, without elections
+CREATE SEQUENCE test_timeshard_seq USING bdr WITH (timeshard = true);
+SELECT pg_xlog_wait_remote_apply(pg_current_xlog_location(), pid) FROM pg_stat_replication;
+SELECT nextval('test_timeshard_seq') > 0 AS ok;
+SELECT nextval('test_timeshard_seq') < nextval('test_timeshard_seq') AS ok;
+
+DROP SEQUENCE test_timeshard_seq;
+SELECT pg_xlog_wait_remote_apply(pg_current_xlog_location(), pid) FROM pg_stat_replication;
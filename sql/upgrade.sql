@@ -60,6 +60,36 @@ DROP EXTENSION bdr;
 CREATE EXTENSION bdr VERSION '0.10.0.2';
 DROP EXTENSION bdr;
 
+CREATE EXTENSION bdr VERSION '0.10.0.3';
+DROP EXTENSION bdr;
+
+CREATE EXTENSION bdr VERSION '0.10.0.4';
+DROP EXTENSION bdr;
+
+CREATE EXTENSION bdr VERSION '0.10.0.5';
+DROP EXTENSION bdr;
+
+CREATE EXTENSION bdr VERSION '0.10.0.6';
+DROP EXTENSION bdr;
+
+CREATE EXTENSION bdr VERSION '0.10.0.7';
+DROP EXTENSION bdr;
+
+CREATE EXTENSION bdr VERSION '0.10.0.8';
+DROP EXTENSION bdr;
+
+CREATE EXTENSION bdr VERSION '0.10.0.9';
+DROP EXTENSION bdr;
+
+CREATE EXTENSION bdr VERSION '0.10.0.10';
+DROP EXTENSION bdr;
+
+CREATE EXTENSION bdr VERSION '0.10.0.11';
+DROP EXTENSION bdr;
+
+CREATE EXTENSION bdr VERSION '0.10.0.12';
+DROP EXTENSION bdr;
+
 -- evolve version one by one from the oldest to the newest one
 CREATE EXTENSION bdr VERSION '0.8.0';
 ALTER EXTENSION bdr UPDATE TO '0.8.0.1';
@@ -78,6 +108,16 @@ ALTER EXTENSION bdr UPDATE TO '0.9.0.5';
 ALTER EXTENSION bdr UPDATE TO '0.10.0.0';
 ALTER EXTENSION bdr UPDATE TO '0.10.0.1';
 ALTER EXTENSION bdr UPDATE TO '0.10.0.2';
+ALTER EXTENSION bdr UPDATE TO '0.10.0.3';
+ALTER EXTENSION bdr UPDATE TO '0.10.0.4';
+ALTER EXTENSION bdr UPDATE TO '0.10.0.5';
+ALTER EXTENSION bdr UPDATE TO '0.10.0.6';
+ALTER EXTENSION bdr UPDATE TO '0.10.0.7';
+ALTER EXTENSION bdr UPDATE TO '0.10.0.8';
+ALTER EXTENSION bdr UPDATE TO '0.10.0.9';
+ALTER EXTENSION bdr UPDATE TO '0.10.0.10';
+ALTER EXTENSION bdr UPDATE TO '0.10.0.11';
+ALTER EXTENSION bdr UPDATE TO '0.10.0.12';
 
 
 -- Should never have to do anything: You missed adding the new version above.